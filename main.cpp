@@ -8,6 +8,62 @@
 #include <iostream>
 #include <filesystem>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <optional>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <bitset>
+#include <complex>
+#include <type_traits>
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+#include <limits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+// Optional libraries are opt-in, each with the -D flag that names it and its
+// -l flag (see README), so a stray header never breaks the default link line
+#if defined(MUSIC_PLAYER_WITH_OPUS)
+#include <opus/opus_multistream.h>
+#define MUSIC_PLAYER_HAS_OPUS
+#endif
+#if defined(MUSIC_PLAYER_WITH_OPENAL_EXT)
+#include <AL/al.h>
+#include <AL/alext.h>
+#define MUSIC_PLAYER_HAS_OPENAL_EXT
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(MUSIC_PLAYER_WITH_SD_BUS)
+#include <systemd/sd-bus.h>
+#define MUSIC_PLAYER_HAS_SD_BUS
+#endif
+#endif
 
 class WindowView
 {
@@ -24,27 +80,55 @@ class HomeView : public WindowView
   sf::Font &font;
   std::vector<std::string> &songs;
   std::function<void(int)> playSongCallback;
+  std::function<void(const std::vector<std::string> &)> prefetchCallback;
+  int hoveredRow = -1;
+  std::size_t prefetchedCount = 0; // rows reported last time; 0 forces a report
+
+  int rowAt(int x, int y) const
+  {
+    for (size_t i = 0; i < songs.size(); i++)
+    {
+      sf::FloatRect songBounds(220, 20 + i * 40, 350, 30);
+      if (songBounds.contains(x, y))
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
 
 public:
-  HomeView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &s, std::function<void(int)> playCb)
-      : window(win), font(f), songs(s), playSongCallback(playCb) {}
+  HomeView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &s, std::function<void(int)> playCb,
+           std::function<void(const std::vector<std::string> &)> prefetchCb = {})
+      : window(win), font(f), songs(s), playSongCallback(playCb), prefetchCallback(prefetchCb) {}
   void handleEvent(const sf::Event &event) override
   {
     if (event.type == sf::Event::MouseButtonPressed)
     {
       sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-      for (size_t i = 0; i < songs.size(); i++)
-      {
-        sf::FloatRect songBounds(220, 20 + i * 40, 350, 30);
-        if (songBounds.contains(mousePos.x, mousePos.y))
-        {
-          playSongCallback(i);
-          break;
-        }
-      }
+      int row = rowAt(mousePos.x, mousePos.y);
+      if (row >= 0)
+        playSongCallback(row);
+    }
+    else if (event.type == sf::Event::MouseMoved && rowAt(event.mouseMove.x, event.mouseMove.y) != hoveredRow)
+    {
+      hoveredRow = rowAt(event.mouseMove.x, event.mouseMove.y);
+      prefetchedCount = 0;
     }
   }
-  void update() override {}
+  // Tells the head cache what is likely to be clicked: the hovered row, then
+  // the rows on screen
+  void update() override
+  {
+    if (!prefetchCallback || prefetchedCount == songs.size() + 1)
+      return;
+    std::vector<std::string> rows;
+    if (hoveredRow >= 0 && hoveredRow < (int)songs.size())
+      rows.push_back(songs[hoveredRow]);
+    for (size_t i = 0; i < songs.size() && 20 + i * 40 < window.getSize().y; i++)
+      if ((int)i != hoveredRow)
+        rows.push_back(songs[i]);
+    prefetchCallback(rows);
+    prefetchedCount = songs.size() + 1;
+  }
   void draw() override
   {
     float contentStartX = 200;
@@ -68,31 +152,59 @@ class FavoritesView : public WindowView
   std::vector<std::string> &favorites;
   std::vector<std::string> &songs;
   std::function<void(int)> playSongCallback;
+  std::function<void(const std::vector<std::string> &)> prefetchCallback;
+  int hoveredRow = -1;
+  std::size_t prefetchedCount = 0;
+
+  int rowAt(int x, int y) const
+  {
+    for (size_t i = 0; i < favorites.size(); i++)
+    {
+      sf::FloatRect bounds(220, 20 + i * 30, 500, 25);
+      if (bounds.contains(x, y))
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
 
 public:
-  FavoritesView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &fav, std::vector<std::string> &s, std::function<void(int)> cb)
-      : window(win), font(f), favorites(fav), songs(s), playSongCallback(cb) {}
+  FavoritesView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &fav, std::vector<std::string> &s, std::function<void(int)> cb,
+                std::function<void(const std::vector<std::string> &)> prefetchCb = {})
+      : window(win), font(f), favorites(fav), songs(s), playSongCallback(cb), prefetchCallback(prefetchCb) {}
   void handleEvent(const sf::Event &event) override
   {
     if (event.type == sf::Event::MouseButtonPressed)
     {
       sf::Vector2i mousePos = sf::Mouse::getPosition(window);
-      for (size_t i = 0; i < favorites.size(); i++)
+      int row = rowAt(mousePos.x, mousePos.y);
+      if (row >= 0)
       {
-        sf::FloatRect bounds(220, 20 + i * 30, 500, 25);
-        if (bounds.contains(mousePos.x, mousePos.y))
+        auto it = std::find(songs.begin(), songs.end(), favorites[row]);
+        if (it != songs.end())
         {
-          auto it = std::find(songs.begin(), songs.end(), favorites[i]);
-          if (it != songs.end())
-          {
-            playSongCallback(std::distance(songs.begin(), it));
-          }
-          break;
+          playSongCallback(std::distance(songs.begin(), it));
         }
       }
     }
+    else if (event.type == sf::Event::MouseMoved && rowAt(event.mouseMove.x, event.mouseMove.y) != hoveredRow)
+    {
+      hoveredRow = rowAt(event.mouseMove.x, event.mouseMove.y);
+      prefetchedCount = 0;
+    }
+  }
+  void update() override
+  {
+    if (!prefetchCallback || prefetchedCount == favorites.size() + 1)
+      return;
+    std::vector<std::string> rows;
+    if (hoveredRow >= 0 && hoveredRow < (int)favorites.size())
+      rows.push_back(favorites[hoveredRow]);
+    for (size_t i = 0; i < favorites.size() && 20 + i * 30 < window.getSize().y; i++)
+      if ((int)i != hoveredRow)
+        rows.push_back(favorites[i]);
+    prefetchCallback(rows);
+    prefetchedCount = favorites.size() + 1;
   }
-  void update() override {}
   void draw() override
   {
     float contentStartX = 200;
@@ -116,12 +228,15 @@ class SettingsView : public WindowView
   sf::Text &volumeText;
   sf::RectangleShape &volumeSlider;
   std::function<void(float)> setVolumeCallback;
+  std::function<void(const sf::Event &)> equalizerEventCallback;
 
 public:
-  SettingsView(sf::RenderWindow &win, sf::Font &f, sf::Text &vt, sf::RectangleShape &vs, std::function<void(float)> cb)
-      : window(win), font(f), volumeText(vt), volumeSlider(vs), setVolumeCallback(cb) {}
+  SettingsView(sf::RenderWindow &win, sf::Font &f, sf::Text &vt, sf::RectangleShape &vs, std::function<void(float)> cb,
+               std::function<void(const sf::Event &)> eqCb)
+      : window(win), font(f), volumeText(vt), volumeSlider(vs), setVolumeCallback(cb), equalizerEventCallback(eqCb) {}
   void handleEvent(const sf::Event &event) override
   {
+    equalizerEventCallback(event);
     if (event.type == sf::Event::MouseButtonPressed)
     {
       sf::Vector2i mousePos = sf::Mouse::getPosition(window);
@@ -352,28 +467,10484 @@ public:
       }
     }
   }
-  void draw()
+  void draw()
+  {
+    window.clear(sf::Color(30, 30, 30));
+    window.draw(promptText);
+    if (!modeSelected)
+    {
+      window.draw(modeText);
+      window.draw(loginBtn);
+      window.draw(signupBtn);
+    }
+    else
+    {
+      userText.setString("Username: " + usernameInput + (usernameActive ? "|" : ""));
+      window.draw(userText);
+      passText.setString("Password: " + std::string(passwordInput.size(), '*') + (passwordActive ? "|" : ""));
+      window.draw(passText);
+    }
+    window.draw(infoText);
+    window.display();
+  }
+  bool isLoggedIn() const { return loginSuccess; }
+  std::string getUsername() const { return usernameInput; }
+};
+
+// Sample formats the decoders understand. Each specialisation converts one
+// stored sample to a float in [-1, 1); the pipeline is float from the
+// decoder until the single conversion to the device format at the end.
+struct Int24
+{
+  unsigned char bytes[3]; // packed little-endian
+};
+
+template <typename Sample>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<std::uint8_t>
+{
+  static const unsigned int bits = 8;
+  static float toFloat(std::uint8_t s) { return (static_cast<int>(s) - 128) * (1.0f / 128); }
+};
+
+template <>
+struct SampleTraits<std::int8_t>
+{
+  static const unsigned int bits = 8;
+  static float toFloat(std::int8_t s) { return s * (1.0f / 128); }
+};
+
+template <>
+struct SampleTraits<sf::Int16>
+{
+  static const unsigned int bits = 16;
+  static float toFloat(sf::Int16 s) { return s * (1.0f / 32768); }
+};
+
+template <>
+struct SampleTraits<Int24>
+{
+  static const unsigned int bits = 24;
+  static float toFloat(Int24 s)
+  {
+    std::int32_t value = s.bytes[0] | (s.bytes[1] << 8) | (s.bytes[2] << 16);
+    value -= (value & 0x800000) << 1; // sign-extend from bit 23
+    return value * (1.0f / 8388608);
+  }
+};
+
+template <>
+struct SampleTraits<std::int32_t>
+{
+  static const unsigned int bits = 32;
+  static float toFloat(std::int32_t s) { return static_cast<float>(s * (1.0 / 2147483648.0)); }
+};
+
+template <>
+struct SampleTraits<float>
+{
+  static const unsigned int bits = 32;
+  static float toFloat(float s) { return s; }
+};
+
+// Big-endian integer samples as stored in AIFF
+template <unsigned int Bytes>
+struct BigEndian
+{
+  unsigned char bytes[Bytes];
+};
+
+template <unsigned int Bytes>
+struct SampleTraits<BigEndian<Bytes>>
+{
+  static const unsigned int bits = Bytes * 8;
+  static float toFloat(BigEndian<Bytes> s)
+  {
+    std::uint32_t value = 0;
+    for (unsigned int i = 0; i < Bytes; i++)
+      value = (value << 8) | s.bytes[i];
+    value <<= 32 - bits; // left-justify so the sign bit lands in bit 31
+    return static_cast<float>(static_cast<std::int32_t>(value) * (1.0 / 2147483648.0));
+  }
+};
+
+struct BigEndianFloat
+{
+  unsigned char bytes[4];
+};
+
+template <>
+struct SampleTraits<BigEndianFloat>
+{
+  static const unsigned int bits = 32;
+  static float toFloat(BigEndianFloat s)
+  {
+    std::uint32_t value = (static_cast<std::uint32_t>(s.bytes[0]) << 24) | (s.bytes[1] << 16) | (s.bytes[2] << 8) | s.bytes[3];
+    float result;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+  }
+};
+
+template <typename Sample>
+void convertToFloat(const Sample *in, float *out, std::size_t count)
+{
+  for (std::size_t i = 0; i < count; i++)
+    out[i] = SampleTraits<Sample>::toFloat(in[i]);
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// 16-bit input is what nearly every track decodes to, so it gets a SIMD kernel.
+template <>
+void convertToFloat<sf::Int16>(const sf::Int16 *in, float *out, std::size_t count)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 32768);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+    __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+    _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+  }
+  for (; i < count; i++)
+    out[i] = SampleTraits<sf::Int16>::toFloat(in[i]);
+}
+#endif
+
+// Quantises float samples to 16-bit with TPDF dither (two uniform variables,
+// +-1 LSB peak). It is the one place the pipeline leaves float. The noise
+// generator is seeded the same way every time so offline renders repeat
+// exactly. When nothing touched the samples since a 16-bit decode, the values
+// are still exact and plain rounding returns the original bits.
+class DitherQuantizer
+{
+  std::uint32_t state[4] = {0x9E3779B9u, 0x243F6A88u, 0xB7E15162u, 0x6A09E667u};
+
+  static std::uint32_t next(std::uint32_t &x)
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+  }
+
+public:
+  void process(const float *in, sf::Int16 *out, std::size_t count, bool dither)
+  {
+    std::size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 unit = _mm_set1_ps(1.0f / 16777216);
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+    for (; i + 8 <= count; i += 8)
+    {
+      __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+      __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+      if (dither)
+      {
+        __m128 noise[2];
+        for (int half = 0; half < 2; half++)
+        {
+          __m128 u[2];
+          for (int k = 0; k < 2; k++)
+          {
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+            x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+            u[k] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)), unit);
+          }
+          noise[half] = _mm_sub_ps(u[0], u[1]);
+        }
+        a = _mm_add_ps(a, noise[0]);
+        b = _mm_add_ps(b, noise[1]);
+      }
+      // cvtps rounds to nearest and packs saturates, so no clipping branch is needed
+      __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), packed);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), x);
+#endif
+    for (; i < count; i++)
+    {
+      float value = in[i] * 32768.0f;
+      if (dither)
+      {
+        std::uint32_t &lane = state[i & 3];
+        float u1 = (next(lane) >> 8) * (1.0f / 16777216);
+        float u2 = (next(lane) >> 8) * (1.0f / 16777216);
+        value += u1 - u2;
+      }
+      out[i] = static_cast<sf::Int16>(std::max(-32768.0f, std::min(32767.0f, std::nearbyint(value))));
+    }
+  }
+};
+
+// Pulls interleaved float samples for one track. read() only returns fewer
+// samples than asked for once the end of the track is reached.
+class AudioDecoder
+{
+public:
+  virtual unsigned int getChannelCount() const = 0;
+  virtual unsigned int getSampleRate() const = 0;
+  virtual sf::Uint64 getSampleCount() const = 0;
+  // Resolution of the source; above 16 bits the output is dithered
+  virtual unsigned int getBitDepth() const { return 16; }
+  virtual sf::Uint64 read(float *samples, sf::Uint64 maxCount) = 0;
+  // Decoders whose storage already is 16-bit native PCM can hand it out
+  // without copying; the pointer stays valid until the next call
+  virtual const sf::Int16 *readDirect(sf::Uint64, sf::Uint64 &) { return nullptr; }
+  virtual void seek(sf::Uint64 sampleOffset) = 0;
+  virtual ~AudioDecoder() {}
+};
+
+// Anything SFML can open (Ogg Vorbis, FLAC, MP3, WAV). Its readers only
+// produce 16-bit samples.
+class SoundFileDecoder : public AudioDecoder
+{
+  sf::InputSoundFile file;
+  std::vector<sf::Int16> scratch;
+
+public:
+  bool open(const std::string &path) { return file.openFromFile(path); }
+  unsigned int getChannelCount() const override { return file.getChannelCount(); }
+  unsigned int getSampleRate() const override { return file.getSampleRate(); }
+  sf::Uint64 getSampleCount() const override { return file.getSampleCount(); }
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    scratch.resize(static_cast<std::size_t>(maxCount));
+    sf::Uint64 count = file.read(scratch.data(), maxCount);
+    convertToFloat(scratch.data(), samples, static_cast<std::size_t>(count));
+    return count;
+  }
+  void seek(sf::Uint64 sampleOffset) override { file.seek(sampleOffset); }
+};
+
+// Read-only memory map of a whole file. Pages are faulted in on demand, so
+// opening even a multi-gigabyte file costs no heap and no reads up front.
+class MappedFile
+{
+  const char *address = nullptr;
+  std::size_t length = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+
+public:
+  MappedFile() {}
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const std::string &path)
+  {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+      close();
+      return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    address = mapping ? static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+    if (!address)
+    {
+      close();
+      return false;
+    }
+    length = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    void *mapped = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+    address = static_cast<const char *>(mapped);
+    length = static_cast<std::size_t>(info.st_size);
+    madvise(mapped, length, MADV_SEQUENTIAL);
+#endif
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if (address)
+      UnmapViewOfFile(address);
+    if (mapping)
+      CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+      CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (address)
+      munmap(const_cast<char *>(address), length);
+#endif
+    address = nullptr;
+    length = 0;
+  }
+
+  // Asks the kernel to start reading a range we are about to touch
+  void willNeed(std::size_t offset, std::size_t bytes) const
+  {
+#ifndef _WIN32
+    if (offset >= length)
+      return;
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t start = offset / page * page;
+    madvise(const_cast<char *>(address) + start, std::min(bytes + offset - start, length - start), MADV_WILLNEED);
+#else
+    (void)offset;
+    (void)bytes;
+#endif
+  }
+
+  const char *data() const { return address; }
+  std::size_t size() const { return length; }
+};
+
+// Uncompressed WAV and AIFF/AIFC, read straight out of a memory map. Samples
+// are converted to float with no intermediate buffer, and 16-bit
+// little-endian data (the common case) can skip conversion entirely through
+// readDirect(). Assumes a little-endian host, like every platform we ship on.
+class PcmFileDecoder : public AudioDecoder
+{
+  enum Encoding
+  {
+    Unsigned8,
+    Signed8,
+    Little16,
+    Little24,
+    Little32,
+    LittleFloat,
+    Big16,
+    Big24,
+    Big32,
+    BigFloat
+  };
+
+  MappedFile file;
+  const char *data = nullptr;
+  std::size_t dataOffset = 0;
+  Encoding encoding = Little16;
+  unsigned int channelCount = 0;
+  unsigned int sampleRate = 0;
+  unsigned int bitsPerSample = 0;
+  unsigned int bytesPerSample = 0;
+  sf::Uint64 sampleCount = 0;
+  sf::Uint64 position = 0;
+
+  static std::uint32_t le32(const char *p)
+  {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    return b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<std::uint32_t>(b[3]) << 24);
+  }
+  static std::uint16_t le16(const char *p)
+  {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<std::uint16_t>(b[0] | (b[1] << 8));
+  }
+  static std::uint32_t be32(const char *p)
+  {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    return (static_cast<std::uint32_t>(b[0]) << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+  }
+  static std::uint16_t be16(const char *p)
+  {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    return static_cast<std::uint16_t>((b[0] << 8) | b[1]);
+  }
+  // AIFF stores the sample rate as an 80-bit IEEE extended float
+  static double extended80(const char *p)
+  {
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+    int exponent = ((b[0] & 0x7F) << 8) | b[1];
+    std::uint64_t mantissa = 0;
+    for (int i = 0; i < 8; i++)
+      mantissa = (mantissa << 8) | b[2 + i];
+    double value = std::ldexp(static_cast<double>(mantissa), exponent - 16383 - 63);
+    return (b[0] & 0x80) ? -value : value;
+  }
+
+  template <typename Sample>
+  static void decode(const char *in, float *out, std::size_t count)
+  {
+    for (std::size_t i = 0; i < count; i++)
+    {
+      Sample sample;
+      std::memcpy(&sample, in + i * sizeof(Sample), sizeof(Sample));
+      out[i] = SampleTraits<Sample>::toFloat(sample);
+    }
+  }
+
+  bool finish(std::size_t offset, std::uint64_t bytes)
+  {
+    if (channelCount == 0 || bytesPerSample == 0 || sampleRate == 0 || offset > file.size())
+      return false;
+    bytes = std::min<std::uint64_t>(bytes, file.size() - offset); // truncated files play what is there
+    dataOffset = offset;
+    data = file.data() + offset;
+    sampleCount = bytes / bytesPerSample / channelCount * channelCount;
+    return true;
+  }
+
+  bool parseWav()
+  {
+    const char *base = file.data();
+    std::size_t size = file.size();
+    bool haveFormat = false;
+    for (std::size_t offset = 12; offset + 8 <= size;)
+    {
+      std::uint32_t chunkSize = le32(base + offset + 4);
+      const char *chunk = base + offset + 8;
+      if (std::memcmp(base + offset, "fmt ", 4) == 0 && chunkSize >= 16 && offset + 8 + chunkSize <= size)
+      {
+        std::uint16_t format = le16(chunk);
+        if (format == 0xFFFE && chunkSize >= 26) // WAVE_FORMAT_EXTENSIBLE: the sub-format GUID starts with the real tag
+          format = le16(chunk + 24);
+        channelCount = le16(chunk + 2);
+        sampleRate = le32(chunk + 4);
+        bitsPerSample = le16(chunk + 14);
+        bytesPerSample = bitsPerSample / 8;
+        if (format == 3 && bitsPerSample == 32)
+          encoding = LittleFloat;
+        else if (format == 1 && bitsPerSample == 8)
+          encoding = Unsigned8;
+        else if (format == 1 && bitsPerSample == 16)
+          encoding = Little16;
+        else if (format == 1 && bitsPerSample == 24)
+          encoding = Little24;
+        else if (format == 1 && bitsPerSample == 32)
+          encoding = Little32;
+        else
+          return false;
+        haveFormat = true;
+      }
+      else if (std::memcmp(base + offset, "data", 4) == 0)
+      {
+        return haveFormat && finish(offset + 8, chunkSize);
+      }
+      offset += 8 + static_cast<std::size_t>(chunkSize) + (chunkSize & 1);
+    }
+    return false;
+  }
+
+  bool parseAiff(bool compressed)
+  {
+    const char *base = file.data();
+    std::size_t size = file.size();
+    bool haveFormat = false;
+    for (std::size_t offset = 12; offset + 8 <= size;)
+    {
+      std::uint32_t chunkSize = be32(base + offset + 4);
+      const char *chunk = base + offset + 8;
+      if (std::memcmp(base + offset, "COMM", 4) == 0 && chunkSize >= 18 && offset + 8 + chunkSize <= size)
+      {
+        channelCount = be16(chunk);
+        bitsPerSample = be16(chunk + 6);
+        bytesPerSample = (bitsPerSample + 7) / 8;
+        sampleRate = static_cast<unsigned int>(extended80(chunk + 8) + 0.5);
+        std::string type = compressed && chunkSize >= 22 ? std::string(chunk + 18, 4) : "NONE";
+        if (type == "sowt" && bytesPerSample == 2)
+          encoding = Little16;
+        else if ((type == "fl32" || type == "FL32") && bytesPerSample == 4)
+          encoding = BigFloat;
+        else if (type != "NONE")
+          return false;
+        else if (bytesPerSample == 1)
+          encoding = Signed8;
+        else if (bytesPerSample == 2)
+          encoding = Big16;
+        else if (bytesPerSample == 3)
+          encoding = Big24;
+        else if (bytesPerSample == 4)
+          encoding = Big32;
+        else
+          return false;
+        haveFormat = true;
+      }
+      else if (std::memcmp(base + offset, "SSND", 4) == 0 && chunkSize >= 8)
+      {
+        std::uint32_t skip = be32(chunk);
+        return haveFormat && finish(offset + 16 + skip, chunkSize - 8 - std::min<std::uint32_t>(skip, chunkSize - 8));
+      }
+      offset += 8 + static_cast<std::size_t>(chunkSize) + (chunkSize & 1);
+    }
+    return false;
+  }
+
+public:
+  bool open(const std::string &path)
+  {
+    if (!file.open(path) || file.size() < 12)
+      return false;
+    const char *header = file.data();
+    if (std::memcmp(header, "RIFF", 4) == 0 && std::memcmp(header + 8, "WAVE", 4) == 0)
+      return parseWav();
+    if (std::memcmp(header, "FORM", 4) == 0 && (std::memcmp(header + 8, "AIFF", 4) == 0 || std::memcmp(header + 8, "AIFC", 4) == 0))
+      return parseAiff(header[11] == 'C');
+    return false;
+  }
+
+  unsigned int getChannelCount() const override { return channelCount; }
+  unsigned int getSampleRate() const override { return sampleRate; }
+  sf::Uint64 getSampleCount() const override { return sampleCount; }
+  unsigned int getBitDepth() const override { return bitsPerSample; }
+
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    std::size_t count = static_cast<std::size_t>(std::min(maxCount, sampleCount - position));
+    const char *in = data + position * bytesPerSample;
+    file.willNeed(dataOffset + static_cast<std::size_t>((position + count) * bytesPerSample), count * bytesPerSample);
+    switch (encoding)
+    {
+    case Unsigned8:
+      decode<std::uint8_t>(in, samples, count);
+      break;
+    case Signed8:
+      decode<std::int8_t>(in, samples, count);
+      break;
+    case Little16:
+      convertToFloat(reinterpret_cast<const sf::Int16 *>(in), samples, count);
+      break;
+    case Little24:
+      decode<Int24>(in, samples, count);
+      break;
+    case Little32:
+      decode<std::int32_t>(in, samples, count);
+      break;
+    case LittleFloat:
+      decode<float>(in, samples, count);
+      break;
+    case Big16:
+      decode<BigEndian<2>>(in, samples, count);
+      break;
+    case Big24:
+      decode<BigEndian<3>>(in, samples, count);
+      break;
+    case Big32:
+      decode<BigEndian<4>>(in, samples, count);
+      break;
+    case BigFloat:
+      decode<BigEndianFloat>(in, samples, count);
+      break;
+    }
+    position += count;
+    return count;
+  }
+
+  const sf::Int16 *readDirect(sf::Uint64 maxCount, sf::Uint64 &count) override
+  {
+    if (encoding != Little16)
+      return nullptr;
+    count = std::min(maxCount, sampleCount - position);
+    const sf::Int16 *samples = reinterpret_cast<const sf::Int16 *>(data + position * 2);
+    file.willNeed(dataOffset + static_cast<std::size_t>((position + count) * 2), static_cast<std::size_t>(count * 2));
+    position += count;
+    return samples;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override { position = std::min(sampleOffset, sampleCount); }
+};
+
+#ifdef MUSIC_PLAYER_HAS_OPUS
+// Ogg Opus through libopus, registered with sf::SoundFileFactory so that every
+// sf::InputSoundFile in the program opens .opus. The Ogg layer is parsed here
+// rather than by libopusfile so seeking can bisect on page granule positions:
+// it lands before the target, decodes 80 ms of pre-roll and drops everything
+// up to the exact sample. Output is always 48 kHz, Opus's native rate.
+class OpusFileReader : public sf::SoundFileReader
+{
+  struct Page
+  {
+    sf::Int64 offset = 0;
+    sf::Int64 size = 0;
+    std::int64_t granule = -1; // -1: no packet finishes on this page
+    std::uint32_t serial = 0;
+    unsigned char flags = 0;
+    std::vector<unsigned char> lacing;
+    std::vector<unsigned char> body;
+  };
+
+  static const int Rate = 48000;
+  static const int MaxFrames = 5760;        // 120 ms, the longest Opus packet
+  static const std::int64_t Preroll = 3840; // 80 ms, as RFC 7845 recommends
+
+  sf::InputStream *stream = nullptr;
+  OpusMSDecoder *decoder = nullptr;
+  std::uint32_t serial = 0;
+  unsigned int channelCount = 0;
+  std::int64_t preSkip = 0;
+  std::int64_t totalFrames = 0;
+  sf::Int64 dataStart = 0;
+  sf::Int64 fileSize = 0;
+  sf::Int64 cursor = 0;
+
+  std::deque<std::vector<unsigned char>> packets;
+  std::vector<unsigned char> partial;
+  bool dropContinuation = false;
+  bool endOfStream = false;
+  std::vector<sf::Int16> decoded;
+  std::size_t decodedOffset = 0;
+  std::int64_t discard = 0;  // frames still to drop before output starts
+  std::int64_t position = 0; // output frames, pre-skip excluded
+
+  static std::uint32_t le32(const unsigned char *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24); }
+
+  static std::uint32_t crc(const unsigned char *data, std::size_t size, std::uint32_t value)
+  {
+    static const std::array<std::uint32_t, 256> table = []
+    {
+      std::array<std::uint32_t, 256> result{};
+      for (std::uint32_t i = 0; i < 256; i++)
+      {
+        std::uint32_t r = i << 24;
+        for (int bit = 0; bit < 8; bit++)
+          r = (r & 0x80000000u) ? (r << 1) ^ 0x04C11DB7u : r << 1;
+        result[i] = r;
+      }
+      return result;
+    }();
+    for (std::size_t i = 0; i < size; i++)
+      value = (value << 8) ^ table[((value >> 24) ^ data[i]) & 0xFF];
+    return value;
+  }
+
+  bool readPageAt(sf::Int64 offset, Page &page)
+  {
+    unsigned char header[27];
+    if (stream->seek(offset) != offset || stream->read(header, 27) != 27 || std::memcmp(header, "OggS", 4) != 0 || header[4] != 0)
+      return false;
+    page.lacing.resize(header[26]);
+    if (!page.lacing.empty() && stream->read(page.lacing.data(), page.lacing.size()) != static_cast<sf::Int64>(page.lacing.size()))
+      return false;
+    std::size_t bodySize = 0;
+    for (unsigned char lace : page.lacing)
+      bodySize += lace;
+    page.body.resize(bodySize);
+    if (bodySize && stream->read(page.body.data(), bodySize) != static_cast<sf::Int64>(bodySize))
+      return false;
+    std::uint32_t expected = le32(header + 22);
+    std::memset(header + 22, 0, 4);
+    std::uint32_t sum = crc(header, 27, 0);
+    sum = crc(page.lacing.data(), page.lacing.size(), sum);
+    if (crc(page.body.data(), bodySize, sum) != expected)
+      return false;
+    page.offset = offset;
+    page.size = 27 + static_cast<sf::Int64>(page.lacing.size() + bodySize);
+    page.flags = header[5];
+    page.granule = static_cast<std::int64_t>(le32(header + 6) | (static_cast<std::uint64_t>(le32(header + 10)) << 32));
+    page.serial = le32(header + 14);
+    return true;
+  }
+
+  // First valid page of our logical stream at or after `from`
+  bool findPage(sf::Int64 from, Page &page)
+  {
+    std::vector<char> block(4096);
+    while (from + 27 <= fileSize)
+    {
+      if (readPageAt(from, page))
+      {
+        if (page.serial == serial)
+          return true;
+        from += page.size;
+        continue;
+      }
+      // Resynchronise on the next capture pattern
+      stream->seek(from + 1);
+      sf::Int64 got = stream->read(block.data(), block.size());
+      if (got < 4)
+        return false;
+      sf::Int64 found = got - 3;
+      for (sf::Int64 i = 0; i + 4 <= got; i++)
+        if (std::memcmp(&block[i], "OggS", 4) == 0)
+        {
+          found = i;
+          break;
+        }
+      from += 1 + found;
+    }
+    return false;
+  }
+
+  void takePackets(const Page &page)
+  {
+    bool continued = page.flags & 1;
+    bool skipping = continued && dropContinuation;
+    if (!continued)
+      partial.clear();
+    std::size_t offset = 0;
+    for (unsigned char lace : page.lacing)
+    {
+      if (!skipping)
+        partial.insert(partial.end(), page.body.begin() + offset, page.body.begin() + offset + lace);
+      offset += lace;
+      if (lace < 255)
+      {
+        if (!skipping && !partial.empty())
+          packets.push_back(std::move(partial));
+        partial.clear();
+        skipping = false;
+      }
+    }
+    dropContinuation = skipping; // the fragment carries on to the next page
+    if (page.flags & 4)
+      endOfStream = true;
+  }
+
+  bool nextPacket(std::vector<unsigned char> &packet)
+  {
+    Page page;
+    while (packets.empty())
+    {
+      if (endOfStream || !findPage(cursor, page))
+        return false;
+      cursor = page.offset + page.size;
+      takePackets(page);
+    }
+    packet = std::move(packets.front());
+    packets.pop_front();
+    return true;
+  }
+
+  bool parseHead(const std::vector<unsigned char> &head)
+  {
+    if (head.size() < 19 || std::memcmp(head.data(), "OpusHead", 8) != 0 || (head[8] & 0xF0) != 0)
+      return false;
+    channelCount = head[9];
+    preSkip = head[10] | (head[11] << 8);
+    opus_int32 gain = static_cast<sf::Int16>(head[16] | (head[17] << 8));
+    int family = head[18];
+    int streams = 1;
+    int coupled = channelCount > 1 ? 1 : 0;
+    unsigned char mapping[8] = {0, 1};
+    if (family == 0 && (channelCount == 1 || channelCount == 2))
+    {
+    }
+    else if (family == 1 && channelCount >= 1 && channelCount <= 8 && head.size() >= 21u + channelCount)
+    {
+      streams = head[19];
+      coupled = head[20];
+      std::memcpy(mapping, &head[21], channelCount);
+    }
+    else
+      return false;
+    int error = OPUS_OK;
+    decoder = opus_multistream_decoder_create(Rate, static_cast<int>(channelCount), streams, coupled, mapping, &error);
+    if (error != OPUS_OK)
+      return false;
+    opus_multistream_decoder_ctl(decoder, OPUS_SET_GAIN(gain));
+    return true;
+  }
+
+  std::int64_t lastGranule()
+  {
+    for (sf::Int64 back = 65536;; back *= 2)
+    {
+      sf::Int64 from = std::max(dataStart, fileSize - back);
+      std::int64_t last = -1;
+      Page page;
+      for (sf::Int64 at = from; findPage(at, page); at = page.offset + page.size)
+        if (page.granule != -1)
+          last = page.granule;
+      if (last >= 0 || from == dataStart)
+        return last;
+    }
+  }
+
+  // Offset of the page following the last page that ends at or before `goal`
+  sf::Int64 pageAfterGranule(std::int64_t goal)
+  {
+    sf::Int64 low = dataStart, high = fileSize, best = dataStart;
+    Page page;
+    while (high - low > 65536)
+    {
+      sf::Int64 middle = low + (high - low) / 2;
+      bool found = false;
+      for (sf::Int64 at = middle; findPage(at, page) && page.offset < high; at = page.offset + page.size)
+        if (page.granule != -1)
+        {
+          found = true;
+          break;
+        }
+      if (found && page.granule <= goal)
+        low = best = page.offset + page.size;
+      else
+        high = middle;
+    }
+    for (sf::Int64 at = low; findPage(at, page); at = page.offset + page.size)
+    {
+      if (page.granule == -1)
+        continue;
+      if (page.granule > goal)
+        break;
+      best = page.offset + page.size;
+    }
+    return best;
+  }
+
+  void seekFrame(std::int64_t target)
+  {
+    target = std::min(std::max<std::int64_t>(target, 0), totalFrames);
+    std::int64_t goal = std::max<std::int64_t>(0, target + preSkip - Preroll);
+    for (;;)
+    {
+      sf::Int64 offset = goal > 0 ? pageAfterGranule(goal) : dataStart;
+      opus_multistream_decoder_ctl(decoder, OPUS_RESET_STATE);
+      packets.clear();
+      partial.clear();
+      decoded.clear();
+      decodedOffset = 0;
+      endOfStream = false;
+      cursor = offset;
+      dropContinuation = offset != dataStart;
+      std::int64_t start = 0;
+      if (offset != dataStart)
+      {
+        // Granules mark where the last packet on a page ends, so the first
+        // whole packet starts that page's granule minus what it holds
+        Page page;
+        start = target + preSkip;
+        while (findPage(cursor, page))
+        {
+          cursor = page.offset + page.size;
+          takePackets(page);
+          if (page.granule == -1)
+            continue;
+          start = page.granule;
+          for (const auto &packet : packets)
+            start -= std::max(0, opus_packet_get_nb_samples(packet.data(), static_cast<opus_int32>(packet.size()), Rate));
+          break;
+        }
+      }
+      if (offset == dataStart || start <= target + preSkip)
+      {
+        discard = std::max<std::int64_t>(0, target + preSkip - start);
+        position = target;
+        return;
+      }
+      goal = std::max<std::int64_t>(0, goal - MaxFrames);
+    }
+  }
+
+public:
+  static bool check(sf::InputStream &input)
+  {
+    char header[36];
+    return input.read(header, 36) == 36 && std::memcmp(header, "OggS", 4) == 0 && std::memcmp(header + 28, "OpusHead", 8) == 0;
+  }
+
+  ~OpusFileReader()
+  {
+    if (decoder)
+      opus_multistream_decoder_destroy(decoder);
+  }
+
+  bool open(sf::InputStream &input, Info &info) override
+  {
+    stream = &input;
+    fileSize = input.getSize();
+    Page page;
+    if (!readPageAt(0, page) || !(page.flags & 2))
+      return false;
+    serial = page.serial;
+    cursor = page.size;
+    takePackets(page);
+    std::vector<unsigned char> head, tags;
+    if (!nextPacket(head) || !parseHead(head) || !nextPacket(tags) || tags.size() < 8 || std::memcmp(tags.data(), "OpusTags", 8) != 0)
+      return false;
+    dataStart = cursor; // OpusTags always ends its page
+    totalFrames = std::max<std::int64_t>(0, lastGranule() - preSkip);
+    seekFrame(0);
+    info.channelCount = channelCount;
+    info.sampleRate = Rate;
+    info.sampleCount = static_cast<sf::Uint64>(totalFrames) * channelCount;
+    return true;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override { seekFrame(static_cast<std::int64_t>(sampleOffset / channelCount)); }
+
+  sf::Uint64 read(sf::Int16 *samples, sf::Uint64 maxCount) override
+  {
+    maxCount = std::min<sf::Uint64>(maxCount, static_cast<sf::Uint64>(totalFrames - position) * channelCount);
+    sf::Uint64 count = 0;
+    std::vector<unsigned char> packet;
+    while (count < maxCount)
+    {
+      if (decodedOffset == decoded.size())
+      {
+        if (!nextPacket(packet))
+          break;
+        decoded.resize(static_cast<std::size_t>(MaxFrames) * channelCount);
+        int frames = opus_multistream_decode(decoder, packet.data(), static_cast<opus_int32>(packet.size()), decoded.data(), MaxFrames, 0);
+        decoded.resize(static_cast<std::size_t>(std::max(frames, 0)) * channelCount); // a corrupt packet is skipped
+        std::int64_t skip = std::min<std::int64_t>(discard, std::max(frames, 0));
+        discard -= skip;
+        decodedOffset = static_cast<std::size_t>(skip) * channelCount;
+        continue;
+      }
+      std::size_t take = static_cast<std::size_t>(std::min<sf::Uint64>(decoded.size() - decodedOffset, maxCount - count));
+      std::memcpy(samples + count, decoded.data() + decodedOffset, take * sizeof(sf::Int16));
+      decodedOffset += take;
+      count += take;
+    }
+    position += static_cast<std::int64_t>(count / channelCount);
+    return count;
+  }
+};
+#endif
+
+// Tracker modules (MOD, S3M, XM, IT) are rendered by a software mixer rather
+// than decoded. Every format loads into the same pattern/sample model, with
+// effects normalised to S3M/IT semantics so that one player handles them all.
+enum ModuleEffect : std::uint8_t
+{
+  FxNone,
+  FxArpeggio,
+  FxPortaUp, // params 0xE0-0xEF are extra-fine, 0xF0-0xFF fine, as in S3M
+  FxPortaDown,
+  FxTonePorta,
+  FxTonePortaVolumeSlide,
+  FxVibrato,
+  FxFineVibrato,
+  FxVibratoVolumeSlide,
+  FxTremolo,
+  FxTremor,
+  FxVolumeSlide, // DxF / DFx are fine slides, as in S3M
+  FxSetVolume,
+  FxChannelVolume,
+  FxChannelVolumeSlide,
+  FxGlobalVolume, // 0-128
+  FxGlobalVolumeSlide,
+  FxPanning, // 0-255
+  FxPanSlide, // x slides right, y left
+  FxOffset,
+  FxRetrig,
+  FxNoteCut,
+  FxNoteDelay,
+  FxKeyOff,
+  FxJump,
+  FxBreak, // row number, already decoded from BCD
+  FxPatternLoop,
+  FxPatternDelay,
+  FxSpeed,
+  FxTempo,
+  FxCount
+};
+
+struct ModuleCell
+{
+  enum : std::uint8_t
+  {
+    NoteFade = 253,
+    NoteCut = 254,
+    NoteOff = 255
+  };
+  std::uint8_t note = 0; // 0 none, 1-120 a key (1 is C-0, 61 is C-5)
+  std::uint8_t instrument = 0;
+  std::uint8_t volumeEffect = FxNone; // the volume column, run without effect memory
+  std::uint8_t volumeParam = 0;
+  std::uint8_t effect = FxNone;
+  std::uint8_t param = 0;
+};
+
+struct ModuleSample
+{
+  std::vector<float> data; // mono; ping-pong loops unrolled, one guard sample past the end
+  std::size_t length = 0;  // playable frames, up to the loop end when looping
+  std::size_t loopStart = 0;
+  bool loop = false;
+  double c5speed = 8363; // playback rate of C-5
+  int volume = 64;       // 0-64
+  int globalVolume = 64; // 0-64
+  int panning = -1;      // 0-256; -1 leaves the channel's alone
+
+  // Call once `data` holds the raw frames. Ping-pong loops become forward
+  // loops twice as long, and the guard sample lets the interpolator read one
+  // frame ahead without a bounds check.
+  void prepare(std::size_t start, std::size_t end, bool looped, bool pingPong)
+  {
+    end = std::min(end, data.size());
+    loop = looped && start < end;
+    if (loop)
+    {
+      data.resize(end);
+      if (pingPong && end - start > 2)
+        for (std::size_t i = end - 2; i > start; i--)
+          data.push_back(data[i]);
+      loopStart = start;
+      length = data.size();
+      data.push_back(data[start]);
+    }
+    else
+    {
+      length = data.size();
+      data.push_back(0);
+    }
+  }
+};
+
+struct ModuleEnvelope
+{
+  std::vector<std::pair<int, int>> points; // tick, value 0-64
+  bool enabled = false;
+  bool loop = false;
+  bool sustain = false;
+  int loopStart = 0, loopEnd = 0, sustainStart = 0, sustainEnd = 0; // point indices
+
+  int value(int tick) const
+  {
+    if (points.empty() || tick <= points.front().first)
+      return points.empty() ? 64 : points.front().second;
+    for (std::size_t i = 1; i < points.size(); i++)
+      if (tick < points[i].first)
+      {
+        const auto &a = points[i - 1], &b = points[i];
+        return a.second + (b.second - a.second) * (tick - a.first) / std::max(1, b.first - a.first);
+      }
+    return points.back().second;
+  }
+
+  // The tick after `tick`, looping in the sustain range while the key is held
+  int advance(int tick, bool keyOn) const
+  {
+    int count = static_cast<int>(points.size());
+    tick++;
+    if (sustain && keyOn && sustainEnd < count && tick > points[sustainEnd].first)
+      return points[std::min(sustainStart, sustainEnd)].first;
+    if (loop && loopEnd < count && tick > points[loopEnd].first)
+      return points[std::min(loopStart, loopEnd)].first;
+    return tick;
+  }
+};
+
+struct ModuleInstrument
+{
+  std::array<std::uint8_t, 120> keys{};     // key actually played for each key pressed
+  std::array<std::uint16_t, 120> samples{}; // 1-based sample for each key, 0 for none
+  ModuleEnvelope volumeEnvelope;
+  ModuleEnvelope panningEnvelope; // 32 is centre
+  double fadeout = 0;             // fraction of full volume lost per tick after key off
+  int globalVolume = 128;         // 0-128
+  int panning = -1;               // 0-256
+};
+
+struct Module
+{
+  static const int OrderSkip = -2;
+  static const int OrderEnd = -1;
+
+  std::string title;
+  unsigned int channels = 0;
+  std::vector<int> orders;
+  std::vector<int> patternRows;
+  std::vector<std::vector<ModuleCell>> patterns; // row-major, `channels` cells per row
+  std::vector<ModuleSample> samples;
+  std::vector<ModuleInstrument> instruments; // empty: cells name samples directly
+  std::vector<int> panning;                  // per channel, 0-256
+  std::vector<int> channelVolume;            // per channel, 0-64
+  int speed = 6;
+  int tempo = 125;
+  int globalVolume = 128; // 0-128
+  bool linearSlides = false;
+
+  void setChannels(unsigned int count)
+  {
+    channels = count;
+    panning.assign(count, 128);
+    channelVolume.assign(count, 64);
+  }
+  ModuleCell *addPattern(int rows)
+  {
+    patternRows.push_back(rows);
+    patterns.emplace_back(static_cast<std::size_t>(rows) * channels);
+    return patterns.back().data();
+  }
+};
+
+// Bounds-checked little/big-endian reads; anything past the end reads as 0,
+// so truncated files load as far as they go.
+class ByteReader
+{
+  const unsigned char *bytes;
+  std::size_t length;
+
+public:
+  ByteReader(const char *data, std::size_t size) : bytes(reinterpret_cast<const unsigned char *>(data)), length(size) {}
+  std::size_t size() const { return length; }
+  bool has(std::size_t offset, std::size_t count) const { return offset <= length && count <= length - offset; }
+  // How many of `count` records of `width` bytes at `offset` are really there,
+  // so header counts cannot ask for more than the file holds
+  std::size_t fit(std::size_t offset, std::size_t width, std::size_t count) const { return offset < length ? std::min(count, (length - offset) / width) : 0; }
+  unsigned int u8(std::size_t offset) const { return offset < length ? bytes[offset] : 0; }
+  int s8(std::size_t offset) const { return static_cast<std::int8_t>(u8(offset)); }
+  unsigned int le16(std::size_t offset) const { return u8(offset) | (u8(offset + 1) << 8); }
+  unsigned int be16(std::size_t offset) const { return (u8(offset) << 8) | u8(offset + 1); }
+  std::uint32_t le32(std::size_t offset) const { return le16(offset) | (static_cast<std::uint32_t>(le16(offset + 2)) << 16); }
+  std::string text(std::size_t offset, std::size_t count) const
+  {
+    std::string result;
+    for (std::size_t i = 0; i < count && u8(offset + i); i++)
+      result += static_cast<char>(u8(offset + i));
+    return result;
+  }
+  // Appends `count` PCM frames starting at `offset` (signed unless told otherwise)
+  void pcm(std::size_t offset, std::size_t count, bool sixteenBit, bool isSigned, bool delta, std::vector<float> &out) const
+  {
+    std::size_t width = sixteenBit ? 2 : 1;
+    count = offset < length ? std::min(count, (length - offset) / width) : 0;
+    out.reserve(out.size() + count);
+    int previous = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+      int value = sixteenBit ? static_cast<int>(le16(offset + i * 2)) : static_cast<int>(u8(offset + i));
+      if (delta)
+        value = previous = (previous + value) & (sixteenBit ? 0xFFFF : 0xFF);
+      if (!isSigned)
+        value ^= sixteenBit ? 0x8000 : 0x80;
+      out.push_back(sixteenBit ? static_cast<std::int16_t>(value) * (1.0f / 32768) : static_cast<std::int8_t>(value) * (1.0f / 128));
+    }
+  }
+};
+
+// Effects 0-F are shared by MOD and XM; XM adds the lettered ones from G on.
+// Plain MOD has no effect memory, so zero-parameter slides are dropped there.
+void convertProtrackerEffect(unsigned int effect, unsigned int param, bool memory, ModuleCell &cell)
+{
+  std::uint8_t fx = FxNone;
+  unsigned int x = param >> 4, y = param & 15;
+  switch (effect)
+  {
+  case 0x0:
+    fx = param ? FxArpeggio : FxNone;
+    break;
+  case 0x1:
+    fx = FxPortaUp;
+    param = std::min(param, 0xDFu);
+    break;
+  case 0x2:
+    fx = FxPortaDown;
+    param = std::min(param, 0xDFu);
+    break;
+  case 0x3:
+    fx = FxTonePorta;
+    break;
+  case 0x4:
+    fx = FxVibrato;
+    break;
+  case 0x5:
+    fx = param || memory ? FxTonePortaVolumeSlide : FxTonePorta;
+    param = x ? x << 4 : y;
+    break;
+  case 0x6:
+    fx = param || memory ? FxVibratoVolumeSlide : FxVibrato;
+    param = x ? x << 4 : y;
+    break;
+  case 0x7:
+    fx = FxTremolo;
+    break;
+  case 0x8:
+    fx = FxPanning;
+    break;
+  case 0x9:
+    fx = FxOffset;
+    break;
+  case 0xA:
+    fx = FxVolumeSlide;
+    param = x ? x << 4 : y; // up wins when both are given
+    break;
+  case 0xB:
+    fx = FxJump;
+    break;
+  case 0xC:
+    fx = FxSetVolume;
+    break;
+  case 0xD:
+    fx = FxBreak;
+    param = x * 10 + y;
+    break;
+  case 0xE:
+    param = y;
+    if (x == 0x1 && y)
+      fx = FxPortaUp, param = 0xF0 | y;
+    else if (x == 0x2 && y)
+      fx = FxPortaDown, param = 0xF0 | y;
+    else if (x == 0x6)
+      fx = FxPatternLoop;
+    else if (x == 0x8)
+      fx = FxPanning, param = y * 17;
+    else if (x == 0x9 && y)
+      fx = FxRetrig;
+    else if (x == 0xA && y)
+      fx = FxVolumeSlide, param = y << 4 | 0x0F;
+    else if (x == 0xB && y)
+      fx = FxVolumeSlide, param = 0xF0 | y;
+    else if (x == 0xC)
+      fx = FxNoteCut;
+    else if (x == 0xD)
+      fx = FxNoteDelay;
+    else if (x == 0xE)
+      fx = FxPatternDelay;
+    break;
+  case 0xF:
+    fx = !param ? FxNone : param < 32 ? FxSpeed : FxTempo;
+    break;
+  case 'G' - 'A' + 10:
+    fx = FxGlobalVolume;
+    param = std::min(param, 64u) * 2;
+    break;
+  case 'H' - 'A' + 10:
+    fx = FxGlobalVolumeSlide;
+    param = x ? x << 4 : y;
+    break;
+  case 'K' - 'A' + 10:
+    fx = FxKeyOff;
+    break;
+  case 'P' - 'A' + 10:
+    fx = FxPanSlide;
+    param = x ? x << 4 : y;
+    break;
+  case 'R' - 'A' + 10:
+    fx = FxRetrig;
+    break;
+  case 'T' - 'A' + 10:
+    fx = FxTremor;
+    break;
+  case 'X' - 'A' + 10:
+    if ((x == 1 || x == 2) && y)
+      fx = x == 1 ? FxPortaUp : FxPortaDown, param = 0xE0 | y;
+    break;
+  }
+  if (!memory && !param && (fx == FxPortaUp || fx == FxPortaDown || fx == FxVolumeSlide))
+    fx = FxNone;
+  cell.effect = fx;
+  cell.param = static_cast<std::uint8_t>(param);
+}
+
+void convertXmVolume(unsigned int volume, ModuleCell &cell)
+{
+  unsigned int x = volume & 15;
+  std::uint8_t fx = FxNone;
+  unsigned int param = x;
+  if (volume >= 0x10 && volume <= 0x50)
+    fx = FxSetVolume, param = volume - 0x10;
+  else if (x || volume >> 4 == 0xF)
+    switch (volume >> 4)
+    {
+    case 0x6:
+      fx = FxVolumeSlide;
+      break;
+    case 0x7:
+      fx = FxVolumeSlide, param = x << 4;
+      break;
+    case 0x8:
+      fx = FxVolumeSlide, param = 0xF0 | x;
+      break;
+    case 0x9:
+      fx = FxVolumeSlide, param = x << 4 | 0x0F;
+      break;
+    case 0xA:
+      fx = FxVibrato, param = x << 4;
+      break;
+    case 0xB:
+      fx = FxVibrato;
+      break;
+    case 0xC:
+      fx = FxPanning, param = x * 17;
+      break;
+    case 0xD:
+      fx = FxPanSlide;
+      break;
+    case 0xE:
+      fx = FxPanSlide, param = x << 4;
+      break;
+    case 0xF:
+      fx = FxTonePorta, param = x << 4;
+      break;
+    }
+  cell.volumeEffect = fx;
+  cell.volumeParam = static_cast<std::uint8_t>(param);
+}
+
+// S3M and IT share their lettered effects (1 is A); IT adds a few and stores
+// pattern breaks in hex instead of BCD.
+void convertS3mEffect(unsigned int letter, unsigned int param, bool it, ModuleCell &cell)
+{
+  std::uint8_t fx = FxNone;
+  unsigned int x = param >> 4, y = param & 15;
+  switch (letter + 'A' - 1)
+  {
+  case 'A':
+    fx = param ? FxSpeed : FxNone;
+    break;
+  case 'B':
+    fx = FxJump;
+    break;
+  case 'C':
+    fx = FxBreak;
+    param = it ? param : x * 10 + y;
+    break;
+  case 'D':
+    fx = FxVolumeSlide;
+    break;
+  case 'E':
+    fx = FxPortaDown;
+    break;
+  case 'F':
+    fx = FxPortaUp;
+    break;
+  case 'G':
+    fx = FxTonePorta;
+    break;
+  case 'H':
+    fx = FxVibrato;
+    break;
+  case 'I':
+    fx = FxTremor;
+    break;
+  case 'J':
+    fx = FxArpeggio;
+    break;
+  case 'K':
+    fx = FxVibratoVolumeSlide;
+    break;
+  case 'L':
+    fx = FxTonePortaVolumeSlide;
+    break;
+  case 'M':
+    fx = it ? FxChannelVolume : FxNone;
+    param = std::min(param, 64u);
+    break;
+  case 'N':
+    fx = it ? FxChannelVolumeSlide : FxNone;
+    break;
+  case 'O':
+    fx = FxOffset;
+    break;
+  case 'P':
+    fx = it ? FxPanSlide : FxNone;
+    param = y << 4 | x; // IT slides left with the high nibble
+    break;
+  case 'Q':
+    fx = FxRetrig;
+    break;
+  case 'R':
+    fx = FxTremolo;
+    break;
+  case 'S':
+    param = y;
+    if (x == 0x8)
+      fx = FxPanning, param = y * 17;
+    else if (x == 0xB)
+      fx = FxPatternLoop;
+    else if (x == 0xC)
+      fx = FxNoteCut;
+    else if (x == 0xD)
+      fx = FxNoteDelay;
+    else if (x == 0xE)
+      fx = FxPatternDelay;
+    break;
+  case 'T':
+    fx = param >= 32 ? FxTempo : FxNone;
+    break;
+  case 'U':
+    fx = FxFineVibrato;
+    break;
+  case 'V':
+    fx = FxGlobalVolume;
+    param = it ? std::min(param, 128u) : std::min(param, 64u) * 2;
+    break;
+  case 'W':
+    fx = it ? FxGlobalVolumeSlide : FxNone;
+    break;
+  case 'X':
+    fx = FxPanning;
+    param = it ? param : std::min(param * 2, 255u);
+    break;
+  }
+  cell.effect = fx;
+  cell.param = static_cast<std::uint8_t>(param);
+}
+
+void convertItVolume(unsigned int volume, ModuleCell &cell)
+{
+  static const std::uint8_t portaSpeeds[] = {0, 1, 4, 8, 16, 32, 64, 96, 128, 255};
+  std::uint8_t fx = FxNone;
+  unsigned int param = 0;
+  if (volume <= 64)
+    fx = FxSetVolume, param = volume;
+  else if (volume <= 74 && volume > 65)
+    fx = FxVolumeSlide, param = (volume - 65) << 4 | 0x0F;
+  else if (volume <= 84 && volume > 75)
+    fx = FxVolumeSlide, param = 0xF0 | (volume - 75);
+  else if (volume <= 94 && volume > 85)
+    fx = FxVolumeSlide, param = (volume - 85) << 4;
+  else if (volume <= 104 && volume > 95)
+    fx = FxVolumeSlide, param = volume - 95;
+  else if (volume <= 114 && volume > 105)
+    fx = FxPortaDown, param = (volume - 105) * 4;
+  else if (volume <= 124 && volume > 115)
+    fx = FxPortaUp, param = (volume - 115) * 4;
+  else if (volume >= 128 && volume <= 192)
+    fx = FxPanning, param = std::min((volume - 128) * 4, 255u);
+  else if (volume >= 193 && volume <= 202)
+    fx = FxTonePorta, param = portaSpeeds[volume - 193];
+  else if (volume >= 203 && volume <= 212)
+    fx = FxVibrato, param = volume - 203;
+  cell.volumeEffect = fx;
+  cell.volumeParam = static_cast<std::uint8_t>(param);
+}
+
+// Signature-tagged ProTracker MODs with 4 to 99 channels. The older
+// 15-sample Soundtracker layout has no signature and is not recognised.
+bool loadMod(const ByteReader &in, Module &module)
+{
+  if (in.size() < 1084)
+    return false;
+  std::string tag = in.text(1080, 4);
+  auto digit = [&](std::size_t i)
+  { return i < tag.size() && tag[i] >= '0' && tag[i] <= '9'; };
+  unsigned int channels = 0;
+  if (tag == "M.K." || tag == "M!K!" || tag == "M&K!" || tag == "FLT4" || tag == "N.T.")
+    channels = 4;
+  else if (tag == "FLT8" || tag == "OKTA" || tag == "CD81")
+    channels = 8;
+  else if (digit(0) && tag.compare(1, 3, "CHN") == 0)
+    channels = tag[0] - '0';
+  else if (digit(0) && digit(1) && (tag.compare(2, 2, "CH") == 0 || tag.compare(2, 2, "CN") == 0))
+    channels = (tag[0] - '0') * 10 + tag[1] - '0';
+  else if (tag.compare(0, 3, "TDZ") == 0 && digit(3))
+    channels = tag[3] - '0';
+  if (channels == 0)
+    return false;
+
+  module.title = in.text(0, 20);
+  module.setChannels(channels);
+  for (unsigned int c = 0; c < channels; c++)
+    module.panning[c] = c % 4 == 0 || c % 4 == 3 ? 64 : 192; // Amiga LRRL, narrowed for headphones
+  unsigned int songLength = std::min(in.u8(950), 128u);
+  unsigned int patternCount = 0;
+  for (unsigned int i = 0; i < 128; i++)
+  {
+    if (i < songLength)
+      module.orders.push_back(in.u8(952 + i));
+    patternCount = std::max(patternCount, in.u8(952 + i) + 1);
+  }
+
+  std::size_t offset = 1084;
+  for (unsigned int p = 0; p < patternCount; p++)
+  {
+    ModuleCell *cells = module.addPattern(64);
+    for (unsigned int i = 0; i < 64 * channels; i++, offset += 4)
+    {
+      unsigned int period = ((in.u8(offset) & 0x0F) << 8) | in.u8(offset + 1);
+      cells[i].instrument = static_cast<std::uint8_t>((in.u8(offset) & 0xF0) | (in.u8(offset + 2) >> 4));
+      if (period) // period 428 is C-5 at 8363 Hz
+        cells[i].note = static_cast<std::uint8_t>(std::min(std::max(61 + static_cast<int>(std::lround(12 * std::log2(428.0 / period))), 1), 120));
+      convertProtrackerEffect(in.u8(offset + 2) & 0x0F, in.u8(offset + 3), false, cells[i]);
+    }
+  }
+
+  for (unsigned int i = 0; i < 31; i++)
+  {
+    std::size_t header = 20 + i * 30;
+    std::size_t length = in.be16(header + 22) * 2u;
+    int finetune = in.u8(header + 24) & 15;
+    std::size_t loopStart = in.be16(header + 26) * 2u, loopLength = in.be16(header + 28) * 2u;
+    ModuleSample sample;
+    sample.c5speed = 8363 * std::exp2((finetune > 7 ? finetune - 16 : finetune) / 96.0);
+    sample.volume = static_cast<int>(std::min(in.u8(header + 25), 64u));
+    in.pcm(offset, length, false, true, false, sample.data);
+    offset += length;
+    sample.prepare(loopStart, loopStart + loopLength, loopLength > 2, false);
+    module.samples.push_back(std::move(sample));
+  }
+  return true;
+}
+
+void readXmEnvelope(const ByteReader &in, std::size_t points, unsigned int count, std::size_t info, unsigned int type, ModuleEnvelope &envelope)
+{
+  for (unsigned int i = 0; i < std::min(count, 12u); i++)
+    envelope.points.emplace_back(static_cast<int>(in.le16(points + i * 4)), static_cast<int>(std::min(in.le16(points + i * 4 + 2), 64u)));
+  envelope.enabled = (type & 1) && !envelope.points.empty();
+  envelope.sustain = type & 2;
+  envelope.loop = type & 4;
+  envelope.sustainStart = envelope.sustainEnd = static_cast<int>(in.u8(info));
+  envelope.loopStart = static_cast<int>(in.u8(info + 1));
+  envelope.loopEnd = static_cast<int>(in.u8(info + 2));
+}
+
+bool loadXm(const ByteReader &in, Module &module)
+{
+  if (in.size() < 336 || in.text(0, 17) != "Extended Module: ")
+    return false;
+  unsigned int channels = in.le16(68);
+  if (channels == 0 || channels > 128)
+    return false;
+  module.title = in.text(17, 20);
+  module.setChannels(channels);
+  module.linearSlides = in.le16(74) & 1;
+  module.speed = in.le16(76) ? static_cast<int>(in.le16(76)) : 6;
+  module.tempo = in.le16(78) ? static_cast<int>(in.le16(78)) : 125;
+  for (unsigned int i = 0; i < std::min(in.le16(64), 256u); i++)
+    module.orders.push_back(in.u8(80 + i));
+
+  // Orders are bytes, so patterns past 256 could never play
+  std::size_t offset = 60 + in.le32(60);
+  for (unsigned int p = 0, count = std::min(in.le16(70), 256u); p < count && in.has(offset, 9); p++)
+  {
+    std::size_t headerLength = std::max<std::size_t>(in.le32(offset), 9);
+    unsigned int rows = in.le16(offset + 5);
+    std::size_t at = offset + headerLength, end = at + in.le16(offset + 7);
+    ModuleCell *cells = module.addPattern(rows == 0 || rows > 256 ? 64 : rows);
+    for (unsigned int i = 0; i < module.patternRows.back() * channels && at < end; i++)
+    {
+      unsigned int fields[5] = {};
+      unsigned int flags = in.u8(at);
+      if (flags & 0x80)
+        at++;
+      for (int f = 0; f < 5; f++)
+        if (!(flags & 0x80) || (flags & (1 << f)))
+          fields[f] = in.u8(at++);
+      if (fields[0] == 97)
+        cells[i].note = ModuleCell::NoteOff;
+      else if (fields[0] >= 1 && fields[0] <= 96)
+        cells[i].note = static_cast<std::uint8_t>(fields[0] + 12);
+      cells[i].instrument = static_cast<std::uint8_t>(fields[1]);
+      convertXmVolume(fields[2], cells[i]);
+      convertProtrackerEffect(fields[3], fields[4], true, cells[i]);
+    }
+    offset += headerLength + in.le16(offset + 7);
+  }
+
+  // Cells and key maps name instruments and samples with a byte
+  for (unsigned int i = 0, count = std::min(in.le16(72), 256u); i < count && in.has(offset, 29); i++)
+  {
+    ModuleInstrument instrument;
+    std::size_t headerSize = std::max<std::size_t>(in.le32(offset), 29);
+    std::size_t sampleHeaderSize = std::max<std::size_t>(in.le32(offset + 29), 40);
+    unsigned int sampleCount = static_cast<unsigned int>(in.fit(offset + headerSize, sampleHeaderSize, std::min(in.le16(offset + 27), 256u)));
+    std::size_t firstSample = module.samples.size();
+    if (sampleCount)
+    {
+      for (int key = 0; key < 120; key++)
+      {
+        unsigned int mapped = in.u8(offset + 33 + std::min(std::max(key - 12, 0), 95));
+        instrument.keys[key] = static_cast<std::uint8_t>(key);
+        instrument.samples[key] = static_cast<std::uint16_t>(mapped < sampleCount ? firstSample + mapped + 1 : 0);
+      }
+      readXmEnvelope(in, offset + 129, in.u8(offset + 225), offset + 227, in.u8(offset + 233), instrument.volumeEnvelope);
+      readXmEnvelope(in, offset + 177, in.u8(offset + 226), offset + 230, in.u8(offset + 234), instrument.panningEnvelope);
+      instrument.fadeout = in.le16(offset + 239) / 32768.0;
+    }
+    offset += headerSize;
+    std::size_t data = offset + sampleCount * sampleHeaderSize;
+    for (unsigned int s = 0; s < sampleCount; s++)
+    {
+      std::size_t header = offset + s * sampleHeaderSize;
+      std::size_t length = in.le32(header), loopStart = in.le32(header + 4), loopLength = in.le32(header + 8);
+      unsigned int type = in.u8(header + 14);
+      bool sixteenBit = type & 0x10;
+      ModuleSample sample;
+      sample.volume = static_cast<int>(std::min(in.u8(header + 12), 64u));
+      sample.panning = static_cast<int>(in.u8(header + 15) * 256 / 255);
+      sample.c5speed = 8363 * std::exp2((in.s8(header + 16) * 128 + in.s8(header + 13)) / 1536.0);
+      in.pcm(data, sixteenBit ? length / 2 : length, sixteenBit, true, true, sample.data);
+      data += length;
+      if (sixteenBit)
+        loopStart /= 2, loopLength /= 2;
+      sample.prepare(loopStart, loopStart + loopLength, (type & 3) && loopLength, (type & 3) == 2);
+      module.samples.push_back(std::move(sample));
+    }
+    offset = data;
+    module.instruments.push_back(instrument);
+  }
+  return true;
+}
+
+void readOrders(const ByteReader &in, std::size_t offset, unsigned int count, Module &module)
+{
+  for (unsigned int i = 0; i < count; i++)
+  {
+    unsigned int order = in.u8(offset + i);
+    module.orders.push_back(order == 255 ? Module::OrderEnd : order == 254 ? Module::OrderSkip : static_cast<int>(order));
+  }
+}
+
+bool loadS3m(const ByteReader &in, Module &module)
+{
+  if (in.size() < 0x60 || in.text(0x2C, 4) != "SCRM")
+    return false;
+  unsigned int orderCount = in.le16(0x20), sampleCount = in.le16(0x22), patternCount = in.le16(0x24);
+  unsigned int channels = 0;
+  for (unsigned int c = 0; c < 32; c++)
+    if (in.u8(0x40 + c) < 16)
+      channels = c + 1;
+  if (channels == 0)
+    return false;
+  module.title = in.text(0, 28);
+  module.setChannels(channels);
+  module.globalVolume = static_cast<int>(std::min(in.u8(0x30), 64u) * 2);
+  module.speed = in.u8(0x31) ? static_cast<int>(in.u8(0x31)) : 6;
+  module.tempo = in.u8(0x32) >= 32 ? static_cast<int>(in.u8(0x32)) : 125;
+  bool stereo = in.u8(0x33) & 0x80;
+  bool signedSamples = in.le16(0x2A) == 1;
+  std::size_t samplePointers = 0x60 + orderCount, patternPointers = samplePointers + sampleCount * 2;
+  std::size_t panTable = patternPointers + patternCount * 2;
+  // Only what the pointer tables hold and a byte can name
+  orderCount = static_cast<unsigned int>(in.fit(0x60, 1, orderCount));
+  sampleCount = static_cast<unsigned int>(in.fit(samplePointers, 2, std::min(sampleCount, 256u)));
+  patternCount = static_cast<unsigned int>(in.fit(patternPointers, 2, std::min(patternCount, 256u)));
+  for (unsigned int c = 0; c < channels; c++)
+  {
+    unsigned int setting = in.u8(0x40 + c) & 15, pan = in.u8(panTable + c);
+    module.panning[c] = !stereo ? 128 : setting < 8 ? 51 : 204;
+    if (in.u8(0x35) == 0xFC && (pan & 0x20))
+      module.panning[c] = static_cast<int>((pan & 15) * 256 / 15);
+  }
+  readOrders(in, 0x60, orderCount, module);
+
+  for (unsigned int i = 0; i < sampleCount; i++)
+  {
+    std::size_t header = in.le16(samplePointers + i * 2) * 16u;
+    ModuleSample sample;
+    if (in.u8(header) == 1) // 2 and up are AdLib instruments
+    {
+      std::size_t data = ((in.u8(header + 13) << 16) | in.le16(header + 14)) * 16u;
+      unsigned int flags = in.u8(header + 0x1F);
+      sample.volume = static_cast<int>(std::min(in.u8(header + 0x1C), 64u));
+      sample.c5speed = in.le32(header + 0x20) ? in.le32(header + 0x20) : 8363;
+      in.pcm(data, in.le32(header + 0x10), flags & 4, signedSamples, false, sample.data);
+      sample.prepare(in.le32(header + 0x14), in.le32(header + 0x18), flags & 1, false);
+    }
+    module.samples.push_back(std::move(sample));
+  }
+
+  for (unsigned int p = 0; p < patternCount; p++)
+  {
+    std::size_t at = in.le16(patternPointers + p * 2) * 16u;
+    ModuleCell *cells = module.addPattern(64);
+    if (at == 0)
+      continue;
+    at += 2;
+    for (unsigned int row = 0; row < 64 && at < in.size();)
+    {
+      unsigned int what = in.u8(at++);
+      if (what == 0)
+      {
+        row++;
+        continue;
+      }
+      ModuleCell ignored;
+      ModuleCell &cell = (what & 31) < channels ? cells[row * channels + (what & 31)] : ignored;
+      if (what & 32)
+      {
+        unsigned int note = in.u8(at);
+        if (note == 254)
+          cell.note = ModuleCell::NoteCut;
+        else if (note < 0xA0 && (note & 15) < 12)
+          cell.note = static_cast<std::uint8_t>(13 + (note >> 4) * 12 + (note & 15));
+        cell.instrument = static_cast<std::uint8_t>(in.u8(at + 1));
+        at += 2;
+      }
+      if (what & 64)
+      {
+        unsigned int volume = in.u8(at++);
+        if (volume <= 64)
+          cell.volumeEffect = FxSetVolume, cell.volumeParam = static_cast<std::uint8_t>(volume);
+      }
+      if (what & 128)
+      {
+        convertS3mEffect(in.u8(at), in.u8(at + 1), false, cell);
+        at += 2;
+      }
+    }
+  }
+  return true;
+}
+
+// IT 2.14/2.15 sample compression: blocks of deltas whose bit width changes
+// in-band. 2.15 integrates twice.
+void decompressItSample(const ByteReader &in, std::size_t offset, std::size_t frames, bool sixteenBit, bool doubleDelta, std::vector<float> &out)
+{
+  const int fullWidth = sixteenBit ? 17 : 9, sampleBits = fullWidth - 1;
+  auto wrap = [&](std::int32_t value)
+  { return sixteenBit ? static_cast<std::int32_t>(static_cast<std::int16_t>(value)) : static_cast<std::int32_t>(static_cast<std::int8_t>(value)); };
+  while (frames > 0 && in.has(offset, 2))
+  {
+    std::size_t blockBytes = in.le16(offset);
+    std::size_t bit = (offset + 2) * 8, bitEnd = (offset + 2 + blockBytes) * 8;
+    auto read = [&](int count)
+    {
+      std::uint32_t value = 0;
+      for (int i = 0; i < count; i++, bit++)
+        value |= ((in.u8(bit >> 3) >> (bit & 7)) & 1u) << i;
+      return value;
+    };
+    std::size_t count = std::min<std::size_t>(frames, sixteenBit ? 0x4000 : 0x8000);
+    int width = fullWidth;
+    std::int32_t delta1 = 0, delta2 = 0;
+    for (std::size_t done = 0; done < count && bit < bitEnd && width <= fullWidth;)
+    {
+      std::uint32_t value = read(width);
+      if (width < 7)
+      {
+        if (value == 1u << (width - 1))
+        {
+          int next = static_cast<int>(read(sixteenBit ? 4 : 3)) + 1;
+          width = next < width ? next : next + 1;
+          continue;
+        }
+      }
+      else if (width < fullWidth)
+      {
+        std::uint32_t border = ((sixteenBit ? 0xFFFFu : 0xFFu) >> (fullWidth - width)) - (sixteenBit ? 8 : 4);
+        if (value > border && value <= border + (sixteenBit ? 16 : 8))
+        {
+          value -= border;
+          width = static_cast<int>(value) < width ? static_cast<int>(value) : static_cast<int>(value) + 1;
+          continue;
+        }
+      }
+      else if (value & (1u << sampleBits))
+      {
+        width = static_cast<int>((value + 1) & 0xFF);
+        continue;
+      }
+      int bits = std::min(width, sampleBits);
+      std::int32_t delta = static_cast<std::int32_t>(value << (32 - bits)) >> (32 - bits);
+      delta1 = wrap(delta1 + delta);
+      delta2 = wrap(delta2 + delta1);
+      std::int32_t sample = doubleDelta ? delta2 : delta1;
+      out.push_back(sample * (sixteenBit ? 1.0f / 32768 : 1.0f / 128));
+      done++;
+    }
+    frames -= count;
+    offset += 2 + blockBytes;
+  }
+}
+
+void readItEnvelope(const ByteReader &in, std::size_t offset, bool panning, ModuleEnvelope &envelope)
+{
+  unsigned int flags = in.u8(offset), count = std::min(in.u8(offset + 1), 25u);
+  for (unsigned int i = 0; i < count; i++)
+  {
+    int value = panning ? in.s8(offset + 6 + i * 3) + 32 : static_cast<int>(in.u8(offset + 6 + i * 3));
+    envelope.points.emplace_back(static_cast<int>(in.le16(offset + 7 + i * 3)), std::min(std::max(value, 0), 64));
+  }
+  envelope.enabled = (flags & 1) && count;
+  envelope.loop = flags & 2;
+  envelope.sustain = flags & 4;
+  envelope.loopStart = static_cast<int>(in.u8(offset + 2));
+  envelope.loopEnd = static_cast<int>(in.u8(offset + 3));
+  envelope.sustainStart = static_cast<int>(in.u8(offset + 4));
+  envelope.sustainEnd = static_cast<int>(in.u8(offset + 5));
+}
+
+// Impulse Tracker. Instruments need the 2.00+ layout; new note actions are
+// not emulated, a new note always replaces the channel's current one.
+bool loadIt(const ByteReader &in, Module &module)
+{
+  if (in.size() < 0xC0 || in.text(0, 4) != "IMPM")
+    return false;
+  unsigned int orderCount = in.le16(0x20), instrumentCount = in.le16(0x22), sampleCount = in.le16(0x24), patternCount = in.le16(0x26);
+  unsigned int flags = in.le16(0x2C);
+  unsigned int channels = 0;
+  for (unsigned int c = 0; c < 64; c++)
+    if (in.u8(0x40 + c) < 128)
+      channels = c + 1;
+  if (channels == 0)
+    return false;
+  module.title = in.text(4, 26);
+  module.setChannels(channels);
+  module.linearSlides = flags & 8;
+  module.globalVolume = static_cast<int>(std::min(in.u8(0x30), 128u));
+  module.speed = in.u8(0x32) ? static_cast<int>(in.u8(0x32)) : 6;
+  module.tempo = in.u8(0x33) >= 32 ? static_cast<int>(in.u8(0x33)) : 125;
+  for (unsigned int c = 0; c < channels; c++)
+  {
+    unsigned int pan = in.u8(0x40 + c);
+    module.panning[c] = (flags & 1) && pan <= 64 ? static_cast<int>(pan * 4) : 128;
+    module.channelVolume[c] = static_cast<int>(std::min(in.u8(0x80 + c), 64u));
+  }
+  readOrders(in, 0xC0, orderCount, module);
+  std::size_t instrumentPointers = 0xC0 + orderCount;
+  std::size_t samplePointers = instrumentPointers + instrumentCount * 4;
+  std::size_t patternPointers = samplePointers + sampleCount * 4;
+  // Only what the pointer tables hold and a byte can name
+  instrumentCount = static_cast<unsigned int>(in.fit(instrumentPointers, 4, std::min(instrumentCount, 256u)));
+  sampleCount = static_cast<unsigned int>(in.fit(samplePointers, 4, std::min(sampleCount, 256u)));
+  patternCount = static_cast<unsigned int>(in.fit(patternPointers, 4, std::min(patternCount, 256u)));
+
+  if ((flags & 4) && in.le16(0x2A) >= 0x200)
+    for (unsigned int i = 0; i < instrumentCount; i++)
+    {
+      std::size_t header = in.le32(instrumentPointers + i * 4);
+      ModuleInstrument instrument;
+      if (in.text(header, 4) == "IMPI")
+      {
+        unsigned int pan = in.u8(header + 0x19);
+        instrument.fadeout = in.le16(header + 0x14) / 1024.0;
+        instrument.globalVolume = static_cast<int>(std::min(in.u8(header + 0x18), 128u));
+        instrument.panning = pan & 0x80 ? -1 : static_cast<int>(std::min(pan, 64u) * 4);
+        for (unsigned int key = 0; key < 120; key++)
+        {
+          instrument.keys[key] = static_cast<std::uint8_t>(std::min(in.u8(header + 0x40 + key * 2), 119u));
+          instrument.samples[key] = static_cast<std::uint16_t>(in.u8(header + 0x41 + key * 2));
+        }
+        readItEnvelope(in, header + 0x130, false, instrument.volumeEnvelope);
+        readItEnvelope(in, header + 0x182, true, instrument.panningEnvelope);
+      }
+      module.instruments.push_back(instrument);
+    }
+
+  for (unsigned int i = 0; i < sampleCount; i++)
+  {
+    std::size_t header = in.le32(samplePointers + i * 4);
+    ModuleSample sample;
+    if (in.text(header, 4) == "IMPS")
+    {
+      unsigned int sampleFlags = in.u8(header + 0x12), convert = in.u8(header + 0x2E), pan = in.u8(header + 0x2F);
+      std::size_t length = in.le32(header + 0x30), data = in.le32(header + 0x48);
+      bool sixteenBit = sampleFlags & 2;
+      sample.globalVolume = static_cast<int>(std::min(in.u8(header + 0x11), 64u));
+      sample.volume = static_cast<int>(std::min(in.u8(header + 0x13), 64u));
+      sample.panning = pan & 0x80 ? static_cast<int>(std::min(pan & 127, 64u) * 4) : -1;
+      sample.c5speed = in.le32(header + 0x3C) ? in.le32(header + 0x3C) : 8363;
+      if ((sampleFlags & 1) && (sampleFlags & 8))
+        decompressItSample(in, data, length, sixteenBit, convert & 4, sample.data);
+      else if (sampleFlags & 1)
+        in.pcm(data, length, sixteenBit, convert & 1, false, sample.data);
+      // A sustain loop is held for the whole note
+      if (sampleFlags & 0x10)
+        sample.prepare(in.le32(header + 0x34), in.le32(header + 0x38), true, sampleFlags & 0x40);
+      else
+        sample.prepare(in.le32(header + 0x40), in.le32(header + 0x44), sampleFlags & 0x20, sampleFlags & 0x80);
+    }
+    module.samples.push_back(std::move(sample));
+  }
+
+  for (unsigned int p = 0; p < patternCount; p++)
+  {
+    std::size_t header = in.le32(patternPointers + p * 4);
+    unsigned int rows = header ? in.le16(header + 2) : 64;
+    ModuleCell *cells = module.addPattern(rows == 0 || rows > 256 ? 64 : rows);
+    if (header == 0)
+      continue;
+    std::size_t at = header + 8, end = at + in.le16(header);
+    std::array<unsigned int, 64> masks{}, notes{}, instruments{}, volumes{}, commands{}, params{};
+    for (unsigned int row = 0; row < rows && at < end;)
+    {
+      unsigned int what = in.u8(at++);
+      if (what == 0)
+      {
+        row++;
+        continue;
+      }
+      unsigned int c = (what - 1) & 63;
+      if (what & 128)
+        masks[c] = in.u8(at++);
+      unsigned int mask = masks[c];
+      if (mask & 1)
+        notes[c] = in.u8(at++);
+      if (mask & 2)
+        instruments[c] = in.u8(at++);
+      if (mask & 4)
+        volumes[c] = in.u8(at++);
+      if (mask & 8)
+      {
+        commands[c] = in.u8(at);
+        params[c] = in.u8(at + 1);
+        at += 2;
+      }
+      if (c >= channels)
+        continue;
+      ModuleCell &cell = cells[row * channels + c];
+      if ((mask & 0x11) && notes[c] < 120)
+        cell.note = static_cast<std::uint8_t>(notes[c] + 1);
+      else if (mask & 0x11)
+        cell.note = notes[c] == 255 ? ModuleCell::NoteOff : notes[c] == 254 ? ModuleCell::NoteCut : ModuleCell::NoteFade;
+      if (mask & 0x22)
+        cell.instrument = static_cast<std::uint8_t>(instruments[c]);
+      if (mask & 0x44)
+        convertItVolume(volumes[c], cell);
+      if (mask & 0x88)
+        convertS3mEffect(commands[c], params[c], true, cell);
+    }
+  }
+  return true;
+}
+
+// Adds `frames` linearly interpolated frames of a mono sample to interleaved
+// stereo `out`. `position` is in 32.32 fixed-point frames and the gains move
+// by `step` every frame, so volume changes glide instead of clicking. The
+// caller guarantees that the frame after the last one read exists. Integer
+// samples are scaled to [-1, 1).
+template <typename Sample>
+void mixInterpolated(const Sample *data, std::uint64_t &position, std::uint64_t increment, float &left, float &right,
+                     float stepLeft, float stepRight, float *out, std::size_t frames)
+{
+  if (left == 0 && right == 0 && stepLeft == 0 && stepRight == 0)
+  {
+    position += increment * frames;
+    return;
+  }
+  const float scale = std::is_same<Sample, float>::value ? 1.0f : 1.0f / 32768;
+  const float gainLeft = left * scale, gainRight = right * scale;
+  const float slopeLeft = stepLeft * scale, slopeRight = stepRight * scale;
+  std::uint64_t at = position;
+  std::size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 gains = _mm256_setr_ps(gainLeft, gainRight, gainLeft + slopeLeft, gainRight + slopeRight,
+                                gainLeft + 2 * slopeLeft, gainRight + 2 * slopeRight, gainLeft + 3 * slopeLeft, gainRight + 3 * slopeRight);
+  const __m256 fourFrames = _mm256_setr_ps(4 * slopeLeft, 4 * slopeRight, 4 * slopeLeft, 4 * slopeRight,
+                                           4 * slopeLeft, 4 * slopeRight, 4 * slopeLeft, 4 * slopeRight);
+  for (; i + 8 <= frames; i += 8)
+  {
+    alignas(32) std::int32_t indices[8];
+    alignas(32) float fractions[8];
+    for (int k = 0; k < 8; k++, at += increment)
+    {
+      indices[k] = static_cast<std::int32_t>(at >> 32);
+      fractions[k] = static_cast<std::uint32_t>(at) * (1.0f / 4294967296.0f);
+    }
+    __m256 a, b;
+    if constexpr (std::is_same<Sample, float>::value)
+    {
+      __m256i index = _mm256_load_si256(reinterpret_cast<const __m256i *>(indices));
+      a = _mm256_i32gather_ps(data, index, 4);
+      b = _mm256_i32gather_ps(data + 1, index, 4);
+    }
+    else
+    {
+      a = _mm256_setr_ps(data[indices[0]], data[indices[1]], data[indices[2]], data[indices[3]],
+                         data[indices[4]], data[indices[5]], data[indices[6]], data[indices[7]]);
+      b = _mm256_setr_ps(data[indices[0] + 1], data[indices[1] + 1], data[indices[2] + 1], data[indices[3] + 1],
+                         data[indices[4] + 1], data[indices[5] + 1], data[indices[6] + 1], data[indices[7] + 1]);
+    }
+    __m256 value = _mm256_fmadd_ps(_mm256_sub_ps(b, a), _mm256_load_ps(fractions), a);
+    __m256 low = _mm256_unpacklo_ps(value, value); // v0 v0 v1 v1 | v4 v4 v5 v5
+    __m256 high = _mm256_unpackhi_ps(value, value);
+    float *o = out + i * 2;
+    _mm256_storeu_ps(o, _mm256_fmadd_ps(_mm256_permute2f128_ps(low, high, 0x20), gains, _mm256_loadu_ps(o)));
+    gains = _mm256_add_ps(gains, fourFrames);
+    _mm256_storeu_ps(o + 8, _mm256_fmadd_ps(_mm256_permute2f128_ps(low, high, 0x31), gains, _mm256_loadu_ps(o + 8)));
+    gains = _mm256_add_ps(gains, fourFrames);
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  __m128 gains = _mm_setr_ps(gainLeft, gainRight, gainLeft + slopeLeft, gainRight + slopeRight);
+  const __m128 twoFrames = _mm_setr_ps(2 * slopeLeft, 2 * slopeRight, 2 * slopeLeft, 2 * slopeRight);
+  for (; i + 4 <= frames; i += 4)
+  {
+    std::size_t indices[4];
+    float fractions[4];
+    for (int k = 0; k < 4; k++, at += increment)
+    {
+      indices[k] = static_cast<std::size_t>(at >> 32);
+      fractions[k] = static_cast<std::uint32_t>(at) * (1.0f / 4294967296.0f);
+    }
+    __m128 a = _mm_setr_ps(data[indices[0]], data[indices[1]], data[indices[2]], data[indices[3]]);
+    __m128 b = _mm_setr_ps(data[indices[0] + 1], data[indices[1] + 1], data[indices[2] + 1], data[indices[3] + 1]);
+    __m128 value = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_loadu_ps(fractions)));
+    float *o = out + i * 2;
+    _mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(_mm_unpacklo_ps(value, value), gains)));
+    gains = _mm_add_ps(gains, twoFrames);
+    _mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4), _mm_mul_ps(_mm_unpackhi_ps(value, value), gains)));
+    gains = _mm_add_ps(gains, twoFrames);
+  }
+#endif
+  for (; i < frames; i++, at += increment)
+  {
+    std::size_t index = static_cast<std::size_t>(at >> 32);
+    float fraction = static_cast<std::uint32_t>(at) * (1.0f / 4294967296.0f);
+    float a = data[index], value = a + (data[index + 1] - a) * fraction;
+    out[i * 2] += value * (gainLeft + slopeLeft * i);
+    out[i * 2 + 1] += value * (gainRight + slopeRight * i);
+  }
+  position = at;
+  left += stepLeft * frames;
+  right += stepRight * frames;
+}
+
+// Plays a Module tick by tick and mixes one voice per channel. Pitch is held
+// as a period: Amiga periods (scaled by 4) unless the module uses linear
+// slides, in which case it is 1/64-semitone steps below C-5.
+class ModulePlayer
+{
+  static constexpr double AmigaClock = 14317456.0; // period 1712 is 8363 Hz
+  static const int RampFrames = 64;                // volume changes are smoothed over this many frames
+
+  struct Channel
+  {
+    const ModuleSample *sample = nullptr;
+    const ModuleInstrument *instrument = nullptr;
+    bool active = false;
+    std::uint64_t position = 0; // 32.32 fixed-point frames
+    std::uint64_t increment = 0;
+    float gainLeft = 0, gainRight = 0;
+    float targetLeft = 0, targetRight = 0;
+    float stepLeft = 0, stepRight = 0;
+    int rampFrames = 0;
+
+    double c5speed = 8363;
+    double period = 0, targetPeriod = 0;
+    double periodOffset = 0; // vibrato, this tick only
+    int arpeggio = 0;        // semitones, this tick only
+    int volume = 64, volumeOffset = 0, channelVolume = 64, panning = 128;
+    bool keyOn = true;
+    double fade = 1;
+    int volumeTick = 0, panningTick = 0;
+
+    std::uint8_t effect = FxNone, param = 0, volumeEffect = FxNone, volumeParam = 0;
+    std::array<std::uint8_t, FxCount> memory{};
+    int portaSpeed = 0;
+    int vibratoPosition = 0, vibratoSpeed = 0, vibratoDepth = 0;
+    int tremoloPosition = 0, tremoloSpeed = 0, tremoloDepth = 0;
+    int tremorCount = 0;
+    bool tremorMuted = false;
+    int retrigCount = 0;
+    int loopRow = 0, loopCount = 0;
+    ModuleCell delayed;
+    int delayTick = -1;
+  };
+
+  const Module &module;
+  unsigned int sampleRate;
+  float masterGain;
+  std::vector<Channel> channels;
+  std::vector<std::vector<bool>> visited;
+  int order = 0, row = 0, tick = 0;
+  int speed = 6, tempo = 125, globalVolume = 128;
+  int patternDelay = 0;
+  bool repeatRow = false, advancePending = false;
+  bool jump = false, loopJump = false, breakRow = false;
+  int jumpOrder = 0, jumpRow = 0;
+  bool ended = false;
+  std::size_t tickFramesLeft = 0;
+  double tickRemainder = 0;
+
+  int rowsIn(int o) const
+  {
+    int pattern = module.orders[o];
+    return pattern >= 0 && pattern < static_cast<int>(module.patterns.size()) ? module.patternRows[pattern] : 64;
+  }
+  const ModuleCell *cellsAt(int o, int r) const
+  {
+    int pattern = module.orders[o];
+    if (pattern < 0 || pattern >= static_cast<int>(module.patterns.size()))
+      return nullptr;
+    return module.patterns[pattern].data() + static_cast<std::size_t>(r) * module.channels;
+  }
+  const ModuleSample *sampleAt(unsigned int number) const
+  {
+    return number >= 1 && number <= module.samples.size() && module.samples[number - 1].length ? &module.samples[number - 1] : nullptr;
+  }
+
+  double periodFor(int key, double c5speed) const
+  {
+    if (module.linearSlides)
+      return (60 - key) * 64.0;
+    return AmigaClock / (c5speed * std::exp2((key - 60) / 12.0));
+  }
+  double frequency(const Channel &ch) const
+  {
+    double period = ch.period + ch.periodOffset;
+    double hz = module.linearSlides ? ch.c5speed * std::exp2(-period / 768) : AmigaClock / std::max(period, 1.0);
+    return ch.arpeggio ? hz * std::exp2(ch.arpeggio / 12.0) : hz;
+  }
+  static int waveform(int position) { return static_cast<int>(std::lround(255 * std::sin(position * (3.14159265358979 / 32)))); }
+
+  // Advances to the next row to play; false at the end of the song, which is
+  // also where a jump would revisit a row (the song loops)
+  bool advance()
+  {
+    if (!advancePending)
+      return true;
+    advancePending = false;
+    bool newOrder = true;
+    if (jump)
+    {
+      newOrder = !loopJump;
+      order = jumpOrder;
+      row = jumpRow;
+    }
+    else if (++row < rowsIn(order))
+      newOrder = false;
+    else
+      row = 0, order++;
+    jump = loopJump = breakRow = false;
+    if (newOrder)
+    {
+      while (order < static_cast<int>(module.orders.size()) && module.orders[order] == Module::OrderSkip)
+        order++;
+      if (order >= static_cast<int>(module.orders.size()) || module.orders[order] == Module::OrderEnd)
+        return false;
+      if (row >= rowsIn(order))
+        row = 0;
+      if (visited[order][row])
+        return false;
+      for (auto &ch : channels)
+        ch.loopCount = 0, ch.loopRow = 0;
+    }
+    visited[order][row] = true;
+    return true;
+  }
+
+  void trigger(Channel &ch, const ModuleCell &cell, bool tonePorta)
+  {
+    const ModuleSample *sample = ch.sample;
+    int key = -1;
+    if (cell.instrument)
+    {
+      if (module.instruments.empty())
+        sample = sampleAt(cell.instrument);
+      else if (cell.instrument <= module.instruments.size())
+        ch.instrument = &module.instruments[cell.instrument - 1];
+    }
+    if (cell.note >= 1 && cell.note <= 120)
+    {
+      key = cell.note - 1;
+      if (ch.instrument && !module.instruments.empty())
+      {
+        sample = sampleAt(ch.instrument->samples[key]);
+        key = ch.instrument->keys[key];
+      }
+    }
+    if (cell.instrument && sample)
+    {
+      ch.volume = sample->volume;
+      if (sample->panning >= 0)
+        ch.panning = sample->panning;
+      else if (ch.instrument && ch.instrument->panning >= 0)
+        ch.panning = ch.instrument->panning;
+    }
+    if (key >= 0 && sample)
+    {
+      if (tonePorta && ch.active)
+        ch.targetPeriod = periodFor(key, ch.c5speed);
+      else
+      {
+        ch.sample = sample;
+        ch.c5speed = sample->c5speed;
+        ch.period = ch.targetPeriod = periodFor(key, sample->c5speed);
+        ch.position = 0;
+        ch.active = true;
+        ch.keyOn = true;
+        ch.fade = 1;
+        ch.volumeTick = ch.panningTick = 0;
+        ch.vibratoPosition = ch.tremoloPosition = 0;
+        ch.retrigCount = 0;
+        ch.gainLeft = ch.gainRight = 0; // ramp in from silence
+      }
+    }
+    else if (key >= 0 && !tonePorta)
+      ch.active = false;
+    if (cell.note == ModuleCell::NoteCut)
+      ch.active = false;
+    else if (cell.note == ModuleCell::NoteOff)
+      keyOff(ch);
+    else if (cell.note == ModuleCell::NoteFade)
+      ch.keyOn = ch.keyOn && ch.instrument && ch.instrument->fadeout > 0;
+  }
+
+  void keyOff(Channel &ch)
+  {
+    ch.keyOn = false;
+    if (!ch.instrument || !ch.instrument->volumeEnvelope.enabled)
+      ch.volume = 0;
+  }
+
+  void volumeSlide(int &value, int param, int limit, bool firstTick)
+  {
+    int x = param >> 4, y = param & 15;
+    bool fine = (y == 0xF && x) || (x == 0xF && y);
+    if (fine != firstTick)
+      return;
+    if (fine)
+      value += y == 0xF ? x : -y;
+    else
+      value += x ? x : -y;
+    value = std::min(std::max(value, 0), limit);
+  }
+
+  void porta(Channel &ch, int param, int direction, bool firstTick)
+  {
+    int amount = param >= 0xF0 ? (param & 15) * 4 : param >= 0xE0 ? (param & 15) : param * 4;
+    if ((param >= 0xE0) == firstTick)
+      ch.period = std::max(ch.period - direction * amount, module.linearSlides ? -8192.0 : 1.0);
+  }
+
+  void vibrato(Channel &ch)
+  {
+    ch.periodOffset = waveform(ch.vibratoPosition) * ch.vibratoDepth / 128.0;
+    ch.vibratoPosition = (ch.vibratoPosition + ch.vibratoSpeed) & 63;
+  }
+
+  // Effects that act once, on the row's first tick
+  void rowEffect(Channel &ch, std::uint8_t effect, std::uint8_t param)
+  {
+    int x = param >> 4, y = param & 15;
+    switch (effect)
+    {
+    case FxSpeed:
+      speed = param;
+      break;
+    case FxTempo:
+      tempo = param;
+      break;
+    case FxJump:
+      jump = true;
+      jumpOrder = param;
+      if (!breakRow)
+        jumpRow = 0;
+      break;
+    case FxBreak:
+      if (!jump)
+        jumpOrder = order + 1;
+      jump = breakRow = true;
+      jumpRow = param;
+      break;
+    case FxPatternLoop:
+      if (param == 0)
+        ch.loopRow = row;
+      else if (ch.loopCount == 0 || --ch.loopCount > 0)
+      {
+        if (ch.loopCount == 0)
+          ch.loopCount = param;
+        jump = loopJump = true;
+        jumpOrder = order;
+        jumpRow = ch.loopRow;
+      }
+      break;
+    case FxPatternDelay:
+      if (!repeatRow)
+        patternDelay = param;
+      break;
+    case FxSetVolume:
+      ch.volume = std::min<int>(param, 64);
+      break;
+    case FxChannelVolume:
+      ch.channelVolume = std::min<int>(param, 64);
+      break;
+    case FxGlobalVolume:
+      globalVolume = std::min<int>(param, 128);
+      break;
+    case FxPanning:
+      ch.panning = param * 256 / 255;
+      break;
+    case FxOffset:
+      if (ch.sample && ch.active)
+      {
+        std::uint64_t offset = static_cast<std::uint64_t>(param) * 256;
+        if (offset < ch.sample->length)
+          ch.position = offset << 32;
+        else
+          ch.active = false;
+      }
+      break;
+    case FxVolumeSlide:
+    case FxTonePortaVolumeSlide:
+    case FxVibratoVolumeSlide:
+      volumeSlide(ch.volume, param, 64, true);
+      break;
+    case FxChannelVolumeSlide:
+      volumeSlide(ch.channelVolume, param, 64, true);
+      break;
+    case FxGlobalVolumeSlide:
+      volumeSlide(globalVolume, param, 128, true);
+      break;
+    case FxPortaUp:
+      porta(ch, param, 1, true);
+      break;
+    case FxPortaDown:
+      porta(ch, param, -1, true);
+      break;
+    case FxTonePorta:
+      if (param)
+        ch.portaSpeed = param;
+      break;
+    case FxVibrato:
+    case FxFineVibrato:
+      if (x)
+        ch.vibratoSpeed = x;
+      if (y)
+        ch.vibratoDepth = effect == FxFineVibrato ? y : y * 4;
+      break;
+    case FxTremolo:
+      if (x)
+        ch.tremoloSpeed = x;
+      if (y)
+        ch.tremoloDepth = y;
+      break;
+    case FxNoteCut:
+      if (param == 0)
+        ch.volume = 0;
+      break;
+    case FxKeyOff:
+      if (param == 0)
+        keyOff(ch);
+      break;
+    }
+  }
+
+  // Effects that run on every tick after the first
+  void tickEffect(Channel &ch, std::uint8_t effect, std::uint8_t param)
+  {
+    int x = param >> 4, y = param & 15;
+    switch (effect)
+    {
+    case FxArpeggio:
+      ch.arpeggio = tick % 3 == 1 ? x : tick % 3 == 2 ? y : 0;
+      break;
+    case FxPortaUp:
+      porta(ch, param, 1, false);
+      break;
+    case FxPortaDown:
+      porta(ch, param, -1, false);
+      break;
+    case FxTonePorta:
+    case FxTonePortaVolumeSlide:
+      if (ch.period < ch.targetPeriod)
+        ch.period = std::min(ch.period + ch.portaSpeed * 4, ch.targetPeriod);
+      else
+        ch.period = std::max(ch.period - ch.portaSpeed * 4, ch.targetPeriod);
+      if (effect == FxTonePortaVolumeSlide)
+        volumeSlide(ch.volume, param, 64, false);
+      break;
+    case FxVibrato:
+    case FxVibratoVolumeSlide:
+      vibrato(ch);
+      if (effect == FxVibratoVolumeSlide)
+        volumeSlide(ch.volume, param, 64, false);
+      break;
+    case FxFineVibrato:
+      vibrato(ch);
+      break;
+    case FxTremolo:
+      ch.volumeOffset = waveform(ch.tremoloPosition) * ch.tremoloDepth / 64;
+      ch.tremoloPosition = (ch.tremoloPosition + ch.tremoloSpeed) & 63;
+      break;
+    case FxTremor:
+      if (++ch.tremorCount > (ch.tremorMuted ? y : x))
+        ch.tremorMuted = !ch.tremorMuted, ch.tremorCount = 0;
+      break;
+    case FxVolumeSlide:
+      volumeSlide(ch.volume, param, 64, false);
+      break;
+    case FxChannelVolumeSlide:
+      volumeSlide(ch.channelVolume, param, 64, false);
+      break;
+    case FxGlobalVolumeSlide:
+      volumeSlide(globalVolume, param, 128, false);
+      break;
+    case FxPanSlide:
+      ch.panning = std::min(std::max(ch.panning + (x ? x : -y) * 4, 0), 256);
+      break;
+    case FxRetrig:
+      if (y && ++ch.retrigCount >= y)
+      {
+        static const int add[16] = {0, -1, -2, -4, -8, -16, 0, 0, 0, 1, 2, 4, 8, 16, 0, 0};
+        ch.retrigCount = 0;
+        ch.position = 0;
+        if (x == 6)
+          ch.volume = ch.volume * 2 / 3;
+        else if (x == 7)
+          ch.volume /= 2;
+        else if (x == 0xE)
+          ch.volume = ch.volume * 3 / 2;
+        else if (x == 0xF)
+          ch.volume *= 2;
+        else
+          ch.volume += add[x];
+        ch.volume = std::min(std::max(ch.volume, 0), 64);
+      }
+      break;
+    case FxNoteCut:
+      if (tick == param)
+        ch.volume = 0;
+      break;
+    case FxKeyOff:
+      if (tick == param)
+        keyOff(ch);
+      break;
+    }
+  }
+
+  static bool isTonePorta(std::uint8_t effect) { return effect == FxTonePorta || effect == FxTonePortaVolumeSlide; }
+
+  // Effect memory slot an effect recalls a zero parameter from, FxNone if it has none
+  static std::uint8_t remembers(std::uint8_t effect)
+  {
+    switch (effect)
+    {
+    case FxTonePortaVolumeSlide:
+    case FxVibratoVolumeSlide:
+      return FxVolumeSlide;
+    case FxArpeggio:
+    case FxPortaUp:
+    case FxPortaDown:
+    case FxTonePorta:
+    case FxTremor:
+    case FxVolumeSlide:
+    case FxChannelVolumeSlide:
+    case FxGlobalVolumeSlide:
+    case FxPanSlide:
+    case FxOffset:
+    case FxRetrig:
+      return effect;
+    default:
+      return FxNone;
+    }
+  }
+
+  void playRow()
+  {
+    const ModuleCell *cells = cellsAt(order, row);
+    for (unsigned int c = 0; c < channels.size(); c++)
+    {
+      Channel &ch = channels[c];
+      ModuleCell cell = cells ? cells[c] : ModuleCell();
+      std::uint8_t param = cell.param;
+      std::uint8_t slot = remembers(cell.effect);
+      if (slot != FxNone)
+      {
+        if (param)
+          ch.memory[slot] = param;
+        else
+          param = ch.memory[slot];
+      }
+      if (cell.effect != FxTremor)
+        ch.tremorMuted = false;
+      ch.effect = cell.effect;
+      ch.param = param;
+      ch.volumeEffect = cell.volumeEffect;
+      ch.volumeParam = cell.volumeParam;
+      ch.delayTick = -1;
+      if (cell.effect == FxNoteDelay && param)
+      {
+        ch.delayed = cell;
+        ch.delayTick = param;
+      }
+      else
+        trigger(ch, cell, isTonePorta(cell.effect) || isTonePorta(cell.volumeEffect));
+      if (ch.delayTick < 0)
+        rowEffect(ch, cell.volumeEffect, cell.volumeParam);
+      rowEffect(ch, cell.effect, param);
+    }
+  }
+
+  void updateVoice(Channel &ch)
+  {
+    if (!ch.active)
+    {
+      ch.targetLeft = ch.targetRight = 0;
+      return;
+    }
+    double envelope = 1;
+    int panning = ch.panning;
+    if (const ModuleInstrument *instrument = ch.instrument)
+    {
+      if (instrument->volumeEnvelope.enabled)
+      {
+        envelope = instrument->volumeEnvelope.value(ch.volumeTick) / 64.0;
+        ch.volumeTick = instrument->volumeEnvelope.advance(ch.volumeTick, ch.keyOn);
+      }
+      if (instrument->panningEnvelope.enabled)
+      {
+        int offset = instrument->panningEnvelope.value(ch.panningTick) - 32;
+        panning += offset * (128 - std::abs(panning - 128)) / 32;
+        ch.panningTick = instrument->panningEnvelope.advance(ch.panningTick, ch.keyOn);
+      }
+      if (!ch.keyOn)
+      {
+        ch.fade -= instrument->fadeout;
+        if (ch.fade <= 0)
+          ch.active = false;
+      }
+      envelope *= std::max(ch.fade, 0.0) * instrument->globalVolume / 128.0;
+    }
+    int volume = ch.tremorMuted ? 0 : std::min(std::max(ch.volume + ch.volumeOffset, 0), 64);
+    double gain = masterGain * volume / 64.0 * envelope * ch.sample->globalVolume / 64.0 * ch.channelVolume / 64.0 * globalVolume / 128.0;
+    panning = std::min(std::max(panning, 0), 256);
+    ch.targetLeft = ch.active ? static_cast<float>(gain * (256 - panning) / 256) : 0;
+    ch.targetRight = ch.active ? static_cast<float>(gain * panning / 256) : 0;
+    ch.increment = static_cast<std::uint64_t>(frequency(ch) / sampleRate * 4294967296.0);
+  }
+
+  void processTick()
+  {
+    if (tick == 0 && !repeatRow)
+    {
+      if (!advance())
+      {
+        ended = true;
+        return;
+      }
+      for (auto &ch : channels)
+        ch.periodOffset = 0, ch.arpeggio = 0, ch.volumeOffset = 0;
+      playRow();
+    }
+    else
+      for (auto &ch : channels)
+      {
+        ch.periodOffset = 0, ch.arpeggio = 0, ch.volumeOffset = 0;
+        if (tick == ch.delayTick)
+        {
+          trigger(ch, ch.delayed, false);
+          rowEffect(ch, ch.delayed.volumeEffect, ch.delayed.volumeParam);
+        }
+        tickEffect(ch, ch.volumeEffect, ch.volumeParam);
+        tickEffect(ch, ch.effect, ch.param);
+      }
+    for (auto &ch : channels)
+    {
+      updateVoice(ch);
+      ch.stepLeft = (ch.targetLeft - ch.gainLeft) / RampFrames;
+      ch.stepRight = (ch.targetRight - ch.gainRight) / RampFrames;
+      ch.rampFrames = RampFrames;
+    }
+    if (++tick >= speed)
+    {
+      tick = 0;
+      repeatRow = patternDelay > 0;
+      if (repeatRow)
+        patternDelay--;
+      else
+        advancePending = true;
+    }
+    tickRemainder += sampleRate * 2.5 / std::max(tempo, 1);
+    tickFramesLeft = static_cast<std::size_t>(tickRemainder);
+    tickRemainder -= tickFramesLeft;
+  }
+
+  // Frames the voice can play before reaching its loop or sample end
+  static std::size_t framesUntilEnd(const Channel &ch, std::size_t limit)
+  {
+    std::uint64_t end = static_cast<std::uint64_t>(ch.sample->length) << 32;
+    if (ch.increment == 0)
+      return limit;
+    return static_cast<std::size_t>(std::min<std::uint64_t>(limit, (end - ch.position + ch.increment - 1) / ch.increment));
+  }
+  // Wraps a looping voice or stops a finished one; false when it stopped
+  static bool wrap(Channel &ch)
+  {
+    std::uint64_t end = static_cast<std::uint64_t>(ch.sample->length) << 32;
+    if (ch.position < end)
+      return true;
+    if (!ch.sample->loop)
+      return ch.active = false;
+    std::uint64_t start = static_cast<std::uint64_t>(ch.sample->loopStart) << 32;
+    ch.position = start + (ch.position - end) % (end - start);
+    return true;
+  }
+
+  static void mixSpan(Channel &ch, float *out, std::size_t frames)
+  {
+    const float *data = ch.sample->data.data();
+    std::size_t ramp = std::min<std::size_t>(frames, static_cast<std::size_t>(ch.rampFrames));
+    mixInterpolated(data, ch.position, ch.increment, ch.gainLeft, ch.gainRight, ch.stepLeft, ch.stepRight, out, ramp);
+    ch.rampFrames -= static_cast<int>(ramp);
+    if (ch.rampFrames == 0)
+      ch.gainLeft = ch.targetLeft, ch.gainRight = ch.targetRight;
+    mixInterpolated(data, ch.position, ch.increment, ch.gainLeft, ch.gainRight, 0.0f, 0.0f, out + ramp * 2, frames - ramp);
+  }
+
+  void mixChannel(Channel &ch, float *out, std::size_t frames)
+  {
+    while (frames > 0 && ch.active && wrap(ch))
+    {
+      std::size_t span = framesUntilEnd(ch, frames);
+      mixSpan(ch, out, span);
+      out += span * 2;
+      frames -= span;
+    }
+  }
+
+  void skipChannel(Channel &ch, std::size_t frames)
+  {
+    ch.gainLeft = ch.targetLeft;
+    ch.gainRight = ch.targetRight;
+    ch.rampFrames = 0;
+    if (ch.active)
+    {
+      ch.position += ch.increment * frames;
+      wrap(ch);
+    }
+  }
+
+public:
+  ModulePlayer(const Module &m, unsigned int rate)
+      : module(m), sampleRate(rate), masterGain(1.0f / std::sqrt(static_cast<float>(std::max(m.channels, 4u))))
+  {
+    restart();
+  }
+
+  void restart()
+  {
+    channels.assign(module.channels, Channel());
+    for (unsigned int c = 0; c < module.channels; c++)
+    {
+      channels[c].panning = module.panning[c];
+      channels[c].channelVolume = module.channelVolume[c];
+    }
+    visited.assign(module.orders.size(), std::vector<bool>(256, false));
+    order = row = tick = 0;
+    speed = module.speed;
+    tempo = module.tempo;
+    globalVolume = module.globalVolume;
+    patternDelay = 0;
+    repeatRow = jump = loopJump = breakRow = false;
+    tickFramesLeft = 0;
+    tickRemainder = 0;
+    // The first row is reached like any jump target, skipping "+++" orders
+    jump = advancePending = true;
+    jumpOrder = jumpRow = 0;
+    ended = module.orders.empty();
+  }
+
+  bool finished() const { return ended; }
+
+  // Mixes up to `frames` stereo frames into `out`; fewer at the end of the song
+  std::size_t render(float *out, std::size_t frames)
+  {
+    std::fill(out, out + frames * 2, 0.0f);
+    std::size_t done = 0;
+    while (done < frames && !ended)
+    {
+      if (tickFramesLeft == 0)
+      {
+        processTick();
+        continue;
+      }
+      std::size_t count = std::min(frames - done, tickFramesLeft);
+      for (auto &ch : channels)
+        mixChannel(ch, out + done * 2, count);
+      done += count;
+      tickFramesLeft -= count;
+    }
+    return done;
+  }
+
+  // Runs the song forward without mixing; returns the frames passed over
+  std::uint64_t skip(std::uint64_t frames)
+  {
+    std::uint64_t done = 0;
+    while (done < frames && !ended)
+    {
+      if (tickFramesLeft == 0)
+      {
+        processTick();
+        continue;
+      }
+      std::size_t count = static_cast<std::size_t>(std::min<std::uint64_t>(frames - done, tickFramesLeft));
+      for (auto &ch : channels)
+        skipChannel(ch, count);
+      done += count;
+      tickFramesLeft -= count;
+    }
+    return done;
+  }
+};
+
+// Presents a tracker module as 44.1 kHz stereo float audio. The length is
+// found by running the song once without mixing, and seeks replay the song
+// from the start the same way, so both are sample-exact.
+class ModuleDecoder : public AudioDecoder
+{
+  static constexpr unsigned int Rate = 44100;
+  static const std::uint64_t MaxFrames = static_cast<std::uint64_t>(Rate) * 60 * 60 * 2; // songs that never end stop after two hours
+
+  Module module;
+  std::unique_ptr<ModulePlayer> player;
+  sf::Uint64 frameCount = 0;
+  sf::Uint64 position = 0;
+
+public:
+  bool open(const std::string &path)
+  {
+    MappedFile file;
+    if (!file.open(path))
+      return false;
+    ByteReader in(file.data(), file.size());
+    if (!loadXm(in, module) && !loadS3m(in, module) && !loadIt(in, module) && !loadMod(in, module))
+      return false;
+    if (module.orders.empty() || module.channels == 0)
+      return false;
+    player = std::make_unique<ModulePlayer>(module, Rate);
+    frameCount = player->skip(MaxFrames);
+    player->restart();
+    std::cout << "[DEBUG] Module \"" << module.title << "\": " << module.channels << " channels, "
+              << frameCount / Rate << " s" << std::endl;
+    return frameCount > 0;
+  }
+
+  unsigned int getChannelCount() const override { return 2; }
+  unsigned int getSampleRate() const override { return Rate; }
+  sf::Uint64 getSampleCount() const override { return frameCount * 2; }
+  unsigned int getBitDepth() const override { return 24; }
+
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    std::size_t frames = static_cast<std::size_t>(std::min(maxCount / 2, frameCount - position));
+    frames = player->render(samples, frames);
+    position += frames;
+    return frames * 2;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override
+  {
+    player->restart();
+    position = player->skip(std::min(sampleOffset / 2, frameCount));
+  }
+};
+
+// General MIDI through SoundFont 2 banks. Presets and instruments are
+// flattened into regions when the bank loads, so a note-on only has to find
+// the regions covering its key and velocity. Sample data stays in the
+// memory map; a bank of several hundred megabytes costs only the pages the
+// song actually plays.
+struct SoundFontRegion
+{
+  int keyLow = 0, keyHigh = 127, velocityLow = 0, velocityHigh = 127;
+  std::uint32_t start = 0, end = 0, loopStart = 0, loopEnd = 0;
+  int loopMode = 0; // 1 loops forever, 3 loops until the key is released
+  int rootKey = 60;
+  int fixedKey = -1, fixedVelocity = -1;
+  float tune = 0;        // cents
+  float scaleTuning = 1; // cents per key / 100
+  unsigned int sampleRate = 44100;
+  float attenuation = 0; // dB
+  float pan = 0;         // -0.5 left to 0.5 right
+  // Volume envelope, in timecents except sustain (dB below peak)
+  int delay = -12000, attack = -12000, hold = -12000, decay = -12000, release = -12000;
+  int holdPerKey = 0, decayPerKey = 0;
+  float sustain = 0;
+  int exclusiveClass = 0;
+};
+
+struct SoundFontPreset
+{
+  std::string name;
+  int bank = 0, program = 0;
+  std::vector<SoundFontRegion> regions;
+};
+
+class SoundFont
+{
+  // Generator numbers from the SoundFont 2.04 specification
+  enum Generator
+  {
+    StartOffset = 0,
+    EndOffset = 1,
+    LoopStartOffset = 2,
+    LoopEndOffset = 3,
+    StartCoarseOffset = 4,
+    EndCoarseOffset = 12,
+    Pan = 17,
+    DelayVolume = 33,
+    AttackVolume = 34,
+    HoldVolume = 35,
+    DecayVolume = 36,
+    SustainVolume = 37,
+    ReleaseVolume = 38,
+    KeyToHold = 39,
+    KeyToDecay = 40,
+    Instrument = 41,
+    KeyRange = 43,
+    VelocityRange = 44,
+    LoopStartCoarseOffset = 45,
+    Key = 46,
+    Velocity = 47,
+    Attenuation = 48,
+    LoopEndCoarseOffset = 50,
+    CoarseTune = 51,
+    FineTune = 52,
+    SampleId = 53,
+    SampleModes = 54,
+    ScaleTuning = 56,
+    ExclusiveClass = 57,
+    RootKey = 58,
+    GeneratorCount = 61
+  };
+  using Generators = std::array<int, GeneratorCount>;
+
+  struct Chunk
+  {
+    std::size_t offset = 0, size = 0;
+  };
+
+  MappedFile file;
+  const sf::Int16 *pool = nullptr;
+  std::size_t poolFrames = 0;
+  std::vector<SoundFontPreset> presets;
+
+  static Chunk findChunk(const ByteReader &in, std::size_t offset, std::size_t end, const char *id, const char *listType = nullptr)
+  {
+    while (offset + 8 <= end && in.has(offset, 8))
+    {
+      std::size_t size = in.le32(offset + 4);
+      if (in.text(offset, 4) == id && (!listType || in.text(offset + 8, 4) == listType))
+        return {offset + 8, std::min(size, in.size() - offset - 8)};
+      offset += 8 + size + (size & 1);
+    }
+    return {};
+  }
+
+  // Applies the generators of one zone; ranges keep their low/high bytes
+  static void applyZone(const ByteReader &in, const Chunk &gens, std::size_t first, std::size_t last, Generators &values, bool &terminal, int terminalGenerator)
+  {
+    terminal = false;
+    for (std::size_t g = first; g < last && (g + 1) * 4 <= gens.size; g++)
+    {
+      unsigned int op = in.le16(gens.offset + g * 4);
+      if (op >= GeneratorCount)
+        continue;
+      values[op] = (op == KeyRange || op == VelocityRange) ? static_cast<int>(in.le16(gens.offset + g * 4 + 2))
+                                                           : static_cast<std::int16_t>(in.le16(gens.offset + g * 4 + 2));
+      if (static_cast<int>(op) == terminalGenerator)
+        terminal = true;
+    }
+  }
+
+  static bool intersect(int range, int otherRange, int &low, int &high)
+  {
+    low = std::max(range & 0xFF, otherRange & 0xFF);
+    high = std::min(range >> 8, otherRange >> 8);
+    return low <= high;
+  }
+
+  SoundFontRegion makeRegion(const ByteReader &in, const Chunk &shdr, const Generators &i, const Generators &p) const
+  {
+    std::size_t header = shdr.offset + static_cast<std::size_t>(i[SampleId]) * 46;
+    SoundFontRegion region;
+    auto address = [&](std::size_t field, Generator fine, Generator coarse)
+    {
+      std::int64_t value = static_cast<std::int64_t>(in.le32(header + field)) + i[fine] + i[coarse] * 32768;
+      return static_cast<std::uint32_t>(std::max<std::int64_t>(0, std::min<std::int64_t>(value, static_cast<std::int64_t>(poolFrames) - 1)));
+    };
+    region.start = address(20, StartOffset, StartCoarseOffset);
+    region.end = std::max(region.start, address(24, EndOffset, EndCoarseOffset));
+    region.loopStart = std::max(region.start, address(28, LoopStartOffset, LoopStartCoarseOffset));
+    region.loopEnd = std::min(region.end, address(32, LoopEndOffset, LoopEndCoarseOffset));
+    region.loopMode = region.loopEnd > region.loopStart ? (i[SampleModes] & 3) : 0;
+    if (region.loopMode == 2)
+      region.loopMode = 0;
+    region.sampleRate = std::max<std::uint32_t>(1, in.le32(header + 36));
+    unsigned int original = in.u8(header + 40);
+    region.rootKey = i[RootKey] >= 0 ? i[RootKey] : (original <= 127 ? static_cast<int>(original) : 60);
+    region.fixedKey = i[Key];
+    region.fixedVelocity = i[Velocity];
+    region.tune = (i[CoarseTune] + p[CoarseTune]) * 100.0f + i[FineTune] + p[FineTune] + in.s8(header + 41);
+    region.scaleTuning = (i[ScaleTuning] + p[ScaleTuning]) / 100.0f;
+    region.attenuation = std::max(0, std::min(1440, i[Attenuation] + p[Attenuation])) / 10.0f;
+    region.pan = std::max(-500, std::min(500, i[Pan] + p[Pan])) / 1000.0f;
+    region.delay = i[DelayVolume] + p[DelayVolume];
+    region.attack = i[AttackVolume] + p[AttackVolume];
+    region.hold = i[HoldVolume] + p[HoldVolume];
+    region.decay = i[DecayVolume] + p[DecayVolume];
+    region.release = i[ReleaseVolume] + p[ReleaseVolume];
+    region.holdPerKey = i[KeyToHold] + p[KeyToHold];
+    region.decayPerKey = i[KeyToDecay] + p[KeyToDecay];
+    region.sustain = std::max(0, std::min(1440, i[SustainVolume] + p[SustainVolume])) / 10.0f;
+    region.exclusiveClass = i[ExclusiveClass];
+    return region;
+  }
+
+public:
+  bool open(const std::string &path)
+  {
+    if (!file.open(path))
+      return false;
+    ByteReader in(file.data(), file.size());
+    if (in.text(0, 4) != "RIFF" || in.text(8, 4) != "sfbk")
+      return false;
+    std::size_t end = std::min<std::size_t>(in.size(), 8 + static_cast<std::size_t>(in.le32(4)));
+    Chunk sdta = findChunk(in, 12, end, "LIST", "sdta");
+    Chunk pdta = findChunk(in, 12, end, "LIST", "pdta");
+    Chunk smpl = findChunk(in, sdta.offset + 4, sdta.offset + sdta.size, "smpl");
+    if (smpl.size < 2 || pdta.size == 0)
+      return false;
+    // RIFF chunks start on even offsets and the map is page aligned
+    pool = reinterpret_cast<const sf::Int16 *>(file.data() + smpl.offset);
+    poolFrames = smpl.size / 2;
+    std::size_t hydraEnd = pdta.offset + pdta.size;
+    Chunk phdr = findChunk(in, pdta.offset + 4, hydraEnd, "phdr");
+    Chunk pbag = findChunk(in, pdta.offset + 4, hydraEnd, "pbag");
+    Chunk pgen = findChunk(in, pdta.offset + 4, hydraEnd, "pgen");
+    Chunk inst = findChunk(in, pdta.offset + 4, hydraEnd, "inst");
+    Chunk ibag = findChunk(in, pdta.offset + 4, hydraEnd, "ibag");
+    Chunk igen = findChunk(in, pdta.offset + 4, hydraEnd, "igen");
+    Chunk shdr = findChunk(in, pdta.offset + 4, hydraEnd, "shdr");
+    std::size_t presetCount = phdr.size / 38, instrumentCount = inst.size / 22, sampleCount = shdr.size / 46;
+    if (presetCount < 2 || instrumentCount < 2 || sampleCount < 2)
+      return false;
+
+    Generators instrumentDefaults{};
+    instrumentDefaults[KeyRange] = instrumentDefaults[VelocityRange] = 127 << 8;
+    instrumentDefaults[DelayVolume] = instrumentDefaults[AttackVolume] = instrumentDefaults[HoldVolume] = -12000;
+    instrumentDefaults[DecayVolume] = instrumentDefaults[ReleaseVolume] = -12000;
+    instrumentDefaults[ScaleTuning] = 100;
+    instrumentDefaults[Key] = instrumentDefaults[Velocity] = instrumentDefaults[RootKey] = -1;
+    Generators presetDefaults{};
+    presetDefaults[KeyRange] = presetDefaults[VelocityRange] = 127 << 8;
+
+    // The last record of each list is a terminator that only bounds the one before it
+    for (std::size_t p = 0; p + 1 < presetCount; p++)
+    {
+      std::size_t record = phdr.offset + p * 38;
+      SoundFontPreset preset;
+      preset.name = in.text(record, 20);
+      preset.program = static_cast<int>(in.le16(record + 20));
+      preset.bank = static_cast<int>(in.le16(record + 22));
+      Generators presetGlobal = presetDefaults;
+      for (std::size_t zone = in.le16(record + 24); zone < in.le16(record + 38 + 24) && (zone + 1) * 4 < pbag.size; zone++)
+      {
+        Generators presetZone = presetGlobal;
+        bool hasInstrument;
+        applyZone(in, pgen, in.le16(pbag.offset + zone * 4), in.le16(pbag.offset + zone * 4 + 4), presetZone, hasInstrument, Instrument);
+        if (!hasInstrument)
+        {
+          if (zone == in.le16(record + 24))
+            presetGlobal = presetZone;
+          continue;
+        }
+        std::size_t instrument = static_cast<std::size_t>(presetZone[Instrument]);
+        if (instrument + 1 >= instrumentCount)
+          continue;
+        std::size_t firstZone = in.le16(inst.offset + instrument * 22 + 20);
+        std::size_t lastZone = in.le16(inst.offset + (instrument + 1) * 22 + 20);
+        Generators instrumentGlobal = instrumentDefaults;
+        for (std::size_t z = firstZone; z < lastZone && (z + 1) * 4 < ibag.size; z++)
+        {
+          Generators instrumentZone = instrumentGlobal;
+          bool hasSample;
+          applyZone(in, igen, in.le16(ibag.offset + z * 4), in.le16(ibag.offset + z * 4 + 4), instrumentZone, hasSample, SampleId);
+          if (!hasSample)
+          {
+            if (z == firstZone)
+              instrumentGlobal = instrumentZone;
+            continue;
+          }
+          std::size_t sample = static_cast<std::size_t>(instrumentZone[SampleId]);
+          if (sample + 1 >= sampleCount || (in.le16(shdr.offset + sample * 46 + 44) & 0x8000)) // ROM samples are not in the file
+            continue;
+          int keyLow, keyHigh, velocityLow, velocityHigh;
+          if (!intersect(instrumentZone[KeyRange], presetZone[KeyRange], keyLow, keyHigh) ||
+              !intersect(instrumentZone[VelocityRange], presetZone[VelocityRange], velocityLow, velocityHigh))
+            continue;
+          SoundFontRegion region = makeRegion(in, shdr, instrumentZone, presetZone);
+          region.keyLow = keyLow;
+          region.keyHigh = keyHigh;
+          region.velocityLow = velocityLow;
+          region.velocityHigh = velocityHigh;
+          if (region.end > region.start)
+            preset.regions.push_back(region);
+        }
+      }
+      presets.push_back(std::move(preset));
+    }
+    std::cout << "[DEBUG] SoundFont " << path << ": " << presets.size() << " presets, " << poolFrames * 2 / (1024 * 1024) << " MB of samples" << std::endl;
+    return !presets.empty();
+  }
+
+  // Falls back to the General MIDI program in bank 0 (or the standard kit
+  // for drums) so files written for GS/XG banks still make sound
+  const SoundFontPreset *find(int bank, int program) const
+  {
+    const SoundFontPreset *fallback = nullptr;
+    for (const SoundFontPreset &preset : presets)
+    {
+      if (preset.bank == bank && preset.program == program)
+        return &preset;
+      if (!fallback && preset.bank == (bank == 128 ? 128 : 0) && preset.program == (bank == 128 ? 0 : program))
+        fallback = &preset;
+    }
+    return fallback ? fallback : &presets.front();
+  }
+
+  const sf::Int16 *samples() const { return pool; }
+
+  // Touches the first pages of every region so note-ons do not fault
+  void prefetch(const SoundFontPreset &preset) const
+  {
+    for (const SoundFontRegion &region : preset.regions)
+      file.willNeed(static_cast<std::size_t>(reinterpret_cast<const char *>(pool + region.start) - file.data()), 64 * 1024);
+  }
+};
+
+// Every track that uses the same bank shares one mapping of it
+std::shared_ptr<const SoundFont> loadSoundFont(const std::string &path)
+{
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<const SoundFont>> loaded;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (auto font = loaded[path].lock())
+    return font;
+  auto font = std::make_shared<SoundFont>();
+  if (!font->open(path))
+  {
+    std::cout << "[ERROR] Could not load SoundFont " << path << "\n";
+    return nullptr;
+  }
+  loaded[path] = font;
+  return font;
+}
+
+struct MidiEvent
+{
+  std::uint64_t frame;
+  std::uint8_t status, data1, data2;
+};
+
+// 16-channel General MIDI synthesizer. Voices are updated every ControlFrames
+// frames (envelopes, volume, pan) and the gains glide across each block, so
+// the sample loop itself is the shared SIMD interpolation kernel.
+class MidiSynth
+{
+public:
+  static const unsigned int MaxVoices = 256;
+
+private:
+  static const std::size_t ControlFrames = 64;
+  static constexpr float MasterGain = 0.4f;
+
+  enum Stage
+  {
+    Delay,
+    Attack,
+    Hold,
+    Decay,
+    Sustain,
+    Release,
+    Finished
+  };
+
+  struct Voice
+  {
+    const SoundFontRegion *region = nullptr; // null when the voice is free
+    int channel = 0, key = 0;
+    float velocityGain = 0;
+    std::uint64_t position = 0, start = 0, end = 0, loopStart = 0, loopEnd = 0;
+    std::uint64_t increment = 0;
+    double pitchRatio = 1; // before pitch bend
+    Stage stage = Delay;
+    double stageTime = 0;
+    float delay = 0, attack = 0, hold = 0, decay = 0, release = 0;
+    float attenuation = 0; // dB below peak while decaying and releasing
+    float releaseFrom = 0;
+    float gainLeft = 0, gainRight = 0;
+    bool released = false, sustained = false;
+    std::uint64_t age = 0;
+  };
+
+  struct Channel
+  {
+    const SoundFontPreset *preset = nullptr;
+    int bank = 0, program = 0;
+    float volume = 100 / 127.0f, expression = 1, pan = 0;
+    int bend = 8192;
+    float bendRange = 2; // semitones
+    bool sustain = false;
+    int rpn = 0x3FFF;
+  };
+
+  std::shared_ptr<const SoundFont> font;
+  unsigned int sampleRate;
+  std::array<Channel, 16> channels;
+  std::vector<Voice> voices;
+  std::uint64_t noteCounter = 0;
+
+  static float timecents(int value) { return static_cast<float>(std::pow(2.0, std::max(-12000, std::min(8000, value)) / 1200.0)); }
+
+  void updatePitch(Voice &voice) const
+  {
+    const Channel &ch = channels[voice.channel];
+    double bend = (ch.bend - 8192) / 8192.0 * ch.bendRange;
+    // Never zero, mixVoice divides by it; an extreme tuning in a corrupt bank just plays wrong
+    double step = voice.pitchRatio * std::pow(2.0, bend / 12.0) * 4294967296.0;
+    voice.increment = static_cast<std::uint64_t>(std::max(1.0, std::min(281474976710656.0, step)));
+  }
+
+  void releaseVoice(Voice &voice, float seconds = -1)
+  {
+    if (voice.stage == Finished || voice.stage == Release)
+      return;
+    // Keep the current level and fall 96 dB over the release time from there
+    float level = voice.stage == Delay ? 0.0f : voice.stage == Attack ? static_cast<float>(voice.stageTime / voice.attack) : 1.0f;
+    voice.releaseFrom = voice.stage >= Decay ? voice.attenuation : (level > 0.00001f ? -20 * std::log10(level) : 96.0f);
+    if (seconds >= 0)
+      voice.release = seconds;
+    voice.stage = Release;
+    voice.stageTime = 0;
+    voice.released = true;
+  }
+
+  // Moves the envelope on by `seconds` and returns its amplitude
+  float advanceEnvelope(Voice &voice, double seconds)
+  {
+    voice.stageTime += seconds;
+    for (;;)
+    {
+      switch (voice.stage)
+      {
+      case Delay:
+        if (voice.stageTime < voice.delay)
+          return 0;
+        voice.stageTime -= voice.delay;
+        voice.stage = Attack;
+        break;
+      case Attack:
+        if (voice.stageTime < voice.attack)
+          return static_cast<float>(voice.stageTime / voice.attack);
+        voice.stageTime -= voice.attack;
+        voice.stage = Hold;
+        break;
+      case Hold:
+        if (voice.stageTime < voice.hold)
+          return 1;
+        voice.stageTime -= voice.hold;
+        voice.stage = Decay;
+        break;
+      case Decay:
+        // Decay and release are linear in dB: 96 dB over the stage time
+        voice.attenuation = static_cast<float>(96 * voice.stageTime / voice.decay);
+        if (voice.attenuation < voice.region->sustain)
+          return std::pow(10.0f, -voice.attenuation / 20);
+        voice.attenuation = voice.region->sustain;
+        voice.stage = Sustain;
+        break;
+      case Sustain:
+        return voice.attenuation < 96 ? std::pow(10.0f, -voice.attenuation / 20) : 0.0f;
+      case Release:
+        voice.attenuation = voice.releaseFrom + static_cast<float>(96 * voice.stageTime / voice.release);
+        if (voice.attenuation < 96)
+          return std::pow(10.0f, -voice.attenuation / 20);
+        voice.stage = Finished;
+        break;
+      case Finished:
+        return 0;
+      }
+    }
+  }
+
+  Voice &allocateVoice()
+  {
+    // A free voice, else the quietest released one, else the oldest
+    Voice *best = nullptr;
+    for (Voice &voice : voices)
+    {
+      if (!voice.region)
+        return voice;
+      if (!best || (voice.released && !best->released) ||
+          (voice.released == best->released && (voice.released ? voice.attenuation > best->attenuation : voice.age < best->age)))
+        best = &voice;
+    }
+    return *best;
+  }
+
+  void noteOn(int channel, int key, int velocity)
+  {
+    Channel &ch = channels[channel];
+    if (!ch.preset)
+      ch.preset = font->find(channel == 9 ? 128 : ch.bank, ch.program);
+    for (const SoundFontRegion &region : ch.preset->regions)
+    {
+      if (key < region.keyLow || key > region.keyHigh || velocity < region.velocityLow || velocity > region.velocityHigh)
+        continue;
+      if (region.exclusiveClass != 0)
+        for (Voice &other : voices)
+          if (other.region && other.channel == channel && other.region->exclusiveClass == region.exclusiveClass)
+            releaseVoice(other, 0.005f);
+      Voice &voice = allocateVoice();
+      voice = Voice();
+      voice.region = &region;
+      voice.channel = channel;
+      voice.key = key;
+      voice.age = noteCounter++;
+      int pitchKey = region.fixedKey >= 0 ? region.fixedKey : key;
+      float noteVelocity = (region.fixedVelocity >= 0 ? region.fixedVelocity : velocity) / 127.0f;
+      // The default velocity modulator: a concave curve, roughly squared
+      voice.velocityGain = noteVelocity * noteVelocity * std::pow(10.0f, -region.attenuation / 20);
+      double cents = (pitchKey - region.rootKey) * 100.0 * region.scaleTuning + region.tune;
+      voice.pitchRatio = std::pow(2.0, cents / 1200.0) * region.sampleRate / sampleRate;
+      updatePitch(voice);
+      voice.start = voice.position = static_cast<std::uint64_t>(region.start) << 32;
+      voice.end = static_cast<std::uint64_t>(region.end) << 32;
+      voice.loopStart = static_cast<std::uint64_t>(region.loopStart) << 32;
+      voice.loopEnd = static_cast<std::uint64_t>(region.loopEnd) << 32;
+      voice.delay = timecents(region.delay);
+      voice.attack = timecents(region.attack);
+      voice.hold = timecents(region.hold + region.holdPerKey * (60 - key));
+      voice.decay = timecents(region.decay + region.decayPerKey * (60 - key));
+      voice.release = timecents(region.release);
+    }
+  }
+
+  void noteOff(int channel, int key)
+  {
+    for (Voice &voice : voices)
+    {
+      if (!voice.region || voice.channel != channel || voice.key != key || voice.released)
+        continue;
+      if (channels[channel].sustain)
+        voice.sustained = true;
+      else
+        releaseVoice(voice);
+    }
+  }
+
+  void controlChange(int channel, int controller, int value)
+  {
+    Channel &ch = channels[channel];
+    switch (controller)
+    {
+    case 0:
+      ch.bank = value;
+      break;
+    case 6: // data entry for the selected RPN
+      if (ch.rpn == 0)
+        ch.bendRange = value + std::fmod(ch.bendRange, 1.0f);
+      break;
+    case 38:
+      if (ch.rpn == 0)
+        ch.bendRange = std::floor(ch.bendRange) + value / 100.0f;
+      break;
+    case 7:
+      ch.volume = value / 127.0f;
+      break;
+    case 10:
+      ch.pan = value / 127.0f - 0.5f;
+      break;
+    case 11:
+      ch.expression = value / 127.0f;
+      break;
+    case 64:
+      ch.sustain = value >= 64;
+      if (!ch.sustain)
+        for (Voice &voice : voices)
+          if (voice.region && voice.channel == channel && voice.sustained)
+            releaseVoice(voice);
+      break;
+    case 100:
+      ch.rpn = (ch.rpn & 0x3F80) | value;
+      break;
+    case 101:
+      ch.rpn = (ch.rpn & 0x7F) | (value << 7);
+      break;
+    case 120: // all sound off
+      for (Voice &voice : voices)
+        if (voice.region && voice.channel == channel)
+          releaseVoice(voice, 0.005f);
+      break;
+    case 121: // reset controllers
+      ch.expression = 1;
+      ch.bend = 8192;
+      ch.sustain = false;
+      ch.rpn = 0x3FFF;
+      for (Voice &voice : voices)
+        if (voice.region && voice.channel == channel)
+        {
+          updatePitch(voice);
+          if (voice.sustained)
+            releaseVoice(voice);
+        }
+      break;
+    case 123: // all notes off
+      for (Voice &voice : voices)
+        if (voice.region && voice.channel == channel)
+          releaseVoice(voice);
+      break;
+    }
+  }
+
+  void mixVoice(Voice &voice, float *out, std::size_t frames)
+  {
+    const Channel &ch = channels[voice.channel];
+    float amplitude = advanceEnvelope(voice, static_cast<double>(frames) / sampleRate);
+    float gain = voice.velocityGain * ch.volume * ch.volume * ch.expression * ch.expression * amplitude * MasterGain;
+    float pan = std::max(-0.5f, std::min(0.5f, voice.region->pan + ch.pan));
+    float targetLeft = gain * std::cos((pan + 0.5f) * 1.5707963f), targetRight = gain * std::sin((pan + 0.5f) * 1.5707963f);
+    float stepLeft = (targetLeft - voice.gainLeft) / frames, stepRight = (targetRight - voice.gainRight) / frames;
+    const sf::Int16 *data = font->samples();
+    bool looping = voice.region->loopMode == 1 || (voice.region->loopMode == 3 && !voice.released);
+    while (frames > 0)
+    {
+      std::uint64_t boundary = looping ? voice.loopEnd : voice.end;
+      if (voice.position >= boundary)
+      {
+        if (!looping)
+        {
+          voice.stage = Finished;
+          break;
+        }
+        voice.position = voice.loopStart + (voice.position - boundary) % (voice.loopEnd - voice.loopStart);
+      }
+      std::size_t span = static_cast<std::size_t>(std::min<std::uint64_t>(frames, (boundary - voice.position + voice.increment - 1) / voice.increment));
+      mixInterpolated(data, voice.position, voice.increment, voice.gainLeft, voice.gainRight, stepLeft, stepRight, out, span);
+      out += span * 2;
+      frames -= span;
+    }
+    if (voice.stage == Finished)
+      voice.region = nullptr;
+  }
+
+public:
+  MidiSynth(std::shared_ptr<const SoundFont> soundFont, unsigned int rate) : font(std::move(soundFont)), sampleRate(rate), voices(MaxVoices)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    channels.fill(Channel());
+    for (Voice &voice : voices)
+      voice = Voice();
+  }
+
+  // Channel messages only; note-ons can be skipped to restore controller
+  // state after a seek without restarting notes
+  void handle(const MidiEvent &event, bool notes = true)
+  {
+    int channel = event.status & 0x0F;
+    switch (event.status & 0xF0)
+    {
+    case 0x80:
+      if (notes)
+        noteOff(channel, event.data1);
+      break;
+    case 0x90:
+      if (notes)
+      {
+        if (event.data2 == 0)
+          noteOff(channel, event.data1);
+        else
+          noteOn(channel, event.data1, event.data2);
+      }
+      break;
+    case 0xB0:
+      controlChange(channel, event.data1, event.data2);
+      break;
+    case 0xC0:
+      channels[channel].program = event.data1;
+      channels[channel].preset = font->find(channel == 9 ? 128 : channels[channel].bank, event.data1);
+      font->prefetch(*channels[channel].preset);
+      break;
+    case 0xE0:
+      channels[channel].bend = event.data1 | (event.data2 << 7);
+      for (Voice &voice : voices)
+        if (voice.region && voice.channel == channel)
+          updatePitch(voice);
+      break;
+    }
+  }
+
+  // Adds `frames` stereo frames to `out`
+  void render(float *out, std::size_t frames)
+  {
+    while (frames > 0)
+    {
+      std::size_t block = std::min(frames, ControlFrames);
+      for (Voice &voice : voices)
+        if (voice.region)
+          mixVoice(voice, out, block);
+      out += block * 2;
+      frames -= block;
+    }
+  }
+};
+
+// Standard MIDI files (formats 0, 1 and 2) rendered through a SoundFont.
+// Tempo changes are resolved up front, so every event carries the exact
+// output frame it happens on and rendering is split there.
+class MidiDecoder : public AudioDecoder
+{
+  static constexpr unsigned int Rate = 44100;
+  static const unsigned int TailFrames = Rate * 2; // lets the last notes ring out
+
+  std::vector<MidiEvent> events;
+  std::unique_ptr<MidiSynth> synth;
+  std::size_t nextEvent = 0;
+  sf::Uint64 frameCount = 0;
+  sf::Uint64 position = 0;
+
+  static std::uint32_t readVariable(const ByteReader &in, std::size_t &offset, std::size_t end)
+  {
+    std::uint32_t value = 0;
+    for (int i = 0; i < 4 && offset < end; i++)
+    {
+      unsigned int byte = in.u8(offset++);
+      value = (value << 7) | (byte & 0x7F);
+      if (!(byte & 0x80))
+        break;
+    }
+    return value;
+  }
+
+  struct TickEvent
+  {
+    std::uint64_t tick;
+    std::uint32_t tempo; // microseconds per quarter note, 0 unless a tempo change
+    MidiEvent event;
+  };
+
+  static void readTrack(const ByteReader &in, std::size_t offset, std::size_t end, std::uint64_t tick, std::vector<TickEvent> &out, std::uint64_t &lastTick)
+  {
+    unsigned int running = 0;
+    while (offset < end)
+    {
+      tick += readVariable(in, offset, end);
+      unsigned int status = in.u8(offset);
+      if (status & 0x80)
+        offset++;
+      else if (running)
+        status = running; // running status: the byte read is already data
+      else
+        break;
+      if (status == 0xFF)
+      {
+        unsigned int type = in.u8(offset++);
+        std::uint32_t length = readVariable(in, offset, end);
+        if (type == 0x51 && length == 3)
+          out.push_back({tick, (in.u8(offset) << 16) | (in.u8(offset + 1) << 8) | in.u8(offset + 2), {0, 0, 0, 0}});
+        offset += length;
+        if (type == 0x2F)
+          break;
+        continue;
+      }
+      if (status == 0xF0 || status == 0xF7)
+      {
+        offset += readVariable(in, offset, end);
+        continue;
+      }
+      if (status >= 0xF0)
+        break; // system common messages do not belong in a file
+      running = status;
+      unsigned int data1 = in.u8(offset++) & 0x7F;
+      unsigned int data2 = 0;
+      if ((status & 0xE0) != 0xC0) // program change and channel pressure carry one byte
+        data2 = in.u8(offset++) & 0x7F;
+      out.push_back({tick, 0, {0, static_cast<std::uint8_t>(status), static_cast<std::uint8_t>(data1), static_cast<std::uint8_t>(data2)}});
+    }
+    lastTick = std::max(lastTick, tick);
+  }
+
+public:
+  // Bank used for every MIDI file; set from --soundfont=
+  inline static std::string soundFontPath = "soundfont.sf2";
+
+  bool open(const std::string &path)
+  {
+    MappedFile file;
+    if (!file.open(path))
+      return false;
+    ByteReader in(file.data(), file.size());
+    if (in.text(0, 4) != "MThd")
+      return false;
+    unsigned int format = in.be16(8), trackCount = in.be16(10), division = in.be16(12);
+    if (division == 0)
+      return false;
+    std::vector<TickEvent> timeline;
+    std::uint64_t lastTick = 0;
+    std::size_t offset = 8 + ((static_cast<std::size_t>(in.be16(4)) << 16) | in.be16(6));
+    for (unsigned int track = 0; track < trackCount && in.has(offset, 8); track++)
+    {
+      std::size_t length = (static_cast<std::size_t>(in.be16(offset + 4)) << 16) | in.be16(offset + 6);
+      if (in.text(offset, 4) == "MTrk")
+        // Format 2 tracks are independent songs played one after another
+        readTrack(in, offset + 8, std::min(in.size(), offset + 8 + length), format == 2 ? lastTick : 0, timeline, lastTick);
+      offset += 8 + length;
+    }
+    std::stable_sort(timeline.begin(), timeline.end(), [](const TickEvent &a, const TickEvent &b)
+                     { return a.tick < b.tick; });
+
+    // Ticks to frames. SMPTE divisions have a fixed tick length; otherwise
+    // it follows the tempo map
+    double secondsPerTick = 0.5 / division;
+    bool smpte = division & 0x8000;
+    if (smpte)
+    {
+      int framesPerSecond = -static_cast<std::int8_t>(division >> 8);
+      secondsPerTick = 1.0 / ((framesPerSecond == 29 ? 29.97 : framesPerSecond) * std::max(1u, division & 0xFF));
+    }
+    double seconds = 0;
+    std::uint64_t tick = 0;
+    for (const TickEvent &entry : timeline)
+    {
+      seconds += (entry.tick - tick) * secondsPerTick;
+      tick = entry.tick;
+      if (entry.event.status == 0)
+      {
+        if (!smpte)
+          secondsPerTick = entry.tempo / 1e6 / division;
+        continue;
+      }
+      events.push_back(entry.event);
+      events.back().frame = static_cast<std::uint64_t>(std::llround(seconds * Rate));
+    }
+    seconds += (lastTick - tick) * secondsPerTick;
+    if (events.empty())
+      return false;
+
+    auto font = loadSoundFont(soundFontPath);
+    if (!font)
+      return false;
+    synth = std::make_unique<MidiSynth>(font, Rate);
+    frameCount = std::max(events.back().frame, static_cast<std::uint64_t>(std::llround(seconds * Rate))) + TailFrames;
+    std::cout << "[DEBUG] MIDI file " << path << ": format " << format << ", " << trackCount << " tracks, "
+              << events.size() << " events, " << frameCount / Rate << " s" << std::endl;
+    return true;
+  }
+
+  unsigned int getChannelCount() const override { return 2; }
+  unsigned int getSampleRate() const override { return Rate; }
+  sf::Uint64 getSampleCount() const override { return frameCount * 2; }
+  unsigned int getBitDepth() const override { return 24; }
+
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    std::size_t frames = static_cast<std::size_t>(std::min(maxCount / 2, frameCount - position));
+    std::fill(samples, samples + frames * 2, 0.0f);
+    std::size_t done = 0;
+    while (done < frames)
+    {
+      while (nextEvent < events.size() && events[nextEvent].frame <= position)
+        synth->handle(events[nextEvent++]);
+      std::size_t span = frames - done;
+      if (nextEvent < events.size())
+        span = static_cast<std::size_t>(std::min<std::uint64_t>(span, events[nextEvent].frame - position));
+      synth->render(samples + done * 2, span);
+      done += span;
+      position += span;
+    }
+    return frames * 2;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override
+  {
+    position = std::min(sampleOffset / 2, frameCount);
+    synth->reset();
+    for (nextEvent = 0; nextEvent < events.size() && events[nextEvent].frame < position; nextEvent++)
+      synth->handle(events[nextEvent], false);
+  }
+};
+
+std::unique_ptr<AudioDecoder> openDecoder(const std::string &path)
+{
+  std::string extension = std::filesystem::path(path).extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  if (extension == ".wav" || extension == ".wave" || extension == ".aif" || extension == ".aiff" || extension == ".aifc")
+  {
+    auto pcm = std::make_unique<PcmFileDecoder>();
+    if (pcm->open(path))
+      return pcm;
+  }
+  if (extension == ".mod" || extension == ".xm" || extension == ".s3m" || extension == ".it")
+  {
+    auto module = std::make_unique<ModuleDecoder>();
+    return module->open(path) ? std::move(module) : nullptr;
+  }
+  if (extension == ".mid" || extension == ".midi")
+  {
+    auto midi = std::make_unique<MidiDecoder>();
+    return midi->open(path) ? std::move(midi) : nullptr;
+  }
+  auto decoder = std::make_unique<SoundFileDecoder>();
+  if (!decoder->open(path))
+    return nullptr;
+  return decoder;
+}
+
+class AudioEffect
+{
+public:
+  // Processes interleaved samples in place.
+  virtual void process(float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate) = 0;
+  // False while the effect passes samples through untouched
+  virtual bool isActive() const { return true; }
+  // Called off the audio thread before a stream of this format plays, for
+  // effects whose setup is too slow for the audio callback
+  virtual void prepare(unsigned int, unsigned int) {}
+  virtual ~AudioEffect() {}
+};
+
+// Sees the final samples after every effect has run, without changing them.
+// `firstSample` is where the block starts in the track, in interleaved
+// samples; it jumps on a seek or when a new track starts.
+class AudioTap
+{
+public:
+  virtual void consume(const float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate, sf::Uint64 firstSample) = 0;
+  virtual ~AudioTap() {}
+};
+
+// Effects run in order on everything that is played, then taps observe the
+// result. The UI thread edits the chain while an audio thread is pulling
+// through it, hence the lock.
+class EffectChain
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<AudioEffect>> effects;
+  std::vector<std::shared_ptr<AudioTap>> taps;
+
+public:
+  void add(std::shared_ptr<AudioEffect> effect)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    effects.push_back(std::move(effect));
+  }
+  void addTap(std::shared_ptr<AudioTap> tap)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    taps.push_back(std::move(tap));
+  }
+  bool hasEffects()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &effect : effects)
+    {
+      if (effect->isActive())
+        return true;
+    }
+    return false;
+  }
+  bool hasTaps()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !taps.empty();
+  }
+  // Off the audio thread; the effects are set up outside the lock, so the
+  // audio thread keeps running meanwhile
+  void prepare(unsigned int channelCount, unsigned int sampleRate)
+  {
+    std::vector<std::shared_ptr<AudioEffect>> all;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      all = effects;
+    }
+    for (auto &effect : all)
+      effect->prepare(channelCount, sampleRate);
+  }
+  void process(float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate, sf::Uint64 firstSample)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &effect : effects)
+      effect->process(samples, count, channelCount, sampleRate);
+    for (auto &tap : taps)
+      tap->consume(samples, count, channelCount, sampleRate, firstSample);
+  }
+  // Feeds the taps alone, for samples that bypassed the effects
+  void observe(const float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate, sf::Uint64 firstSample)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &tap : taps)
+      tap->consume(samples, count, channelCount, sampleRate, firstSample);
+  }
+};
+
+// A named block of memory other processes can map (POSIX shm / Win32 file mapping).
+class SharedMemory
+{
+  std::string name;
+  void *address = nullptr;
+  std::size_t size = 0;
+#ifdef _WIN32
+  HANDLE mapping = nullptr;
+#endif
+
+public:
+  SharedMemory() {}
+  SharedMemory(const SharedMemory &) = delete;
+  SharedMemory &operator=(const SharedMemory &) = delete;
+  ~SharedMemory() { close(); }
+
+  bool create(const std::string &n, std::size_t bytes)
+  {
+    close();
+#ifdef _WIN32
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(bytes), ("Local\\" + n).c_str());
+    if (!mapping)
+      return false;
+    address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+    if (!address)
+    {
+      CloseHandle(mapping);
+      mapping = nullptr;
+      return false;
+    }
+#else
+    int fd = shm_open(("/" + n).c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+      return false;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+    {
+      ::close(fd);
+      shm_unlink(("/" + n).c_str());
+      return false;
+    }
+    address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+      address = nullptr;
+      shm_unlink(("/" + n).c_str());
+      return false;
+    }
+#endif
+    name = n;
+    size = bytes;
+    std::memset(address, 0, bytes);
+    return true;
+  }
+
+  void close()
+  {
+    if (!address)
+      return;
+#ifdef _WIN32
+    UnmapViewOfFile(address);
+    CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    munmap(address, size);
+    shm_unlink(("/" + name).c_str());
+#endif
+    address = nullptr;
+  }
+
+  void *data() const { return address; }
+};
+
+// Publishes the post-effect samples in shared memory for external meters and
+// visualisers. The writer never waits: readers attach by mapping the region
+// and copy out whatever is still in the ring.
+//
+// Layout: PcmTapHeader, then blockCapacity PcmTapBlock entries, then
+// `capacity` float samples in [-1, 1]. Sample n of the stream lives at ring
+// index n % capacity. To read, load writeSample, copy the wanted range, then
+// load writeSample again; anything older than the new writeSample - capacity
+// was overwritten while copying and must be dropped. Each block records the
+// format and the steady-clock time (CLOCK_MONOTONIC on Linux) at which its
+// first sample reaches the speaker. Blocks are written when they are decoded,
+// which is up to a few seconds earlier; the player keeps the estimate on
+// track through setHeard(). A block's `sequence` is zero while it is being
+// rewritten, so readers compare it before and after copying the entry.
+struct PcmTapHeader
+{
+  char magic[8]; // "MPPCMTAP"
+  std::uint32_t version;
+  std::uint32_t capacity;
+  std::uint32_t blockCapacity;
+  std::uint32_t reserved;
+  std::atomic<std::uint64_t> writeSample; // samples ever written
+  std::atomic<std::uint64_t> sequence;    // blocks ever written
+};
+
+struct PcmTapBlock
+{
+  std::atomic<std::uint64_t> sequence; // 1-based block number, 0 while being written
+  std::uint64_t firstSample;
+  std::uint64_t timestampNs; // when firstSample is heard
+  std::uint32_t sampleCount;
+  std::uint32_t channelCount;
+  std::uint32_t sampleRate;
+  std::uint32_t reserved;
+};
+
+class SharedMemoryTap : public AudioTap
+{
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "PCM tap needs lock-free 64-bit atomics");
+
+  SharedMemory memory;
+  PcmTapHeader *header = nullptr;
+  PcmTapBlock *blocks = nullptr;
+  float *ring = nullptr;
+  std::uint32_t capacity;
+  std::uint32_t blockCapacity;
+
+  // Track position heard at a moment, from the player's clock. A jump in the
+  // track (a seek or a new track) restarts it at the block being written.
+  struct Clock
+  {
+    double seconds = 0;
+    std::chrono::steady_clock::time_point at;
+  };
+  std::mutex clockMutex;
+  Clock heard;
+  bool heardKnown = false;
+  Clock clock;                    // the audio thread's copy
+  sf::Uint64 nextTrackSample = 0; // where the last block ended in the track
+
+public:
+  SharedMemoryTap(std::uint32_t samples = 1 << 20, std::uint32_t blockCount = 1024)
+      : capacity(samples), blockCapacity(blockCount) {}
+
+  bool open(const std::string &name)
+  {
+    std::size_t bytes = sizeof(PcmTapHeader) + blockCapacity * sizeof(PcmTapBlock) + capacity * sizeof(float);
+    if (!memory.create(name, bytes))
+      return false;
+    char *base = static_cast<char *>(memory.data());
+    header = new (base) PcmTapHeader();
+    blocks = reinterpret_cast<PcmTapBlock *>(base + sizeof(PcmTapHeader));
+    for (std::uint32_t i = 0; i < blockCapacity; i++)
+      new (&blocks[i]) PcmTapBlock();
+    ring = reinterpret_cast<float *>(blocks + blockCapacity);
+    header->version = 1;
+    header->capacity = capacity;
+    header->blockCapacity = blockCapacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, "MPPCMTAP", 8);
+    return true;
+  }
+
+  // Called from the UI thread with the track position being heard right now
+  // (the playing offset less the device latency)
+  void setHeard(double seconds)
+  {
+    std::lock_guard<std::mutex> lock(clockMutex);
+    heard = {seconds, std::chrono::steady_clock::now()};
+    heardKnown = true;
+  }
+
+  void consume(const float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate, sf::Uint64 firstSample) override
+  {
+    if (!header || count == 0)
+      return;
+    double trackSeconds = static_cast<double>(firstSample / channelCount) / sampleRate;
+    bool jumped = firstSample != nextTrackSample;
+    nextTrackSample = firstSample + count;
+    // Never waits on the UI thread: if it holds the lock, the last copy will do
+    if (clockMutex.try_lock())
+    {
+      if (jumped || !heardKnown)
+      {
+        heard = {trackSeconds, std::chrono::steady_clock::now()};
+        heardKnown = true;
+      }
+      clock = heard;
+      clockMutex.unlock();
+    }
+    else if (jumped)
+    {
+      clock = {trackSeconds, std::chrono::steady_clock::now()};
+    }
+    auto heardAt = clock.at + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(trackSeconds - clock.seconds));
+
+    std::uint64_t first = header->writeSample.load(std::memory_order_relaxed);
+    std::size_t start = static_cast<std::size_t>(first % capacity);
+    std::size_t head = std::min(count, capacity - start);
+    std::memcpy(ring + start, samples, head * sizeof(float));
+    std::memcpy(ring, samples + head, (count - head) * sizeof(float));
+
+    std::uint64_t number = header->sequence.load(std::memory_order_relaxed) + 1;
+    PcmTapBlock &block = blocks[(number - 1) % blockCapacity];
+    block.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    block.firstSample = first;
+    block.timestampNs = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(heardAt.time_since_epoch()).count());
+    block.sampleCount = static_cast<std::uint32_t>(count);
+    block.channelCount = channelCount;
+    block.sampleRate = sampleRate;
+    block.sequence.store(number, std::memory_order_release);
+
+    header->writeSample.store(first + count, std::memory_order_release);
+    header->sequence.store(number, std::memory_order_release);
+  }
+};
+
+// A decoder followed by the effect chain. Every output, live or offline,
+// pulls its samples through one of these: devices take the 16-bit read(),
+// the offline renderer keeps working in float with readFloat().
+class PlaybackSource
+{
+  std::unique_ptr<AudioDecoder> decoder;
+  std::shared_ptr<EffectChain> effects;
+  std::vector<float> scratch;
+  DitherQuantizer quantizer;
+  sf::Uint64 position = 0; // next sample the decoder returns
+
+public:
+  PlaybackSource(std::unique_ptr<AudioDecoder> d, std::shared_ptr<EffectChain> e)
+      : decoder(std::move(d)), effects(std::move(e))
+  {
+    if (effects)
+      effects->prepare(getChannelCount(), getSampleRate());
+  }
+  unsigned int getChannelCount() const { return decoder->getChannelCount(); }
+  unsigned int getSampleRate() const { return decoder->getSampleRate(); }
+  sf::Uint64 getSampleCount() const { return decoder->getSampleCount(); }
+  sf::Time getDuration() const { return sf::seconds(static_cast<float>(static_cast<double>(getSampleCount()) / getChannelCount() / getSampleRate())); }
+  // Dither is only needed once the samples carry more than 16 bits of information
+  bool needsDither() const { return decoder->getBitDepth() > 16 || (effects && effects->hasEffects()); }
+  sf::Uint64 readFloat(float *samples, sf::Uint64 maxCount)
+  {
+    sf::Uint64 count = decoder->read(samples, maxCount);
+    if (effects && count > 0)
+      effects->process(samples, static_cast<std::size_t>(count), getChannelCount(), getSampleRate(), position);
+    position += count;
+    return count;
+  }
+  sf::Uint64 read(sf::Int16 *samples, sf::Uint64 maxCount)
+  {
+    scratch.resize(static_cast<std::size_t>(maxCount));
+    bool dither = needsDither();
+    sf::Uint64 count = readFloat(scratch.data(), maxCount);
+    quantizer.process(scratch.data(), samples, static_cast<std::size_t>(count), dither);
+    return count;
+  }
+  // Passthrough: with nothing to process, native 16-bit PCM goes to the device
+  // straight from the decoder's storage. Returns null when the samples need
+  // work; use read() then.
+  const sf::Int16 *readDirect(sf::Uint64 maxCount, sf::Uint64 &count)
+  {
+    if (effects && effects->hasEffects())
+      return nullptr;
+    const sf::Int16 *direct = decoder->readDirect(maxCount, count);
+    if (direct && effects && effects->hasTaps())
+    {
+      scratch.resize(static_cast<std::size_t>(count));
+      convertToFloat(direct, scratch.data(), scratch.size());
+      effects->observe(scratch.data(), scratch.size(), getChannelCount(), getSampleRate(), position);
+    }
+    if (direct)
+      position += count;
+    return direct;
+  }
+  void seek(sf::Uint64 sampleOffset)
+  {
+    decoder->seek(sampleOffset);
+    position = sampleOffset;
+  }
+};
+
+struct EqBand
+{
+  enum Type
+  {
+    LowShelf,
+    Peak,
+    HighShelf
+  };
+  Type type;
+  float frequency; // Hz
+  float gain;      // dB
+  float q;
+};
+
+// Low shelf, ten peaking bands and a high shelf, run as a cascade of
+// biquads in double precision. Each SSE2 register holds one channel pair,
+// so a stereo frame goes through a section in a single pass. Parameter
+// changes from the UI are picked up without blocking the audio thread and
+// the coefficients glide to their new values over a few milliseconds, so
+// dragging a band does not click.
+class ParametricEq : public AudioEffect
+{
+public:
+  static const int BandCount = 12;
+  typedef std::array<EqBand, BandCount> Bands;
+
+  static Bands defaultBands()
+  {
+    Bands bands;
+    const float centres[10] = {31.5f, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 16000};
+    bands[0] = {EqBand::LowShelf, 80, 0, 0.707f};
+    for (int i = 0; i < 10; i++)
+      bands[i + 1] = {EqBand::Peak, centres[i], 0, 1.41f};
+    bands[BandCount - 1] = {EqBand::HighShelf, 12000, 0, 0.707f};
+    return bands;
+  }
+
+  // RBJ audio EQ cookbook; c = {b0, b1, b2, a1, a2} normalised by a0.
+  // Parameters are clamped to what gives a stable filter at this rate, so
+  // a band set for 48 kHz still works on a 22 kHz track.
+  static void design(const EqBand &band, double sampleRate, double c[5])
+  {
+    double frequency = std::max(1.0, std::min<double>(band.frequency, sampleRate * 0.45));
+    double q = std::max(0.05, std::min<double>(band.q, 50));
+    double A = std::pow(10.0, std::max(-30.0, std::min<double>(band.gain, 30)) / 40.0);
+    double w0 = 2 * 3.14159265358979323846 * frequency / sampleRate;
+    double cosw = std::cos(w0);
+    double alpha = std::sin(w0) / (2 * q);
+    double b0, b1, b2, a0, a1, a2;
+    if (band.type == EqBand::Peak)
+    {
+      b0 = 1 + alpha * A;
+      b1 = -2 * cosw;
+      b2 = 1 - alpha * A;
+      a0 = 1 + alpha / A;
+      a1 = -2 * cosw;
+      a2 = 1 - alpha / A;
+    }
+    else
+    {
+      double s = band.type == EqBand::LowShelf ? 1 : -1; // the high shelf mirrors the low one
+      double root = 2 * std::sqrt(A) * alpha;
+      b0 = A * ((A + 1) - s * (A - 1) * cosw + root);
+      b1 = s * 2 * A * ((A - 1) - s * (A + 1) * cosw);
+      b2 = A * ((A + 1) - s * (A - 1) * cosw - root);
+      a0 = (A + 1) + s * (A - 1) * cosw + root;
+      a1 = -s * 2 * ((A - 1) + s * (A + 1) * cosw);
+      a2 = (A + 1) + s * (A - 1) * cosw - root;
+    }
+    c[0] = b0 / a0;
+    c[1] = b1 / a0;
+    c[2] = b2 / a0;
+    c[3] = a1 / a0;
+    c[4] = a2 / a0;
+  }
+
+  // Combined gain of the cascade at one frequency, for drawing the curve.
+  static double responseDb(const Bands &bands, double frequency, double sampleRate)
+  {
+    double w = 2 * 3.14159265358979323846 * frequency / sampleRate;
+    std::complex<double> z1 = std::polar(1.0, -w), z2 = std::polar(1.0, -2 * w);
+    double db = 0;
+    for (const EqBand &band : bands)
+    {
+      if (band.gain == 0)
+        continue;
+      double c[5];
+      design(band, sampleRate, c);
+      std::complex<double> h = (c[0] + c[1] * z1 + c[2] * z2) / (1.0 + c[3] * z1 + c[4] * z2);
+      db += 20 * std::log10(std::abs(h));
+    }
+    return db;
+  }
+
+  ParametricEq() : pendingBands(defaultBands()), bands(defaultBands()) {}
+
+  // UI thread
+  void setBands(const Bands &b)
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pendingBands = b;
+    changed = true;
+  }
+  Bands getBands()
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    return pendingBands;
+  }
+
+  bool isActive() const override { return active.load(); }
+
+  void process(float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate) override
+  {
+    if (changed.load() && pendingMutex.try_lock())
+    {
+      bands = pendingBands;
+      changed = false;
+      pendingMutex.unlock();
+      retarget(sampleRate, false);
+    }
+    if (sampleRate != currentRate || channelCount != channels)
+    {
+      channels = std::min(channelCount, MaxChannels);
+      retarget(sampleRate, true);
+    }
+    if (!active.load())
+      return;
+
+    std::size_t frames = count / channelCount;
+    unsigned int pairs = (channels + 1) / 2;
+    work.resize(pairs * frames * 2);
+    for (unsigned int p = 0; p < pairs; p++)
+    {
+      double *lane = &work[p * frames * 2];
+      for (std::size_t f = 0; f < frames; f++)
+      {
+        lane[f * 2] = samples[f * channelCount + p * 2];
+        lane[f * 2 + 1] = p * 2 + 1 < channels ? samples[f * channelCount + p * 2 + 1] : 0.0;
+      }
+    }
+    for (std::size_t start = 0; start < frames; start += SmoothingFrames)
+    {
+      std::size_t end = std::min(frames, start + SmoothingFrames);
+      glide();
+      for (int s = 0; s < BandCount; s++)
+      {
+        if (!sectionActive[s])
+          continue;
+        for (unsigned int p = 0; p < pairs; p++)
+          runSection(s, p, &work[p * frames * 2], start, end);
+      }
+    }
+    for (unsigned int p = 0; p < pairs; p++)
+    {
+      const double *lane = &work[p * frames * 2];
+      for (std::size_t f = 0; f < frames; f++)
+      {
+        samples[f * channelCount + p * 2] = static_cast<float>(lane[f * 2]);
+        if (p * 2 + 1 < channels)
+          samples[f * channelCount + p * 2 + 1] = static_cast<float>(lane[f * 2 + 1]);
+      }
+    }
+    updateActive();
+  }
+
+private:
+  static const unsigned int MaxChannels = 8;
+  static const std::size_t SmoothingFrames = 32;
+
+  void retarget(unsigned int sampleRate, bool snap)
+  {
+    currentRate = sampleRate;
+    for (int s = 0; s < BandCount; s++)
+    {
+      design(bands[s], sampleRate, target[s]);
+      bool flat = bands[s].gain == 0;
+      if (!sectionActive[s] && !flat)
+      {
+        // Starting from silence: no history to glide from
+        std::fill(std::begin(state[s]), std::end(state[s]), 0.0);
+        snapSection(s);
+      }
+      if (snap)
+      {
+        snapSection(s);
+        std::fill(std::begin(state[s]), std::end(state[s]), 0.0);
+      }
+      sectionActive[s] = sectionActive[s] || !flat;
+    }
+    updateActive();
+  }
+
+  void snapSection(int s) { std::copy(std::begin(target[s]), std::end(target[s]), std::begin(coeffs[s])); }
+
+  // One-pole glide of every coefficient towards its target, once per 32 frames
+  void glide()
+  {
+    for (int s = 0; s < BandCount; s++)
+    {
+      if (!sectionActive[s])
+        continue;
+      double distance = 0;
+      for (int k = 0; k < 5; k++)
+      {
+        coeffs[s][k] += (target[s][k] - coeffs[s][k]) * 0.15;
+        distance = std::max(distance, std::abs(target[s][k] - coeffs[s][k]));
+      }
+      if (distance < 1e-9)
+        snapSection(s);
+    }
+  }
+
+  // A section whose target is flat drops out once it has glided there
+  void updateActive()
+  {
+    bool any = false;
+    for (int s = 0; s < BandCount; s++)
+    {
+      if (sectionActive[s] && bands[s].gain == 0 && std::equal(std::begin(coeffs[s]), std::end(coeffs[s]), std::begin(target[s])))
+        sectionActive[s] = false;
+      any = any || sectionActive[s];
+    }
+    active = any;
+  }
+
+  // Transposed direct form II over frames [start, end) of one channel pair
+  void runSection(int s, unsigned int pair, double *lane, std::size_t start, std::size_t end)
+  {
+    double *z = &state[s][pair * 4]; // z1 left/right, z2 left/right
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128d b0 = _mm_set1_pd(coeffs[s][0]), b1 = _mm_set1_pd(coeffs[s][1]), b2 = _mm_set1_pd(coeffs[s][2]);
+    const __m128d a1 = _mm_set1_pd(coeffs[s][3]), a2 = _mm_set1_pd(coeffs[s][4]);
+    __m128d z1 = _mm_loadu_pd(z), z2 = _mm_loadu_pd(z + 2);
+    for (std::size_t f = start; f < end; f++)
+    {
+      __m128d x = _mm_loadu_pd(lane + f * 2);
+      __m128d y = _mm_add_pd(_mm_mul_pd(b0, x), z1);
+      z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, x), _mm_mul_pd(a1, y)), z2);
+      z2 = _mm_sub_pd(_mm_mul_pd(b2, x), _mm_mul_pd(a2, y));
+      _mm_storeu_pd(lane + f * 2, y);
+    }
+    _mm_storeu_pd(z, z1);
+    _mm_storeu_pd(z + 2, z2);
+#else
+    const double *c = coeffs[s];
+    for (std::size_t f = start; f < end; f++)
+    {
+      for (int ch = 0; ch < 2; ch++)
+      {
+        double x = lane[f * 2 + ch];
+        double y = c[0] * x + z[ch];
+        z[ch] = c[1] * x - c[3] * y + z[ch + 2];
+        z[ch + 2] = c[2] * x - c[4] * y;
+        lane[f * 2 + ch] = y;
+      }
+    }
+#endif
+  }
+
+  std::mutex pendingMutex;
+  Bands pendingBands;
+  std::atomic<bool> changed{true};
+  std::atomic<bool> active{false};
+
+  // Audio thread only
+  Bands bands;
+  unsigned int currentRate = 0;
+  unsigned int channels = 0;
+  double target[BandCount][5] = {};
+  double coeffs[BandCount][5] = {};
+  double state[BandCount][MaxChannels * 2] = {};
+  bool sectionActive[BandCount] = {};
+  std::vector<double> work;
+};
+
+// Named gain settings for the twelve bands, in the order of defaultBands().
+struct EqPreset
+{
+  const char *name;
+  float gains[ParametricEq::BandCount];
+};
+
+const EqPreset eqPresets[] = {
+    {"Flat", {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"Bass Boost", {6, 3, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0}},
+    {"Treble Boost", {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 2, 6}},
+    {"Vocal", {0, 0, -2, -1, -2, 0, 2, 3, 2, 0, 0, 0}},
+    {"Loudness", {4, 1, 0, 0, 0, 0, -1, 0, 0, 0, 0, 3}},
+};
+
+ParametricEq::Bands eqPresetBands(const EqPreset &preset)
+{
+  ParametricEq::Bands bands = ParametricEq::defaultBands();
+  for (int i = 0; i < ParametricEq::BandCount; i++)
+    bands[i].gain = preset.gains[i];
+  return bands;
+}
+
+// A preset file has one "frequency gain q" line per band. Presets with a
+// band no filter can be designed for (q or frequency not above zero, or
+// anything not a number) are rejected.
+bool loadEqBands(const std::string &path, ParametricEq::Bands &bands)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  ParametricEq::Bands loaded = ParametricEq::defaultBands();
+  for (EqBand &band : loaded)
+  {
+    if (!(file >> band.frequency >> band.gain >> band.q))
+      return false;
+    if (!std::isfinite(band.frequency) || !std::isfinite(band.gain) || !std::isfinite(band.q) || band.frequency <= 0 || band.q <= 0)
+    {
+      std::cout << "[ERROR] EQ preset " << path << " has an invalid band; ignored.\n";
+      return false;
+    }
+  }
+  bands = loaded;
+  return true;
+}
+
+void saveEqBands(const std::string &path, const ParametricEq::Bands &bands)
+{
+  std::ofstream file(path);
+  for (const EqBand &band : bands)
+    file << band.frequency << " " << band.gain << " " << band.q << "\n";
+}
+
+// Equalizer editor on the settings page: a log-frequency response graph with
+// a handle per band (drag to move frequency and gain, scroll to change Q)
+// and a column of preset buttons. "Save Mine" stores the current curve for
+// the logged-in user; "Mine" brings it back.
+class EqualizerPanel
+{
+  sf::RenderWindow &window;
+  sf::Font &font;
+  std::shared_ptr<ParametricEq> equalizer;
+  std::string userPresetPath;
+  ParametricEq::Bands bands;
+  std::string presetName = "Flat";
+  sf::FloatRect graph{220, 130, 560, 160};
+  int dragging = -1;
+  static constexpr float MaxGain = 15.0f;
+  static constexpr float MinFrequency = 20.0f;
+  static constexpr float MaxFrequency = 20000.0f;
+
+  float frequencyToX(float frequency) const
+  {
+    return graph.left + graph.width * std::log(frequency / MinFrequency) / std::log(MaxFrequency / MinFrequency);
+  }
+  float xToFrequency(float x) const
+  {
+    float t = std::max(0.0f, std::min(1.0f, (x - graph.left) / graph.width));
+    return MinFrequency * std::pow(MaxFrequency / MinFrequency, t);
+  }
+  float gainToY(float gain) const { return graph.top + graph.height * (0.5f - gain / (2 * MaxGain)); }
+  float yToGain(float y) const
+  {
+    float gain = (0.5f - (y - graph.top) / graph.height) * 2 * MaxGain;
+    return std::round(std::max(-MaxGain, std::min(MaxGain, gain)) * 2) / 2; // half-dB steps
+  }
+
+  int numPresetButtons() const { return static_cast<int>(sizeof(eqPresets) / sizeof(eqPresets[0])) + 2; }
+  sf::FloatRect presetButton(int i) const { return sf::FloatRect(800, 130 + i * 28, 170, 24); }
+
+  int bandAt(sf::Vector2i mouse) const
+  {
+    for (int i = 0; i < ParametricEq::BandCount; i++)
+    {
+      float dx = mouse.x - frequencyToX(bands[i].frequency);
+      float dy = mouse.y - gainToY(bands[i].gain);
+      if (dx * dx + dy * dy <= 64)
+        return i;
+    }
+    return -1;
+  }
+
+  void apply(const ParametricEq::Bands &b, const std::string &name)
+  {
+    bands = b;
+    presetName = name;
+    equalizer->setBands(bands);
+  }
+
+public:
+  EqualizerPanel(sf::RenderWindow &win, sf::Font &f, std::shared_ptr<ParametricEq> eq, const std::string &username)
+      : window(win), font(f), equalizer(std::move(eq)), userPresetPath("eq_" + username + ".txt")
+  {
+    bands = equalizer->getBands();
+    ParametricEq::Bands saved;
+    if (loadEqBands(userPresetPath, saved))
+      apply(saved, "Mine");
+  }
+
+  void handleEvent(const sf::Event &event)
+  {
+    sf::Vector2i mouse = sf::Mouse::getPosition(window);
+    if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
+    {
+      dragging = bandAt(mouse);
+      for (int i = 0; i < numPresetButtons(); i++)
+      {
+        if (!presetButton(i).contains(mouse.x, mouse.y))
+          continue;
+        int builtIn = numPresetButtons() - 2;
+        if (i < builtIn)
+        {
+          apply(eqPresetBands(eqPresets[i]), eqPresets[i].name);
+        }
+        else if (i == builtIn)
+        {
+          ParametricEq::Bands saved;
+          if (loadEqBands(userPresetPath, saved))
+            apply(saved, "Mine");
+        }
+        else
+        {
+          saveEqBands(userPresetPath, bands);
+          presetName = "Mine";
+        }
+      }
+    }
+    else if (event.type == sf::Event::MouseButtonReleased)
+    {
+      dragging = -1;
+    }
+    else if (event.type == sf::Event::MouseMoved && dragging >= 0)
+    {
+      bands[dragging].frequency = xToFrequency(static_cast<float>(mouse.x));
+      bands[dragging].gain = yToGain(static_cast<float>(mouse.y));
+      apply(bands, "Custom");
+    }
+    else if (event.type == sf::Event::MouseWheelScrolled)
+    {
+      int band = bandAt(mouse);
+      if (band >= 0)
+      {
+        bands[band].q = std::max(0.1f, std::min(10.0f, bands[band].q * std::pow(1.15f, event.mouseWheelScroll.delta)));
+        apply(bands, "Custom");
+      }
+    }
+  }
+
+  void draw()
+  {
+    sf::RectangleShape background(sf::Vector2f(graph.width, graph.height));
+    background.setPosition(graph.left, graph.top);
+    background.setFillColor(sf::Color(40, 40, 40, 220));
+    window.draw(background);
+
+    sf::RectangleShape zeroLine(sf::Vector2f(graph.width, 1));
+    zeroLine.setPosition(graph.left, gainToY(0));
+    zeroLine.setFillColor(sf::Color(100, 100, 100));
+    window.draw(zeroLine);
+
+    sf::VertexArray curve(sf::LineStrip, static_cast<std::size_t>(graph.width / 2));
+    for (std::size_t i = 0; i < curve.getVertexCount(); i++)
+    {
+      float x = graph.left + i * 2.0f;
+      float gain = static_cast<float>(ParametricEq::responseDb(bands, xToFrequency(x), 48000));
+      curve[i].position = sf::Vector2f(x, gainToY(std::max(-MaxGain, std::min(MaxGain, gain))));
+      curve[i].color = sf::Color(34, 197, 94);
+    }
+    window.draw(curve);
+
+    for (int i = 0; i < ParametricEq::BandCount; i++)
+    {
+      sf::CircleShape handle(6);
+      handle.setOrigin(6, 6);
+      handle.setPosition(frequencyToX(bands[i].frequency), gainToY(bands[i].gain));
+      handle.setFillColor(i == dragging ? sf::Color(255, 215, 0) : sf::Color(120, 120, 200));
+      window.draw(handle);
+    }
+
+    sf::Text label;
+    label.setFont(font);
+    label.setCharacterSize(16);
+    label.setFillColor(sf::Color::White);
+    label.setPosition(graph.left, graph.top + graph.height + 4);
+    label.setString("EQ: " + presetName + "   (drag bands, scroll to change width)");
+    window.draw(label);
+
+    for (int i = 0; i < numPresetButtons(); i++)
+    {
+      sf::FloatRect bounds = presetButton(i);
+      sf::RectangleShape button(sf::Vector2f(bounds.width, bounds.height));
+      button.setPosition(bounds.left, bounds.top);
+      button.setFillColor(sf::Color(70, 70, 70));
+      window.draw(button);
+      int builtIn = numPresetButtons() - 2;
+      label.setString(i < builtIn ? eqPresets[i].name : (i == builtIn ? "Mine" : "Save Mine"));
+      label.setPosition(bounds.left + 8, bounds.top + 2);
+      window.draw(label);
+    }
+  }
+};
+
+// Opt-in real-time treatment for the threads that feed the audio device:
+// SCHED_FIFO (or rtkit when we lack the privilege), an optional CPU pin and
+// locked sample buffers. An audio thread only reports itself; a helper
+// thread of this class does the slow part (system calls, D-Bus) by thread
+// id, so nothing here ever runs inside the audio callback. Every step falls
+// back quietly, refusals are remembered for the next thread, and the mode
+// that actually took effect is kept for the settings view.
+class RealtimeAudio
+{
+public:
+  struct Settings
+  {
+    int priority = 70; // SCHED_FIFO priority; rtkit clamps to its own maximum
+    int core = -1;     // CPU to pin to, -1 leaves the affinity alone
+  };
+
+  explicit RealtimeAudio(const Settings &s) : settings(s), worker(&RealtimeAudio::run, this) {}
+
+  ~RealtimeAudio()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+#ifdef MUSIC_PLAYER_HAS_SD_BUS
+    if (bus)
+      sd_bus_unref(bus);
+#endif
+  }
+
+  // Called on the audio thread itself, once. Never waits: returns false
+  // when the helper is busy, and the caller simply tries again next time.
+  bool requestPromotion()
+  {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return false;
+#ifdef _WIN32
+    pending.push_back(GetCurrentThreadId());
+#else
+    pending.push_back(static_cast<long>(syscall(SYS_gettid)));
+#endif
+    wake.notify_one();
+    return true;
+  }
+
+  // Called where a sample buffer is allocated, outside the audio callback
+  bool lockBuffer(void *buffer, std::size_t bytes)
+  {
+#ifdef _WIN32
+    bool locked = VirtualLock(buffer, bytes) != 0;
+#else
+    bool locked = mlock(buffer, bytes) == 0;
+#endif
+    std::lock_guard<std::mutex> lock(mutex);
+    buffersLocked = locked;
+    return locked;
+  }
+
+  static void unlockBuffer(void *buffer, std::size_t bytes)
+  {
+#ifdef _WIN32
+    VirtualUnlock(buffer, bytes);
+#else
+    munlock(buffer, bytes);
+#endif
+  }
+
+  std::string getMode() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return threadMode + (buffersLocked ? (*buffersLocked ? ", buffers locked" : ", buffers not locked") : "");
+  }
+
+private:
+#ifdef _WIN32
+  typedef DWORD ThreadId;
+#else
+  typedef long ThreadId;
+#endif
+
+  Settings settings;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<ThreadId> pending;
+  bool stopping = false;
+  std::string threadMode = "normal scheduling";
+  std::optional<bool> buffersLocked;
+  bool fifoRefused = false, rtkitRefused = false; // helper thread only
+#ifdef MUSIC_PLAYER_HAS_SD_BUS
+  sd_bus *bus = nullptr;
+#endif
+  std::thread worker; // started last, after every member it reads
+
+  bool coreExists() const
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return settings.core < 64 && static_cast<DWORD>(settings.core) < info.dwNumberOfProcessors;
+#else
+    return settings.core < CPU_SETSIZE && settings.core < sysconf(_SC_NPROCESSORS_CONF);
+#endif
+  }
+
+#ifndef _WIN32
+  // rtkit's MakeThreadRealtime(thread id, priority) on the system bus
+  bool askRtkit(ThreadId thread, int priority)
+  {
+#ifdef MUSIC_PLAYER_HAS_SD_BUS
+    if (!bus && sd_bus_open_system(&bus) < 0)
+      return false;
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    int result = sd_bus_call_method(bus, "org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1", "org.freedesktop.RealtimeKit1",
+                                    "MakeThreadRealtime", &error, nullptr, "tu", static_cast<std::uint64_t>(thread), static_cast<std::uint32_t>(priority));
+    sd_bus_error_free(&error);
+    return result >= 0;
+#else
+    // Without the sd-bus headers, busctl makes the call for us
+    std::string id = std::to_string(thread), level = std::to_string(priority);
+    std::vector<std::string> args = {"busctl", "--system", "call", "org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+                                     "org.freedesktop.RealtimeKit1", "MakeThreadRealtime", "tu", id, level};
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+      argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    pid_t child;
+    int status = -1;
+    if (posix_spawnp(&child, "busctl", &actions, nullptr, argv.data(), environ) == 0)
+      waitpid(child, &status, 0);
+    posix_spawn_file_actions_destroy(&actions);
+    return status == 0;
+#endif
+  }
+#endif
+
+  std::string raisePriority(ThreadId thread)
+  {
+#ifdef _WIN32
+    HANDLE handle = OpenThread(THREAD_SET_INFORMATION, FALSE, thread);
+    bool raised = handle && SetThreadPriority(handle, THREAD_PRIORITY_TIME_CRITICAL);
+    if (handle)
+      CloseHandle(handle);
+    return raised ? "time-critical priority" : "normal priority (not permitted)";
+#else
+    sched_param param{};
+    param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO), std::min(settings.priority, sched_get_priority_max(SCHED_FIFO)));
+    if (!fifoRefused)
+    {
+      if (sched_setscheduler(static_cast<pid_t>(thread), SCHED_FIFO, &param) == 0)
+        return "SCHED_FIFO priority " + std::to_string(param.sched_priority);
+      fifoRefused = true;
+    }
+
+    // Unprivileged: ask rtkit. It refuses processes without an RLIMIT_RTTIME,
+    // a process-wide limit, so one is set only if there is none yet; it also
+    // stops a runaway real-time thread from locking up the box.
+    if (!rtkitRefused)
+    {
+      rlimit limit{};
+      if (getrlimit(RLIMIT_RTTIME, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY)
+      {
+        limit.rlim_cur = std::min<rlim_t>(200000, limit.rlim_max);
+        setrlimit(RLIMIT_RTTIME, &limit);
+      }
+      int rtkitPriority = std::min(param.sched_priority, 20);
+      if (askRtkit(thread, rtkitPriority) && sched_getscheduler(static_cast<pid_t>(thread)) == SCHED_FIFO &&
+          sched_getparam(static_cast<pid_t>(thread), &param) == 0)
+        return "SCHED_FIFO priority " + std::to_string(param.sched_priority) + " via rtkit";
+      rtkitRefused = true;
+    }
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(thread), -10) == 0)
+      return "nice -10 (real-time not permitted)";
+    return "normal scheduling (real-time not permitted)";
+#endif
+  }
+
+  std::string pinToCore(ThreadId thread)
+  {
+    if (settings.core < 0)
+      return "";
+    bool pinned = false;
+    if (coreExists())
+    {
+#ifdef _WIN32
+      HANDLE handle = OpenThread(THREAD_SET_INFORMATION | THREAD_QUERY_INFORMATION, FALSE, thread);
+      pinned = handle && SetThreadAffinityMask(handle, DWORD_PTR(1) << settings.core) != 0;
+      if (handle)
+        CloseHandle(handle);
+#else
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(settings.core, &cpus);
+      pinned = sched_setaffinity(static_cast<pid_t>(thread), sizeof(cpus), &cpus) == 0;
+#endif
+    }
+    return pinned ? ", pinned to core " + std::to_string(settings.core) : ", core " + std::to_string(settings.core) + " not available";
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wake.wait(lock, [this]
+                { return stopping || !pending.empty(); });
+      if (stopping)
+        return;
+      ThreadId thread = pending.front();
+      pending.pop_front();
+      lock.unlock();
+      std::string result = raisePriority(thread) + pinToCore(thread);
+      lock.lock();
+      if (result != threadMode)
+        std::cout << "[DEBUG] Audio thread: " << result << std::endl;
+      threadMode = result;
+    }
+  }
+};
+
+// One opened track on an output device. MusicPlayer only talks to this
+// interface, so playback works the same whether or not a sound card exists.
+class AudioOutput
+{
+public:
+  virtual void play() = 0;
+  virtual void pause() = 0;
+  virtual void stop() = 0;
+  virtual sf::SoundSource::Status getStatus() const = 0;
+  virtual void setVolume(float volume) = 0;
+  virtual sf::Time getPlayingOffset() const = 0;
+  virtual void setPlayingOffset(sf::Time offset) = 0;
+  virtual sf::Time getDuration() const = 0;
+  // How long after leaving getPlayingOffset() a sample reaches the speaker
+  virtual sf::Time getLatency() const { return sf::Time::Zero; }
+  virtual ~AudioOutput() {}
+};
+
+// Plays through OpenAL, streaming from a PlaybackSource like sf::Music does.
+class StreamAudioOutput : public AudioOutput
+{
+  class Stream : public sf::SoundStream
+  {
+    PlaybackSource &source;
+    std::vector<sf::Int16> buffer;
+    std::shared_ptr<RealtimeAudio> realtime;
+    bool locked = false;
+    std::thread::id promoted; // SFML starts a new streaming thread on every play and seek
+
+  public:
+    Stream(PlaybackSource &d, std::shared_ptr<RealtimeAudio> rt)
+        : source(d), buffer(d.getSampleRate() * d.getChannelCount()), realtime(std::move(rt))
+    {
+      initialize(d.getChannelCount(), d.getSampleRate());
+      if (realtime)
+        locked = realtime->lockBuffer(buffer.data(), buffer.size() * sizeof(sf::Int16));
+    }
+    ~Stream() override
+    {
+      stop();
+      if (locked)
+        RealtimeAudio::unlockBuffer(buffer.data(), buffer.size() * sizeof(sf::Int16));
+    }
+
+    // The OpenAL device's own buffering, when the implementation reports it
+    sf::Time getLatency() const
+    {
+#if defined(MUSIC_PLAYER_HAS_OPENAL_EXT) && defined(AL_SOFT_source_latency)
+      static LPALGETSOURCEDVSOFT getSourcedv = alIsExtensionPresent("AL_SOFT_source_latency")
+                                                   ? reinterpret_cast<LPALGETSOURCEDVSOFT>(alGetProcAddress("alGetSourcedvSOFT"))
+                                                   : nullptr;
+      if (getSourcedv)
+      {
+        ALdouble offsetAndLatency[2] = {0, 0};
+        getSourcedv(m_source, AL_SEC_OFFSET_LATENCY_SOFT, offsetAndLatency);
+        return sf::seconds(static_cast<float>(offsetAndLatency[1]));
+      }
+#endif
+      return sf::Time::Zero;
+    }
+
+  protected:
+    bool onGetData(Chunk &data) override
+    {
+      if (realtime && promoted != std::this_thread::get_id() && realtime->requestPromotion())
+        promoted = std::this_thread::get_id();
+      sf::Uint64 count = 0;
+      const sf::Int16 *direct = source.readDirect(buffer.size(), count);
+      if (!direct)
+        count = source.read(buffer.data(), buffer.size());
+      data.samples = direct ? direct : buffer.data();
+      data.sampleCount = static_cast<std::size_t>(count);
+      return data.sampleCount == buffer.size();
+    }
+    void onSeek(sf::Time timeOffset) override
+    {
+      sf::Uint64 frame = static_cast<sf::Uint64>(timeOffset.asMicroseconds()) * source.getSampleRate() / 1000000;
+      source.seek(frame * source.getChannelCount());
+    }
+  };
+
+  std::unique_ptr<PlaybackSource> source;
+  Stream stream;
+
+public:
+  StreamAudioOutput(std::unique_ptr<PlaybackSource> d, std::shared_ptr<RealtimeAudio> realtime)
+      : source(std::move(d)), stream(*source, std::move(realtime)) {}
+  void play() override { stream.play(); }
+  void pause() override { stream.pause(); }
+  void stop() override { stream.stop(); }
+  sf::SoundSource::Status getStatus() const override { return stream.getStatus(); }
+  void setVolume(float volume) override { stream.setVolume(volume); }
+  sf::Time getPlayingOffset() const override { return stream.getPlayingOffset(); }
+  void setPlayingOffset(sf::Time offset) override { stream.setPlayingOffset(offset); }
+  sf::Time getDuration() const override { return source->getDuration(); }
+  sf::Time getLatency() const override { return stream.getLatency(); }
+};
+
+// Output that needs no audio device: a worker thread consumes the decoded
+// samples and counts them, either paced to the sample rate or as fast as
+// the decoder allows. Used for CI and for benchmarking on headless machines.
+// Only the worker touches the source, and it decodes without holding the
+// lock, so control calls never wait on a decode: seeks are left for the
+// worker, and a block read across a seek or stop is dropped.
+class NullAudioOutput : public AudioOutput
+{
+  typedef std::chrono::steady_clock Clock;
+
+  std::unique_ptr<PlaybackSource> source;
+  bool realTime;
+  std::shared_ptr<RealtimeAudio> realtime;
+  mutable std::mutex mutex;
+  std::condition_variable wakeUp;
+  sf::SoundSource::Status status = sf::SoundSource::Stopped;
+  sf::Uint64 samplesConsumed = 0;
+  sf::Uint64 anchorSamples = 0; // samplesConsumed when the pacing clock was last restarted
+  Clock::time_point anchorTime;
+  std::optional<sf::Uint64> seekTo; // for the worker, before its next read
+  unsigned generation = 0;          // bumped by every seek and stop
+  bool quitting = false;
+  std::thread worker;
+
+public:
+  NullAudioOutput(std::unique_ptr<PlaybackSource> d, bool paced, std::shared_ptr<RealtimeAudio> rt)
+      : source(std::move(d)), realTime(paced), realtime(std::move(rt)), worker(&NullAudioOutput::run, this) {}
+  ~NullAudioOutput() override
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wakeUp.notify_all();
+    worker.join();
+  }
+
+  void play() override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (status == sf::SoundSource::Playing)
+      return;
+    status = sf::SoundSource::Playing;
+    anchorSamples = samplesConsumed;
+    anchorTime = Clock::now();
+    wakeUp.notify_all();
+  }
+  void pause() override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (status == sf::SoundSource::Playing)
+      status = sf::SoundSource::Paused;
+    wakeUp.notify_all();
+  }
+  void stop() override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    status = sf::SoundSource::Stopped;
+    seekTo = 0;
+    samplesConsumed = 0;
+    generation++;
+    wakeUp.notify_all();
+  }
+  sf::SoundSource::Status getStatus() const override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return status;
+  }
+  void setVolume(float) override {}
+  sf::Time getPlayingOffset() const override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sf::Uint64 samples = samplesConsumed;
+    if (realTime && status == sf::SoundSource::Playing)
+    {
+      double elapsed = std::chrono::duration<double>(Clock::now() - anchorTime).count();
+      samples = std::min(samples, anchorSamples + static_cast<sf::Uint64>(elapsed * samplesPerSecond()));
+    }
+    return sf::seconds(static_cast<float>(samples / samplesPerSecond()));
+  }
+  void setPlayingOffset(sf::Time offset) override
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sf::Uint64 frame = static_cast<sf::Uint64>(offset.asMicroseconds()) * source->getSampleRate() / 1000000;
+    samplesConsumed = std::min(frame * source->getChannelCount(), source->getSampleCount());
+    seekTo = samplesConsumed;
+    generation++;
+    anchorSamples = samplesConsumed;
+    anchorTime = Clock::now();
+  }
+  sf::Time getDuration() const override { return source->getDuration(); }
+
+private:
+  double samplesPerSecond() const { return static_cast<double>(source->getSampleRate()) * source->getChannelCount(); }
+
+  void run()
+  {
+    std::vector<sf::Int16> buffer(4096 * source->getChannelCount());
+    bool locked = realtime && realtime->lockBuffer(buffer.data(), buffer.size() * sizeof(sf::Int16));
+    if (realtime)
+      while (!realtime->requestPromotion())
+        std::this_thread::yield();
+    Clock::time_point started;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wakeUp.wait(lock, [this]
+                  { return quitting || status == sf::SoundSource::Playing; });
+      if (quitting)
+        break;
+      if (samplesConsumed == 0)
+        started = Clock::now();
+      unsigned readIn = generation;
+      std::optional<sf::Uint64> seek;
+      seek.swap(seekTo);
+      lock.unlock();
+      if (seek)
+        source->seek(*seek);
+      sf::Uint64 count = 0;
+      if (!source->readDirect(buffer.size(), count))
+        count = source->read(buffer.data(), buffer.size());
+      lock.lock();
+      if (readIn != generation)
+        continue; // seeked or stopped meanwhile; the block is from before
+      samplesConsumed += count;
+      if (realTime)
+      {
+        auto due = anchorTime + std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>((samplesConsumed - anchorSamples) / samplesPerSecond()));
+        wakeUp.wait_until(lock, due, [this]
+                          { return quitting || status != sf::SoundSource::Playing; });
+      }
+      if (count < buffer.size() && readIn == generation && status == sf::SoundSource::Playing)
+      {
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+        std::cout << "[DEBUG] Null output consumed " << samplesConsumed << " samples in " << ms << " ms." << std::endl;
+        status = sf::SoundSource::Stopped;
+        seekTo = 0;
+        samplesConsumed = 0;
+        generation++;
+      }
+    }
+    if (locked)
+      RealtimeAudio::unlockBuffer(buffer.data(), buffer.size() * sizeof(sf::Int16));
+  }
+};
+
+// -1 if the file is missing; only ever compared for equality
+long long fileModificationTime(const std::string &path)
+{
+  std::error_code error;
+  auto time = std::filesystem::last_write_time(path, error);
+  return error ? -1 : static_cast<long long>(time.time_since_epoch().count());
+}
+
+// For background work that must never compete with playback or the UI
+void lowerCurrentThreadPriority()
+{
+#ifdef _WIN32
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#else
+  setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#endif
+}
+
+// Threads nobody joins, so the caller never waits for a slow disk. They are
+// counted, and main waits for the last of them on its way out (ExitGuard),
+// so none is still running when static objects are destroyed.
+class DetachedThreads
+{
+public:
+  struct ExitGuard
+  {
+    ~ExitGuard() { waitForAll(); }
+  };
+
+  template <typename Work>
+  static void start(Work work)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex());
+      running()++;
+    }
+    std::thread([work]() mutable
+                {
+                  work();
+                  std::lock_guard<std::mutex> lock(mutex());
+                  if (--running() == 0)
+                    finished().notify_all();
+                })
+        .detach();
+  }
+
+  static void waitForAll()
+  {
+    std::unique_lock<std::mutex> lock(mutex());
+    finished().wait(lock, []
+                    { return running() == 0; });
+  }
+
+private:
+  static std::mutex &mutex()
+  {
+    static std::mutex instance;
+    return instance;
+  }
+  static std::condition_variable &finished()
+  {
+    static std::condition_variable instance;
+    return instance;
+  }
+  static std::size_t &running()
+  {
+    static std::size_t count = 0;
+    return count;
+  }
+};
+
+// Keeps heavy-rotation tracks decoded as FLAC, which compresses about as
+// well as any lossless format and decodes several times cheaper than Vorbis,
+// MP3 or Opus. A background thread fills it until the disk budget is used
+// up; entries are keyed by source path and modification time and evicted
+// least recently played first, tracks never played before any that were. An
+// evicted track is not queued again until it is played, so favourites that
+// outgrow the budget are not re-encoded on every launch. Only sources that
+// decode to 16 bits are cached, so playing the cached copy is bit-identical
+// to decoding the original. The index is a plain text file next to the
+// cached tracks.
+class PcmCache
+{
+public:
+  PcmCache(const std::string &dir, std::uintmax_t budgetBytes) : directory(dir), budget(budgetBytes)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    loadIndex();
+    worker = std::thread(&PcmCache::run, this);
+  }
+
+  ~PcmCache()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  // The cached copy of `path` when there is an up-to-date one, else `path`
+  std::string resolve(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end())
+    {
+      if (evicted.erase(path))
+        saveIndex();
+      return path;
+    }
+    std::filesystem::path cached = fileFor(path);
+    std::error_code error;
+    if (it->second.sourceTime != fileModificationTime(path) || !std::filesystem::exists(cached, error))
+    {
+      std::filesystem::remove(cached, error);
+      entries.erase(it);
+      saveIndex();
+      return path;
+    }
+    it->second.lastUsed = now();
+    saveIndex();
+    return cached.string();
+  }
+
+  // Queues tracks for caching; ones already cached or not worth it are skipped
+  void fill(const std::vector<std::string> &paths)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::string &path : paths)
+    {
+      auto it = entries.find(path);
+      auto dropped = evicted.find(path);
+      long long sourceTime = fileModificationTime(path);
+      if (!isWorthCaching(path) || (it != entries.end() && it->second.sourceTime == sourceTime) ||
+          (dropped != evicted.end() && dropped->second == sourceTime) ||
+          std::find(pending.begin(), pending.end(), path) != pending.end())
+        continue;
+      pending.push_back(path);
+    }
+    wake.notify_one();
+  }
+
+private:
+  struct Entry
+  {
+    long long sourceTime = 0;
+    std::uintmax_t bytes = 0;
+    long long lastUsed = 0; // seconds since the epoch, 0 if not played since it was cached
+  };
+
+  std::string directory;
+  std::uintmax_t budget;
+  std::map<std::string, Entry> entries;
+  std::map<std::string, long long> evicted; // source time of each, until it is played again
+  std::deque<std::string> pending;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread worker;
+
+  static long long now()
+  {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  // Lossless sources already decode cheaply
+  static bool isWorthCaching(const std::string &path)
+  {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension != ".flac" && extension != ".wav" && extension != ".wave" && extension != ".aif" &&
+           extension != ".aiff" && extension != ".aifc";
+  }
+
+  std::filesystem::path fileFor(const std::string &path) const
+  {
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>{}(path) << ".flac";
+    return std::filesystem::path(directory) / name.str();
+  }
+
+  // One entry per line: source time, bytes, last used, then the source path.
+  // Evicted tracks are listed with 0 bytes.
+  void loadIndex()
+  {
+    std::ifstream file((std::filesystem::path(directory) / "index.txt").string());
+    Entry entry;
+    std::string path;
+    while (file >> entry.sourceTime >> entry.bytes >> entry.lastUsed && std::getline(file >> std::ws, path))
+      if (entry.bytes)
+        entries[path] = entry;
+      else
+        evicted[path] = entry.sourceTime;
+  }
+
+  void saveIndex() const
+  {
+    std::ofstream file((std::filesystem::path(directory) / "index.txt").string());
+    for (const auto &[path, entry] : entries)
+      file << entry.sourceTime << " " << entry.bytes << " " << entry.lastUsed << " " << path << "\n";
+    for (const auto &[path, sourceTime] : evicted)
+      file << sourceTime << " 0 0 " << path << "\n";
+  }
+
+  std::uintmax_t totalBytes() const
+  {
+    std::uintmax_t total = 0;
+    for (const auto &entry : entries)
+      total += entry.second.bytes;
+    return total;
+  }
+
+  // Decodes `path` into the cache; returns the size written, 0 on failure
+  std::uintmax_t encode(const std::string &path) const
+  {
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+    if (!decoder || decoder->getBitDepth() != 16)
+      return 0;
+    std::filesystem::path target = fileFor(path);
+    std::filesystem::path partial = target;
+    partial.replace_extension(".part.flac");
+    std::vector<float> block(8192 * decoder->getChannelCount());
+    std::vector<sf::Int16> samples(block.size());
+    DitherQuantizer quantizer;
+    {
+      sf::OutputSoundFile file;
+      if (!file.openFromFile(partial.string(), decoder->getSampleRate(), decoder->getChannelCount()))
+        return 0;
+      for (sf::Uint64 read = block.size(); read == block.size();)
+      {
+        read = decoder->read(block.data(), block.size());
+        quantizer.process(block.data(), samples.data(), static_cast<std::size_t>(read), false);
+        file.write(samples.data(), read);
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(partial, target, error);
+    std::uintmax_t bytes = error ? 0 : std::filesystem::file_size(target, error);
+    if (error || bytes == 0)
+    {
+      std::filesystem::remove(partial, error);
+      return 0;
+    }
+    return bytes;
+  }
+
+  // Drops least recently played entries until the cache fits its budget
+  void evict()
+  {
+    std::uintmax_t total = totalBytes();
+    while (total > budget && !entries.empty())
+    {
+      auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b)
+                                     { return a.second.lastUsed < b.second.lastUsed; });
+      std::error_code error;
+      std::filesystem::remove(fileFor(oldest->first), error);
+      std::cout << "[DEBUG] PCM cache evicted " << oldest->first << std::endl;
+      total -= oldest->second.bytes;
+      evicted[oldest->first] = oldest->second.sourceTime;
+      entries.erase(oldest);
+    }
+  }
+
+  void run()
+  {
+    while (true)
+    {
+      std::string path;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]
+                  { return stopping || !pending.empty(); });
+        if (stopping)
+          return;
+        if (totalBytes() >= budget)
+        {
+          std::cout << "[DEBUG] PCM cache is full, " << pending.size() << " tracks left uncached." << std::endl;
+          pending.clear();
+          continue;
+        }
+        path = pending.front();
+      }
+      long long sourceTime = fileModificationTime(path);
+      std::uintmax_t bytes = encode(path);
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.pop_front();
+      if (bytes == 0)
+        continue;
+      entries[path] = {sourceTime, bytes, 0};
+      evicted.erase(path);
+      std::cout << "[DEBUG] PCM cache stored " << path << " (" << bytes / 1024 << " KB)." << std::endl;
+      evict();
+      saveIndex();
+    }
+  }
+};
+
+// First half second of the tracks the user is likely to click next: the row
+// under the cursor and the rows on screen. Low-priority worker threads
+// decode them ahead of time, so a click can start playing from RAM while
+// the real decoder opens (see HeadStartDecoder). Like the AnalysisStore,
+// heads are keyed by path and modification time: a file replaced in place is
+// decoded again rather than starting with the old one's head.
+class HeadCache
+{
+public:
+  static const unsigned int HeadMilliseconds = 500;
+
+  struct Head
+  {
+    unsigned int channels = 0, sampleRate = 0, bitDepth = 16;
+    sf::Uint64 sampleCount = 0; // of the whole track
+    std::vector<float> samples;
+  };
+
+  explicit HeadCache(std::size_t maxEntries = 32, unsigned int workerCount = 2) : capacity(maxEntries)
+  {
+    for (unsigned int i = 0; i < workerCount; i++)
+      workers.emplace_back(&HeadCache::run, this);
+  }
+
+  ~HeadCache()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  // Replaces the wish list, most wanted first; anything not in it may be evicted
+  void prefetch(const std::vector<std::string> &paths)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    wanted = paths;
+    if (wanted.size() > capacity)
+      wanted.resize(capacity);
+    for (const std::string &path : wanted)
+    {
+      auto it = heads.find(path);
+      if (it != heads.end())
+        it->second.lastUsed = ++clock;
+    }
+    wake.notify_all();
+  }
+
+  std::shared_ptr<const Head> find(const std::string &path)
+  {
+    long long sourceTime = fileModificationTime(path);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = heads.find(path);
+    if (it == heads.end() || !it->second.ready)
+      return nullptr;
+    if (it->second.sourceTime != sourceTime)
+    {
+      heads.erase(it); // a worker decodes it again if it is still wanted
+      wake.notify_all();
+      return nullptr;
+    }
+    if (!it->second.head)
+      return nullptr;
+    it->second.lastUsed = ++clock;
+    return it->second.head;
+  }
+
+private:
+  struct Slot
+  {
+    std::shared_ptr<const Head> head; // null if the file could not be decoded
+    bool ready = false;               // false while a worker decodes it
+    long long sourceTime = 0;         // of the file the head was decoded from
+    std::uint64_t lastUsed = 0;
+  };
+
+  std::size_t capacity;
+  std::vector<std::string> wanted;
+  std::map<std::string, Slot> heads;
+  std::uint64_t clock = 0;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  static std::shared_ptr<const Head> decode(const std::string &path)
+  {
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+    if (!decoder)
+      return nullptr;
+    auto head = std::make_shared<Head>();
+    head->channels = decoder->getChannelCount();
+    head->sampleRate = decoder->getSampleRate();
+    head->bitDepth = decoder->getBitDepth();
+    head->sampleCount = decoder->getSampleCount();
+    head->samples.resize(static_cast<std::size_t>(head->sampleRate) * HeadMilliseconds / 1000 * head->channels);
+    head->samples.resize(static_cast<std::size_t>(decoder->read(head->samples.data(), head->samples.size())));
+    return head;
+  }
+
+  void evict()
+  {
+    while (heads.size() > capacity)
+    {
+      auto oldest = heads.end();
+      for (auto it = heads.begin(); it != heads.end(); ++it)
+        if (it->second.ready && std::find(wanted.begin(), wanted.end(), it->first) == wanted.end() &&
+            (oldest == heads.end() || it->second.lastUsed < oldest->second.lastUsed))
+          oldest = it;
+      if (oldest == heads.end())
+        return;
+      heads.erase(oldest);
+    }
+  }
+
+  void run()
+  {
+    lowerCurrentThreadPriority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      std::string path;
+      wake.wait(lock, [&]
+                {
+                  if (stopping)
+                    return true;
+                  for (const std::string &candidate : wanted)
+                    if (!heads.count(candidate))
+                    {
+                      path = candidate;
+                      return true;
+                    }
+                  return false;
+                });
+      if (stopping)
+        return;
+      heads[path].lastUsed = ++clock; // claims it, so other workers move on
+      lock.unlock();
+      long long sourceTime = fileModificationTime(path);
+      std::shared_ptr<const Head> head = decode(path);
+      lock.lock();
+      heads[path].head = head;
+      heads[path].sourceTime = sourceTime;
+      heads[path].ready = true;
+      evict();
+    }
+  }
+};
+
+// Plays a track's cached head while its real decoder opens on a thread of
+// its own, then hands over to that decoder. The decoder is already
+// positioned at the end of the head by the time it takes over, so the
+// switch happens on an exact sample boundary. If the open outlasts the head,
+// or a seek leaves it early, silence takes the place of the audio until the
+// decoder is ready, instead of stalling the audio thread on the disk; the
+// track's timeline moves on with it, so positions stay true.
+class HeadStartDecoder : public AudioDecoder
+{
+  std::shared_ptr<const HeadCache::Head> head;
+  std::future<std::unique_ptr<AudioDecoder>> opening;
+  std::unique_ptr<AudioDecoder> decoder;
+  sf::Uint64 position = 0;        // next sample handed out
+  sf::Uint64 decoderPosition = 0; // next sample `decoder` would return
+
+  // Never blocks; false while the open is still running or once it failed
+  bool takeOver()
+  {
+    if (!decoder && opening.valid() && opening.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+      decoder = opening.get();
+    return decoder != nullptr;
+  }
+
+public:
+  HeadStartDecoder(std::shared_ptr<const HeadCache::Head> cached, std::function<std::unique_ptr<AudioDecoder>()> open)
+      : head(std::move(cached)), decoderPosition(head->samples.size())
+  {
+    // Detached, so abandoning a track mid-open never waits for the disk
+    auto promise = std::make_shared<std::promise<std::unique_ptr<AudioDecoder>>>();
+    opening = promise->get_future();
+    sf::Uint64 skip = decoderPosition;
+    DetachedThreads::start([promise, open, skip]
+                           {
+                             std::unique_ptr<AudioDecoder> opened = open();
+                             if (opened)
+                               opened->seek(skip);
+                             promise->set_value(std::move(opened));
+                           });
+  }
+
+  unsigned int getChannelCount() const override { return head->channels; }
+  unsigned int getSampleRate() const override { return head->sampleRate; }
+  sf::Uint64 getSampleCount() const override { return head->sampleCount; }
+  unsigned int getBitDepth() const override { return head->bitDepth; }
+
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    sf::Uint64 count = 0;
+    if (position < head->samples.size())
+    {
+      count = std::min<sf::Uint64>(maxCount, head->samples.size() - position);
+      std::copy(head->samples.begin() + position, head->samples.begin() + position + count, samples);
+      position += count;
+    }
+    if (count == maxCount)
+      return count;
+    if (!takeOver())
+    {
+      if (!opening.valid())
+        return count; // the open failed, so the track ends with its head
+        // Silence stands in for the samples it covers, so the timeline every
+      // caller keeps stays the track's; the takeover seeks past it
+      sf::Uint64 left = head->sampleCount ? head->sampleCount - std::min(position, head->sampleCount) : maxCount; // 0: length unknown
+      sf::Uint64 padding = std::min<sf::Uint64>(maxCount - count, left);
+      std::fill(samples + count, samples + count + padding, 0.0f);
+      position += padding;
+      return count + padding;
+    }
+    if (decoderPosition != position)
+      decoder->seek(position);
+    sf::Uint64 read = decoder->read(samples + count, maxCount - count);
+    position += read;
+    decoderPosition = position;
+    return count + read;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override
+  {
+    position = sampleOffset;
+    if (position >= head->samples.size() && takeOver())
+    {
+      decoder->seek(position);
+      decoderPosition = position;
+    }
+  }
+};
+
+// Plays only the audible part [first, end) of a track, given in interleaved
+// samples, while keeping the track's own timeline: positions and the sample
+// count are unchanged, any seek before the audible part lands exactly on its
+// first sample, and the track ends where the audible part does.
+class TrimmedDecoder : public AudioDecoder
+{
+  std::unique_ptr<AudioDecoder> decoder;
+  sf::Uint64 first, end;
+  sf::Uint64 position;
+
+public:
+  TrimmedDecoder(std::unique_ptr<AudioDecoder> d, sf::Uint64 firstSample, sf::Uint64 endSample)
+      : decoder(std::move(d)), first(firstSample), end(std::max(firstSample, endSample)), position(firstSample)
+  {
+    if (first > 0)
+      decoder->seek(first);
+  }
+
+  unsigned int getChannelCount() const override { return decoder->getChannelCount(); }
+  unsigned int getSampleRate() const override { return decoder->getSampleRate(); }
+  sf::Uint64 getSampleCount() const override { return decoder->getSampleCount(); }
+  unsigned int getBitDepth() const override { return decoder->getBitDepth(); }
+
+  sf::Uint64 read(float *samples, sf::Uint64 maxCount) override
+  {
+    sf::Uint64 count = decoder->read(samples, std::min(maxCount, end - position));
+    position += count;
+    return count;
+  }
+
+  const sf::Int16 *readDirect(sf::Uint64 maxCount, sf::Uint64 &count) override
+  {
+    const sf::Int16 *samples = decoder->readDirect(std::min(maxCount, end - position), count);
+    if (samples)
+      position += count;
+    return samples;
+  }
+
+  void seek(sf::Uint64 sampleOffset) override
+  {
+    position = std::max(first, std::min(sampleOffset, end));
+    decoder->seek(position);
+  }
+};
+
+struct OutputSettings
+{
+  enum Backend
+  {
+    Device,
+    Null
+  };
+  Backend backend = Device;
+  bool realTime = true; // null backend only: consume at playback speed
+  std::shared_ptr<EffectChain> effects = std::make_shared<EffectChain>();
+  std::shared_ptr<RealtimeAudio> realtime; // null unless --realtime was given
+  std::shared_ptr<PcmCache> cache;         // null unless --pcm-cache was given
+  std::shared_ptr<HeadCache> heads;        // interactive playback only
+  std::shared_ptr<SharedMemoryTap> pcmTap; // null unless --pcm-tap was given
+  // Audible frames [first, end) of a track, where known; tracks play whole
+  // while trimSilence is off, and the player can flip it at any time
+  std::function<std::optional<std::pair<sf::Uint64, sf::Uint64>>(const std::string &)> audibleRange;
+  std::shared_ptr<std::atomic<bool>> trimSilence = std::make_shared<std::atomic<bool>>(false);
+
+  // Accepts "openal", "null" (real-time) and "null-fast" (as fast as possible).
+  static OutputSettings fromName(const std::string &name)
+  {
+    OutputSettings settings;
+    if (name == "null" || name == "null-fast")
+    {
+      settings.backend = Null;
+      settings.realTime = (name == "null");
+    }
+    else if (name != "openal")
+    {
+      std::cout << "[ERROR] Unknown audio output '" << name << "', using openal.\n";
+    }
+    return settings;
+  }
+};
+
+std::unique_ptr<AudioOutput> openOutput(const std::string &path, const OutputSettings &settings)
+{
+  auto open = [path, cache = settings.cache]() -> std::unique_ptr<AudioDecoder>
+  {
+    std::unique_ptr<AudioDecoder> decoder;
+    if (cache)
+    {
+      std::string cached = cache->resolve(path);
+      if (cached != path && !(decoder = openDecoder(cached)))
+        std::cout << "[ERROR] Cached copy of " << path << " is unreadable, decoding the original.\n";
+    }
+    return decoder ? std::move(decoder) : openDecoder(path);
+  };
+  std::unique_ptr<AudioDecoder> decoder;
+  if (auto head = settings.heads ? settings.heads->find(path) : nullptr)
+    decoder = std::make_unique<HeadStartDecoder>(std::move(head), open);
+  else
+    decoder = open();
+  if (!decoder)
+    return nullptr;
+  std::optional<std::pair<sf::Uint64, sf::Uint64>> range;
+  if (*settings.trimSilence && settings.audibleRange)
+    range = settings.audibleRange(path);
+  unsigned int channels = decoder->getChannelCount(), sampleRate = decoder->getSampleRate();
+  if (range)
+    decoder = std::make_unique<TrimmedDecoder>(std::move(decoder), range->first * channels, range->second * channels);
+  auto source = std::make_unique<PlaybackSource>(std::move(decoder), settings.effects);
+  std::unique_ptr<AudioOutput> output;
+  if (settings.backend == OutputSettings::Null)
+    output = std::make_unique<NullAudioOutput>(std::move(source), settings.realTime, settings.realtime);
+  else
+    output = std::make_unique<StreamAudioOutput>(std::move(source), settings.realtime);
+  // Rounded up to a microsecond, so the outputs' frame = us * rate / 1e6
+  // lands back on the first audible frame and the clock shows track time
+  if (range && range->first > 0)
+    output->setPlayingOffset(sf::microseconds(static_cast<sf::Int64>((range->first * 1000000 + sampleRate - 1) / sampleRate)));
+  return output;
+}
+
+// Extensions some decoder can open
+bool isSupportedAudioFile(const std::filesystem::path &path)
+{
+  static const std::vector<std::string> extensions = {
+      ".ogg", ".oga", ".flac", ".mp3", ".wav", ".wave", ".aif", ".aiff", ".aifc", ".mod", ".xm", ".s3m", ".it", ".mid", ".midi",
+#ifdef MUSIC_PLAYER_HAS_OPUS
+      ".opus",
+#endif
+  };
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+  return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+// Library contents and queue order, shared by MusicPlayer and OfflineRenderer
+// so an offline render walks the queue exactly like interactive playback:
+// the built-in tracks, then anything found under songs/.
+std::vector<std::string> loadLibrary()
+{
+  std::vector<std::string> songs = {"Music1.ogg", "Music2.ogg", "Music3.ogg", "cold.mp3"};
+  std::vector<std::string> found;
+  std::error_code error;
+  for (std::filesystem::recursive_directory_iterator it("songs", std::filesystem::directory_options::skip_permission_denied, error), end; !error && it != end; it.increment(error))
+    if (it->is_regular_file(error) && isSupportedAudioFile(it->path()))
+      found.push_back(it->path().generic_string());
+  std::sort(found.begin(), found.end());
+  songs.insert(songs.end(), found.begin(), found.end());
+  return songs;
+}
+
+// "m:ss"
+std::string formatTime(sf::Time time)
+{
+  int seconds = static_cast<int>(time.asSeconds());
+  std::string twoDigits = std::to_string(seconds % 60);
+  return std::to_string(seconds / 60) + ":" + (twoDigits.size() < 2 ? "0" : "") + twoDigits;
+}
+
+int nextSongIndex(int current, int count) { return (current + 1) % count; }
+int previousSongIndex(int current, int count) { return (current - 1 + count) % count; }
+int songIndexAfterEnd(int current, int count, bool repeat) { return repeat ? current : nextSongIndex(current, count); }
+
+// Converts interleaved float audio to a fixed channel count and sample rate:
+// mono is duplicated, anything is averaged down to mono, and surround is
+// folded down to stereo (see downmixGains); other layouts keep their first
+// channels. Raising the rate interpolates linearly; lowering it goes through
+// a Kaiser-windowed sinc low-pass below the new Nyquist frequency, so nothing
+// above it folds back into the audible band. That filter looks ahead, so a
+// stream ends with flush(). The arithmetic runs in a fixed order, so the
+// result is the same on every run.
+class FormatConverter
+{
+  static const int Phases = 256;       // kernel table entries per input frame
+  static const int ZeroCrossings = 32; // per side of the sinc kernel
+
+  unsigned int inChannels, inRate, outChannels, outRate;
+  double position = 0; // read position in input frames; linear: frame 0 is `history`, sinc: into `pending`
+  std::vector<float> history;
+  std::vector<float> leftGains, rightGains; // per input channel, surround to stereo only
+  int halfTaps = 0;                         // sinc only: input frames on each side of an output frame
+  std::vector<float> kernel;                // sinc only: the kernel at every 1/Phases frame from 0 outwards
+  std::vector<float> pending;               // sinc only: mapped input frames still needed
+  std::vector<float> weights;
+
+  static double besselI0(double x)
+  {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  // Cutoff at 92% of the new Nyquist frequency, which puts the stopband
+  // (about -80 dB) at it
+  void designLowPass()
+  {
+    const double pi = 3.14159265358979323846, beta = 8;
+    double cutoff = 0.46 * outRate / inRate; // cycles per input frame
+    halfTaps = static_cast<int>(std::ceil(ZeroCrossings / (2 * cutoff)));
+    kernel.assign(static_cast<std::size_t>(halfTaps) * Phases + 2, 0.0f);
+    for (std::size_t i = 0; i <= static_cast<std::size_t>(halfTaps) * Phases; i++)
+    {
+      double t = static_cast<double>(i) / Phases, x = 2 * cutoff * t, ratio = t / halfTaps;
+      double sinc = x == 0 ? 1 : std::sin(pi * x) / (pi * x);
+      kernel[i] = static_cast<float>(2 * cutoff * sinc * besselI0(beta * std::sqrt(std::max(0.0, 1 - ratio * ratio))) / besselI0(beta));
+    }
+    pending.assign(static_cast<std::size_t>(halfTaps - 1) * outChannels, 0.0f);
+    position = halfTaps - 1;
+    weights.resize(static_cast<std::size_t>(halfTaps) * 2);
+  }
+
+  // Emits every output frame before `end` (in `pending` frames) that the
+  // kernel can already see whole, then drops the frames no longer needed
+  void filterPending(double end, std::vector<float> &out)
+  {
+    double step = static_cast<double>(inRate) / outRate;
+    std::size_t available = pending.size() / outChannels;
+    while (position < end && static_cast<std::size_t>(position) + halfTaps < available)
+    {
+      std::size_t centre = static_cast<std::size_t>(position), first = centre + 1 - halfTaps;
+      for (int k = 0; k < halfTaps * 2; k++)
+      {
+        double at = std::fabs(static_cast<double>(first + k) - position) * Phases;
+        std::size_t i = static_cast<std::size_t>(at);
+        float f = static_cast<float>(at - i);
+        weights[k] = kernel[i] + (kernel[i + 1] - kernel[i]) * f;
+      }
+      for (unsigned int c = 0; c < outChannels; c++)
+      {
+        const float *frame = pending.data() + first * outChannels + c;
+        float sum = 0;
+        for (int k = 0; k < halfTaps * 2; k++)
+          sum += frame[k * outChannels] * weights[k];
+        out.push_back(sum);
+      }
+      position += step;
+    }
+    std::size_t drop = std::min(available, static_cast<std::size_t>(position) + 1 - halfTaps);
+    pending.erase(pending.begin(), pending.begin() + drop * outChannels);
+    position -= drop;
+  }
+
+  // Channels in WAV/OpenAL order (front left, right, centre, LFE, then the
+  // surrounds in left/right pairs). Centre and surrounds go in at -3 dB, the
+  // LFE is dropped, and each side is scaled so it cannot clip.
+  void downmixGains()
+  {
+    const float minus3dB = 0.70710678f;
+    leftGains.assign(inChannels, 0.0f);
+    rightGains.assign(inChannels, 0.0f);
+    leftGains[0] = rightGains[1] = 1.0f;
+    unsigned int c = 2;
+    if (inChannels == 3 || inChannels >= 5)
+      leftGains[c] = rightGains[c] = minus3dB, c++;
+    if (inChannels >= 6)
+      c++; // LFE
+    if (inChannels == 7)
+      leftGains[c] = rightGains[c] = minus3dB, c++; // back centre
+    for (bool left = true; c < inChannels; c++, left = !left)
+      (left ? leftGains : rightGains)[c] = minus3dB;
+    float leftSum = 0, rightSum = 0;
+    for (unsigned int i = 0; i < inChannels; i++)
+      leftSum += leftGains[i], rightSum += rightGains[i];
+    for (unsigned int i = 0; i < inChannels; i++)
+      leftGains[i] /= leftSum, rightGains[i] /= rightSum;
+  }
+
+  float mapped(const float *frame, unsigned int channel) const
+  {
+    if (inChannels == outChannels)
+      return frame[channel];
+    if (outChannels == 1)
+    {
+      float sum = 0;
+      for (unsigned int c = 0; c < inChannels; c++)
+        sum += frame[c];
+      return sum / inChannels;
+    }
+    if (inChannels == 1)
+      return frame[0];
+    if (outChannels == 2)
+    {
+      const std::vector<float> &gains = channel == 0 ? leftGains : rightGains;
+      float sum = 0;
+      for (unsigned int c = 0; c < inChannels; c++)
+        sum += frame[c] * gains[c];
+      return sum;
+    }
+    return channel < inChannels ? frame[channel] : 0.0f;
+  }
+
+public:
+  FormatConverter(unsigned int inCh, unsigned int inHz, unsigned int outCh, unsigned int outHz)
+      : inChannels(inCh), inRate(inHz), outChannels(outCh), outRate(outHz)
+  {
+    if (outChannels == 2 && inChannels > 2)
+      downmixGains();
+    if (outRate < inRate)
+      designLowPass();
+  }
+
+  bool isPassthrough() const { return inChannels == outChannels && inRate == outRate; }
+
+  void convert(const float *in, std::size_t frames, std::vector<float> &out)
+  {
+    out.clear();
+    if (isPassthrough())
+    {
+      out.assign(in, in + frames * inChannels);
+      return;
+    }
+    if (frames == 0)
+      return;
+    if (!kernel.empty())
+    {
+      for (std::size_t f = 0; f < frames; f++)
+        for (unsigned int c = 0; c < outChannels; c++)
+          pending.push_back(mapped(in + f * inChannels, c));
+      filterPending(std::numeric_limits<double>::infinity(), out);
+      return;
+    }
+    if (history.empty())
+    {
+      for (unsigned int c = 0; c < outChannels; c++)
+        history.push_back(mapped(in, c));
+    }
+    double step = static_cast<double>(inRate) / outRate;
+    while (position < frames)
+    {
+      std::size_t index = static_cast<std::size_t>(position);
+      float t = static_cast<float>(position - index);
+      for (unsigned int c = 0; c < outChannels; c++)
+      {
+        float a = index == 0 ? history[c] : mapped(in + (index - 1) * inChannels, c);
+        float b = mapped(in + index * inChannels, c);
+        out.push_back(a + (b - a) * t);
+      }
+      position += step;
+    }
+    position -= frames;
+    for (unsigned int c = 0; c < outChannels; c++)
+      history[c] = mapped(in + (frames - 1) * inChannels, c);
+  }
+
+  // The frames the low-pass still holds back at the end of the stream
+  void flush(std::vector<float> &out)
+  {
+    out.clear();
+    if (kernel.empty())
+      return;
+    double end = static_cast<double>(pending.size() / outChannels);
+    pending.resize(pending.size() + static_cast<std::size_t>(halfTaps) * outChannels, 0.0f);
+    filterPending(end, out);
+  }
+};
+
+// In-place complex FFT on split real/imaginary arrays: radix-2, decimation in
+// time, with a twiddle table per stage. Stages with eight or more butterflies
+// per group run on AVX2/FMA vectors when the build enables them, on SSE
+// otherwise.
+class Fft
+{
+  std::size_t size;
+  std::vector<std::uint32_t> bitReverse;
+  std::vector<float> twiddleRe, twiddleIm; // stage with half-size h starts at h - 1
+
+public:
+  explicit Fft(std::size_t n) : size(n), bitReverse(n), twiddleRe(n), twiddleIm(n)
+  {
+    unsigned int bits = 0;
+    while ((std::size_t(1) << bits) < n)
+      bits++;
+    for (std::size_t i = 0; i < n; i++)
+    {
+      std::uint32_t reversed = 0;
+      for (unsigned int b = 0; b < bits; b++)
+        reversed |= ((i >> b) & 1) << (bits - 1 - b);
+      bitReverse[i] = reversed;
+    }
+    for (std::size_t half = 1; half < n; half *= 2)
+    {
+      for (std::size_t j = 0; j < half; j++)
+      {
+        double angle = -3.14159265358979323846 * j / half;
+        twiddleRe[half - 1 + j] = static_cast<float>(std::cos(angle));
+        twiddleIm[half - 1 + j] = static_cast<float>(std::sin(angle));
+      }
+    }
+  }
+
+  std::size_t getSize() const { return size; }
+
+  // Unscaled forward transform
+  void forward(float *re, float *im) const
+  {
+    for (std::size_t i = 0; i < size; i++)
+    {
+      std::size_t j = bitReverse[i];
+      if (j > i)
+      {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+    for (std::size_t half = 1; half < size; half *= 2)
+    {
+      const float *wr = &twiddleRe[half - 1];
+      const float *wi = &twiddleIm[half - 1];
+      for (std::size_t start = 0; start < size; start += 2 * half)
+      {
+        float *ar = re + start, *ai = im + start, *br = re + start + half, *bi = im + start + half;
+        std::size_t j = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+        for (; j + 8 <= half; j += 8)
+        {
+          __m256 xr = _mm256_loadu_ps(br + j), xi = _mm256_loadu_ps(bi + j);
+          __m256 cr = _mm256_loadu_ps(wr + j), ci = _mm256_loadu_ps(wi + j);
+          __m256 tr = _mm256_fmsub_ps(xr, cr, _mm256_mul_ps(xi, ci));
+          __m256 ti = _mm256_fmadd_ps(xr, ci, _mm256_mul_ps(xi, cr));
+          __m256 ur = _mm256_loadu_ps(ar + j), ui = _mm256_loadu_ps(ai + j);
+          _mm256_storeu_ps(ar + j, _mm256_add_ps(ur, tr));
+          _mm256_storeu_ps(ai + j, _mm256_add_ps(ui, ti));
+          _mm256_storeu_ps(br + j, _mm256_sub_ps(ur, tr));
+          _mm256_storeu_ps(bi + j, _mm256_sub_ps(ui, ti));
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        for (; j + 4 <= half; j += 4)
+        {
+          __m128 xr = _mm_loadu_ps(br + j), xi = _mm_loadu_ps(bi + j);
+          __m128 cr = _mm_loadu_ps(wr + j), ci = _mm_loadu_ps(wi + j);
+          __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+          __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+          __m128 ur = _mm_loadu_ps(ar + j), ui = _mm_loadu_ps(ai + j);
+          _mm_storeu_ps(ar + j, _mm_add_ps(ur, tr));
+          _mm_storeu_ps(ai + j, _mm_add_ps(ui, ti));
+          _mm_storeu_ps(br + j, _mm_sub_ps(ur, tr));
+          _mm_storeu_ps(bi + j, _mm_sub_ps(ui, ti));
+        }
+#endif
+        for (; j < half; j++)
+        {
+          float tr = br[j] * wr[j] - bi[j] * wi[j];
+          float ti = br[j] * wi[j] + bi[j] * wr[j];
+          br[j] = ar[j] - tr;
+          bi[j] = ai[j] - ti;
+          ar[j] += tr;
+          ai[j] += ti;
+        }
+      }
+    }
+  }
+
+  // Inverse transform scaled by 1/size: swapping the real and imaginary
+  // parts turns the forward transform into the inverse
+  void inverse(float *re, float *im) const
+  {
+    forward(im, re);
+    float scale = 1.0f / size;
+    for (std::size_t i = 0; i < size; i++)
+    {
+      re[i] *= scale;
+      im[i] *= scale;
+    }
+  }
+};
+
+// acc += x * h over split complex arrays; n is a multiple of 8.
+void complexMultiplyAccumulate(const float *xr, const float *xi, const float *hr, const float *hi,
+                               float *accRe, float *accIm, std::size_t n)
+{
+  std::size_t k = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  for (; k < n; k += 8)
+  {
+    __m256 a = _mm256_loadu_ps(xr + k), b = _mm256_loadu_ps(xi + k);
+    __m256 c = _mm256_loadu_ps(hr + k), d = _mm256_loadu_ps(hi + k);
+    __m256 re = _mm256_fmadd_ps(a, c, _mm256_loadu_ps(accRe + k));
+    __m256 im = _mm256_fmadd_ps(a, d, _mm256_loadu_ps(accIm + k));
+    _mm256_storeu_ps(accRe + k, _mm256_fnmadd_ps(b, d, re));
+    _mm256_storeu_ps(accIm + k, _mm256_fmadd_ps(b, c, im));
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  for (; k < n; k += 4)
+  {
+    __m128 a = _mm_loadu_ps(xr + k), b = _mm_loadu_ps(xi + k);
+    __m128 c = _mm_loadu_ps(hr + k), d = _mm_loadu_ps(hi + k);
+    __m128 re = _mm_sub_ps(_mm_mul_ps(a, c), _mm_mul_ps(b, d));
+    __m128 im = _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(b, c));
+    _mm_storeu_ps(accRe + k, _mm_add_ps(_mm_loadu_ps(accRe + k), re));
+    _mm_storeu_ps(accIm + k, _mm_add_ps(_mm_loadu_ps(accIm + k), im));
+  }
+#endif
+  for (; k < n; k++)
+  {
+    accRe[k] += xr[k] * hr[k] - xi[k] * hi[k];
+    accIm[k] += xr[k] * hi[k] + xi[k] * hr[k];
+  }
+}
+
+// Convolves the output with a measured impulse response (room correction,
+// headphone compensation) using uniformly partitioned overlap-save: the IR is
+// cut into blocks of `partition` frames whose spectra are multiplied with a
+// delay line of past input spectra. Latency is exactly one partition. Two
+// channels share one complex FFT (left in the real part, right in the
+// imaginary part) and are separated by conjugate symmetry.
+class ConvolutionEffect : public AudioEffect
+{
+  // One FFT frame of spectra for a left/right pair, in split re/im form
+  struct Spectrum
+  {
+    std::vector<float> leftRe, leftIm, rightRe, rightIm;
+    void resize(std::size_t n)
+    {
+      leftRe.assign(n, 0);
+      leftIm.assign(n, 0);
+      rightRe.assign(n, 0);
+      rightIm.assign(n, 0);
+    }
+  };
+
+  struct ChannelPair
+  {
+    std::vector<float> inputLeft, inputRight;   // previous and current block
+    std::vector<float> outputLeft, outputRight; // last block's result, played while the next one fills
+    std::vector<Spectrum> delayLine;            // input spectra, newest at `head`
+    std::size_t head = 0;
+  };
+
+  // Everything that depends on the stream format: the IR resampled and
+  // transformed into partitions, plus the running state. Built off the
+  // audio thread, which only ever swaps a finished one in.
+  struct Prepared
+  {
+    unsigned int rate = 0;
+    unsigned int channels = 0;
+    std::unique_ptr<Fft> fft;
+    std::size_t bins = 0; // partition + 1, rounded up to a multiple of 8
+    std::vector<std::vector<Spectrum>> filters; // [pair][partition]
+    std::vector<ChannelPair> pairs;
+    std::size_t fill = 0;
+    std::vector<float> re, im;
+    Spectrum sum;
+  };
+
+  std::size_t partition;
+  std::string impulsePath;
+  std::vector<float> impulse; // interleaved, at impulseRate
+  unsigned int impulseChannels = 0;
+  unsigned int impulseRate = 0;
+
+  std::mutex preparedMutex;
+  std::vector<std::shared_ptr<Prepared>> ready; // the formats played lately, newest last
+  std::shared_ptr<Prepared> current;            // audio thread only
+
+public:
+  explicit ConvolutionEffect(std::size_t partitionFrames = 512) : partition(partitionFrames) {}
+
+  bool loadImpulse(const std::string &path)
+  {
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+    if (!decoder)
+      return false;
+    impulseChannels = decoder->getChannelCount();
+    impulseRate = decoder->getSampleRate();
+    impulse.resize(static_cast<std::size_t>(decoder->getSampleCount()));
+    impulse.resize(static_cast<std::size_t>(decoder->read(impulse.data(), impulse.size())));
+    impulsePath = path;
+    return !impulse.empty();
+  }
+
+  // Builds the filter for a stream format ahead of time (PlaybackSource
+  // calls this on the thread that opens the track). Cheap when it exists.
+  void prepare(unsigned int channelCount, unsigned int sampleRate) override
+  {
+    if (impulse.empty())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(preparedMutex);
+      for (const auto &prepared : ready)
+        if (prepared->rate == sampleRate && prepared->channels == channelCount)
+          return;
+    }
+    std::shared_ptr<Prepared> prepared = build(sampleRate, channelCount);
+    std::lock_guard<std::mutex> lock(preparedMutex);
+    ready.push_back(std::move(prepared));
+    if (ready.size() > 4)
+      ready.erase(ready.begin());
+  }
+
+  std::size_t getLatencyFrames() const { return partition; }
+  std::string getImpulsePath() const { return impulsePath; }
+  bool isActive() const override { return !impulse.empty(); }
+
+  void process(float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate) override
+  {
+    if (impulse.empty())
+      return;
+    if (!current || sampleRate != current->rate || channelCount != current->channels)
+    {
+      // Never waits: until the filter for this format is in, audio passes dry
+      std::shared_ptr<Prepared> next;
+      if (preparedMutex.try_lock())
+      {
+        for (const auto &prepared : ready)
+          if (prepared->rate == sampleRate && prepared->channels == channelCount)
+            next = prepared;
+        preparedMutex.unlock();
+      }
+      if (!next)
+        return;
+      current = std::move(next);
+      reset(*current);
+    }
+    Prepared &state = *current;
+    std::vector<ChannelPair> &pairs = state.pairs;
+    std::size_t &fill = state.fill;
+    std::size_t frames = count / channelCount;
+    for (std::size_t f = 0; f < frames; f++)
+    {
+      float *frame = samples + f * channelCount;
+      for (std::size_t p = 0; p < pairs.size(); p++)
+      {
+        ChannelPair &pair = pairs[p];
+        unsigned int left = static_cast<unsigned int>(p * 2), right = left + 1;
+        pair.inputLeft[partition + fill] = frame[left];
+        pair.inputRight[partition + fill] = right < channelCount ? frame[right] : 0.0f;
+        frame[left] = pair.outputLeft[fill];
+        if (right < channelCount)
+          frame[right] = pair.outputRight[fill];
+      }
+      if (++fill == partition)
+      {
+        for (std::size_t p = 0; p < pairs.size(); p++)
+          processBlock(state, p);
+        fill = 0;
+      }
+    }
+  }
+
+private:
+  std::shared_ptr<Prepared> build(unsigned int sampleRate, unsigned int channelCount) const
+  {
+    auto prepared = std::make_shared<Prepared>();
+    prepared->rate = sampleRate;
+    prepared->channels = channelCount;
+    std::size_t n = partition * 2;
+    prepared->fft = std::make_unique<Fft>(n);
+    prepared->bins = (partition + 1 + 7) / 8 * 8;
+    prepared->re.assign(n, 0);
+    prepared->im.assign(n, 0);
+    prepared->sum.resize(prepared->bins);
+    std::vector<float> &re = prepared->re, &im = prepared->im;
+
+    // Bring the IR to the stream's rate; channels stay as recorded
+    std::vector<float> ir;
+    FormatConverter converter(impulseChannels, impulseRate, impulseChannels, sampleRate);
+    converter.convert(impulse.data(), impulse.size() / impulseChannels, ir);
+    std::vector<float> tail;
+    converter.flush(tail);
+    ir.insert(ir.end(), tail.begin(), tail.end());
+    std::size_t irFrames = ir.size() / impulseChannels;
+    std::size_t partitions = std::max<std::size_t>(1, (irFrames + partition - 1) / partition);
+
+    std::size_t pairCount = (channelCount + 1) / 2;
+    prepared->filters.assign(pairCount, std::vector<Spectrum>(partitions));
+    prepared->pairs.assign(pairCount, ChannelPair());
+    for (std::size_t p = 0; p < pairCount; p++)
+    {
+      ChannelPair &pair = prepared->pairs[p];
+      pair.inputLeft.assign(n, 0);
+      pair.inputRight.assign(n, 0);
+      pair.outputLeft.assign(partition, 0);
+      pair.outputRight.assign(partition, 0);
+      pair.delayLine.assign(partitions, Spectrum());
+      for (Spectrum &spectrum : pair.delayLine)
+        spectrum.resize(prepared->bins);
+
+      // A mono IR applies to every channel; otherwise channel c uses IR channel c
+      unsigned int irLeft = static_cast<unsigned int>(p * 2) % impulseChannels;
+      unsigned int irRight = static_cast<unsigned int>(p * 2 + 1) % impulseChannels;
+      for (std::size_t k = 0; k < partitions; k++)
+      {
+        std::fill(re.begin(), re.end(), 0.0f);
+        std::fill(im.begin(), im.end(), 0.0f);
+        for (std::size_t i = 0; i < partition && k * partition + i < irFrames; i++)
+        {
+          re[i] = ir[(k * partition + i) * impulseChannels + irLeft];
+          im[i] = ir[(k * partition + i) * impulseChannels + irRight];
+        }
+        prepared->fft->forward(re.data(), im.data());
+        prepared->filters[p][k].resize(prepared->bins);
+        split(*prepared, prepared->filters[p][k]);
+      }
+    }
+    return prepared;
+  }
+
+  // Silences the history, so a format played before starts clean; no allocation
+  static void reset(Prepared &prepared)
+  {
+    for (ChannelPair &pair : prepared.pairs)
+    {
+      std::fill(pair.inputLeft.begin(), pair.inputLeft.end(), 0.0f);
+      std::fill(pair.inputRight.begin(), pair.inputRight.end(), 0.0f);
+      std::fill(pair.outputLeft.begin(), pair.outputLeft.end(), 0.0f);
+      std::fill(pair.outputRight.begin(), pair.outputRight.end(), 0.0f);
+      for (Spectrum &spectrum : pair.delayLine)
+      {
+        std::fill(spectrum.leftRe.begin(), spectrum.leftRe.end(), 0.0f);
+        std::fill(spectrum.leftIm.begin(), spectrum.leftIm.end(), 0.0f);
+        std::fill(spectrum.rightRe.begin(), spectrum.rightRe.end(), 0.0f);
+        std::fill(spectrum.rightIm.begin(), spectrum.rightIm.end(), 0.0f);
+      }
+      pair.head = 0;
+    }
+    prepared.fill = 0;
+  }
+
+  // Separates the spectra of two real signals transformed together as re + j*im
+  void split(const Prepared &state, Spectrum &out) const
+  {
+    const std::vector<float> &re = state.re, &im = state.im;
+    std::size_t n = state.fft->getSize();
+    for (std::size_t k = 0; k <= partition; k++)
+    {
+      std::size_t mirror = (n - k) % n;
+      out.leftRe[k] = (re[k] + re[mirror]) * 0.5f;
+      out.leftIm[k] = (im[k] - im[mirror]) * 0.5f;
+      out.rightRe[k] = (im[k] + im[mirror]) * 0.5f;
+      out.rightIm[k] = (re[mirror] - re[k]) * 0.5f;
+    }
+  }
+
+  void processBlock(Prepared &state, std::size_t p)
+  {
+    ChannelPair &pair = state.pairs[p];
+    std::vector<float> &re = state.re, &im = state.im;
+    Spectrum &sum = state.sum;
+    std::size_t bins = state.bins;
+    std::size_t n = state.fft->getSize();
+    std::copy(pair.inputLeft.begin(), pair.inputLeft.end(), re.begin());
+    std::copy(pair.inputRight.begin(), pair.inputRight.end(), im.begin());
+    state.fft->forward(re.data(), im.data());
+    split(state, pair.delayLine[pair.head]);
+
+    std::size_t partitions = pair.delayLine.size();
+    std::fill(sum.leftRe.begin(), sum.leftRe.end(), 0.0f);
+    std::fill(sum.leftIm.begin(), sum.leftIm.end(), 0.0f);
+    std::fill(sum.rightRe.begin(), sum.rightRe.end(), 0.0f);
+    std::fill(sum.rightIm.begin(), sum.rightIm.end(), 0.0f);
+    for (std::size_t k = 0; k < partitions; k++)
+    {
+      const Spectrum &x = pair.delayLine[(pair.head + partitions - k) % partitions];
+      const Spectrum &h = state.filters[p][k];
+      complexMultiplyAccumulate(x.leftRe.data(), x.leftIm.data(), h.leftRe.data(), h.leftIm.data(),
+                                sum.leftRe.data(), sum.leftIm.data(), bins);
+      complexMultiplyAccumulate(x.rightRe.data(), x.rightIm.data(), h.rightRe.data(), h.rightIm.data(),
+                                sum.rightRe.data(), sum.rightIm.data(), bins);
+    }
+    pair.head = (pair.head + 1) % partitions;
+
+    // Recombine as left + j*right over the full, conjugate-symmetric spectrum
+    for (std::size_t k = 0; k <= partition; k++)
+    {
+      re[k] = sum.leftRe[k] - sum.rightIm[k];
+      im[k] = sum.leftIm[k] + sum.rightRe[k];
+    }
+    for (std::size_t k = partition + 1; k < n; k++)
+    {
+      std::size_t mirror = n - k;
+      re[k] = sum.leftRe[mirror] + sum.rightIm[mirror];
+      im[k] = sum.rightRe[mirror] - sum.leftIm[mirror];
+    }
+    state.fft->inverse(re.data(), im.data());
+
+    // Overlap-save: only the second half is free of circular wrap-around
+    std::copy(re.begin() + partition, re.end(), pair.outputLeft.begin());
+    std::copy(im.begin() + partition, im.end(), pair.outputRight.begin());
+    std::copy(pair.inputLeft.begin() + partition, pair.inputLeft.end(), pair.inputLeft.begin());
+    std::copy(pair.inputRight.begin() + partition, pair.inputRight.end(), pair.inputRight.begin());
+  }
+};
+
+// Renders the play queue to a sound file through the same PlaybackSource,
+// queue order and silence trimming as live playback. Volume, which OpenAL applies live, is a gain
+// on every rendered frame here. Time is a count of rendered frames instead of
+// the audio clock, so a render runs as fast as decoding allows and produces
+// the same bytes on every run.
+class OfflineRenderer
+{
+public:
+  struct VolumeChange
+  {
+    double atSeconds;
+    float volume; // 0-100, like the volume slider
+  };
+  struct Options
+  {
+    int startIndex = 0;
+    bool repeat = false;
+    double lengthSeconds = 0;         // 0 plays each queued track once
+    std::vector<VolumeChange> volume; // any order; volume starts at 100
+  };
+
+  OfflineRenderer(const std::vector<std::string> &s, const OutputSettings &o) : songs(s), settings(o) {}
+
+  bool render(const std::string &outputPath, const Options &options)
+  {
+    int count = static_cast<int>(songs.size());
+    if (count == 0)
+      return false;
+    int index = std::max(0, std::min(options.startIndex, count - 1));
+    std::unique_ptr<PlaybackSource> source = openSource(index);
+    if (!source)
+      return false;
+
+    // The output format is the first track's; later tracks are converted to it
+    unsigned int channels = source->getChannelCount();
+    unsigned int rate = source->getSampleRate();
+    sf::OutputSoundFile file;
+    if (!file.openFromFile(outputPath, rate, channels))
+    {
+      std::cout << "[ERROR] Could not create " << outputPath << "\n";
+      return false;
+    }
+
+    std::vector<VolumeChange> changes = options.volume;
+    std::stable_sort(changes.begin(), changes.end(), [](const VolumeChange &a, const VolumeChange &b)
+                     { return a.atSeconds < b.atSeconds; });
+    const std::size_t blockFrames = 4096;
+    sf::Uint64 lengthFrames = static_cast<sf::Uint64>(options.lengthSeconds * rate);
+    sf::Uint64 clock = 0;
+    std::size_t nextChange = 0;
+    float gain = 1.0f;
+    int tracksStarted = 0;
+    int silentTracks = 0;
+    std::vector<float> block, converted, tail;
+    std::vector<sf::Int16> output;
+    DitherQuantizer quantizer;
+    auto started = std::chrono::steady_clock::now();
+
+    while (source)
+    {
+      tracksStarted++;
+      FormatConverter converter(source->getChannelCount(), source->getSampleRate(), channels, rate);
+      block.resize(blockFrames * source->getChannelCount());
+      sf::Uint64 trackStart = clock;
+      bool finished = false;
+      while (true)
+      {
+        sf::Uint64 read = source->readFloat(block.data(), block.size());
+        converter.convert(block.data(), static_cast<std::size_t>(read / source->getChannelCount()), converted);
+        if (read < block.size())
+        {
+          converter.flush(tail);
+          converted.insert(converted.end(), tail.begin(), tail.end());
+        }
+        sf::Uint64 frames = converted.size() / channels;
+        if (lengthFrames > 0)
+          frames = std::min(frames, lengthFrames - clock);
+        for (sf::Uint64 f = 0; f < frames; f++)
+        {
+          while (nextChange < changes.size() && changes[nextChange].atSeconds * rate <= clock + f)
+            gain = changes[nextChange++].volume / 100.0f;
+          if (gain == 1.0f)
+            continue;
+          for (unsigned int c = 0; c < channels; c++)
+            converted[f * channels + c] *= gain;
+        }
+        output.resize(static_cast<std::size_t>(frames * channels));
+        quantizer.process(converted.data(), output.data(), output.size(), source->needsDither() || gain != 1.0f || !converter.isPassthrough());
+        file.write(output.data(), output.size());
+        clock += frames;
+        if (lengthFrames > 0 && clock >= lengthFrames)
+        {
+          finished = true;
+          break;
+        }
+        if (read < block.size())
+          break;
+      }
+      silentTracks = clock == trackStart ? silentTracks + 1 : 0;
+      if (finished || silentTracks >= count)
+        break;
+      if (lengthFrames == 0 && (options.repeat || tracksStarted >= count))
+        break;
+      source.reset();
+      for (int attempt = 0; attempt < count && !source; attempt++)
+      {
+        index = songIndexAfterEnd(index, count, options.repeat);
+        source = openSource(index);
+      }
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    double audio = static_cast<double>(clock) / rate;
+    std::cout << "[DEBUG] Rendered " << audio << " s of audio to " << outputPath << " in " << wall << " s ("
+              << (wall > 0 ? audio / wall : 0) << "x real time)." << std::endl;
+    return true;
+  }
+
+private:
+  std::unique_ptr<PlaybackSource> openSource(int index)
+  {
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(songs[index]);
+    if (!decoder)
+    {
+      std::cout << "[ERROR] Could not open " << songs[index] << " for rendering.\n";
+      return nullptr;
+    }
+    if (*settings.trimSilence && settings.audibleRange)
+      if (std::optional<std::pair<sf::Uint64, sf::Uint64>> range = settings.audibleRange(songs[index]))
+      {
+        unsigned int channels = decoder->getChannelCount();
+        decoder = std::make_unique<TrimmedDecoder>(std::move(decoder), range->first * channels, range->second * channels);
+      }
+    return std::make_unique<PlaybackSource>(std::move(decoder), settings.effects);
+  }
+
+  const std::vector<std::string> &songs;
+  OutputSettings settings;
+};
+
+// Integrated loudness after ITU-R BS.1770: K-weighting, 400 ms blocks every
+// 100 ms, then the absolute (-70 LUFS) and relative (-10 LU) gates. Every
+// channel is weighted 1, which is exact for mono and stereo.
+class LoudnessMeter
+{
+  unsigned int channels;
+  double shelf[5], highpass[5];
+  std::vector<double> state; // four per channel: two biquads, two delays each
+  std::size_t stepFrames, stepFilled = 0;
+  double stepSum = 0;
+  std::deque<double> recentSteps; // the four steps making up the current block
+  std::vector<double> blocks;     // mean square of every 400 ms block
+  float peak = 0;
+
+  static double filter(const double c[5], double input, double *z)
+  {
+    double output = c[0] * input + z[0];
+    z[0] = c[1] * input - c[3] * output + z[1];
+    z[1] = c[2] * input - c[4] * output;
+    return output;
+  }
+
+  static double toLufs(double meanSquare) { return -0.691 + 10 * std::log10(meanSquare); }
+
+public:
+  LoudnessMeter(unsigned int channelCount, unsigned int sampleRate)
+      : channels(channelCount), state(channelCount * 4, 0.0), stepFrames(std::max(1u, sampleRate / 10))
+  {
+    // The BS.1770 prefilter and RLB high-pass, recomputed for any rate
+    const double pi = 3.14159265358979323846;
+    double K = std::tan(pi * 1681.974450955533 / sampleRate), Q = 0.7071752369554196;
+    double Vh = std::pow(10.0, 3.999843853973347 / 20), Vb = std::pow(Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+    shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+    shelf[1] = 2 * (K * K - Vh) / a0;
+    shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+    shelf[3] = 2 * (K * K - 1) / a0;
+    shelf[4] = (1 - K / Q + K * K) / a0;
+    K = std::tan(pi * 38.13547087602444 / sampleRate);
+    Q = 0.5003270373238773;
+    a0 = 1 + K / Q + K * K;
+    highpass[0] = highpass[2] = 1;
+    highpass[1] = -2;
+    highpass[3] = 2 * (K * K - 1) / a0;
+    highpass[4] = (1 - K / Q + K * K) / a0;
+  }
+
+  void add(const float *samples, std::size_t frames)
+  {
+    for (std::size_t f = 0; f < frames; f++)
+    {
+      for (unsigned int c = 0; c < channels; c++)
+      {
+        float sample = samples[f * channels + c];
+        peak = std::max(peak, std::fabs(sample));
+        double weighted = filter(highpass, filter(shelf, sample, &state[c * 4]), &state[c * 4 + 2]);
+        stepSum += weighted * weighted;
+      }
+      if (++stepFilled < stepFrames)
+        continue;
+      recentSteps.push_back(stepSum / stepFrames);
+      stepSum = 0;
+      stepFilled = 0;
+      if (recentSteps.size() > 4)
+        recentSteps.pop_front();
+      if (recentSteps.size() == 4)
+        blocks.push_back((recentSteps[0] + recentSteps[1] + recentSteps[2] + recentSteps[3]) / 4);
+    }
+  }
+
+  // LUFS; -70 or below means silence (or under 400 ms of audio)
+  double integrated() const
+  {
+    double sum = 0;
+    std::size_t count = 0;
+    for (double block : blocks)
+      if (toLufs(block) > -70)
+        sum += block, count++;
+    if (count == 0)
+      return -70;
+    double relativeGate = toLufs(sum / count) - 10;
+    sum = 0;
+    count = 0;
+    for (double block : blocks)
+      if (toLufs(block) > -70 && toLufs(block) > relativeGate)
+        sum += block, count++;
+    return toLufs(sum / count);
+  }
+
+  float samplePeak() const { return peak; }
+};
+
+// Converts a list of tracks to another format, sample rate and loudness,
+// one file per worker thread. Outputs are written under a temporary name
+// and renamed once complete, so an interrupted job never leaves a truncated
+// file behind, and running it again skips every output that is already
+// newer than its source and was made with the same options.
+class BatchTranscoder
+{
+public:
+  struct Options
+  {
+    std::string outputDir = "transcoded";
+    std::string format = "ogg";  // any extension sf::OutputSoundFile writes: ogg, flac, wav
+    unsigned int sampleRate = 0; // 0 keeps each source's rate
+    double loudness = 0;         // target LUFS, e.g. -16; 0 keeps the levels
+    unsigned int jobs = 0;       // 0 uses every core
+  };
+
+  BatchTranscoder(const Options &o) : options(o) {}
+
+  bool run(std::vector<std::string> paths)
+  {
+    // Biggest files first, so a long track never starts last and leaves
+    // the other cores idle at the end of the job
+    std::vector<std::pair<std::uintmax_t, std::string>> queue;
+    std::map<std::filesystem::path, std::string> targets;
+    for (const std::string &path : paths)
+    {
+      // Two sources writing one output would race on its temporary file
+      auto claimed = targets.emplace(outputPathFor(path), path);
+      if (!claimed.second)
+      {
+        if (std::filesystem::path(claimed.first->second).lexically_normal() != std::filesystem::path(path).lexically_normal())
+          fail(path, "same output as " + claimed.first->second);
+        continue;
+      }
+      std::error_code error;
+      std::uintmax_t size = std::filesystem::file_size(path, error);
+      queue.push_back({error ? 0 : size, path});
+    }
+    std::stable_sort(queue.begin(), queue.end(), [](const auto &a, const auto &b)
+                     { return a.first > b.first; });
+
+    unsigned int workers = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    workers = static_cast<unsigned int>(std::min<std::size_t>(workers, std::max<std::size_t>(1, queue.size())));
+    std::cout << "[DEBUG] Transcoding " << queue.size() << " files to " << options.outputDir << " (" << options.format
+              << ") on " << workers << " threads." << std::endl;
+    auto started = std::chrono::steady_clock::now();
+    std::atomic<std::size_t> next{0};
+    std::vector<std::thread> threads;
+    for (unsigned int w = 0; w < workers; w++)
+      threads.emplace_back([&]
+                           {
+                             for (std::size_t i; (i = next++) < queue.size();)
+                               transcode(queue[i].second, queue[i].first);
+                           });
+    for (std::thread &thread : threads)
+      thread.join();
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "[DEBUG] Transcoding finished: " << done << " converted, " << skipped << " already done, " << failed
+              << " failed; " << audioSeconds.load() << " s of audio in " << wall << " s ("
+              << (wall > 0 ? audioSeconds.load() / wall : 0) << "x real time)." << std::endl;
+    return failed == 0;
+  }
+
+private:
+  Options options;
+  std::mutex logMutex;
+  std::atomic<int> done{0}, skipped{0}, failed{0};
+  std::atomic<double> audioSeconds{0};
+
+  // Mirrors the library layout under the output directory. The source
+  // extension stays in the name, so a.ogg and a.mp3 do not meet as a.flac;
+  // absolute paths keep their folders and ".." becomes "_".
+  std::filesystem::path outputPathFor(const std::string &path) const
+  {
+    std::filesystem::path target = options.outputDir;
+    for (const std::filesystem::path &part : std::filesystem::path(path).lexically_normal().relative_path())
+      target /= part == ".." ? std::filesystem::path("_") : part;
+    return target += "." + options.format;
+  }
+
+  // Recorded next to each output; a rerun with other settings redoes it
+  std::string stamp() const
+  {
+    std::ostringstream text;
+    text << options.format << " " << options.sampleRate << " " << options.loudness;
+    return text.str();
+  }
+  static std::filesystem::path stampPathFor(std::filesystem::path target) { return target += ".stamp"; }
+  bool isCurrent(const std::string &path, const std::filesystem::path &target) const
+  {
+    std::error_code error;
+    if (!std::filesystem::exists(target, error) || std::filesystem::last_write_time(target, error) < std::filesystem::last_write_time(path, error) || error)
+      return false;
+    std::ifstream file(stampPathFor(target).string());
+    std::string line;
+    return std::getline(file, line) && line == stamp();
+  }
+
+  void fail(const std::string &path, const std::string &reason)
+  {
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::cout << "[ERROR] Could not transcode " << path << ": " << reason << "\n";
+    failed++;
+  }
+
+  void transcode(const std::string &path, std::uintmax_t bytes)
+  {
+    auto started = std::chrono::steady_clock::now();
+    std::filesystem::path target = outputPathFor(path);
+    std::error_code error;
+    if (isCurrent(path, target))
+    {
+      skipped++;
+      return;
+    }
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+    if (!decoder)
+      return fail(path, "unsupported or unreadable");
+    unsigned int channels = decoder->getChannelCount();
+    unsigned int inRate = decoder->getSampleRate();
+    unsigned int outRate = options.sampleRate ? options.sampleRate : inRate;
+    const std::size_t blockFrames = 8192;
+    std::vector<float> block(blockFrames * channels), converted, tail;
+    std::vector<sf::Int16> output;
+
+    // Loudness needs the whole track before the first sample is written,
+    // so it costs a second decode rather than holding the track in memory
+    float gain = 1.0f;
+    if (options.loudness != 0)
+    {
+      LoudnessMeter meter(channels, inRate);
+      for (sf::Uint64 read = block.size(); read == block.size();)
+      {
+        read = decoder->read(block.data(), block.size());
+        meter.add(block.data(), static_cast<std::size_t>(read / channels));
+      }
+      double measured = meter.integrated();
+      if (measured > -70)
+      {
+        gain = static_cast<float>(std::pow(10.0, (options.loudness - measured) / 20));
+        if (meter.samplePeak() > 0)
+          gain = std::min(gain, 0.891f / meter.samplePeak()); // keep peaks 1 dB below full scale
+      }
+      decoder->seek(0);
+    }
+
+    std::filesystem::create_directories(target.parent_path(), error);
+    std::filesystem::remove(stampPathFor(target), error);
+    std::filesystem::path partial = target;
+    partial.replace_extension(".part." + options.format); // the writer is picked by the last extension
+    {
+      sf::OutputSoundFile file;
+      if (!file.openFromFile(partial.string(), outRate, channels))
+        return fail(path, "cannot write " + partial.string());
+      FormatConverter converter(channels, inRate, channels, outRate);
+      DitherQuantizer quantizer;
+      bool dither = decoder->getBitDepth() > 16 || gain != 1.0f || !converter.isPassthrough();
+      for (sf::Uint64 read = block.size(); read == block.size();)
+      {
+        read = decoder->read(block.data(), block.size());
+        if (gain != 1.0f)
+          for (sf::Uint64 i = 0; i < read; i++)
+            block[i] *= gain;
+        converter.convert(block.data(), static_cast<std::size_t>(read / channels), converted);
+        if (read < block.size())
+        {
+          converter.flush(tail);
+          converted.insert(converted.end(), tail.begin(), tail.end());
+        }
+        output.resize(converted.size());
+        quantizer.process(converted.data(), output.data(), output.size(), dither);
+        file.write(output.data(), output.size());
+      }
+    }
+    std::filesystem::rename(partial, target, error);
+    if (error)
+    {
+      std::filesystem::remove(partial, error);
+      return fail(path, "cannot rename to " + target.string());
+    }
+    std::ofstream(stampPathFor(target).string()) << stamp() << "\n";
+
+    double audio = static_cast<double>(decoder->getSampleCount()) / channels / inRate;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    for (double total = audioSeconds.load(); !audioSeconds.compare_exchange_weak(total, total + audio);)
+      ;
+    done++;
+    std::lock_guard<std::mutex> lock(logMutex);
+    std::cout << "[DEBUG] Transcoded " << path << " -> " << target.generic_string() << ": " << audio << " s in " << wall << " s ("
+              << (wall > 0 ? audio / wall : 0) << "x real time, " << (wall > 0 ? bytes / wall / 1e6 : 0) << " MB/s";
+    if (gain != 1.0f)
+      std::cout << ", gain " << 20 * std::log10(gain) << " dB";
+    std::cout << ")." << std::endl;
+  }
+};
+
+// Offline analysis of whole tracks. A TrackAnalyzer is registered once; for
+// every track it starts a TrackAnalysis, which is fed the decoded audio in
+// consecutive interleaved blocks and finally returns its result as one line
+// of text for the AnalysisStore.
+class TrackAnalysis
+{
+public:
+  virtual void process(const float *samples, std::size_t frames) = 0;
+  virtual std::string finish() = 0;
+  virtual ~TrackAnalysis() {}
+};
+
+class TrackAnalyzer
+{
+public:
+  // Key in the store; changing what an analyzer computes means a new name
+  virtual std::string name() const = 0;
+  virtual std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64 sampleCount) const = 0;
+  // Result for a track that cannot be opened at all; by default there is
+  // none, and the track is tried again next time
+  virtual std::optional<std::string> unreadable() const { return std::nullopt; }
+  virtual ~TrackAnalyzer() {}
+};
+
+// "<integrated LUFS> <sample peak>"
+class LoudnessAnalyzer : public TrackAnalyzer
+{
+  class Analysis : public TrackAnalysis
+  {
+    LoudnessMeter meter;
+
+  public:
+    Analysis(unsigned int channels, unsigned int sampleRate) : meter(channels, sampleRate) {}
+    void process(const float *samples, std::size_t frames) override { meter.add(samples, frames); }
+    std::string finish() override
+    {
+      std::ostringstream result;
+      result << meter.integrated() << " " << meter.samplePeak();
+      return result.str();
+    }
+  };
+
+public:
+  std::string name() const override { return "loudness"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate);
+  }
+};
+
+// Analysis results, one text file per track under `directory`: the source
+// path and modification time, then one "<analyzer> <result>" line each.
+// Results are only handed out while the source is unchanged. Only the most
+// recently used tracks stay in memory, so a pass over a large library does
+// not end up holding all of it. Files are read and written outside the lock,
+// which only covers that memory, so no caller waits on another's disk I/O.
+class AnalysisStore
+{
+public:
+  explicit AnalysisStore(const std::string &dir) : directory(dir)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+  }
+
+  std::optional<std::string> get(const std::string &path, const std::string &analyzer)
+  {
+    long long sourceTime = fileModificationTime(path);
+    std::uint64_t writesBefore;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = entries.find(path);
+      if (found != entries.end())
+      {
+        found->second.lastUsed = ++clock;
+        return resultOf(found->second, analyzer, sourceTime);
+      }
+      writesBefore = writes;
+    }
+    Entry entry = read(path);
+    std::optional<std::string> result = resultOf(entry, analyzer, sourceTime);
+    remember(path, std::move(entry), writesBefore);
+    return result;
+  }
+
+  // Adds results for `path`, keeping the other analyzers' ones if they
+  // describe the same version of the file
+  void put(const std::string &path, long long sourceTime, const std::map<std::string, std::string> &results)
+  {
+    // Writers of one track take turns, so none overwrites another's results
+    std::shared_ptr<std::mutex> turn;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::shared_ptr<std::mutex> &slot = writing[fileFor(path).string()];
+      if (!slot)
+        slot = std::make_shared<std::mutex>();
+      turn = slot;
+    }
+    {
+      std::lock_guard<std::mutex> writeLock(*turn);
+      std::optional<Entry> found = cached(path);
+      Entry entry = found ? *found : read(path);
+      if (entry.sourceTime != sourceTime)
+        entry = Entry{sourceTime, {}, 0};
+      for (const auto &[name, result] : results)
+        entry.results[name] = result;
+      std::filesystem::path target = fileFor(path), partial = target;
+      partial.replace_extension(".part");
+      {
+        std::ofstream file(partial.string());
+        file << "source " << path << "\n"
+             << "time " << entry.sourceTime << "\n";
+        for (const auto &[name, result] : entry.results)
+          file << name << " " << result << "\n";
+      }
+      std::error_code error;
+      std::filesystem::rename(partial, target, error);
+      std::lock_guard<std::mutex> lock(mutex);
+      writes++;
+      store(path, std::move(entry));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (turn.use_count() == 2) // only the map and this call still hold it
+      writing.erase(fileFor(path).string());
+  }
+
+private:
+  struct Entry
+  {
+    long long sourceTime = -1;
+    std::map<std::string, std::string> results;
+    std::uint64_t lastUsed = 0;
+  };
+
+  static const std::size_t CachedEntries = 256;
+
+  // `mutex` guards only the members below, never file access
+  std::string directory;
+  std::map<std::string, Entry> entries;
+  std::map<std::string, std::shared_ptr<std::mutex>> writing; // per file being written
+  std::uint64_t clock = 0;
+  std::uint64_t writes = 0;
+  std::mutex mutex;
+
+  std::filesystem::path fileFor(const std::string &path) const
+  {
+    std::ostringstream name;
+    name << std::hex << std::hash<std::string>{}(path) << ".txt";
+    return std::filesystem::path(directory) / name.str();
+  }
+
+  std::optional<Entry> cached(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(path);
+    if (found == entries.end())
+      return std::nullopt;
+    found->second.lastUsed = ++clock;
+    return found->second;
+  }
+
+  static std::optional<std::string> resultOf(const Entry &entry, const std::string &analyzer, long long sourceTime)
+  {
+    auto it = entry.results.find(analyzer);
+    if (it == entry.results.end() || entry.sourceTime != sourceTime)
+      return std::nullopt;
+    return it->second;
+  }
+
+  // Caches what get() read, unless a put may have changed the file meanwhile
+  void remember(const std::string &path, Entry entry, std::uint64_t writesBefore)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (writes == writesBefore && !entries.count(path))
+      store(path, std::move(entry));
+  }
+
+  // With `mutex` held
+  void store(const std::string &path, Entry entry)
+  {
+    if (!entries.count(path) && entries.size() >= CachedEntries)
+      entries.erase(std::min_element(entries.begin(), entries.end(), [](const auto &a, const auto &b)
+                                     { return a.second.lastUsed < b.second.lastUsed; }));
+    entry.lastUsed = ++clock;
+    entries[path] = std::move(entry);
+  }
+
+  Entry read(const std::string &path) const
+  {
+    Entry entry;
+    std::ifstream file(fileFor(path).string());
+    std::string line;
+    if (!std::getline(file, line) || line.rfind("source ", 0) != 0 || line.substr(7) != path)
+      return entry; // missing, or a hash collision with another track
+    while (std::getline(file, line))
+    {
+      std::size_t space = line.find(' ');
+      if (space == std::string::npos)
+        continue;
+      if (line.compare(0, space, "time") == 0)
+        entry.sourceTime = std::atoll(line.c_str() + space + 1);
+      else
+        entry.results[line.substr(0, space)] = line.substr(space + 1);
+    }
+    return entry;
+  }
+};
+
+// Runs every registered analyzer over a set of tracks, decoding each track
+// once and handing the same blocks to all analyzers that still lack a
+// result for it. Tracks wait in one queue per priority, so the playing
+// track jumps ahead of a background library scan; queuing a track again at
+// a higher priority moves it up, and queuing one that is being analyzed
+// does nothing.
+class LibraryAnalyzer
+{
+public:
+  enum Priority
+  {
+    Background,
+    Visible,
+    Playing,
+    PriorityCount
+  };
+
+  struct Progress
+  {
+    std::size_t done = 0, total = 0;
+  };
+
+  LibraryAnalyzer(std::shared_ptr<AnalysisStore> s, unsigned int workerCount, bool idle) : store(std::move(s)), idlePriority(idle)
+  {
+    for (unsigned int i = 0; i < std::max(1u, workerCount); i++)
+      workers.emplace_back(&LibraryAnalyzer::run, this);
+  }
+
+  ~LibraryAnalyzer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    generation++;
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  void add(std::shared_ptr<TrackAnalyzer> analyzer)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    analyzers.push_back(std::move(analyzer));
+  }
+
+  void enqueue(const std::vector<std::string> &paths, Priority priority)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::string &path : paths)
+    {
+      if (isAnalyzing(path))
+        continue;
+      auto it = queued.find(path);
+      if (it != queued.end())
+      {
+        if (it->second >= priority)
+          continue;
+        std::deque<std::string> &from = queues[it->second];
+        from.erase(std::find(from.begin(), from.end(), path));
+        it->second = priority;
+      }
+      else
+      {
+        queued[path] = priority;
+      }
+      queues[priority].push_back(path);
+    }
+    wake.notify_all();
+  }
+
+  // Drops everything queued and abandons the tracks being analyzed
+  void cancel()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::deque<std::string> &queue : queues)
+      queue.clear();
+    queued.clear();
+    done = 0;
+    generation++;
+    idle.notify_all();
+  }
+
+  Progress progress()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {done, done + queued.size() + analyzing.size()};
+  }
+
+  // Tracks finished since the last call, whether analyzed now or already
+  // stored, so consumers of the results need not re-read the whole library
+  std::vector<std::string> takeFinished()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> taken;
+    taken.swap(finished);
+    return taken;
+  }
+
+  // Blocks until the queue has drained
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]
+              { return queued.empty() && analyzing.empty(); });
+  }
+
+private:
+  std::shared_ptr<AnalysisStore> store;
+  bool idlePriority;
+  std::vector<std::shared_ptr<TrackAnalyzer>> analyzers;
+  std::array<std::deque<std::string>, PriorityCount> queues;
+  std::map<std::string, Priority> queued;
+  std::multimap<std::string, unsigned> analyzing; // and the generation each started in
+  std::size_t done = 0;
+  std::vector<std::string> finished;
+  std::atomic<unsigned> generation{0};
+  std::mutex mutex;
+  std::condition_variable wake, idle;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  // Abandoned by cancel() does not count, it ends without a result
+  bool isAnalyzing(const std::string &path) const
+  {
+    auto range = analyzing.equal_range(path);
+    return std::any_of(range.first, range.second, [this](const auto &entry)
+                       { return entry.second == generation; });
+  }
+
+  bool pop(std::string &path)
+  {
+    for (int p = PriorityCount - 1; p >= 0; p--)
+      if (!queues[p].empty())
+      {
+        path = queues[p].front();
+        queues[p].pop_front();
+        queued.erase(path);
+        return true;
+      }
+    return false;
+  }
+
+  void analyze(const std::string &path, const std::vector<std::shared_ptr<TrackAnalyzer>> &all, unsigned int startedIn)
+  {
+    long long sourceTime = fileModificationTime(path);
+    std::vector<std::shared_ptr<TrackAnalyzer>> missing;
+    for (const auto &analyzer : all)
+      if (!store->get(path, analyzer->name()))
+        missing.push_back(analyzer);
+    if (missing.empty())
+      return;
+    std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+    if (!decoder)
+    {
+      std::cout << "[ERROR] Could not open " << path << " for analysis.\n";
+      std::map<std::string, std::string> results;
+      for (const auto &analyzer : missing)
+        if (std::optional<std::string> result = analyzer->unreadable())
+          results[analyzer->name()] = *result;
+      if (!results.empty())
+        store->put(path, sourceTime, results);
+      return;
+    }
+    unsigned int channels = decoder->getChannelCount();
+    std::vector<std::unique_ptr<TrackAnalysis>> running;
+    for (const auto &analyzer : missing)
+      running.push_back(analyzer->start(channels, decoder->getSampleRate(), decoder->getSampleCount()));
+    std::vector<float> block(8192 * channels);
+    for (sf::Uint64 read = block.size(); read == block.size();)
+    {
+      if (generation != startedIn)
+        return;
+      read = decoder->read(block.data(), block.size());
+      for (auto &analysis : running)
+        analysis->process(block.data(), static_cast<std::size_t>(read / channels));
+    }
+    std::map<std::string, std::string> results;
+    for (std::size_t i = 0; i < running.size(); i++)
+      results[missing[i]->name()] = running[i]->finish();
+    store->put(path, sourceTime, results);
+  }
+
+  void run()
+  {
+    if (idlePriority)
+      lowerCurrentThreadPriority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      std::string path;
+      wake.wait(lock, [&]
+                { return stopping || pop(path); });
+      if (stopping)
+        return;
+      std::vector<std::shared_ptr<TrackAnalyzer>> all = analyzers;
+      unsigned int startedIn = generation;
+      auto claim = analyzing.emplace(path, startedIn);
+      lock.unlock();
+      analyze(path, all, startedIn);
+      lock.lock();
+      analyzing.erase(claim);
+      if (generation == startedIn)
+      {
+        done++;
+        finished.push_back(path);
+      }
+      if (queued.empty() && analyzing.empty())
+        idle.notify_all();
+    }
+  }
+};
+
+// Min, max and sum of squares of `count` samples, folded into the running values
+void reducePeaks(const float *in, std::size_t count, float &low, float &high, float &sumSquares)
+{
+  std::size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  if (count >= 8)
+  {
+    __m256 lows = _mm256_set1_ps(low), highs = _mm256_set1_ps(high), sums = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8)
+    {
+      __m256 x = _mm256_loadu_ps(in + i);
+      lows = _mm256_min_ps(lows, x);
+      highs = _mm256_max_ps(highs, x);
+      sums = _mm256_fmadd_ps(x, x, sums);
+    }
+    alignas(32) float lane[3][8];
+    _mm256_store_ps(lane[0], lows);
+    _mm256_store_ps(lane[1], highs);
+    _mm256_store_ps(lane[2], sums);
+    for (int k = 0; k < 8; k++)
+    {
+      low = std::min(low, lane[0][k]);
+      high = std::max(high, lane[1][k]);
+      sumSquares += lane[2][k];
+    }
+  }
+#elif defined(__SSE2__) || defined(_M_X64)
+  if (count >= 4)
+  {
+    __m128 lows = _mm_set1_ps(low), highs = _mm_set1_ps(high), sums = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128 x = _mm_loadu_ps(in + i);
+      lows = _mm_min_ps(lows, x);
+      highs = _mm_max_ps(highs, x);
+      sums = _mm_add_ps(sums, _mm_mul_ps(x, x));
+    }
+    alignas(16) float lane[3][4];
+    _mm_store_ps(lane[0], lows);
+    _mm_store_ps(lane[1], highs);
+    _mm_store_ps(lane[2], sums);
+    for (int k = 0; k < 4; k++)
+    {
+      low = std::min(low, lane[0][k]);
+      high = std::max(high, lane[1][k]);
+      sumSquares += lane[2][k];
+    }
+  }
+#endif
+  for (; i < count; i++)
+  {
+    low = std::min(low, in[i]);
+    high = std::max(high, in[i]);
+    sumSquares += in[i] * in[i];
+  }
+}
+
+std::string encodeBase64(const std::vector<unsigned char> &bytes)
+{
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string text;
+  text.reserve((bytes.size() + 2) / 3 * 4);
+  for (std::size_t i = 0; i < bytes.size(); i += 3)
+  {
+    std::uint32_t group = bytes[i] << 16;
+    if (i + 1 < bytes.size())
+      group |= bytes[i + 1] << 8;
+    if (i + 2 < bytes.size())
+      group |= bytes[i + 2];
+    text += digits[group >> 18];
+    text += digits[(group >> 12) & 63];
+    text += i + 1 < bytes.size() ? digits[(group >> 6) & 63] : '=';
+    text += i + 2 < bytes.size() ? digits[group & 63] : '=';
+  }
+  return text;
+}
+
+std::vector<unsigned char> decodeBase64(const std::string &text)
+{
+  std::vector<unsigned char> bytes;
+  bytes.reserve(text.size() / 4 * 3);
+  std::uint32_t group = 0;
+  int bits = 0;
+  for (char c : text)
+  {
+    int value = c >= 'A' && c <= 'Z' ? c - 'A' : c >= 'a' && c <= 'z' ? c - 'a' + 26 : c >= '0' && c <= '9' ? c - '0' + 52 : c == '+' ? 62 : c == '/' ? 63 : -1;
+    if (value < 0)
+      continue; // padding
+    group = (group << 6) | static_cast<std::uint32_t>(value);
+    bits += 6;
+    if (bits >= 8)
+    {
+      bits -= 8;
+      bytes.push_back(static_cast<unsigned char>(group >> bits));
+    }
+  }
+  return bytes;
+}
+
+// Min/max/RMS overview of a track. Level 0 has one bin per BinFrames frames
+// (all channels together) and each level above halves the one below, so
+// any stretch of the track can be drawn at any width from the coarsest
+// level that still has a bin per pixel, without touching the audio. Only
+// level 0 is stored, three bytes a bin; the rest is rebuilt on load.
+class PeakPyramid
+{
+public:
+  static constexpr std::size_t BinFrames = 512;
+
+  struct Bin
+  {
+    float low = 0, high = 0, rms = 0;
+  };
+
+  static std::string encode(const std::vector<Bin> &bins, unsigned int sampleRate)
+  {
+    std::vector<unsigned char> bytes;
+    bytes.reserve(bins.size() * 3);
+    for (const Bin &bin : bins)
+    {
+      bytes.push_back(static_cast<unsigned char>(static_cast<std::int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, bin.low)) * 127))));
+      bytes.push_back(static_cast<unsigned char>(static_cast<std::int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, bin.high)) * 127))));
+      bytes.push_back(static_cast<unsigned char>(std::lround(std::max(0.0f, std::min(1.0f, bin.rms)) * 255)));
+    }
+    return std::to_string(sampleRate) + " " + encodeBase64(bytes);
+  }
+
+  bool parse(const std::string &stored)
+  {
+    std::size_t space = stored.find(' ');
+    sampleRate = static_cast<unsigned int>(std::atoi(stored.c_str()));
+    if (space == std::string::npos || sampleRate == 0)
+      return false;
+    std::vector<unsigned char> bytes = decodeBase64(stored.substr(space + 1));
+    levels.assign(1, std::vector<Bin>(bytes.size() / 3));
+    for (std::size_t i = 0; i < levels[0].size(); i++)
+    {
+      levels[0][i].low = static_cast<std::int8_t>(bytes[i * 3]) / 127.0f;
+      levels[0][i].high = static_cast<std::int8_t>(bytes[i * 3 + 1]) / 127.0f;
+      levels[0][i].rms = bytes[i * 3 + 2] / 255.0f;
+    }
+    while (levels.back().size() > 1)
+    {
+      const std::vector<Bin> &below = levels.back();
+      std::vector<Bin> level((below.size() + 1) / 2);
+      for (std::size_t i = 0; i < level.size(); i++)
+        level[i] = merge(below.data() + i * 2, std::min<std::size_t>(2, below.size() - i * 2));
+      levels.push_back(std::move(level));
+    }
+    return !levels[0].empty();
+  }
+
+  double getDuration() const { return static_cast<double>(levels.empty() ? 0 : levels[0].size()) * BinFrames / sampleRate; }
+
+  // `columns` bins evenly covering [start, end) seconds
+  void summarize(double start, double end, std::size_t columns, std::vector<Bin> &out) const
+  {
+    out.assign(columns, Bin());
+    if (levels.empty() || columns == 0 || end <= start)
+      return;
+    double binsPerColumn = (end - start) * sampleRate / BinFrames / columns;
+    std::size_t level = 0;
+    while (level + 1 < levels.size() && binsPerColumn >= 2)
+    {
+      binsPerColumn /= 2;
+      level++;
+    }
+    const std::vector<Bin> &bins = levels[level];
+    double binSeconds = static_cast<double>(BinFrames << level) / sampleRate;
+    for (std::size_t c = 0; c < columns; c++)
+    {
+      double from = start + (end - start) * c / columns, to = start + (end - start) * (c + 1) / columns;
+      std::size_t first = static_cast<std::size_t>(std::max(0.0, from / binSeconds));
+      std::size_t last = std::max(first + 1, static_cast<std::size_t>(std::ceil(to / binSeconds)));
+      if (first < bins.size())
+        out[c] = merge(bins.data() + first, std::min(last, bins.size()) - first);
+    }
+  }
+
+private:
+  unsigned int sampleRate = 44100;
+  std::vector<std::vector<Bin>> levels;
+
+  static Bin merge(const Bin *bins, std::size_t count)
+  {
+    Bin merged = bins[0];
+    float squares = bins[0].rms * bins[0].rms;
+    for (std::size_t i = 1; i < count; i++)
+    {
+      merged.low = std::min(merged.low, bins[i].low);
+      merged.high = std::max(merged.high, bins[i].high);
+      squares += bins[i].rms * bins[i].rms;
+    }
+    merged.rms = std::sqrt(squares / count);
+    return merged;
+  }
+};
+
+// "<sample rate> <level 0 of a PeakPyramid, base64>"
+class PeakAnalyzer : public TrackAnalyzer
+{
+  class Analysis : public TrackAnalysis
+  {
+    unsigned int channels, sampleRate;
+    std::vector<PeakPyramid::Bin> bins;
+    std::size_t filled = 0; // frames in the bin being built
+    float low = 1, high = -1, sumSquares = 0;
+
+    void closeBin()
+    {
+      PeakPyramid::Bin bin;
+      bin.low = std::min(low, 0.0f);
+      bin.high = std::max(high, 0.0f);
+      bin.rms = std::sqrt(sumSquares / (filled * channels));
+      bins.push_back(bin);
+      filled = 0;
+      low = 1;
+      high = -1;
+      sumSquares = 0;
+    }
+
+  public:
+    Analysis(unsigned int ch, unsigned int rate, sf::Uint64 sampleCount) : channels(ch), sampleRate(rate)
+    {
+      bins.reserve(static_cast<std::size_t>(sampleCount / ch / PeakPyramid::BinFrames + 1));
+    }
+    void process(const float *samples, std::size_t frames) override
+    {
+      while (frames > 0)
+      {
+        std::size_t take = std::min(frames, PeakPyramid::BinFrames - filled);
+        reducePeaks(samples, take * channels, low, high, sumSquares);
+        samples += take * channels;
+        frames -= take;
+        filled += take;
+        if (filled == PeakPyramid::BinFrames)
+          closeBin();
+      }
+    }
+    std::string finish() override
+    {
+      if (filled > 0)
+        closeBin();
+      return PeakPyramid::encode(bins, sampleRate);
+    }
+  };
+
+public:
+  std::string name() const override { return "peaks"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64 sampleCount) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate, sampleCount);
+  }
+};
+
+// Acoustic fingerprint of a track's first two minutes, after the chroma
+// approach: the audio is mixed to mono and brought down to about 11 kHz,
+// and about eight times a second a 4096-point FFT is folded into the
+// energy of the 12 pitch classes. Each frame then gives a 32-bit
+// sub-fingerprint, one bit per comparison between neighbouring pitch
+// classes or consecutive frames. Every comparison is between sums over two
+// frames rather than single bins, so a lossy re-encode of the same
+// recording flips only a few bits.
+// "<sub-fingerprints, 32-bit little-endian, base64>"
+class FingerprintAnalyzer : public TrackAnalyzer
+{
+public:
+  static constexpr double TargetRate = 11025;
+  static const std::size_t FrameSize = 4096, Hop = 1365, MaxFrames = 969; // 120 s
+
+  class Analysis : public TrackAnalysis
+  {
+    unsigned int channels;
+    double step; // input samples per resampled one
+    double phase = 0, sum = 0;
+    unsigned int summed = 0;
+    std::vector<float> pending, re, im, hann;
+    std::vector<int> pitchClass; // per FFT bin, -1 outside 28 Hz - 3.5 kHz
+    std::array<std::array<float, 12>, 4> chroma{}; // newest first
+    std::size_t frames = 0;
+    std::vector<std::uint32_t> prints;
+    Fft fft{FrameSize};
+
+    void analyzeFrame()
+    {
+      for (std::size_t i = 0; i < FrameSize; i++)
+      {
+        re[i] = pending[i] * hann[i];
+        im[i] = 0;
+      }
+      fft.forward(re.data(), im.data());
+      std::rotate(chroma.rbegin(), chroma.rbegin() + 1, chroma.rend());
+      std::array<float, 12> &c = chroma[0];
+      c.fill(0);
+      for (std::size_t k = 0; k < pitchClass.size(); k++)
+        if (pitchClass[k] >= 0)
+          c[pitchClass[k]] += re[k] * re[k] + im[k] * im[k];
+      float total = 0;
+      for (float energy : c)
+        total += energy;
+      for (float &energy : c)
+        energy = total > 1e-6f ? energy / total : 0;
+      if (++frames < 4)
+        return;
+      auto recent = [&](int i)
+      { return chroma[0][i % 12] + chroma[1][i % 12]; };
+      std::uint32_t print = 0;
+      for (int i = 0; i < 12; i++)
+      {
+        print |= std::uint32_t(recent(i) > recent(i + 1)) << i;
+        print |= std::uint32_t(recent(i) > chroma[2][i] + chroma[3][i]) << (12 + i);
+        if (i < 8)
+          print |= std::uint32_t(recent(i) > recent(i + 7)) << (24 + i);
+      }
+      prints.push_back(print);
+    }
+
+  public:
+    Analysis(unsigned int ch, unsigned int sampleRate)
+        : channels(ch), step(std::max(1.0, sampleRate / TargetRate)), re(FrameSize), im(FrameSize), hann(FrameSize), pitchClass(FrameSize / 2, -1)
+    {
+      pending.reserve(FrameSize);
+      double rate = sampleRate / step;
+      for (std::size_t i = 0; i < FrameSize; i++)
+        hann[i] = 0.5f - 0.5f * std::cos(2 * 3.14159265358979f * i / FrameSize);
+      for (std::size_t k = 1; k < pitchClass.size(); k++)
+      {
+        double frequency = k * rate / FrameSize;
+        if (frequency >= 28 && frequency <= 3520)
+          pitchClass[k] = (static_cast<int>(std::lround(12 * std::log2(frequency / 440))) % 12 + 12) % 12;
+      }
+    }
+
+    void process(const float *samples, std::size_t count) override
+    {
+      for (std::size_t f = 0; f < count && prints.size() < MaxFrames; f++)
+      {
+        // Box-filter decimation: good enough for pitch classes below 3.5 kHz
+        for (unsigned int c = 0; c < channels; c++)
+          sum += samples[f * channels + c];
+        summed += channels;
+        phase += 1;
+        if (phase < step)
+          continue;
+        phase -= step;
+        pending.push_back(static_cast<float>(sum / summed));
+        sum = 0;
+        summed = 0;
+        if (pending.size() == FrameSize)
+        {
+          analyzeFrame();
+          pending.erase(pending.begin(), pending.begin() + Hop);
+        }
+      }
+    }
+
+    std::string finish() override
+    {
+      std::vector<unsigned char> bytes;
+      bytes.reserve(prints.size() * 4);
+      for (std::uint32_t print : prints)
+        for (int b = 0; b < 4; b++)
+          bytes.push_back(static_cast<unsigned char>(print >> (8 * b)));
+      return encodeBase64(bytes);
+    }
+  };
+
+  std::string name() const override { return "fingerprint"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate);
+  }
+
+  static std::vector<std::uint32_t> parse(const std::string &stored)
+  {
+    std::vector<unsigned char> bytes = decodeBase64(stored);
+    std::vector<std::uint32_t> prints(bytes.size() / 4);
+    for (std::size_t i = 0; i < prints.size(); i++)
+      prints[i] = bytes[i * 4] | bytes[i * 4 + 1] << 8 | bytes[i * 4 + 2] << 16 | std::uint32_t(bytes[i * 4 + 3]) << 24;
+    return prints;
+  }
+
+  // 1 for the same recording, falling to 0 for unrelated ones. Sub-fingerprints
+  // that match exactly vote for how far one track is shifted against the
+  // other; the bit error rate over the overlap at the winning shift decides.
+  static float similarity(const std::vector<std::uint32_t> &a, const std::vector<std::uint32_t> &b)
+  {
+    std::map<std::uint32_t, std::size_t> first;
+    for (std::size_t i = a.size(); i-- > 0;)
+      first[a[i]] = i;
+    std::map<long, int> votes;
+    for (std::size_t j = 0; j < b.size(); j++)
+    {
+      auto it = first.find(b[j]);
+      if (it != first.end() && b[j] != 0)
+        votes[static_cast<long>(j) - static_cast<long>(it->second)]++;
+    }
+    if (votes.empty())
+      return 0;
+    long shift = std::max_element(votes.begin(), votes.end(), [](const auto &x, const auto &y)
+                                  { return x.second < y.second; })
+                     ->first;
+    std::size_t errors = 0, overlap = 0;
+    for (std::size_t i = static_cast<std::size_t>(std::max(0L, -shift)); i < a.size() && i + shift < b.size(); i++, overlap++)
+      errors += std::bitset<32>(a[i] ^ b[i + shift]).count();
+    if (overlap < 40) // five seconds
+      return 0;
+    return std::max(0.0f, 1 - 2.0f * errors / (32.0f * overlap));
+  }
+};
+
+struct DuplicateGroup
+{
+  std::vector<std::string> paths;
+  std::vector<float> confidence; // per path, its best match within the group
+};
+
+struct DuplicateReport
+{
+  std::vector<DuplicateGroup> groups;
+  std::size_t fingerprinted = 0; // tracks that had a fingerprint to compare
+};
+
+// Groups the tracks whose fingerprints match. Comparing every pair would
+// not scale past a few thousand tracks, so each track is first reduced to
+// a sketch: the 64 of its sub-fingerprints that hash lowest. Re-encodes of
+// one recording share many exact sub-fingerprints and therefore usually
+// several sketch entries, while unrelated tracks almost never share two.
+// One sorted array of (hash, track) is the inverted index; only pairs that
+// meet in it at least twice are compared in full. Values shared by very
+// many tracks (near-silence, test tones) are skipped like stop words.
+DuplicateReport findDuplicates(const std::vector<std::string> &paths, AnalysisStore &store)
+{
+  const std::size_t SketchSize = 64, MaxPostings = 32;
+  const float MinSimilarity = 0.5f;
+  auto mix = [](std::uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    return x ^ (x >> 16);
+  };
+
+  DuplicateReport report;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> index; // (hash, track)
+  for (std::size_t t = 0; t < paths.size(); t++)
+  {
+    std::optional<std::string> stored = store.get(paths[t], "fingerprint");
+    if (!stored)
+      continue;
+    std::vector<std::uint32_t> hashes;
+    for (std::uint32_t print : FingerprintAnalyzer::parse(*stored))
+      if (print != 0 && print != 0xffffffffu)
+        hashes.push_back(mix(print));
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    hashes.resize(std::min(hashes.size(), SketchSize));
+    for (std::uint32_t hash : hashes)
+      index.emplace_back(hash, static_cast<std::uint32_t>(t));
+    report.fingerprinted++;
+  }
+  std::sort(index.begin(), index.end());
+
+  std::vector<std::uint64_t> pairs; // lower track << 32 | higher track, once per shared hash
+  for (std::size_t run = 0, end; run < index.size(); run = end)
+  {
+    for (end = run + 1; end < index.size() && index[end].first == index[run].first; end++)
+      ;
+    if (end - run > MaxPostings)
+      continue;
+    for (std::size_t i = run; i < end; i++)
+      for (std::size_t j = i + 1; j < end; j++)
+        pairs.push_back(std::uint64_t(index[i].second) << 32 | index[j].second);
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  // Candidates that pass the full comparison are joined into groups
+  std::vector<std::uint32_t> parent(paths.size());
+  std::vector<float> best(paths.size(), 0);
+  for (std::size_t i = 0; i < parent.size(); i++)
+    parent[i] = static_cast<std::uint32_t>(i);
+  std::function<std::uint32_t(std::uint32_t)> root = [&](std::uint32_t t)
+  { return parent[t] == t ? t : parent[t] = root(parent[t]); };
+  for (std::size_t run = 0, end; run < pairs.size(); run = end)
+  {
+    for (end = run + 1; end < pairs.size() && pairs[end] == pairs[run]; end++)
+      ;
+    if (end - run < 2)
+      continue;
+    std::uint32_t a = static_cast<std::uint32_t>(pairs[run] >> 32), b = static_cast<std::uint32_t>(pairs[run]);
+    std::optional<std::string> storedA = store.get(paths[a], "fingerprint"), storedB = store.get(paths[b], "fingerprint");
+    if (!storedA || !storedB)
+      continue;
+    float score = FingerprintAnalyzer::similarity(FingerprintAnalyzer::parse(*storedA), FingerprintAnalyzer::parse(*storedB));
+    if (score < MinSimilarity)
+      continue;
+    best[a] = std::max(best[a], score);
+    best[b] = std::max(best[b], score);
+    parent[root(a)] = root(b);
+  }
+
+  std::map<std::uint32_t, DuplicateGroup> groups;
+  for (std::size_t t = 0; t < paths.size(); t++)
+    if (best[t] > 0)
+    {
+      DuplicateGroup &group = groups[root(static_cast<std::uint32_t>(t))];
+      group.paths.push_back(paths[t]);
+      group.confidence.push_back(best[t]);
+    }
+  for (auto &entry : groups)
+    report.groups.push_back(std::move(entry.second));
+  return report;
+}
+
+// True if any of in[0..8) is louder than `threshold`
+inline bool anyLouder(const float *in, float threshold)
+{
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_loadu_ps(in));
+  return _mm256_movemask_ps(_mm256_cmp_ps(magnitude, _mm256_set1_ps(threshold), _CMP_GT_OQ)) != 0;
+#elif defined(__SSE2__) || defined(_M_X64)
+  __m128 sign = _mm_set1_ps(-0.0f), limit = _mm_set1_ps(threshold);
+  __m128 low = _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_loadu_ps(in)), limit);
+  __m128 high = _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_loadu_ps(in + 4)), limit);
+  return _mm_movemask_ps(_mm_or_ps(low, high)) != 0;
+#else
+  for (int k = 0; k < 8; k++)
+    if (std::fabs(in[k]) > threshold)
+      return true;
+  return false;
+#endif
+}
+
+// Index of the first sample louder than `threshold`, or `count` if none is
+std::size_t findFirstLouder(const float *in, std::size_t count, float threshold)
+{
+  std::size_t i = 0;
+  while (i + 8 <= count && !anyLouder(in + i, threshold))
+    i += 8;
+  while (i < count && std::fabs(in[i]) <= threshold)
+    i++;
+  return i;
+}
+
+// Index of the last sample louder than `threshold`, or `count` if none is
+std::size_t findLastLouder(const float *in, std::size_t count, float threshold)
+{
+  std::size_t i = count;
+  while (i >= 8 && !anyLouder(in + i - 8, threshold))
+    i -= 8;
+  while (i > 0)
+    if (std::fabs(in[--i]) > threshold)
+      return i;
+  return count;
+}
+
+// "<first audible frame> <end of the audible part>", the frames of a track
+// worth playing. The music starts where the signal first rises above -60
+// dBFS, taken back to the start of the run above -70 dBFS (with gaps of up
+// to 20 ms) that it belongs to, so a fade-in keeps its first notes; it ends
+// after the last sample above -70 dBFS, so fade-outs and reverb tails play
+// out. A track that never gets loud enough is kept whole.
+class SilenceAnalyzer : public TrackAnalyzer
+{
+  class Analysis : public TrackAnalysis
+  {
+    static constexpr float Start = 0.001f;     // -60 dBFS
+    static constexpr float Audible = 0.000316f; // -70 dBFS
+    unsigned int channels;
+    sf::Uint64 hold;          // quiet samples that end a run
+    sf::Uint64 seen = 0;      // interleaved samples processed
+    bool inRun = false, started = false;
+    sf::Uint64 runStart = 0, quiet = 0;
+    sf::Uint64 first = 0, last = 0; // sample indices once started
+
+  public:
+    Analysis(unsigned int ch, unsigned int sampleRate) : channels(ch), hold(static_cast<sf::Uint64>(sampleRate) * ch / 50) {}
+    void process(const float *samples, std::size_t frames) override
+    {
+      std::size_t count = frames * channels, i = 0;
+      while (!started && i < count)
+      {
+        if (!inRun)
+        {
+          i += findFirstLouder(samples + i, count - i, Audible);
+          if (i == count)
+            break;
+          inRun = true;
+          runStart = seen + i;
+          quiet = 0;
+        }
+        float magnitude = std::fabs(samples[i]);
+        if (magnitude > Start)
+        {
+          started = true;
+          first = runStart;
+        }
+        else if (magnitude > Audible)
+          quiet = 0;
+        else if (++quiet > hold)
+          inRun = false;
+        i++;
+      }
+      if (started)
+      {
+        std::size_t loud = findLastLouder(samples, count, Audible);
+        if (loud < count)
+          last = std::max(last, seen + loud);
+      }
+      seen += count;
+    }
+    std::string finish() override
+    {
+      std::ostringstream result;
+      if (started)
+        result << first / channels << " " << last / channels + 1;
+      else
+        result << 0 << " " << seen / channels;
+      return result.str();
+    }
+  };
+
+public:
+  std::string name() const override { return "silence"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate);
+  }
+
+  // The stored frame range, if it is well formed
+  static std::optional<std::pair<sf::Uint64, sf::Uint64>> parse(const std::string &stored)
+  {
+    std::istringstream in(stored);
+    sf::Uint64 first = 0, end = 0;
+    if (!(in >> first >> end) || end <= first)
+      return std::nullopt;
+    return std::make_pair(first, end);
+  }
+};
+
+// "<BPM> <confidence> <first beat, seconds>": tempo and beat grid. The onset
+// strength envelope is the spectral flux of a 512-point FFT every 64 samples
+// of a mono 11 kHz copy (172 values a second). Its autocorrelation scores
+// each tempo from 60 to 200 BPM through a comb over the first four multiples
+// of the beat period, weighted toward 120 BPM to settle octave errors; the
+// grid starts at the offset whose comb through the envelope collects the
+// most onset strength. Confidence is the envelope's normalized
+// autocorrelation at the beat period, so 0 for no pulse at all.
+class TempoAnalyzer : public TrackAnalyzer
+{
+public:
+  static constexpr double TargetRate = 11025;
+  static const std::size_t FrameSize = 512, Hop = 64;
+
+  struct Tempo
+  {
+    double bpm = 0, confidence = 0, firstBeat = 0;
+  };
+
+  class Analysis : public TrackAnalysis
+  {
+    unsigned int channels;
+    double step; // input samples per resampled one
+    double rate; // resampled rate
+    double phase = 0, sum = 0;
+    unsigned int summed = 0;
+    std::vector<float> pending, re, im, hann, previous;
+    std::vector<float> envelope;
+    Fft fft{FrameSize};
+
+    void analyzeFrame()
+    {
+      for (std::size_t i = 0; i < FrameSize; i++)
+      {
+        re[i] = pending[i] * hann[i];
+        im[i] = 0;
+      }
+      fft.forward(re.data(), im.data());
+      float flux = 0;
+      for (std::size_t k = 1; k < previous.size(); k++)
+      {
+        float magnitude = std::log1p(std::sqrt(re[k] * re[k] + im[k] * im[k]));
+        flux += std::max(0.0f, magnitude - previous[k]);
+        previous[k] = magnitude;
+      }
+      envelope.push_back(envelope.empty() ? 0 : flux); // the first frame has nothing to rise from
+    }
+
+  public:
+    Analysis(unsigned int ch, unsigned int sampleRate, sf::Uint64 sampleCount)
+        : channels(ch), step(std::max(1.0, sampleRate / TargetRate)), rate(sampleRate / step), re(FrameSize), im(FrameSize), hann(FrameSize), previous(FrameSize / 2)
+    {
+      pending.reserve(FrameSize);
+      envelope.reserve(static_cast<std::size_t>(sampleCount / ch / step / Hop + 1));
+      for (std::size_t i = 0; i < FrameSize; i++)
+        hann[i] = 0.5f - 0.5f * std::cos(2 * 3.14159265358979f * i / FrameSize);
+    }
+
+    void process(const float *samples, std::size_t count) override
+    {
+      for (std::size_t f = 0; f < count; f++)
+      {
+        for (unsigned int c = 0; c < channels; c++)
+          sum += samples[f * channels + c];
+        summed += channels;
+        phase += 1;
+        if (phase < step)
+          continue;
+        phase -= step;
+        pending.push_back(static_cast<float>(sum / summed));
+        sum = 0;
+        summed = 0;
+        if (pending.size() == FrameSize)
+        {
+          analyzeFrame();
+          pending.erase(pending.begin(), pending.begin() + Hop);
+        }
+      }
+    }
+
+    std::string finish() override
+    {
+      Tempo tempo = estimate();
+      std::ostringstream result;
+      result << tempo.bpm << " " << tempo.confidence << " " << tempo.firstBeat;
+      return result.str();
+    }
+
+  private:
+    Tempo estimate()
+    {
+      double envelopeRate = rate / Hop;
+      std::size_t minLag = static_cast<std::size_t>(envelopeRate * 60 / 200);
+      std::size_t maxLag = static_cast<std::size_t>(std::ceil(envelopeRate * 60 / 60));
+      std::size_t n = envelope.size();
+      if (n < maxLag * 8)
+        return Tempo();
+      // Onsets stand out from the local mean (one second around them)
+      std::vector<double> prefix(n + 1, 0);
+      for (std::size_t i = 0; i < n; i++)
+        prefix[i + 1] = prefix[i] + envelope[i];
+      std::size_t half = static_cast<std::size_t>(envelopeRate / 2);
+      std::vector<float> onset(n);
+      for (std::size_t i = 0; i < n; i++)
+      {
+        std::size_t from = i > half ? i - half : 0, to = std::min(n, i + half + 1);
+        onset[i] = std::max(0.0f, envelope[i] - static_cast<float>((prefix[to] - prefix[from]) / (to - from)));
+      }
+      std::vector<double> correlation(maxLag * 4 + 2, 0);
+      for (std::size_t lag = 0; lag < correlation.size(); lag++)
+      {
+        float total = 0;
+        for (std::size_t i = 0; i + lag < n; i++)
+          total += onset[i] * onset[i + lag];
+        correlation[lag] = total;
+      }
+      if (correlation[0] <= 0)
+        return Tempo();
+      std::size_t best = 0;
+      double bestScore = 0;
+      for (std::size_t lag = minLag; lag <= maxLag; lag++)
+      {
+        double score = 0;
+        for (std::size_t k = 1; k <= 4; k++)
+          score += correlation[lag * k] / k;
+        double octaves = std::log2(envelopeRate * 60 / lag / 120);
+        score *= std::exp(-0.5 * octaves * octaves);
+        if (score > bestScore)
+        {
+          bestScore = score;
+          best = lag;
+        }
+      }
+      if (best == 0)
+        return Tempo();
+      // Parabolic peak of the autocorrelation around the winning lag
+      double period = static_cast<double>(best);
+      double before = correlation[best - 1], at = correlation[best], after = correlation[best + 1];
+      if (before - 2 * at + after < 0)
+        period += std::max(-0.5, std::min(0.5, 0.5 * (before - after) / (before - 2 * at + after)));
+      // A grid laid over the whole track drifts off the beats unless its
+      // period is far more exact than one lag, so the period is refined
+      // together with the offset: within 1% of the estimate, the grid
+      // with the strongest average onset wins
+      double bestPeriod = period, bestStrength = -1;
+      std::size_t bestOffset = 0;
+      for (int step = -20; step <= 20; step++)
+      {
+        double candidate = period * (1 + step * 0.0005);
+        for (std::size_t offset = 0; offset < static_cast<std::size_t>(std::ceil(candidate)); offset++)
+        {
+          double strength = 0;
+          std::size_t beats = 0;
+          for (double beat = static_cast<double>(offset); beat < n; beat += candidate, beats++)
+            strength += onset[static_cast<std::size_t>(beat)];
+          if (strength / beats > bestStrength)
+          {
+            bestStrength = strength / beats;
+            bestPeriod = candidate;
+            bestOffset = offset;
+          }
+        }
+      }
+      Tempo tempo;
+      tempo.bpm = std::round(envelopeRate * 60 / bestPeriod * 100) / 100;
+      tempo.confidence = std::round(std::max(0.0, std::min(1.0, correlation[best] / correlation[0])) * 1000) / 1000;
+      // Envelope value i belongs to the frame centred on sample i * Hop + FrameSize / 2
+      tempo.firstBeat = std::round((bestOffset * Hop + FrameSize / 2.0) / rate * 1000) / 1000;
+      return tempo;
+    }
+  };
+
+  std::string name() const override { return "tempo"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64 sampleCount) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate, sampleCount);
+  }
+
+  static std::optional<Tempo> parse(const std::string &stored)
+  {
+    std::istringstream in(stored);
+    Tempo tempo;
+    if (!(in >> tempo.bpm >> tempo.confidence >> tempo.firstBeat) || tempo.bpm <= 0)
+      return std::nullopt;
+    return tempo;
+  }
+};
+
+// Timbre summary for finding similar-sounding tracks: means and standard
+// deviations of MFCCs 1-12 (26 mel bands from 60 Hz to 5 kHz), of the
+// spectral centroid, flatness and log level, plus the mean roll-off point
+// and zero-crossing rate, all over 93 ms frames of a mono 11 kHz copy.
+// Frames below -70 dBFS are left out, so silence does not count as timbre.
+// Stored as Dimensions numbers separated by spaces.
+class FeatureAnalyzer : public TrackAnalyzer
+{
+public:
+  static constexpr double TargetRate = 11025;
+  static const std::size_t FrameSize = 1024, Hop = 512, Bands = 26, Coefficients = 12;
+  static const std::size_t Dimensions = Coefficients * 2 + 8;
+
+  class Analysis : public TrackAnalysis
+  {
+    unsigned int channels;
+    double step; // input samples per resampled one
+    double rate; // resampled rate
+    double phase = 0, sum = 0;
+    unsigned int summed = 0;
+    std::vector<float> pending, re, im, hann, power;
+    std::vector<std::vector<std::pair<std::size_t, float>>> bands; // (bin, weight) per mel band
+    std::vector<float> dct;                                         // Coefficients x Bands
+    std::vector<double> sums, squares;                              // per frame feature
+    std::size_t frames = 0;
+    Fft fft{FrameSize};
+
+    static double mel(double hz) { return 2595 * std::log10(1 + hz / 700); }
+    static double hz(double mel) { return 700 * (std::pow(10, mel / 2595) - 1); }
+
+    void analyzeFrame()
+    {
+      float energy = 0, crossings = 0;
+      for (std::size_t i = 0; i < FrameSize; i++)
+      {
+        energy += pending[i] * pending[i];
+        if (i > 0 && (pending[i] >= 0) != (pending[i - 1] >= 0))
+          crossings++;
+        re[i] = pending[i] * hann[i];
+        im[i] = 0;
+      }
+      float level = std::sqrt(energy / FrameSize);
+      if (level < 0.000316f)
+        return;
+      fft.forward(re.data(), im.data());
+      double total = 0, weighted = 0, logSum = 0;
+      for (std::size_t k = 1; k < power.size(); k++)
+      {
+        power[k] = re[k] * re[k] + im[k] * im[k] + 1e-12f;
+        total += power[k];
+        weighted += power[k] * k;
+        logSum += std::log(power[k]);
+      }
+      double rolled = 0;
+      std::size_t rolloff = 1;
+      while (rolloff + 1 < power.size() && (rolled += power[rolloff]) < 0.85 * total)
+        rolloff++;
+      std::array<float, Bands> logBands;
+      for (std::size_t b = 0; b < Bands; b++)
+      {
+        float bandEnergy = 1e-10f;
+        for (const auto &[bin, weight] : bands[b])
+          bandEnergy += power[bin] * weight;
+        logBands[b] = std::log(bandEnergy);
+      }
+      std::array<double, Dimensions / 2 + 1> values{};
+      for (std::size_t c = 0; c < Coefficients; c++)
+        for (std::size_t b = 0; b < Bands; b++)
+          values[c] += dct[c * Bands + b] * logBands[b];
+      std::size_t bins = power.size() - 1;
+      values[Coefficients] = weighted / total / bins;                  // centroid
+      values[Coefficients + 1] = std::exp(logSum / bins) / (total / bins); // flatness
+      values[Coefficients + 2] = 20 * std::log10(level);                  // level, dB
+      values[Coefficients + 3] = static_cast<double>(rolloff) / bins;
+      values[Coefficients + 4] = crossings / FrameSize;
+      for (std::size_t v = 0; v < values.size(); v++)
+      {
+        sums[v] += values[v];
+        squares[v] += values[v] * values[v];
+      }
+      frames++;
+    }
+
+  public:
+    Analysis(unsigned int ch, unsigned int sampleRate)
+        : channels(ch), step(std::max(1.0, sampleRate / TargetRate)), rate(sampleRate / step), re(FrameSize), im(FrameSize), hann(FrameSize),
+          power(FrameSize / 2, 0), bands(Bands), dct(Coefficients * Bands), sums(Dimensions / 2 + 1, 0), squares(Dimensions / 2 + 1, 0)
+    {
+      pending.reserve(FrameSize);
+      for (std::size_t i = 0; i < FrameSize; i++)
+        hann[i] = 0.5f - 0.5f * std::cos(2 * 3.14159265358979f * i / FrameSize);
+      double low = mel(60), high = mel(std::min(5000.0, rate / 2));
+      for (std::size_t b = 0; b < Bands; b++)
+      {
+        double left = hz(low + (high - low) * b / (Bands + 1)), centre = hz(low + (high - low) * (b + 1) / (Bands + 1)),
+               right = hz(low + (high - low) * (b + 2) / (Bands + 1));
+        for (std::size_t k = 1; k < power.size(); k++)
+        {
+          double frequency = k * rate / FrameSize;
+          double weight = frequency < centre ? (frequency - left) / (centre - left) : (right - frequency) / (right - centre);
+          if (weight > 0)
+            bands[b].push_back({k, static_cast<float>(weight)});
+        }
+      }
+      for (std::size_t c = 0; c < Coefficients; c++)
+        for (std::size_t b = 0; b < Bands; b++)
+          dct[c * Bands + b] = static_cast<float>(std::cos(3.14159265358979 * (c + 1) * (b + 0.5) / Bands));
+    }
+
+    void process(const float *samples, std::size_t count) override
+    {
+      for (std::size_t f = 0; f < count; f++)
+      {
+        for (unsigned int c = 0; c < channels; c++)
+          sum += samples[f * channels + c];
+        summed += channels;
+        phase += 1;
+        if (phase < step)
+          continue;
+        phase -= step;
+        pending.push_back(static_cast<float>(sum / summed));
+        sum = 0;
+        summed = 0;
+        if (pending.size() == FrameSize)
+        {
+          analyzeFrame();
+          pending.erase(pending.begin(), pending.begin() + Hop);
+        }
+      }
+    }
+
+    // Mean and deviation of the MFCCs, centroid, flatness and level; mean
+    // of roll-off and zero crossings
+    std::string finish() override
+    {
+      std::ostringstream result;
+      result.precision(4);
+      for (std::size_t v = 0; v < sums.size(); v++)
+      {
+        double mean = frames ? sums[v] / frames : 0;
+        double deviation = frames ? std::sqrt(std::max(0.0, squares[v] / frames - mean * mean)) : 0;
+        result << (v ? " " : "") << mean;
+        if (v < Coefficients + 3)
+          result << " " << deviation;
+      }
+      return result.str();
+    }
+  };
+
+  std::string name() const override { return "features"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate);
+  }
+
+  // Empty unless all Dimensions numbers are there
+  static std::vector<float> parse(const std::string &stored)
+  {
+    std::istringstream in(stored);
+    std::vector<float> features;
+    float value;
+    while (in >> value)
+      features.push_back(value);
+    if (features.size() != Dimensions)
+      features.clear();
+    return features;
+  }
+};
+
+// "<problems> <sample rate> <decoded frames> <frames in the header>
+// <clipping runs> <invalid samples>", where problems is "ok" or a comma-separated list of
+// unreadable, truncated, overlong, clipped and invalid. Decoding stops at the
+// first read error, so a damaged stream shows up as truncated. A clipping
+// run is 3 or more consecutive full-scale samples in one channel; invalid
+// samples are NaN or infinite. Each block gets one SIMD pass (reducePeaks),
+// and only blocks that reach full scale or hold invalid values are looked
+// at sample by sample.
+class VerifyAnalyzer : public TrackAnalyzer
+{
+public:
+  static constexpr float FullScale = 0.9999f;
+  static const unsigned int ClippingRun = 3;
+  static const sf::Uint64 LengthTolerance = 4096; // frames; MP3 headers are estimates
+
+  struct Report
+  {
+    std::string problems;
+    unsigned int sampleRate = 0;
+    sf::Uint64 frames = 0, headerFrames = 0, clippingRuns = 0, invalidSamples = 0;
+    bool ok() const { return problems == "ok"; }
+  };
+
+  class Analysis : public TrackAnalysis
+  {
+    unsigned int channels;
+    Report report;
+    std::vector<unsigned int> run; // full-scale samples in a row, per channel
+
+  public:
+    Analysis(unsigned int ch, unsigned int sampleRate, sf::Uint64 sampleCount) : channels(ch), run(ch, 0)
+    {
+      report.sampleRate = sampleRate;
+      report.headerFrames = sampleCount / ch;
+    }
+
+    void process(const float *samples, std::size_t frames) override
+    {
+      float low = 0, high = 0, sumSquares = 0;
+      reducePeaks(samples, frames * channels, low, high, sumSquares);
+      report.frames += frames;
+      if (std::isfinite(sumSquares) && high < FullScale && low > -FullScale)
+      {
+        std::fill(run.begin(), run.end(), 0);
+        return;
+      }
+      for (std::size_t i = 0; i < frames * channels; i++)
+      {
+        unsigned int &length = run[i % channels];
+        if (!std::isfinite(samples[i]))
+        {
+          report.invalidSamples++;
+          length = 0;
+        }
+        else if (std::fabs(samples[i]) >= FullScale)
+        {
+          if (++length == ClippingRun)
+            report.clippingRuns++;
+        }
+        else
+          length = 0;
+      }
+    }
+
+    std::string finish() override
+    {
+      std::string problems;
+      auto add = [&](const char *problem)
+      { problems += (problems.empty() ? "" : ",") + std::string(problem); };
+      if (report.headerFrames > 0 && report.frames + LengthTolerance < report.headerFrames)
+        add("truncated");
+      if (report.headerFrames > 0 && report.frames > report.headerFrames + LengthTolerance)
+        add("overlong");
+      if (report.clippingRuns > 0)
+        add("clipped");
+      if (report.invalidSamples > 0)
+        add("invalid");
+      std::ostringstream result;
+      result << (problems.empty() ? "ok" : problems) << " " << report.sampleRate << " " << report.frames << " " << report.headerFrames << " " << report.clippingRuns << " "
+             << report.invalidSamples;
+      return result.str();
+    }
+  };
+
+  std::string name() const override { return "verify"; }
+  std::unique_ptr<TrackAnalysis> start(unsigned int channels, unsigned int sampleRate, sf::Uint64 sampleCount) const override
+  {
+    return std::make_unique<Analysis>(channels, sampleRate, sampleCount);
+  }
+  std::optional<std::string> unreadable() const override { return std::string("unreadable 0 0 0 0 0"); }
+
+  static std::optional<Report> parse(const std::string &stored)
+  {
+    std::istringstream in(stored);
+    Report report;
+    if (!(in >> report.problems >> report.sampleRate >> report.frames >> report.headerFrames >> report.clippingRuns >> report.invalidSamples))
+      return std::nullopt;
+    return report;
+  }
+
+  // One line about a report that is not ok, e.g. "truncated: 1:02 of 3:40 decoded"
+  static std::string describe(const Report &report)
+  {
+    unsigned int sampleRate = std::max(1u, report.sampleRate);
+    std::ostringstream text;
+    text << report.problems;
+    if (report.problems.find("truncated") != std::string::npos || report.problems.find("overlong") != std::string::npos)
+      text << ": " << formatTime(sf::seconds(static_cast<float>(report.frames) / sampleRate)) << " of "
+           << formatTime(sf::seconds(static_cast<float>(report.headerFrames) / sampleRate)) << " decoded";
+    if (report.clippingRuns > 0)
+      text << ", " << report.clippingRuns << " clipping runs";
+    if (report.invalidSamples > 0)
+      text << ", " << report.invalidSamples << " invalid samples";
+    return text.str();
+  }
+};
+
+// Lets openOutput and the renderer skip each track's silence once it has been analyzed
+OutputSettings withAudibleRanges(OutputSettings settings, std::shared_ptr<AnalysisStore> store)
+{
+  settings.audibleRange = [store](const std::string &path) -> std::optional<std::pair<sf::Uint64, sf::Uint64>>
+  {
+    std::optional<std::string> stored = store->get(path, "silence");
+    return stored ? SilenceAnalyzer::parse(*stored) : std::nullopt;
+  };
+  return settings;
+}
+
+// Every analysis the player knows how to run
+void addStandardAnalyzers(LibraryAnalyzer &analyzer)
+{
+  analyzer.add(std::make_shared<LoudnessAnalyzer>());
+  analyzer.add(std::make_shared<PeakAnalyzer>());
+  analyzer.add(std::make_shared<FingerprintAnalyzer>());
+  analyzer.add(std::make_shared<SilenceAnalyzer>());
+  analyzer.add(std::make_shared<TempoAnalyzer>());
+  analyzer.add(std::make_shared<FeatureAnalyzer>());
+  analyzer.add(std::make_shared<VerifyAnalyzer>());
+}
+
+// Verification results so far for a set of tracks
+struct VerifySummary
+{
+  std::size_t verified = 0;
+  std::vector<std::pair<std::string, VerifyAnalyzer::Report>> problems;
+};
+
+VerifySummary summarizeVerification(const std::vector<std::string> &paths, AnalysisStore &store)
+{
+  VerifySummary summary;
+  for (const std::string &path : paths)
+    if (std::optional<std::string> stored = store.get(path, "verify"))
+      if (std::optional<VerifyAnalyzer::Report> report = VerifyAnalyzer::parse(*stored))
+      {
+        summary.verified++;
+        if (!report->ok())
+          summary.problems.emplace_back(path, *report);
+      }
+  return summary;
+}
+
+// Squared Euclidean distance between two vectors of `count` floats
+float squaredDistance(const float *a, const float *b, std::size_t count)
+{
+  std::size_t i = 0;
+  float total = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 sums = _mm256_setzero_ps();
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256 difference = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    sums = _mm256_fmadd_ps(difference, difference, sums);
+  }
+  alignas(32) float lane[8];
+  _mm256_store_ps(lane, sums);
+  for (float value : lane)
+    total += value;
+#elif defined(__SSE2__) || defined(_M_X64)
+  __m128 sums = _mm_setzero_ps();
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 difference = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    sums = _mm_add_ps(sums, _mm_mul_ps(difference, difference));
+  }
+  alignas(16) float lane[4];
+  _mm_store_ps(lane, sums);
+  for (float value : lane)
+    total += value;
+#endif
+  for (; i < count; i++)
+    total += (a[i] - b[i]) * (a[i] - b[i]);
+  return total;
+}
+
+// Approximate nearest neighbours by inverted file (IVF): vectors are
+// standardized per dimension, k-means splits them into about 2 sqrt(n) lists,
+// and a query scans only the lists of the few centroids closest to it. Each
+// list keeps its vectors contiguous, so a scan is a straight pass through
+// memory. New vectors go into the list of their nearest centroid; the
+// centroids and scaling are retrained from scratch whenever the index has
+// doubled since the last training, which keeps the total training cost
+// proportional to the final size. Ids are handed out in order from 0.
+class SimilarityIndex
+{
+public:
+  explicit SimilarityIndex(std::size_t dims) : dimensions(dims) {}
+
+  std::size_t size() const { return count; }
+
+  std::uint32_t add(const std::vector<float> &vector)
+  {
+    std::uint32_t id = static_cast<std::uint32_t>(count++);
+    raw.insert(raw.end(), vector.begin(), vector.end());
+    if (count >= trainedSize * 2)
+      train();
+    else
+      insert(id);
+    return id;
+  }
+
+  // Up to `k` ids closest to `id`, nearest first, leaving out `id` itself
+  // and those `skip` rejects. Lists are probed in order of centroid distance
+  // until `probes` have been scanned and `k` ids found.
+  std::vector<std::uint32_t> nearest(std::uint32_t id, std::size_t k, const std::function<bool(std::uint32_t)> &skip, std::size_t probes = 8) const
+  {
+    std::vector<float> query = standardized(&raw[static_cast<std::size_t>(id) * dimensions]);
+    std::vector<std::pair<float, std::size_t>> order(lists.size());
+    for (std::size_t l = 0; l < lists.size(); l++)
+      order[l] = {squaredDistance(query.data(), &centroids[l * dimensions], dimensions), l};
+    std::sort(order.begin(), order.end());
+    std::vector<std::pair<float, std::uint32_t>> best; // max-heap of the k closest so far
+    for (std::size_t p = 0; p < order.size() && (p < probes || best.size() < k); p++)
+    {
+      const List &list = lists[order[p].second];
+      for (std::size_t i = 0; i < list.ids.size(); i++)
+      {
+        float distance = squaredDistance(query.data(), &list.vectors[i * dimensions], dimensions);
+        if (best.size() == k && distance >= best.front().first)
+          continue;
+        if (list.ids[i] == id || (skip && skip(list.ids[i])))
+          continue;
+        best.push_back({distance, list.ids[i]});
+        std::push_heap(best.begin(), best.end());
+        if (best.size() > k)
+        {
+          std::pop_heap(best.begin(), best.end());
+          best.pop_back();
+        }
+      }
+    }
+    std::sort_heap(best.begin(), best.end());
+    std::vector<std::uint32_t> ids;
+    for (const auto &entry : best)
+      ids.push_back(entry.second);
+    return ids;
+  }
+
+private:
+  struct List
+  {
+    std::vector<std::uint32_t> ids;
+    std::vector<float> vectors; // standardized, ids.size() x dimensions
+  };
+
+  std::size_t dimensions, count = 0, trainedSize = 0;
+  std::vector<float> raw; // every vector as added, for retraining
+  std::vector<float> mean, scale;
+  std::vector<float> centroids;
+  std::vector<List> lists;
+
+  std::vector<float> standardized(const float *vector) const
+  {
+    std::vector<float> result(dimensions);
+    for (std::size_t d = 0; d < dimensions; d++)
+      result[d] = (vector[d] - mean[d]) * scale[d];
+    return result;
+  }
+
+  std::size_t nearestCentroid(const float *vector) const
+  {
+    std::size_t best = 0;
+    float bestDistance = std::numeric_limits<float>::max();
+    for (std::size_t l = 0; l * dimensions < centroids.size(); l++)
+    {
+      float distance = squaredDistance(vector, &centroids[l * dimensions], dimensions);
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = l;
+      }
+    }
+    return best;
+  }
+
+  void insert(std::uint32_t id)
+  {
+    std::vector<float> vector = standardized(&raw[static_cast<std::size_t>(id) * dimensions]);
+    List &list = lists[nearestCentroid(vector.data())];
+    list.ids.push_back(id);
+    list.vectors.insert(list.vectors.end(), vector.begin(), vector.end());
+  }
+
+  void train()
+  {
+    trainedSize = count;
+    mean.assign(dimensions, 0);
+    scale.assign(dimensions, 0);
+    for (std::size_t i = 0; i < count; i++)
+      for (std::size_t d = 0; d < dimensions; d++)
+        mean[d] += raw[i * dimensions + d] / count;
+    for (std::size_t i = 0; i < count; i++)
+      for (std::size_t d = 0; d < dimensions; d++)
+        scale[d] += (raw[i * dimensions + d] - mean[d]) * (raw[i * dimensions + d] - mean[d]) / count;
+    for (float &s : scale)
+      s = s > 1e-12f ? 1 / std::sqrt(s) : 0;
+    // Lloyd's k-means on an evenly spaced sample of at most 32 per list
+    std::size_t listCount = std::max<std::size_t>(1, static_cast<std::size_t>(2 * std::sqrt(static_cast<double>(count))));
+    std::size_t sampleCount = std::min(count, listCount * 32);
+    std::vector<float> sample;
+    sample.reserve(sampleCount * dimensions);
+    for (std::size_t s = 0; s < sampleCount; s++)
+    {
+      std::vector<float> vector = standardized(&raw[s * count / sampleCount * dimensions]);
+      sample.insert(sample.end(), vector.begin(), vector.end());
+    }
+    centroids.clear();
+    for (std::size_t l = 0; l < listCount; l++)
+      centroids.insert(centroids.end(), sample.begin() + l * sampleCount / listCount * dimensions,
+                       sample.begin() + (l * sampleCount / listCount + 1) * dimensions);
+    std::vector<std::size_t> assigned(sampleCount);
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+      for (std::size_t s = 0; s < sampleCount; s++)
+        assigned[s] = nearestCentroid(&sample[s * dimensions]);
+      std::vector<float> sums(centroids.size(), 0);
+      std::vector<std::size_t> members(listCount, 0);
+      for (std::size_t s = 0; s < sampleCount; s++)
+      {
+        members[assigned[s]]++;
+        for (std::size_t d = 0; d < dimensions; d++)
+          sums[assigned[s] * dimensions + d] += sample[s * dimensions + d];
+      }
+      for (std::size_t l = 0; l < listCount; l++)
+        if (members[l] > 0) // an empty list keeps its old centroid
+          for (std::size_t d = 0; d < dimensions; d++)
+            centroids[l * dimensions + d] = sums[l * dimensions + d] / members[l];
+    }
+    lists.assign(listCount, List());
+    for (std::size_t i = 0; i < count; i++)
+      insert(static_cast<std::uint32_t>(i));
+  }
+};
+
+// Feature vectors of the library, kept in a SimilarityIndex for radio mode.
+// A worker thread turns "features" and "tempo" results from the analysis
+// store into vectors for each track offered once its analysis finishes. The index is never waited for: while the worker
+// holds it, next() simply has no answer.
+class RadioIndex
+{
+public:
+  static const std::size_t Dimensions = FeatureAnalyzer::Dimensions + 1;
+
+  explicit RadioIndex(std::shared_ptr<AnalysisStore> s) : store(std::move(s)), index(Dimensions), worker(&RadioIndex::run, this) {}
+
+  ~RadioIndex()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  // Offers tracks whose analysis has finished; indexed ones are skipped
+  void update(const std::vector<std::string> &paths)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.insert(pending.end(), paths.begin(), paths.end());
+    wake.notify_all();
+  }
+
+  // The indexed track that sounds most like `path`, other than those in `exclude`
+  std::optional<std::string> next(const std::string &path, const std::vector<std::string> &exclude)
+  {
+    std::unique_lock<std::mutex> lock(indexMutex, std::try_to_lock);
+    if (!lock)
+      return std::nullopt;
+    auto it = ids.find(path);
+    if (it == ids.end())
+      return std::nullopt;
+    std::vector<std::uint32_t> found = index.nearest(it->second, 1, [&](std::uint32_t id)
+                                                     { return std::find(exclude.begin(), exclude.end(), paths[id]) != exclude.end(); });
+    if (found.empty())
+      return std::nullopt;
+    return paths[found[0]];
+  }
+
+private:
+  std::shared_ptr<AnalysisStore> store;
+  std::mutex mutex, indexMutex; // pending and stopping; index, ids and paths
+  std::condition_variable wake;
+  std::vector<std::string> pending;
+  bool stopping = false;
+  SimilarityIndex index;
+  std::map<std::string, std::uint32_t> ids;
+  std::vector<std::string> paths; // by id
+  std::thread worker;             // started last, after every member it reads
+
+  // Timbre features, then tempo as octaves from 120 BPM scaled by how sure
+  // the tempo is; empty until both analyses are in
+  std::vector<float> vectorFor(const std::string &path)
+  {
+    std::optional<std::string> features = store->get(path, "features"), tempo = store->get(path, "tempo");
+    std::vector<float> vector = features ? FeatureAnalyzer::parse(*features) : std::vector<float>();
+    if (vector.empty() || !tempo)
+      return {};
+    std::optional<TempoAnalyzer::Tempo> parsed = TempoAnalyzer::parse(*tempo);
+    vector.push_back(parsed ? static_cast<float>(std::log2(parsed->bpm / 120) * parsed->confidence) : 0.0f);
+    return vector;
+  }
+
+  void run()
+  {
+    lowerCurrentThreadPriority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wake.wait(lock, [this]
+                { return stopping || !pending.empty(); });
+      if (stopping)
+        return;
+      std::vector<std::string> offered;
+      offered.swap(pending);
+      lock.unlock();
+      for (const std::string &path : offered)
+      {
+        {
+          std::lock_guard<std::mutex> indexLock(indexMutex);
+          if (ids.count(path))
+            continue;
+        }
+        std::vector<float> vector = vectorFor(path);
+        if (vector.empty())
+          continue;
+        std::lock_guard<std::mutex> indexLock(indexMutex);
+        ids[path] = index.add(vector);
+        paths.push_back(path);
+      }
+      lock.lock();
+    }
+  }
+};
+
+// Tempos of the library for sorting and "bpm:" searches. Reading them means
+// a stat and a read of each track's analysis file, so a worker thread does
+// it for each track offered once its analysis finishes, and the UI thread
+// only collects what it has found.
+class TempoIndex
+{
+public:
+  explicit TempoIndex(std::shared_ptr<AnalysisStore> s) : store(std::move(s)), worker(&TempoIndex::run, this) {}
+
+  ~TempoIndex()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  // Offers tracks whose analysis has finished; ones with a tempo are skipped
+  void update(const std::vector<std::string> &paths)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.insert(pending.end(), paths.begin(), paths.end());
+    wake.notify_all();
+  }
+
+  // Moves the tempos found since the last call into `tempos`; never waits
+  void collect(std::map<std::string, double> &tempos)
+  {
+    std::unique_lock<std::mutex> lock(foundMutex, std::try_to_lock);
+    if (!lock || found.empty())
+      return;
+    for (const auto &[path, bpm] : found)
+      tempos[path] = bpm;
+    found.clear();
+  }
+
+private:
+  std::shared_ptr<AnalysisStore> store;
+  std::mutex mutex, foundMutex; // pending and stopping; found
+  std::condition_variable wake;
+  std::vector<std::string> pending;
+  bool stopping = false;
+  std::map<std::string, double> found;
+  std::set<std::string> known; // worker only
+  std::thread worker;          // started last, after every member it reads
+
+  void run()
+  {
+    lowerCurrentThreadPriority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wake.wait(lock, [this]
+                { return stopping || !pending.empty(); });
+      if (stopping)
+        return;
+      std::vector<std::string> offered;
+      offered.swap(pending);
+      lock.unlock();
+      for (const std::string &path : offered)
+        if (!known.count(path))
+          if (std::optional<std::string> stored = store->get(path, "tempo"))
+            if (std::optional<TempoAnalyzer::Tempo> tempo = TempoAnalyzer::parse(*stored))
+            {
+              known.insert(path);
+              std::lock_guard<std::mutex> foundLock(foundMutex);
+              found[path] = tempo->bpm;
+            }
+      lock.lock();
+    }
+  }
+};
+
+// Album art. The readers below return a picture exactly as it is stored
+// (usually JPEG or PNG), preferring the one marked as the front cover, or
+// nothing. Only the headers are read, never the audio.
+std::uint32_t readBigEndian(const unsigned char *bytes, int count)
+{
+  std::uint32_t value = 0;
+  for (int i = 0; i < count; i++)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+
+std::uint32_t readLittleEndian32(const unsigned char *bytes)
+{
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<std::uint32_t>(bytes[3]) << 24);
+}
+
+// ID3 sizes keep the top bit of every byte clear
+std::uint32_t readSyncsafe(const unsigned char *bytes)
+{
+  return (bytes[0] & 0x7f) << 21 | (bytes[1] & 0x7f) << 14 | (bytes[2] & 0x7f) << 7 | (bytes[3] & 0x7f);
+}
+
+// Undoes ID3 unsynchronisation, which stuffs a zero after every 0xFF
+void removeUnsynchronisation(std::vector<unsigned char> &bytes)
+{
+  std::size_t out = 0;
+  for (std::size_t i = 0; i < bytes.size(); i++)
+  {
+    bytes[out++] = bytes[i];
+    if (bytes[i] == 0xff && i + 1 < bytes.size() && bytes[i + 1] == 0)
+      i++;
+  }
+  bytes.resize(out);
+}
+
+// A FLAC PICTURE block, also what Vorbis comments carry in base64 as
+// METADATA_BLOCK_PICTURE
+std::vector<unsigned char> parseFlacPicture(const std::vector<unsigned char> &block, unsigned int &type)
+{
+  std::size_t pos = 8;
+  if (block.size() < pos)
+    return {};
+  type = readBigEndian(block.data(), 4);
+  pos += readBigEndian(block.data() + 4, 4); // MIME type
+  if (block.size() < pos + 4)
+    return {};
+  pos += 4 + readBigEndian(block.data() + pos, 4); // description
+  pos += 16;                                       // width, height, depth, palette size
+  if (block.size() < pos + 4)
+    return {};
+  std::uint32_t length = readBigEndian(block.data() + pos, 4);
+  pos += 4;
+  if (block.size() - pos < length)
+    return {};
+  return std::vector<unsigned char>(block.begin() + pos, block.begin() + pos + length);
+}
+
+// APIC frames of ID3v2.3 and v2.4, PIC frames of v2.2
+std::vector<unsigned char> readId3Art(std::istream &file)
+{
+  unsigned char header[10];
+  if (!file.read(reinterpret_cast<char *>(header), 10) || std::memcmp(header, "ID3", 3) != 0 || header[3] < 2 || header[3] > 4)
+    return {};
+  unsigned int version = header[3];
+  // The size is up to 256 MB; a corrupt one must not allocate past the file
+  std::streampos start = file.tellg();
+  std::uint32_t tagSize = readSyncsafe(header + 6);
+  if (start < 0 || !file.seekg(0, std::ios::end) || file.tellg() - start < static_cast<std::streamoff>(tagSize) || !file.seekg(start))
+    return {};
+  std::vector<unsigned char> tag(tagSize);
+  if (!file.read(reinterpret_cast<char *>(tag.data()), tag.size()))
+    return {};
+  if ((header[5] & 0x80) && version < 4)
+    removeUnsynchronisation(tag);
+  std::size_t pos = 0;
+  if ((header[5] & 0x40) && version > 2 && tag.size() >= 4)
+    pos = version == 3 ? 4 + readBigEndian(tag.data(), 4) : readSyncsafe(tag.data());
+  std::size_t headerSize = version == 2 ? 6 : 10;
+  std::vector<unsigned char> best;
+  while (pos + headerSize <= tag.size() && tag[pos] != 0) // zeros are padding
+  {
+    const unsigned char *frame = tag.data() + pos;
+    std::size_t size = version == 2 ? readBigEndian(frame + 3, 3) : version == 3 ? readBigEndian(frame + 4, 4)
+                                                                                 : readSyncsafe(frame + 4);
+    pos += headerSize;
+    if (size > tag.size() - pos)
+      break;
+    bool picture = version == 2 ? std::memcmp(frame, "PIC", 3) == 0 : std::memcmp(frame, "APIC", 4) == 0;
+    // Compressed and encrypted frames are not worth the trouble
+    bool packed = version == 3 ? (frame[9] & 0xc0) != 0 : version == 4 && (frame[9] & 0x0c) != 0;
+    if (picture && !packed)
+    {
+      std::vector<unsigned char> body(tag.begin() + pos, tag.begin() + pos + size);
+      if (version == 4 && (frame[9] & 0x02))
+        removeUnsynchronisation(body);
+      std::size_t p = version == 4 && (frame[9] & 0x01) ? 4 : 0; // data length indicator
+      if (p < body.size())
+      {
+        unsigned char encoding = body[p++];
+        if (version == 2)
+          p += 3; // image format
+        else
+          while (p < body.size() && body[p++] != 0)
+            ; // MIME type
+        unsigned int type = p < body.size() ? body[p++] : 0;
+        // The description ends in one zero, or two aligned ones in UTF-16
+        if (encoding == 1 || encoding == 2)
+        {
+          while (p + 1 < body.size() && (body[p] != 0 || body[p + 1] != 0))
+            p += 2;
+          p += 2;
+        }
+        else
+        {
+          while (p < body.size() && body[p] != 0)
+            p++;
+          p++;
+        }
+        if (p < body.size())
+        {
+          if (type == 3)
+            return std::vector<unsigned char>(body.begin() + p, body.end());
+          if (best.empty())
+            best.assign(body.begin() + p, body.end());
+        }
+      }
+    }
+    pos += size;
+  }
+  return best;
+}
+
+std::vector<unsigned char> readFlacArt(std::istream &file)
+{
+  char magic[4];
+  if (!file.read(magic, 4) || std::memcmp(magic, "fLaC", 4) != 0)
+    return {};
+  std::vector<unsigned char> best;
+  for (bool last = false; !last;)
+  {
+    unsigned char header[4];
+    if (!file.read(reinterpret_cast<char *>(header), 4))
+      break;
+    last = header[0] & 0x80;
+    std::uint32_t size = readBigEndian(header + 1, 3);
+    if ((header[0] & 0x7f) != 6)
+    {
+      file.seekg(size, std::ios::cur);
+      continue;
+    }
+    std::vector<unsigned char> block(size);
+    if (!file.read(reinterpret_cast<char *>(block.data()), size))
+      break;
+    unsigned int type = 0;
+    std::vector<unsigned char> picture = parseFlacPicture(block, type);
+    if (type == 3 && !picture.empty())
+      return picture;
+    if (best.empty())
+      best = std::move(picture);
+  }
+  return best;
+}
+
+// The comment header of Ogg Vorbis or Opus: the second packet of the first
+// stream, which spans as many pages as its pictures need
+std::vector<unsigned char> readOggArt(std::istream &file)
+{
+  std::vector<unsigned char> packet;
+  int packets = 0;
+  std::uint32_t serial = 0;
+  unsigned char header[27], lacing[255];
+  while (packets < 2 && file.read(reinterpret_cast<char *>(header), 27) && std::memcmp(header, "OggS", 4) == 0)
+  {
+    if (!file.read(reinterpret_cast<char *>(lacing), header[26]))
+      return {};
+    if (packets == 0 && packet.empty())
+      serial = readLittleEndian32(header + 14);
+    if (readLittleEndian32(header + 14) != serial)
+    {
+      std::size_t skip = 0;
+      for (int s = 0; s < header[26]; s++)
+        skip += lacing[s];
+      file.seekg(skip, std::ios::cur);
+      continue;
+    }
+    for (int s = 0; s < header[26] && packets < 2; s++)
+    {
+      std::size_t old = packet.size();
+      packet.resize(old + lacing[s]);
+      if (!file.read(reinterpret_cast<char *>(packet.data() + old), lacing[s]))
+        return {};
+      if (lacing[s] < 255 && ++packets == 1)
+        packet.clear();
+    }
+    if (packet.size() > (64u << 20))
+      return {};
+  }
+  if (packets < 2)
+    return {};
+  std::size_t pos;
+  if (packet.size() >= 7 && std::memcmp(packet.data(), "\x03vorbis", 7) == 0)
+    pos = 7;
+  else if (packet.size() >= 8 && std::memcmp(packet.data(), "OpusTags", 8) == 0)
+    pos = 8;
+  else
+    return {};
+  if (packet.size() < pos + 4)
+    return {};
+  pos += 4 + readLittleEndian32(packet.data() + pos); // vendor
+  if (packet.size() < pos + 4)
+    return {};
+  std::uint32_t comments = readLittleEndian32(packet.data() + pos);
+  pos += 4;
+  static const char key[] = "METADATA_BLOCK_PICTURE=";
+  const std::size_t keyLength = sizeof(key) - 1;
+  std::vector<unsigned char> best;
+  for (std::uint32_t c = 0; c < comments && packet.size() >= pos + 4; c++)
+  {
+    std::size_t length = readLittleEndian32(packet.data() + pos);
+    pos += 4;
+    if (packet.size() - pos < length)
+      break;
+    const char *comment = reinterpret_cast<const char *>(packet.data() + pos);
+    pos += length;
+    if (length <= keyLength || !std::equal(key, key + keyLength, comment, [](char a, char b)
+                                           { return a == std::toupper(static_cast<unsigned char>(b)); }))
+      continue;
+    unsigned int type = 0;
+    std::vector<unsigned char> picture = parseFlacPicture(decodeBase64(std::string(comment + keyLength, length - keyLength)), type);
+    if (type == 3 && !picture.empty())
+      return picture;
+    if (best.empty())
+      best = std::move(picture);
+  }
+  return best;
+}
+
+// Picks the reader by the file's first bytes rather than its extension
+std::vector<unsigned char> readEmbeddedArt(const std::string &path)
+{
+  std::ifstream file(path, std::ios::binary);
+  char magic[4] = {};
+  if (!file.read(magic, 4))
+    return {};
+  file.seekg(0);
+  if (std::memcmp(magic, "ID3", 3) == 0)
+    return readId3Art(file);
+  if (std::memcmp(magic, "fLaC", 4) == 0)
+    return readFlacArt(file);
+  if (std::memcmp(magic, "OggS", 4) == 0)
+    return readOggArt(file);
+  return {};
+}
+
+// cover.jpg and the like in the track's folder, best known name first
+std::vector<unsigned char> readFolderArt(const std::string &path)
+{
+  static const std::vector<std::string> names = {"cover", "folder", "front", "album", "albumart"};
+  std::filesystem::path best;
+  std::size_t bestRank = names.size();
+  std::filesystem::path folder = std::filesystem::path(path).parent_path();
+  if (folder.empty())
+    folder = "."; // tracks in the working directory
+  std::error_code error, ignored;
+  for (std::filesystem::directory_iterator it(folder, error), end; !error && it != end; it.increment(error))
+  {
+    const std::filesystem::directory_entry &entry = *it;
+    std::string stem = entry.path().stem().string(), extension = entry.path().extension().string();
+    std::transform(stem.begin(), stem.end(), stem.begin(), ::tolower);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    std::size_t rank = std::find(names.begin(), names.end(), stem) - names.begin();
+    if (rank < bestRank && (extension == ".jpg" || extension == ".jpeg" || extension == ".png") && entry.is_regular_file(ignored))
+    {
+      best = entry.path();
+      bestRank = rank;
+    }
+  }
+  if (best.empty())
+    return {};
+  std::ifstream file(best.string(), std::ios::binary);
+  return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Area-average weights for resizing `from` samples to `to`: output i covers
+// [i, i + 1) * from / to of the input, and each input sample counts by how
+// much of it lies inside. Enlarging takes the nearest sample instead.
+struct ResampleTap
+{
+  unsigned int index;
+  float weight;
+};
+
+std::vector<std::vector<ResampleTap>> areaTaps(unsigned int from, unsigned int to)
+{
+  std::vector<std::vector<ResampleTap>> taps(to);
+  double scale = static_cast<double>(from) / to;
+  for (unsigned int i = 0; i < to; i++)
+  {
+    double start = i * scale, end = (i + 1) * scale;
+    if (scale <= 1)
+    {
+      taps[i].push_back({std::min(from - 1, static_cast<unsigned int>((i + 0.5) * scale)), 1.0f});
+      continue;
+    }
+    for (unsigned int j = static_cast<unsigned int>(start); j < end && j < from; j++)
+    {
+      double covered = std::min(end, j + 1.0) - std::max(start, static_cast<double>(j));
+      if (covered > 0)
+        taps[i].push_back({j, static_cast<float>(covered / scale)});
+    }
+  }
+  return taps;
+}
+
+// Resizes RGBA pixels in two separable passes, rows first. Each pixel is one
+// four-lane vector, so a tap is one multiply-add for all four channels.
+void resampleArea(const sf::Uint8 *in, unsigned int inWidth, unsigned int inHeight, std::size_t inStride,
+                  sf::Uint8 *out, unsigned int outWidth, unsigned int outHeight)
+{
+  std::vector<std::vector<ResampleTap>> columns = areaTaps(inWidth, outWidth), rows = areaTaps(inHeight, outHeight);
+  std::vector<float> across(static_cast<std::size_t>(inHeight) * outWidth * 4);
+  for (unsigned int y = 0; y < inHeight; y++)
+  {
+    const sf::Uint8 *line = in + y * inStride;
+    float *target = across.data() + static_cast<std::size_t>(y) * outWidth * 4;
+    for (unsigned int x = 0; x < outWidth; x++)
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+      __m128 sum = _mm_setzero_ps();
+      for (const ResampleTap &tap : columns[x])
+      {
+        int rgba;
+        std::memcpy(&rgba, line + tap.index * 4, 4);
+        __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(rgba), _mm_setzero_si128()), _mm_setzero_si128());
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(tap.weight)));
+      }
+      _mm_storeu_ps(target + x * 4, sum);
+#else
+      float sum[4] = {};
+      for (const ResampleTap &tap : columns[x])
+        for (int c = 0; c < 4; c++)
+          sum[c] += line[tap.index * 4 + c] * tap.weight;
+      std::copy(sum, sum + 4, target + x * 4);
+#endif
+    }
+  }
+  for (unsigned int y = 0; y < outHeight; y++)
+  {
+    sf::Uint8 *target = out + static_cast<std::size_t>(y) * outWidth * 4;
+    for (unsigned int x = 0; x < outWidth; x++)
+    {
+#if defined(__SSE2__) || defined(_M_X64)
+      __m128 sum = _mm_setzero_ps();
+      for (const ResampleTap &tap : rows[y])
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(across.data() + (static_cast<std::size_t>(tap.index) * outWidth + x) * 4), _mm_set1_ps(tap.weight)));
+      __m128i rounded = _mm_cvtps_epi32(sum);
+      rounded = _mm_packus_epi16(_mm_packs_epi32(rounded, rounded), _mm_setzero_si128());
+      int rgba = _mm_cvtsi128_si32(rounded);
+      std::memcpy(target + x * 4, &rgba, 4);
+#else
+      float sum[4] = {};
+      for (const ResampleTap &tap : rows[y])
+        for (int c = 0; c < 4; c++)
+          sum[c] += across[(static_cast<std::size_t>(tap.index) * outWidth + x) * 4 + c] * tap.weight;
+      for (int c = 0; c < 4; c++)
+        target[x * 4 + c] = static_cast<sf::Uint8>(std::max(0L, std::min(255L, std::lround(sum[c]))));
+#endif
+    }
+  }
+}
+
+// Square thumbnail from the middle of `image`
+sf::Image makeThumbnail(const sf::Image &image, unsigned int size)
+{
+  sf::Vector2u full = image.getSize();
+  unsigned int side = std::min(full.x, full.y);
+  std::vector<sf::Uint8> pixels(static_cast<std::size_t>(size) * size * 4);
+  std::size_t offset = (static_cast<std::size_t>((full.y - side) / 2) * full.x + (full.x - side) / 2) * 4;
+  resampleArea(image.getPixelsPtr() + offset, side, side, static_cast<std::size_t>(full.x) * 4, pixels.data(), size, size);
+  sf::Image thumbnail;
+  thumbnail.create(size, size, pixels.data());
+  return thumbnail;
+}
+
+// Album art thumbnails for the song list and the now-playing corner. Like
+// HeadCache it works from a wish list, on a low-priority thread. Art is
+// decoded at full size only the first time it is seen: it is stored shrunk
+// to each of the fixed sizes as PNG files named by a hash of the art, so all
+// tracks of an album share one set, and an index of track path, time and
+// hash sends later sessions straight to them. The UI only ever gets small
+// images that are already in memory.
+class ArtCache
+{
+public:
+  enum Size
+  {
+    Row,
+    Playing,
+    SizeCount
+  };
+  static constexpr unsigned int Pixels[SizeCount] = {32, 96};
+
+  struct Thumbnail
+  {
+    std::string key; // the same for every track with this art at this size
+    sf::Image image;
+  };
+
+  explicit ArtCache(const std::string &dir, std::size_t maxEntries = 256) : directory(dir), capacity(maxEntries)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    loadIndex();
+    worker = std::thread(&ArtCache::run, this);
+  }
+
+  ~ArtCache()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  // Replaces the wish list, most wanted first; anything not in it may be evicted
+  void request(const std::vector<std::string> &paths)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (paths == wanted)
+      return;
+    wanted = paths;
+    if (wanted.size() > capacity)
+      wanted.resize(capacity);
+    for (const std::string &path : wanted)
+    {
+      auto it = slots.find(path);
+      if (it != slots.end())
+        it->second.lastUsed = ++clock;
+    }
+    wake.notify_all();
+  }
+
+  std::shared_ptr<const Thumbnail> find(const std::string &path, Size size)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = slots.find(path);
+    if (it == slots.end() || !it->second.ready)
+      return nullptr;
+    it->second.lastUsed = ++clock;
+    return it->second.thumbnails[size];
+  }
+
+private:
+  using Thumbnails = std::array<std::shared_ptr<const Thumbnail>, SizeCount>;
+
+  struct Slot
+  {
+    Thumbnails thumbnails; // null if the track has no art
+    bool ready = false;    // false while the worker looks for it
+    std::uint64_t lastUsed = 0;
+  };
+
+  struct Known
+  {
+    long long sourceTime = 0;
+    std::string hash; // empty if the track has no art
+  };
+
+  std::string directory;
+  std::size_t capacity;
+  std::vector<std::string> wanted;
+  std::map<std::string, Slot> slots;
+  std::map<std::string, Known> index;
+  std::uint64_t clock = 0;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::thread worker;
+
+  // 64-bit FNV-1a
+  static std::string hashOf(const std::vector<unsigned char> &bytes)
+  {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char byte : bytes)
+      hash = (hash ^ byte) * 1099511628211ull;
+    std::ostringstream text;
+    text << std::hex;
+    text.width(16);
+    text.fill('0');
+    text << hash;
+    return text.str();
+  }
+
+  std::filesystem::path fileFor(const std::string &hash, Size size) const
+  {
+    return std::filesystem::path(directory) / (hash + "-" + std::to_string(Pixels[size]) + ".png");
+  }
+
+  // One line per track: source time, art hash or "-", then the source path.
+  // Lines are only ever appended; a later line for a path replaces earlier ones.
+  void loadIndex()
+  {
+    std::ifstream file((std::filesystem::path(directory) / "index.txt").string());
+    Known known;
+    std::string path;
+    while (file >> known.sourceTime >> known.hash && std::getline(file >> std::ws, path))
+    {
+      if (known.hash == "-")
+        known.hash.clear();
+      index[path] = known;
+    }
+  }
+
+  void remember(const std::string &path, const Known &known)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    index[path] = known;
+    std::ofstream file((std::filesystem::path(directory) / "index.txt").string(), std::ios::app);
+    file << known.sourceTime << " " << (known.hash.empty() ? "-" : known.hash) << " " << path << "\n";
+  }
+
+  Thumbnails loadThumbnails(const std::string &hash) const
+  {
+    Thumbnails thumbnails;
+    for (int size = 0; size < SizeCount; size++)
+    {
+      auto thumbnail = std::make_shared<Thumbnail>();
+      thumbnail->key = hash + "-" + std::to_string(Pixels[size]);
+      if (!thumbnail->image.loadFromFile(fileFor(hash, static_cast<Size>(size)).string()))
+        return {};
+      thumbnails[size] = thumbnail;
+    }
+    return thumbnails;
+  }
+
+  Thumbnails produce(const std::string &path)
+  {
+    Known known{fileModificationTime(path), {}};
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = index.find(path);
+      if (it != index.end() && it->second.sourceTime == known.sourceTime)
+      {
+        if (it->second.hash.empty())
+          return {};
+        known.hash = it->second.hash;
+      }
+    }
+    if (!known.hash.empty())
+    {
+      Thumbnails thumbnails = loadThumbnails(known.hash);
+      if (thumbnails[0])
+        return thumbnails;
+    }
+    std::vector<unsigned char> art = readEmbeddedArt(path);
+    if (art.empty())
+      art = readFolderArt(path);
+    known.hash = art.empty() ? std::string() : hashOf(art);
+    Thumbnails thumbnails;
+    if (!known.hash.empty())
+    {
+      thumbnails = loadThumbnails(known.hash); // another album track got there first
+      sf::Image full;
+      if (!thumbnails[0] && full.loadFromMemory(art.data(), art.size()))
+      {
+        for (int size = 0; size < SizeCount; size++)
+        {
+          auto thumbnail = std::make_shared<Thumbnail>();
+          thumbnail->key = known.hash + "-" + std::to_string(Pixels[size]);
+          thumbnail->image = makeThumbnail(full, Pixels[size]);
+          std::filesystem::path target = fileFor(known.hash, static_cast<Size>(size)), partial = target;
+          partial.replace_extension(".part.png");
+          std::error_code error;
+          if (thumbnail->image.saveToFile(partial.string()))
+            std::filesystem::rename(partial, target, error);
+          thumbnails[size] = thumbnail;
+        }
+        std::cout << "[DEBUG] Art cache stored " << full.getSize().x << "x" << full.getSize().y << " art of " << path << std::endl;
+      }
+      else if (!thumbnails[0])
+      {
+        std::cout << "[ERROR] Could not decode the album art of " << path << std::endl;
+        known.hash.clear();
+      }
+    }
+    remember(path, known);
+    return thumbnails;
+  }
+
+  void evict()
+  {
+    while (slots.size() > capacity)
+    {
+      auto oldest = slots.end();
+      for (auto it = slots.begin(); it != slots.end(); ++it)
+        if (it->second.ready && std::find(wanted.begin(), wanted.end(), it->first) == wanted.end() &&
+            (oldest == slots.end() || it->second.lastUsed < oldest->second.lastUsed))
+          oldest = it;
+      if (oldest == slots.end())
+        return;
+      slots.erase(oldest);
+    }
+  }
+
+  void run()
+  {
+    lowerCurrentThreadPriority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      std::string path;
+      wake.wait(lock, [&]
+                {
+                  if (stopping)
+                    return true;
+                  for (const std::string &candidate : wanted)
+                    if (!slots.count(candidate))
+                    {
+                      path = candidate;
+                      return true;
+                    }
+                  return false;
+                });
+      if (stopping)
+        return;
+      slots[path].lastUsed = ++clock;
+      lock.unlock();
+      Thumbnails thumbnails = produce(path);
+      lock.lock();
+      slots[path].thumbnails = thumbnails;
+      slots[path].ready = true;
+      evict();
+    }
+  }
+};
+
+// Waveform of the playing track under the song title. Click to seek; scroll
+// to zoom around the cursor, and scroll back out to see the whole track.
+// The waveform is one vertex buffer that is rebuilt only when the track or
+// the zoom changes, and every zoom level comes from the peak pyramid.
+class WaveformSeekBar
+{
+  sf::RenderWindow &window;
+  sf::FloatRect bounds{220, 377, 760, 18};
+  std::function<void(double)> seekCallback;
+  std::optional<PeakPyramid> peaks;
+  double duration = 0, position = 0;
+  double viewStart = 0, viewEnd = 0; // visible part of the track, in seconds
+  std::vector<sf::Vertex> vertices;
+  sf::VertexBuffer buffer{sf::Quads, sf::VertexBuffer::Static};
+  bool stale = true;
+
+  double xToSeconds(float x) const
+  {
+    return viewStart + (viewEnd - viewStart) * std::max(0.0f, std::min(1.0f, (x - bounds.left) / bounds.width));
+  }
+  float secondsToX(double seconds) const
+  {
+    return bounds.left + static_cast<float>((seconds - viewStart) / (viewEnd - viewStart)) * bounds.width;
+  }
+
+  void rebuild()
+  {
+    stale = false;
+    vertices.clear();
+    if (!peaks)
+      return;
+    std::vector<PeakPyramid::Bin> columns;
+    peaks->summarize(viewStart, viewEnd, static_cast<std::size_t>(bounds.width), columns);
+    float middle = bounds.top + bounds.height / 2, scale = bounds.height / 2;
+    auto bar = [&](float x, float top, float bottom, sf::Color color)
+    {
+      vertices.push_back(sf::Vertex(sf::Vector2f(x, top), color));
+      vertices.push_back(sf::Vertex(sf::Vector2f(x + 1, top), color));
+      vertices.push_back(sf::Vertex(sf::Vector2f(x + 1, bottom), color));
+      vertices.push_back(sf::Vertex(sf::Vector2f(x, bottom), color));
+    };
+    for (std::size_t c = 0; c < columns.size(); c++)
+    {
+      float x = bounds.left + c;
+      bar(x, middle - columns[c].high * scale, middle - columns[c].low * scale + 1, sf::Color(34, 120, 70));
+      bar(x, middle - columns[c].rms * scale, middle + columns[c].rms * scale + 1, sf::Color(34, 197, 94));
+    }
+    if (sf::VertexBuffer::isAvailable() && buffer.create(vertices.size()))
+      buffer.update(vertices.data());
+  }
+
+public:
+  WaveformSeekBar(sf::RenderWindow &win, std::function<void(double)> seekCb) : window(win), seekCallback(seekCb) {}
+
+  void setTrack(double seconds, std::optional<PeakPyramid> overview)
+  {
+    duration = seconds;
+    peaks = std::move(overview);
+    position = viewStart = 0;
+    viewEnd = std::max(duration, 0.001);
+    stale = true;
+  }
+  // For peaks that finish computing while the track plays
+  void setPeaks(PeakPyramid overview)
+  {
+    peaks = std::move(overview);
+    stale = true;
+  }
+  bool hasPeaks() const { return peaks.has_value(); }
+  void setPosition(double seconds) { position = seconds; }
+
+  void handleEvent(const sf::Event &event)
+  {
+    if (duration <= 0)
+      return;
+    if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left &&
+        bounds.contains(event.mouseButton.x, event.mouseButton.y))
+    {
+      seekCallback(xToSeconds(static_cast<float>(event.mouseButton.x)));
+    }
+    else if (event.type == sf::Event::MouseWheelScrolled && bounds.contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y))
+    {
+      double anchor = xToSeconds(static_cast<float>(event.mouseWheelScroll.x));
+      double span = std::max(0.5, std::min(duration, (viewEnd - viewStart) * std::pow(0.8, event.mouseWheelScroll.delta)));
+      double fraction = (anchor - viewStart) / (viewEnd - viewStart);
+      viewStart = std::max(0.0, std::min(duration - span, anchor - span * fraction));
+      viewEnd = viewStart + span;
+      stale = true;
+    }
+  }
+
+  void draw()
+  {
+    if (stale)
+      rebuild();
+    sf::RectangleShape background(sf::Vector2f(bounds.width, bounds.height));
+    background.setPosition(bounds.left, bounds.top);
+    background.setFillColor(sf::Color(40, 40, 40, 200));
+    window.draw(background);
+    if (!vertices.empty())
+    {
+      if (buffer.getVertexCount() == vertices.size())
+        window.draw(buffer);
+      else
+        window.draw(vertices.data(), vertices.size(), sf::Quads);
+    }
+    if (duration <= 0)
+      return;
+    // Played part dimmed, then the playhead
+    float playhead = std::max(bounds.left, std::min(bounds.left + bounds.width, secondsToX(position)));
+    sf::RectangleShape played(sf::Vector2f(playhead - bounds.left, bounds.height));
+    played.setPosition(bounds.left, bounds.top);
+    played.setFillColor(sf::Color(255, 255, 255, 40));
+    window.draw(played);
+    if (position >= viewStart && position <= viewEnd)
+    {
+      sf::RectangleShape line(sf::Vector2f(2, bounds.height));
+      line.setPosition(playhead - 1, bounds.top);
+      line.setFillColor(sf::Color::White);
+      window.draw(line);
+    }
+  }
+};
+
+// Holds the last few seconds of output for the visualizer, indexed by
+// position in the track, because decoding runs up to a few seconds ahead
+// of what is heard. The audio thread writes and the UI thread reads without
+// a lock: the reader copies, then checks that the writer neither jumped nor
+// reached the copied frames meanwhile, and discards the copy if it did.
+class SpectrumTap : public AudioTap
+{
+public:
+  static const std::size_t Capacity = std::size_t(1) << 19; // frames; 11 s at 44.1 kHz
+
+  SpectrumTap() : left(Capacity), right(Capacity) {}
+
+  void consume(const float *samples, std::size_t count, unsigned int channelCount, unsigned int sampleRate, sf::Uint64 firstSample) override
+  {
+    std::size_t frames = count / channelCount;
+    sf::Uint64 first = firstSample / channelCount;
+    if (first != end.load(std::memory_order_relaxed) || sampleRate != rate.load(std::memory_order_relaxed))
+    {
+      // A seek or a new track: nothing stored leads up to these frames
+      jumps.fetch_add(1, std::memory_order_relaxed);
+      begin.store(first, std::memory_order_relaxed);
+      end.store(first, std::memory_order_relaxed);
+      rate.store(sampleRate, std::memory_order_relaxed);
+    }
+    writing.store(first + frames, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    unsigned int second = channelCount > 1 ? 1 : 0;
+    for (std::size_t i = 0; i < frames; i++)
+    {
+      std::size_t slot = static_cast<std::size_t>((first + i) % Capacity);
+      left[slot] = samples[i * channelCount];
+      right[slot] = samples[i * channelCount + second];
+    }
+    end.store(first + frames, std::memory_order_release);
+  }
+
+  unsigned int getSampleRate() const { return rate.load(std::memory_order_acquire); }
+
+  // Copies the `frames` frames that end just before `endFrame`; frames never
+  // written read as silence. False if nothing usable could be copied.
+  bool read(sf::Uint64 endFrame, std::size_t frames, float *outLeft, float *outRight) const
+  {
+    unsigned int jumpsBefore = jumps.load(std::memory_order_acquire);
+    sf::Uint64 from = endFrame > frames ? endFrame - frames : 0;
+    sf::Uint64 first = std::max(from, begin.load(std::memory_order_acquire));
+    sf::Uint64 last = std::min(endFrame, end.load(std::memory_order_acquire));
+    if (first >= last)
+      return false;
+    std::fill(outLeft, outLeft + frames, 0.0f);
+    std::fill(outRight, outRight + frames, 0.0f);
+    std::size_t skip = frames - static_cast<std::size_t>(endFrame - from); // near the start of a track
+    for (sf::Uint64 frame = first; frame < last; frame++)
+    {
+      std::size_t slot = static_cast<std::size_t>(frame % Capacity);
+      outLeft[skip + frame - from] = left[slot];
+      outRight[skip + frame - from] = right[slot];
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return jumps.load(std::memory_order_relaxed) == jumpsBefore && writing.load(std::memory_order_relaxed) <= first + Capacity;
+  }
+
+private:
+  std::vector<float> left, right;
+  std::atomic<sf::Uint64> begin{0}, end{0}; // frames held, as track positions
+  std::atomic<sf::Uint64> writing{0};       // end of the block being written
+  std::atomic<unsigned int> jumps{0}, rate{0};
+};
+
+// Live spectrum and peak meters under the transport buttons. Each frame
+// takes the window of output that is being heard right now (the playing
+// offset less the device latency) from a SpectrumTap, runs a Hann-windowed
+// FFT, and folds the bins into log-spaced bars with falling peak markers.
+// Reports in the log whenever a frame takes more than its 1 ms budget.
+class SpectrumVisualizer
+{
+  static const std::size_t WindowFrames = 2048;
+  static const std::size_t BarCount = 48;
+  static constexpr float FloorDb = -72, MeterFloorDb = -60;
+
+  sf::RenderWindow &window;
+  std::shared_ptr<SpectrumTap> tap;
+  sf::FloatRect bounds{220, 515, 760, 70};
+  Fft fft{WindowFrames};
+  std::vector<float> hann, left, right, re, im;
+  std::array<float, BarCount + 1> bandEdges{}; // in FFT bins
+  unsigned int bandRate = 0;
+  std::array<float, BarCount> bars{}, barPeaks{}, barPeakAges{};
+  std::array<float, 2> levels{}, levelPeaks{}, levelPeakAges{};
+  sf::VertexArray vertices{sf::Quads};
+  std::chrono::steady_clock::time_point lastUpdate = std::chrono::steady_clock::now();
+  double slowestMs = 0;
+  int framesSinceReport = 0;
+
+  void layoutBands(unsigned int sampleRate)
+  {
+    bandRate = sampleRate;
+    float low = 40, high = std::min(16000.0f, sampleRate / 2.0f);
+    for (std::size_t b = 0; b <= BarCount; b++)
+      bandEdges[b] = low * std::pow(high / low, static_cast<float>(b) / BarCount) * WindowFrames / sampleRate;
+  }
+
+  // Peak power in a band, relative to a full-scale sine
+  float bandDb(std::size_t band) const
+  {
+    float from = bandEdges[band], to = bandEdges[band + 1];
+    float power = 0;
+    for (std::size_t k = static_cast<std::size_t>(std::ceil(from)); k < to; k++)
+      power = std::max(power, re[k] * re[k] + im[k] * im[k]);
+    if (power == 0)
+    {
+      // Narrower than a bin: interpolate at the band centre
+      float centre = (from + to) / 2;
+      std::size_t k = static_cast<std::size_t>(centre);
+      float fraction = centre - k;
+      power = (re[k] * re[k] + im[k] * im[k]) * (1 - fraction) + (re[k + 1] * re[k + 1] + im[k + 1] * im[k + 1]) * fraction;
+    }
+    float fullScale = WindowFrames * WindowFrames / 16.0f; // |X|^2 of a unit sine under a Hann window
+    return 10 * std::log10(power / fullScale + 1e-12f);
+  }
+
+  // Levels jump up at once and fall at 48 dB a second; peak markers hold
+  // for 0.8 s, then fall at half that speed
+  static void follow(float value, float &level, float &peak, float &peakAge, float seconds, float floor)
+  {
+    level = std::max(value, std::max(floor, level - 48 * seconds));
+    peakAge += seconds;
+    if (value >= peak)
+    {
+      peak = value;
+      peakAge = 0;
+    }
+    else if (peakAge > 0.8f)
+      peak = std::max(floor, peak - 24 * seconds);
+  }
+
+  void quad(float x, float y, float width, float height, sf::Color color)
+  {
+    vertices.append(sf::Vertex(sf::Vector2f(x, y), color));
+    vertices.append(sf::Vertex(sf::Vector2f(x + width, y), color));
+    vertices.append(sf::Vertex(sf::Vector2f(x + width, y + height), color));
+    vertices.append(sf::Vertex(sf::Vector2f(x, y + height), color));
+  }
+
+  void rebuild()
+  {
+    vertices.clear();
+    float meterWidth = 14, spectrumWidth = bounds.width - 3 * meterWidth;
+    float barWidth = spectrumWidth / BarCount;
+    float bottom = bounds.top + bounds.height;
+    for (std::size_t b = 0; b < BarCount; b++)
+    {
+      float x = bounds.left + b * barWidth;
+      float height = (bars[b] - FloorDb) / -FloorDb * bounds.height;
+      float peak = (barPeaks[b] - FloorDb) / -FloorDb * bounds.height;
+      quad(x + 1, bottom - height, barWidth - 2, height, sf::Color(34, 197, 94));
+      quad(x + 1, bottom - peak - 2, barWidth - 2, 2, sf::Color::White);
+    }
+    for (std::size_t c = 0; c < 2; c++)
+    {
+      float x = bounds.left + spectrumWidth + meterWidth * (0.5f + c * 1.25f);
+      float height = (levels[c] - MeterFloorDb) / -MeterFloorDb * bounds.height;
+      float peak = (levelPeaks[c] - MeterFloorDb) / -MeterFloorDb * bounds.height;
+      quad(x, bottom - height, meterWidth - 2, height, levels[c] > -1 ? sf::Color(220, 60, 60) : sf::Color(70, 130, 180));
+      quad(x, bottom - peak - 2, meterWidth - 2, 2, sf::Color::White);
+    }
+  }
+
+public:
+  SpectrumVisualizer(sf::RenderWindow &win, std::shared_ptr<SpectrumTap> t)
+      : window(win), tap(std::move(t)), hann(WindowFrames), left(WindowFrames), right(WindowFrames), re(WindowFrames), im(WindowFrames)
+  {
+    for (std::size_t i = 0; i < WindowFrames; i++)
+      hann[i] = 0.5f - 0.5f * std::cos(2 * 3.14159265358979f * i / WindowFrames);
+    bars.fill(FloorDb);
+    barPeaks.fill(FloorDb);
+    levels.fill(MeterFloorDb);
+    levelPeaks.fill(MeterFloorDb);
+  }
+
+  // `heard`: the position reaching the speaker now, or nothing when paused
+  void update(std::optional<sf::Time> heard)
+  {
+    auto started = std::chrono::steady_clock::now();
+    float seconds = std::min(0.1f, std::chrono::duration<float>(started - lastUpdate).count());
+    lastUpdate = started;
+    unsigned int sampleRate = tap->getSampleRate();
+    std::array<float, BarCount> barDb;
+    std::array<float, 2> levelDb = {MeterFloorDb, MeterFloorDb};
+    barDb.fill(FloorDb);
+    sf::Uint64 endFrame = heard ? static_cast<sf::Uint64>(std::max<sf::Int64>(0, heard->asMicroseconds())) * sampleRate / 1000000 : 0;
+    if (heard && sampleRate > 0 && tap->read(endFrame, WindowFrames, left.data(), right.data()))
+    {
+      if (sampleRate != bandRate)
+        layoutBands(sampleRate);
+      float peaks[2] = {0, 0};
+      for (std::size_t i = 0; i < WindowFrames; i++)
+      {
+        peaks[0] = std::max(peaks[0], std::fabs(left[i]));
+        peaks[1] = std::max(peaks[1], std::fabs(right[i]));
+        re[i] = (left[i] + right[i]) * 0.5f * hann[i];
+        im[i] = 0;
+      }
+      fft.forward(re.data(), im.data());
+      for (std::size_t b = 0; b < BarCount; b++)
+        barDb[b] = std::max(FloorDb, bandDb(b));
+      for (std::size_t c = 0; c < 2; c++)
+        levelDb[c] = std::max(MeterFloorDb, 20 * std::log10(peaks[c] + 1e-9f));
+    }
+    for (std::size_t b = 0; b < BarCount; b++)
+      follow(barDb[b], bars[b], barPeaks[b], barPeakAges[b], seconds, FloorDb);
+    for (std::size_t c = 0; c < 2; c++)
+      follow(levelDb[c], levels[c], levelPeaks[c], levelPeakAges[c], seconds, MeterFloorDb);
+    rebuild();
+
+    slowestMs = std::max(slowestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+    if (++framesSinceReport == 300)
+    {
+      if (slowestMs > 1)
+        std::cout << "[DEBUG] Visualizer frame took up to " << slowestMs << " ms (budget 1 ms)." << std::endl;
+      slowestMs = 0;
+      framesSinceReport = 0;
+    }
+  }
+
+  void draw()
+  {
+    sf::RectangleShape background(sf::Vector2f(bounds.width, bounds.height));
+    background.setPosition(bounds.left, bounds.top);
+    background.setFillColor(sf::Color(40, 40, 40, 200));
+    window.draw(background);
+    window.draw(vertices);
+  }
+};
+
+// Spectrogram tiles of whole tracks, computed by a pool of low-priority
+// worker threads. A tile is TileColumns STFT columns by TileRows log-spaced
+// frequency rows. At zoom level z one column steps BaseHop << z frames, so
+// each level halves the one below and the coarsest fits a track into one
+// tile. Tiles are kept at one byte a pixel (the level in dB, coloured by the
+// view on upload), a quarter of an RGBA texture, and the least recently used
+// go first once over budget. Like the head cache, it works from a wish list
+// the view replaces as it pans and zooms.
+class SpectrogramTiles
+{
+public:
+  static const std::size_t TileColumns = 256, TileRows = 256, FftSize = 2048;
+  static const unsigned int BaseHop = 256;
+
+  struct Key
+  {
+    std::string path;
+    int level = 0; // -1 asks for the track's format only
+    std::int64_t index = 0;
+    bool operator<(const Key &other) const { return std::tie(path, level, index) < std::tie(other.path, other.level, other.index); }
+  };
+
+  struct Track
+  {
+    unsigned int sampleRate = 0;
+    sf::Uint64 frames = 0;
+
+    std::int64_t columns(int level) const { return static_cast<std::int64_t>((frames + (sf::Uint64(BaseHop) << level) - 1) / (sf::Uint64(BaseHop) << level)); }
+    int levelCount() const
+    {
+      int level = 0;
+      while (columns(level) > static_cast<std::int64_t>(TileColumns))
+        level++;
+      return level + 1;
+    }
+  };
+
+  struct Tile
+  {
+    std::vector<std::uint8_t> pixels; // TileRows rows of TileColumns, highest frequency first
+    std::size_t columns = 0;          // the last tile of a track is cut short
+  };
+
+  explicit SpectrogramTiles(unsigned int workerCount, std::size_t maxTiles = 512) : capacity(maxTiles)
+  {
+    for (unsigned int i = 0; i < std::max(1u, workerCount); i++)
+      workers.emplace_back(&SpectrogramTiles::run, this);
+  }
+
+  ~SpectrogramTiles()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+  }
+
+  // Replaces the wish list, most wanted first
+  void request(const std::vector<Key> &keys)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    wanted = keys;
+    for (const Key &key : wanted)
+    {
+      auto it = tiles.find(key);
+      if (it != tiles.end())
+        it->second.lastUsed = ++clock;
+    }
+    wake.notify_all();
+  }
+
+  std::shared_ptr<const Tile> find(const Key &key)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tiles.find(key);
+    if (it == tiles.end() || !it->second.tile)
+      return nullptr;
+    it->second.lastUsed = ++clock;
+    return it->second.tile;
+  }
+
+  // The track's format once a worker has opened it; no frames if it could not
+  std::optional<Track> findTrack(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tracks.find(path);
+    if (it == tracks.end() || !it->second.ready)
+      return std::nullopt;
+    return it->second.track;
+  }
+
+private:
+  struct Slot
+  {
+    std::shared_ptr<const Tile> tile; // null if it could not be computed
+    bool ready = false;               // false while a worker computes it
+    std::uint64_t lastUsed = 0;
+  };
+
+  struct TrackSlot
+  {
+    Track track;
+    bool ready = false;
+  };
+
+  std::size_t capacity;
+  std::vector<Key> wanted;
+  std::map<Key, Slot> tiles;
+  std::map<std::string, TrackSlot> tracks;
+  std::uint64_t clock = 0;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+
+  bool isDone(const Key &key) const { return key.level < 0 ? tracks.count(key.path) > 0 : tiles.count(key) > 0; }
+
+  static std::shared_ptr<const Tile> compute(AudioDecoder &decoder, const Key &key)
+  {
+    unsigned int channels = decoder.getChannelCount(), sampleRate = decoder.getSampleRate();
+    Track track{sampleRate, decoder.getSampleCount() / channels};
+    std::int64_t firstColumn = key.index * static_cast<std::int64_t>(TileColumns);
+    if (firstColumn >= track.columns(key.level))
+      return nullptr;
+    auto tile = std::make_shared<Tile>();
+    tile->columns = static_cast<std::size_t>(std::min<std::int64_t>(TileColumns, track.columns(key.level) - firstColumn));
+    tile->pixels.assign(TileColumns * TileRows, 0);
+
+    // Log-spaced rows from 30 Hz to Nyquist, as ranges of FFT bins
+    std::array<float, TileRows + 1> edges;
+    for (std::size_t r = 0; r <= TileRows; r++)
+      edges[r] = 30.0f * std::pow(sampleRate / 2.0f / 30.0f, static_cast<float>(r) / TileRows) * FftSize / sampleRate;
+    std::vector<float> hann(FftSize), mono(FftSize), re(FftSize), im(FftSize), block(FftSize * channels), power(FftSize / 2 + 1);
+    for (std::size_t i = 0; i < FftSize; i++)
+      hann[i] = 0.5f - 0.5f * std::cos(2 * 3.14159265358979f * i / FftSize);
+    Fft fft(FftSize);
+
+    // Reads `frames` frames, mixed to mono, to the end of `mono`
+    auto append = [&](std::size_t frames)
+    {
+      std::copy(mono.begin() + frames, mono.end(), mono.begin());
+      std::size_t read = static_cast<std::size_t>(decoder.read(block.data(), frames * channels)) / channels;
+      float *out = mono.data() + FftSize - frames;
+      for (std::size_t i = 0; i < frames; i++)
+      {
+        float sum = 0;
+        for (unsigned int c = 0; c < channels; c++)
+          sum += i < read ? block[i * channels + c] : 0.0f;
+        out[i] = sum / channels;
+      }
+    };
+
+    sf::Uint64 hop = sf::Uint64(BaseHop) << key.level;
+    float fullScale = FftSize * FftSize / 16.0f; // |X|^2 of a unit sine under a Hann window
+    for (std::size_t c = 0; c < tile->columns; c++)
+    {
+      // Close columns slide one window along; far apart ones seek
+      if (c == 0 || hop >= FftSize)
+      {
+        decoder.seek((firstColumn + c) * hop * channels);
+        append(FftSize);
+      }
+      else
+        append(static_cast<std::size_t>(hop));
+      for (std::size_t i = 0; i < FftSize; i++)
+      {
+        re[i] = mono[i] * hann[i];
+        im[i] = 0;
+      }
+      fft.forward(re.data(), im.data());
+      for (std::size_t k = 0; k < power.size(); k++)
+        power[k] = (re[k] * re[k] + im[k] * im[k]) / fullScale;
+      for (std::size_t r = 0; r < TileRows; r++)
+      {
+        float peak = 0;
+        for (std::size_t k = static_cast<std::size_t>(std::ceil(edges[r])); k < edges[r + 1] && k < power.size(); k++)
+          peak = std::max(peak, power[k]);
+        if (peak == 0)
+        {
+          // Narrower than a bin: interpolate at the row centre
+          float centre = std::min((edges[r] + edges[r + 1]) / 2, static_cast<float>(power.size() - 2));
+          std::size_t k = static_cast<std::size_t>(centre);
+          peak = power[k] + (power[k + 1] - power[k]) * (centre - k);
+        }
+        float db = 10 * std::log10(peak + 1e-12f); // 0 to -100 dB maps to 255 to 0
+        tile->pixels[(TileRows - 1 - r) * TileColumns + c] = static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, (db + 100) * 2.55f)));
+      }
+    }
+    return tile;
+  }
+
+  void evict()
+  {
+    while (tiles.size() > capacity)
+    {
+      auto oldest = tiles.end();
+      for (auto it = tiles.begin(); it != tiles.end(); ++it)
+        if (it->second.ready && std::find_if(wanted.begin(), wanted.end(), [&](const Key &key)
+                                             { return !(key < it->first) && !(it->first < key); }) == wanted.end() &&
+            (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+          oldest = it;
+      if (oldest == tiles.end())
+        return;
+      tiles.erase(oldest);
+    }
+  }
+
+  void run()
+  {
+    lowerCurrentThreadPriority();
+    // Each worker keeps its own decoder on the track it last worked on
+    std::string openPath;
+    std::unique_ptr<AudioDecoder> decoder;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      Key key;
+      wake.wait(lock, [&]
+                {
+                  if (stopping)
+                    return true;
+                  for (const Key &candidate : wanted)
+                    if (!isDone(candidate))
+                    {
+                      key = candidate;
+                      return true;
+                    }
+                  return false;
+                });
+      if (stopping)
+        return;
+      if (key.level < 0)
+        tracks[key.path]; // claims it; filled in below
+      else
+        tiles[key].lastUsed = ++clock;
+      lock.unlock();
+      if (key.path != openPath)
+      {
+        decoder = openDecoder(key.path);
+        openPath = key.path;
+      }
+      Track track;
+      std::shared_ptr<const Tile> tile;
+      if (decoder)
+      {
+        track = {decoder->getSampleRate(), decoder->getSampleCount() / decoder->getChannelCount()};
+        if (key.level >= 0)
+          tile = compute(*decoder, key);
+      }
+      lock.lock();
+      if (key.level < 0)
+        tracks[key.path] = {track, true};
+      else
+      {
+        tiles[key].tile = tile;
+        tiles[key].ready = true;
+        evict();
+      }
+    }
+  }
+};
+
+// Zoomable spectrogram of the playing track. Scroll to zoom around the
+// cursor, drag or use the arrow keys to pan. While the tiles at the current
+// zoom are being computed, the coarser levels already at hand are drawn
+// stretched underneath, so a long track shows an overview at once and
+// sharpens as tiles arrive. Tiles are uploaded into a small pool of
+// textures, a few per frame, as they come into view.
+class SpectrogramView : public WindowView
+{
+  static const std::size_t TextureCount = 32, UploadsPerFrame = 4;
+
+  struct Resident
+  {
+    sf::Texture texture;
+    std::uint64_t lastUsed = 0;
+  };
+
+  sf::RenderWindow &window;
+  sf::Font &font;
+  std::shared_ptr<SpectrogramTiles> tiles;
+  std::string path;
+  std::function<double()> positionCallback; // seconds, negative when nothing plays
+  sf::FloatRect bounds{220, 60, 760, 280};
+  std::optional<SpectrogramTiles::Track> track;
+  int level = 0;
+  double viewColumn = 0; // left edge, in columns of `level`
+  bool dragging = false;
+  int dragX = 0;
+  bool requested = false;
+  std::map<SpectrogramTiles::Key, Resident> textures;
+  std::uint64_t clock = 0;
+  std::size_t uploads = 0;
+  std::array<sf::Color, 256> palette;
+  std::vector<sf::Uint8> rgba;
+
+  std::int64_t columns() const { return track->columns(level); }
+
+  void clampView()
+  {
+    viewColumn = std::max(0.0, std::min(viewColumn, static_cast<double>(columns()) - bounds.width));
+    requested = false;
+  }
+
+  void zoom(int steps, float anchorX)
+  {
+    int target = std::max(0, std::min(track->levelCount() - 1, level - steps));
+    double anchor = viewColumn + (anchorX - bounds.left);
+    viewColumn = anchor * std::pow(2.0, level - target) - (anchorX - bounds.left);
+    level = target;
+    clampView();
+  }
+
+  // The coarsest level first, for an overview, then the visible tiles from
+  // the middle out, then one more on either side for panning
+  void requestVisible()
+  {
+    requested = true;
+    int coarsest = track->levelCount() - 1;
+    std::vector<SpectrogramTiles::Key> keys = {{path, coarsest, 0}};
+    std::int64_t first = static_cast<std::int64_t>(viewColumn) / static_cast<std::int64_t>(SpectrogramTiles::TileColumns);
+    std::int64_t last = static_cast<std::int64_t>(viewColumn + bounds.width) / static_cast<std::int64_t>(SpectrogramTiles::TileColumns);
+    auto add = [&](std::int64_t index)
+    {
+      if (level != coarsest && index >= 0 && index * static_cast<std::int64_t>(SpectrogramTiles::TileColumns) < columns())
+        keys.push_back({path, level, index});
+    };
+    std::int64_t middle = (first + last) / 2;
+    for (std::int64_t distance = 0; middle - distance >= first || middle + distance <= last; distance++)
+    {
+      if (middle - distance >= first)
+        add(middle - distance);
+      if (distance > 0 && middle + distance <= last)
+        add(middle + distance);
+    }
+    add(first - 1);
+    add(last + 1);
+    tiles->request(keys);
+  }
+
+  // The tile's texture, uploading it if it is not resident yet and this
+  // frame's upload budget allows
+  const sf::Texture *textureFor(const SpectrogramTiles::Key &key, const SpectrogramTiles::Tile &tile)
+  {
+    auto it = textures.find(key);
+    if (it != textures.end())
+    {
+      it->second.lastUsed = ++clock;
+      return &it->second.texture;
+    }
+    if (uploads == UploadsPerFrame)
+      return nullptr;
+    uploads++;
+    if (textures.size() >= TextureCount)
+    {
+      // Reuse the least recently drawn texture rather than allocate another
+      auto oldest = std::min_element(textures.begin(), textures.end(), [](const auto &a, const auto &b)
+                                     { return a.second.lastUsed < b.second.lastUsed; });
+      auto node = textures.extract(oldest);
+      node.key() = key;
+      it = textures.insert(std::move(node)).position;
+    }
+    else
+    {
+      it = textures.emplace(key, Resident()).first;
+      it->second.texture.create(SpectrogramTiles::TileColumns, SpectrogramTiles::TileRows);
+    }
+    for (std::size_t i = 0; i < tile.pixels.size(); i++)
+    {
+      const sf::Color &color = palette[tile.pixels[i]];
+      rgba[i * 4] = color.r;
+      rgba[i * 4 + 1] = color.g;
+      rgba[i * 4 + 2] = color.b;
+      rgba[i * 4 + 3] = 255;
+    }
+    it->second.texture.update(rgba.data());
+    it->second.lastUsed = ++clock;
+    return &it->second.texture;
+  }
+
+  void drawLevel(int tileLevel)
+  {
+    double scale = std::pow(2.0, tileLevel - level); // screen pixels per column of tileLevel
+    double from = viewColumn / scale, to = (viewColumn + bounds.width) / scale;
+    for (std::int64_t index = static_cast<std::int64_t>(from) / static_cast<std::int64_t>(SpectrogramTiles::TileColumns);
+         index * static_cast<double>(SpectrogramTiles::TileColumns) < to; index++)
+    {
+      SpectrogramTiles::Key key{path, tileLevel, index};
+      std::shared_ptr<const SpectrogramTiles::Tile> tile = tiles->find(key);
+      if (!tile)
+        continue;
+      const sf::Texture *texture = textureFor(key, *tile);
+      if (!texture)
+        continue;
+      double base = static_cast<double>(index * static_cast<std::int64_t>(SpectrogramTiles::TileColumns));
+      int first = static_cast<int>(std::max(0.0, std::ceil(from - base)));
+      int last = static_cast<int>(std::min(static_cast<double>(tile->columns), std::floor(to - base)));
+      if (first >= last)
+        continue;
+      sf::Sprite sprite(*texture, sf::IntRect(first, 0, last - first, SpectrogramTiles::TileRows));
+      sprite.setPosition(bounds.left + static_cast<float>((base + first) * scale - viewColumn), bounds.top);
+      sprite.setScale(static_cast<float>(scale), bounds.height / SpectrogramTiles::TileRows);
+      window.draw(sprite);
+    }
+  }
+
+public:
+  SpectrogramView(sf::RenderWindow &win, sf::Font &f, std::shared_ptr<SpectrogramTiles> t, const std::string &trackPath,
+                  std::function<double()> positionCb)
+      : window(win), font(f), tiles(std::move(t)), path(trackPath), positionCallback(positionCb),
+        rgba(SpectrogramTiles::TileColumns * SpectrogramTiles::TileRows * 4)
+  {
+    // Black through purple and orange to pale yellow
+    const float stops[5][3] = {{0, 0, 0}, {80, 18, 123}, {190, 55, 82}, {252, 140, 40}, {252, 250, 190}};
+    for (std::size_t i = 0; i < palette.size(); i++)
+    {
+      float position = i / 255.0f * 4;
+      std::size_t stop = std::min<std::size_t>(3, static_cast<std::size_t>(position));
+      float fraction = position - stop;
+      palette[i] = sf::Color(static_cast<sf::Uint8>(stops[stop][0] + (stops[stop + 1][0] - stops[stop][0]) * fraction),
+                             static_cast<sf::Uint8>(stops[stop][1] + (stops[stop + 1][1] - stops[stop][1]) * fraction),
+                             static_cast<sf::Uint8>(stops[stop][2] + (stops[stop + 1][2] - stops[stop][2]) * fraction));
+    }
+    if (!path.empty())
+      tiles->request({{path, -1, 0}});
+  }
+
+  void handleEvent(const sf::Event &event) override
+  {
+    if (!track)
+      return;
+    if (event.type == sf::Event::MouseWheelScrolled && bounds.contains(event.mouseWheelScroll.x, event.mouseWheelScroll.y))
+      zoom(event.mouseWheelScroll.delta > 0 ? 1 : -1, static_cast<float>(event.mouseWheelScroll.x));
+    else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left &&
+             bounds.contains(event.mouseButton.x, event.mouseButton.y))
+    {
+      dragging = true;
+      dragX = event.mouseButton.x;
+    }
+    else if (event.type == sf::Event::MouseButtonReleased)
+      dragging = false;
+    else if (event.type == sf::Event::MouseMoved && dragging)
+    {
+      viewColumn -= event.mouseMove.x - dragX;
+      dragX = event.mouseMove.x;
+      clampView();
+    }
+    else if (event.type == sf::Event::KeyPressed && (event.key.code == sf::Keyboard::Left || event.key.code == sf::Keyboard::Right))
+    {
+      viewColumn += (event.key.code == sf::Keyboard::Left ? -1 : 1) * bounds.width / 4;
+      clampView();
+    }
+  }
+
+  void update() override
+  {
+    if (path.empty())
+      return;
+    if (!track)
+    {
+      track = tiles->findTrack(path);
+      if (!track)
+        return;
+      if (track->frames == 0)
+      {
+        std::cout << "[ERROR] Could not open " << path << " for the spectrogram.\n";
+        return;
+      }
+      // Start with the whole track in view
+      while (level + 1 < track->levelCount() && columns() > bounds.width)
+        level++;
+    }
+    if (track->frames > 0 && !requested)
+      requestVisible();
+  }
+
+  void draw() override
+  {
+    sf::RectangleShape background(sf::Vector2f(bounds.width, bounds.height));
+    background.setPosition(bounds.left, bounds.top);
+    background.setFillColor(sf::Color::Black);
+    window.draw(background);
+    if (!track || track->frames == 0)
+    {
+      sf::Text text(path.empty() ? "Play a track to see its spectrogram" : "Opening the track...", font, 18);
+      text.setFillColor(sf::Color(180, 180, 180));
+      text.setPosition(bounds.left + 20, bounds.top + 20);
+      window.draw(text);
+      return;
+    }
+    uploads = 0;
+    for (int tileLevel = track->levelCount() - 1; tileLevel >= level; tileLevel--)
+      drawLevel(tileLevel);
+
+    double position = positionCallback();
+    float x = bounds.left + static_cast<float>(position * track->sampleRate / (sf::Uint64(SpectrogramTiles::BaseHop) << level) - viewColumn);
+    if (position >= 0 && x >= bounds.left && x <= bounds.left + bounds.width)
+    {
+      sf::RectangleShape line(sf::Vector2f(1, bounds.height));
+      line.setPosition(x, bounds.top);
+      line.setFillColor(sf::Color::White);
+      window.draw(line);
+    }
+  }
+};
+
+// Groups of tracks that are the same recording under different names or
+// formats, from the fingerprints analyzed so far. The search runs on a
+// thread of its own; click a track to play it, scroll to see more groups.
+class DuplicatesView : public WindowView
+{
+  sf::RenderWindow &window;
+  sf::Font &font;
+  std::vector<std::string> &songs;
+  std::function<void(int)> playSongCallback;
+  std::future<DuplicateReport> searching;
+  std::optional<DuplicateReport> report;
+  std::vector<std::pair<std::string, std::string>> rows; // (path or empty for a heading, text)
+  float scroll = 0;
+
+  // Only rows draw() shows can be hit, so clicks on the controls below pass through
+  int rowAt(int x, int y) const
+  {
+    int row = static_cast<int>((y - 60 + scroll) / 25);
+    float top = 60 + row * 25 - scroll;
+    if (x < 220 || y < 60 || row < 0 || row >= static_cast<int>(rows.size()) || top < 60 || top > 320)
+      return -1;
+    return row;
+  }
+
+public:
+  DuplicatesView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &s, std::shared_ptr<AnalysisStore> store,
+                 std::function<void(int)> playCb)
+      : window(win), font(f), songs(s), playSongCallback(playCb)
+  {
+    // Detached, so leaving the page never waits for a search over a big library
+    auto promise = std::make_shared<std::promise<DuplicateReport>>();
+    searching = promise->get_future();
+    std::thread([promise, paths = songs, store]
+                {
+                  lowerCurrentThreadPriority();
+                  promise->set_value(findDuplicates(paths, *store));
+                })
+        .detach();
+  }
+
+  void handleEvent(const sf::Event &event) override
+  {
+    if (event.type == sf::Event::MouseWheelScrolled)
+      scroll = std::max(0.0f, std::min(scroll - event.mouseWheelScroll.delta * 25, rows.size() * 25.0f));
+    else if (event.type == sf::Event::MouseButtonPressed)
+    {
+      int row = rowAt(event.mouseButton.x, event.mouseButton.y);
+      if (row < 0 || rows[row].first.empty())
+        return;
+      auto it = std::find(songs.begin(), songs.end(), rows[row].first);
+      if (it != songs.end())
+        playSongCallback(static_cast<int>(std::distance(songs.begin(), it)));
+    }
+  }
+
+  void update() override
+  {
+    if (report || searching.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;
+    report = searching.get();
+    for (std::size_t g = 0; g < report->groups.size(); g++)
+    {
+      const DuplicateGroup &group = report->groups[g];
+      rows.emplace_back("", "Group " + std::to_string(g + 1) + " (" + std::to_string(group.paths.size()) + " tracks)");
+      for (std::size_t i = 0; i < group.paths.size(); i++)
+        rows.emplace_back(group.paths[i], "   " + std::to_string(static_cast<int>(std::lround(group.confidence[i] * 100))) + "%   " + group.paths[i]);
+    }
+  }
+
+  void draw() override
+  {
+    sf::Text status("", font, 18);
+    status.setFillColor(sf::Color(180, 180, 180));
+    status.setPosition(220, 20);
+    if (!report)
+      status.setString("Looking for duplicates among " + std::to_string(songs.size()) + " tracks...");
+    else
+      status.setString(std::to_string(report->groups.size()) + " duplicate groups, from " + std::to_string(report->fingerprinted) + " of " +
+                       std::to_string(songs.size()) + " tracks fingerprinted so far");
+    window.draw(status);
+    for (std::size_t i = 0; i < rows.size(); i++)
+    {
+      float y = 60 + i * 25 - scroll;
+      if (y < 60 || y > 320)
+        continue;
+      sf::Text text(rows[i].second, font, 18);
+      text.setFillColor(rows[i].first.empty() ? sf::Color(34, 197, 94) : sf::Color::White);
+      text.setPosition(220, y);
+      window.draw(text);
+    }
+  }
+};
+
+// Library check: how much of the library has been verified, and every
+// track that failed and why. The background analysis verifies tracks as it
+// goes; "Verify all now" starts a job on every core, which the player keeps
+// running when the page is left. Results are kept per track, so an
+// interrupted check picks up where it stopped. Click a track to play it.
+class VerifyView : public WindowView
+{
+  sf::RenderWindow &window;
+  sf::Font &font;
+  std::vector<std::string> &songs;
+  std::shared_ptr<AnalysisStore> store;
+  std::function<void(int)> playSongCallback;
+  std::function<std::optional<LibraryAnalyzer::Progress>()> jobProgress; // nothing until a job was started
+  std::function<void()> startJob;
+  std::function<std::size_t()> finishedCount; // tracks analyzed so far, by the background analysis and the job
+  std::future<VerifySummary> scanning;
+  std::optional<VerifySummary> summary;
+  std::size_t scannedAt = 0;
+  int framesSinceScan = 0;
+  float scroll = 0;
+  sf::FloatRect button{760, 15, 200, 32};
+
+  // Reading every track's result touches the disk, so it runs off the UI thread
+  void scan()
+  {
+    scannedAt = finishedCount();
+    auto promise = std::make_shared<std::promise<VerifySummary>>();
+    scanning = promise->get_future();
+    std::thread([promise, paths = songs, store = store]
+                {
+                  lowerCurrentThreadPriority();
+                  promise->set_value(summarizeVerification(paths, *store));
+                })
+        .detach();
+  }
+
+  // Only rows draw() shows can be hit, so clicks on the controls below pass through
+  int rowAt(int x, int y) const
+  {
+    int row = static_cast<int>((y - 100 + scroll) / 25);
+    float top = 100 + row * 25 - scroll;
+    if (!summary || x < 220 || y < 100 || row < 0 || row >= static_cast<int>(summary->problems.size()) || top < 100 || top > 320)
+      return -1;
+    return row;
+  }
+
+public:
+  VerifyView(sf::RenderWindow &win, sf::Font &f, std::vector<std::string> &s, std::shared_ptr<AnalysisStore> st,
+             std::function<void(int)> playCb, std::function<std::optional<LibraryAnalyzer::Progress>()> progressCb,
+             std::function<void()> startCb, std::function<std::size_t()> finishedCb)
+      : window(win), font(f), songs(s), store(std::move(st)), playSongCallback(playCb), jobProgress(progressCb), startJob(startCb),
+        finishedCount(finishedCb)
+  {
+    scan();
+  }
+
+  void handleEvent(const sf::Event &event) override
+  {
+    if (event.type == sf::Event::MouseWheelScrolled && summary)
+      scroll = std::max(0.0f, std::min(scroll - event.mouseWheelScroll.delta * 25, summary->problems.size() * 25.0f));
+    else if (event.type == sf::Event::MouseButtonPressed)
+    {
+      if (button.contains(event.mouseButton.x, event.mouseButton.y))
+      {
+        startJob();
+        return;
+      }
+      int row = rowAt(event.mouseButton.x, event.mouseButton.y);
+      if (row < 0)
+        return;
+      auto it = std::find(songs.begin(), songs.end(), summary->problems[row].first);
+      if (it != songs.end())
+        playSongCallback(static_cast<int>(std::distance(songs.begin(), it)));
+    }
+  }
+
+  // Rescans at most once a second, and only once new results have come in
+  void update() override
   {
-    window.clear(sf::Color(30, 30, 30));
-    window.draw(promptText);
-    if (!modeSelected)
+    if (scanning.valid() && scanning.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
     {
-      window.draw(modeText);
-      window.draw(loginBtn);
-      window.draw(signupBtn);
+      summary = scanning.get();
+      framesSinceScan = 0;
     }
+    if (!scanning.valid() && ++framesSinceScan >= 60 && finishedCount() != scannedAt)
+      scan();
+  }
+
+  void draw() override
+  {
+    sf::Text status("", font, 18);
+    status.setFillColor(sf::Color(180, 180, 180));
+    status.setPosition(220, 20);
+    if (!summary)
+      status.setString("Reading verification results for " + std::to_string(songs.size()) + " tracks...");
     else
+      status.setString("Verified " + std::to_string(summary->verified) + " of " + std::to_string(songs.size()) + " tracks, " +
+                       std::to_string(summary->problems.size()) + " with problems");
+    window.draw(status);
+    std::optional<LibraryAnalyzer::Progress> progress = jobProgress();
+    bool running = progress && progress->done < progress->total;
+    sf::RectangleShape background(sf::Vector2f(button.width, button.height));
+    background.setPosition(button.left, button.top);
+    background.setFillColor(running ? sf::Color(60, 60, 60) : sf::Color(70, 130, 180));
+    window.draw(background);
+    sf::Text label(running ? "Verifying..." : "Verify all now", font, 18);
+    label.setPosition(button.left + 12, button.top + 5);
+    window.draw(label);
+    if (progress)
     {
-      userText.setString("Username: " + usernameInput + (usernameActive ? "|" : ""));
-      window.draw(userText);
-      passText.setString("Password: " + std::string(passwordInput.size(), '*') + (passwordActive ? "|" : ""));
-      window.draw(passText);
+      // Progress bar of the running job
+      float fraction = progress->total ? static_cast<float>(progress->done) / progress->total : 1.0f;
+      sf::RectangleShape track(sf::Vector2f(740, 6)), filled(sf::Vector2f(740 * fraction, 6));
+      track.setPosition(220, 60);
+      track.setFillColor(sf::Color(60, 60, 60));
+      filled.setPosition(220, 60);
+      filled.setFillColor(sf::Color(34, 197, 94));
+      window.draw(track);
+      window.draw(filled);
+      sf::Text count(std::to_string(progress->done) + " / " + std::to_string(progress->total), font, 14);
+      count.setFillColor(sf::Color(180, 180, 180));
+      count.setPosition(220, 70);
+      window.draw(count);
+    }
+    if (!summary)
+      return;
+    for (std::size_t i = 0; i < summary->problems.size(); i++)
+    {
+      float y = 100 + i * 25 - scroll;
+      if (y < 100 || y > 320)
+        continue;
+      const auto &[path, report] = summary->problems[i];
+      sf::Text text(path + "   " + VerifyAnalyzer::describe(report), font, 18);
+      text.setFillColor(report.problems == "clipped" ? sf::Color(250, 204, 21) : sf::Color(248, 113, 113));
+      text.setPosition(220, y);
+      window.draw(text);
     }
-    window.draw(infoText);
-    window.display();
   }
-  bool isLoggedIn() const { return loginSuccess; }
-  std::string getUsername() const { return usernameInput; }
+};
+
+// Opens tracks on a background I/O thread so a slow disk or network share never
+// stalls the event loop. Only the newest request matters: a request still
+// queued when a newer one arrives is dropped without touching the file, and a
+// result that finishes after being superseded is simply never handed out.
+class TrackLoader
+{
+public:
+  struct Result
+  {
+    int songIndex = -1;
+    std::unique_ptr<AudioOutput> output; // null if the file could not be opened
+  };
+
+  explicit TrackLoader(const OutputSettings &s) : settings(s), worker(&TrackLoader::run, this) {}
+  ~TrackLoader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wakeUp.notify_all();
+    worker.join();
+  }
+
+  void request(int songIndex, const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+    if (pending)
+      pending->promise.set_value(Result{pending->songIndex, nullptr});
+    pending.emplace();
+    pending->songIndex = songIndex;
+    pending->path = path;
+    pending->generation = generation;
+    current = pending->promise.get_future();
+    wakeUp.notify_one();
+  }
+
+  bool isLoading() const
+  {
+    return current.valid() && current.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+  }
+
+  // Called from the UI thread; returns true once when the latest request completes.
+  bool poll(Result &out)
+  {
+    if (!current.valid() || current.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return false;
+    out = current.get();
+    return true;
+  }
+
+private:
+  struct Job
+  {
+    int songIndex = -1;
+    std::string path;
+    unsigned generation = 0;
+    std::promise<Result> promise;
+  };
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+      wakeUp.wait(lock, [this]
+                  { return quitting || pending.has_value(); });
+      if (quitting)
+        break;
+      Job job = std::move(*pending);
+      pending.reset();
+      lock.unlock();
+
+      Result result;
+      result.songIndex = job.songIndex;
+      if (job.generation == generation.load())
+      {
+        // A corrupt file must not take the loader thread down with it
+        try
+        {
+          result.output = openOutput(job.path, settings);
+        }
+        catch (const std::exception &ex)
+        {
+          std::cout << "[ERROR] Failed to load " << job.path << ": " << ex.what() << std::endl;
+        }
+      }
+      job.promise.set_value(std::move(result));
+      lock.lock();
+    }
+    if (pending)
+      pending->promise.set_value(Result{pending->songIndex, nullptr});
+  }
+
+  OutputSettings settings;
+  std::mutex mutex;
+  std::condition_variable wakeUp;
+  std::optional<Job> pending;
+  std::future<Result> current;
+  std::atomic<unsigned> generation{0};
+  bool quitting = false;
+  std::thread worker; // started last, after every member it reads
 };
 
 class MusicPlayer
@@ -387,23 +10958,43 @@ private:
   sf::Font font;
   sf::Font modernFont;
   sf::Font extraBoldFont;
-  sf::Music music;
+  std::shared_ptr<AnalysisStore> analysisStore = std::make_shared<AnalysisStore>("analysis");
+  OutputSettings outputSettings;
+  std::unique_ptr<AudioOutput> music;
+  TrackLoader loader;
   std::vector<std::string> songs;
   std::vector<std::string> favorites;
   float volume;
   bool isPlaying;
   int currentSongIndex;
+  std::size_t failedLoads = 0; // tracks in a row that could not be opened
   std::string currentWindow; // "home", "favorites", "settings"
   std::string searchQuery;
   bool searchBarActive = false;
 
+  // Song list order; the tempo orders put tracks not yet analyzed last
+  enum SongOrder
+  {
+    LibraryOrder,
+    TempoAscending,
+    TempoDescending
+  };
+  SongOrder songOrder = LibraryOrder;
+  std::vector<std::string> libraryOrder;
+  std::map<std::string, double> tempos; // BPM of every analyzed track, as collected from tempoIndex
+  int analysisPollFrames = 0;
+  sf::RectangleShape sortButton;
+  sf::Text sortButtonText;
+
   // UI Elements
   sf::RectangleShape navBar;
   std::vector<sf::RectangleShape> navButtons;
   std::vector<sf::Text> navTexts;
   sf::Text currentSongText;
+  sf::Text timeText;
   sf::Text volumeText;
   sf::RectangleShape volumeSlider;
+  sf::Text audioModeText;
   sf::RectangleShape playButton;
   sf::Text playButtonText;
   sf::RectangleShape nextButton;
@@ -419,18 +11010,47 @@ private:
   sf::Text repeatButtonText;
   bool repeatOn;
 
+  // Radio mode: the next track is the closest-sounding one not heard lately
+  sf::RectangleShape radioButton;
+  sf::Text radioButtonText;
+  bool radioOn = false;
+  std::deque<std::string> recentlyPlayed;
+  std::unique_ptr<RadioIndex> radio;
+  std::unique_ptr<TempoIndex> tempoIndex;
+
   // Favourite button
   sf::RectangleShape favButton;
   sf::Text favButtonText;
 
   std::string username;
 
+  std::shared_ptr<ParametricEq> equalizer;
+  std::unique_ptr<EqualizerPanel> equalizerPanel;
+  sf::RectangleShape trimButton;
+  sf::Text trimButtonText;
+  std::unique_ptr<LibraryAnalyzer> analyzer;
+  std::unique_ptr<LibraryAnalyzer> verifier; // "Verify all now" on the Verify page
+  std::unique_ptr<WaveformSeekBar> seekBar;
+  int peakPollFrames = 0;
+  std::future<std::optional<PeakPyramid>> peakFetch; // for peakFetchPath
+  std::string peakFetchPath;
+  std::shared_ptr<SpectrumTap> spectrumTap = std::make_shared<SpectrumTap>();
+  std::unique_ptr<SpectrumVisualizer> visualizer;
+  std::shared_ptr<SpectrogramTiles> spectrogramTiles = std::make_shared<SpectrogramTiles>(std::max(1u, std::thread::hardware_concurrency() / 2));
+  // Album art; textures are made from the cached thumbnails a few per frame
+  ArtCache art{"thumbs"};
+  std::map<std::string, sf::Texture> artTextures; // by thumbnail key
+  std::vector<std::string> artRows;               // rows on screen this frame
+  int artUploads = 0;
+
   int navSelectedIndex = 0;
-  sf::SoundBuffer selectBuffer;
-  sf::Sound selectSound;
+  std::unique_ptr<sf::SoundBuffer> selectBuffer; // only with a real audio device
+  std::unique_ptr<sf::Sound> selectSound;
 
 public:
-  MusicPlayer(sf::RenderWindow &win, const std::string &uname) : window(win),
+  MusicPlayer(sf::RenderWindow &win, const std::string &uname, const OutputSettings &output) : window(win),
+                                                                 outputSettings(withAudibleRanges(output, analysisStore)),
+                                                                 loader(outputSettings),
                                                                  volume(100.0f),
                                                                  isPlaying(false),
                                                                  currentSongIndex(-1),
@@ -476,21 +11096,45 @@ public:
 
     setupUI();
     std::cout << "[DEBUG] UI setup complete." << std::endl;
+    equalizer = std::make_shared<ParametricEq>();
+    outputSettings.effects->add(equalizer);
+    equalizerPanel = std::make_unique<EqualizerPanel>(window, extraBoldFont, equalizer, username);
+    seekBar = std::make_unique<WaveformSeekBar>(window, [this](double seconds)
+                                                {
+                                                  if (music && !loader.isLoading())
+                                                    music->setPlayingOffset(sf::seconds(static_cast<float>(seconds)));
+                                                });
+    outputSettings.effects->addTap(spectrumTap);
+    visualizer = std::make_unique<SpectrumVisualizer>(window, spectrumTap);
     loadSongs();
     std::cout << "[DEBUG] Songs loaded: " << songs.size() << std::endl;
+    // A quarter of the cores at idle priority: the library is analyzed while
+    // the player sits open, without ever taking time from playback
+    analyzer = std::make_unique<LibraryAnalyzer>(analysisStore, std::max(1u, std::thread::hardware_concurrency() / 4), true);
+    addStandardAnalyzers(*analyzer);
+    analyzer->enqueue(songs, LibraryAnalyzer::Background);
+    radio = std::make_unique<RadioIndex>(analysisStore);
+    tempoIndex = std::make_unique<TempoIndex>(analysisStore);
     loadFavorites();
     std::cout << "[DEBUG] Favorites loaded: " << favorites.size() << std::endl;
+    if (outputSettings.cache)
+      outputSettings.cache->fill(favorites);
     switchView("home");
     std::cout << "[DEBUG] Initial view set to home." << std::endl;
 
-    if (selectBuffer.loadFromFile("select.wav"))
+    if (outputSettings.backend == OutputSettings::Device)
     {
-      selectSound.setBuffer(selectBuffer);
+      selectBuffer = std::make_unique<sf::SoundBuffer>();
+      if (selectBuffer->loadFromFile("select.wav"))
+      {
+        selectSound = std::make_unique<sf::Sound>(*selectBuffer);
+      }
     }
   }
 
   void handleEvent(const sf::Event &event)
   {
+    seekBar->handleEvent(event);
     // Arrow key navigation for nav bar
     if (event.type == sf::Event::KeyPressed)
     {
@@ -498,12 +11142,12 @@ public:
       if (event.key.code == sf::Keyboard::Down)
       {
         navSelectedIndex = (navSelectedIndex + 1) % navCount;
-        selectSound.play();
+        playSelectSound();
       }
       else if (event.key.code == sf::Keyboard::Up)
       {
         navSelectedIndex = (navSelectedIndex - 1 + navCount) % navCount;
-        selectSound.play();
+        playSelectSound();
       }
       else if (event.key.code == sf::Keyboard::Enter)
       {
@@ -521,8 +11165,17 @@ public:
         case 3:
           switchView("user");
           break;
+        case 4:
+          switchView("spectrogram");
+          break;
+        case 5:
+          switchView("duplicates");
+          break;
+        case 6:
+          switchView("verify");
+          break;
         }
-        selectSound.play();
+        playSelectSound();
       }
     }
     if (event.type == sf::Event::MouseButtonPressed)
@@ -534,7 +11187,7 @@ public:
         if (navButtons[i].getGlobalBounds().contains(mousePos.x, mousePos.y))
         {
           navSelectedIndex = i;
-          selectSound.play();
+          playSelectSound();
           switch (i)
           {
           case 0:
@@ -549,6 +11202,15 @@ public:
           case 3:
             switchView("user");
             break;
+          case 4:
+            switchView("spectrogram");
+            break;
+          case 5:
+            switchView("duplicates");
+            break;
+          case 6:
+            switchView("verify");
+            break;
           }
           // Do not return here; allow other UI elements to process the event
         }
@@ -570,6 +11232,8 @@ public:
       {
         searchBarActive = false;
       }
+      if (sortButton.getGlobalBounds().contains(mousePos.x, mousePos.y))
+        cycleSongOrder();
     }
     if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape)
     {
@@ -599,6 +11263,11 @@ public:
       repeatOn = !repeatOn;
       repeatButtonText.setString(repeatOn ? "Repeat: ON" : "Repeat: OFF");
     }
+    else if (isPlaying && radioButton.getGlobalBounds().contains(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y) && event.type == sf::Event::MouseButtonPressed)
+    {
+      radioOn = !radioOn;
+      radioButtonText.setString(radioOn ? "Radio: ON" : "Radio: OFF");
+    }
     else if (isPlaying && favButton.getGlobalBounds().contains(sf::Mouse::getPosition(window).x, sf::Mouse::getPosition(window).y) && event.type == sf::Event::MouseButtonPressed)
     {
       if (isCurrentSongFavourite())
@@ -617,18 +11286,50 @@ public:
 
   void update()
   {
-    // Update music status
-    if (isPlaying && music.getStatus() == sf::Music::Stopped)
+    TrackLoader::Result loaded;
+    if (loader.poll(loaded))
     {
-      if (repeatOn)
+      startLoadedSong(loaded);
+    }
+    // Update music status; a track still being opened is not "stopped"
+    if (isPlaying && !loader.isLoading() && (!music || music->getStatus() == sf::SoundSource::Stopped))
+    {
+      playSong(repeatOn ? songIndexAfterEnd(currentSongIndex, songs.size(), true)
+                        : radioSongAfter(currentSongIndex).value_or(nextSongIndex(currentSongIndex, songs.size())));
+    }
+    if (music && !loader.isLoading())
+    {
+      timeText.setString(formatTime(music->getPlayingOffset()) + " / " + formatTime(music->getDuration()));
+      seekBar->setPosition(music->getPlayingOffset().asSeconds());
+      // The playing track is analyzed first, so its peaks usually turn up within seconds
+      if (peakFetch.valid() && peakFetch.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
       {
-        playSong(currentSongIndex);
+        std::optional<PeakPyramid> peaks = peakFetch.get();
+        if (peaks && peakFetchPath == songs[currentSongIndex] && !seekBar->hasPeaks())
+          seekBar->setPeaks(std::move(*peaks));
       }
-      else
+      if (!seekBar->hasPeaks() && !peakFetch.valid() && ++peakPollFrames % 30 == 0)
+        fetchPeaks(songs[currentSongIndex]);
+    }
+    else
+      timeText.setString("");
+    // New analysis results: tempos for the song list, vectors for the radio
+    if (++analysisPollFrames % 60 == 0)
+    {
+      std::vector<std::string> finished = analyzer->takeFinished();
+      if (!finished.empty())
       {
-        playNext();
+        tempoIndex->update(finished);
+        radio->update(finished);
       }
     }
+    tempoIndex->collect(tempos);
+    std::optional<sf::Time> heard;
+    if (music && !loader.isLoading() && music->getStatus() == sf::SoundSource::Playing)
+      heard = music->getPlayingOffset() - music->getLatency();
+    if (heard && outputSettings.pcmTap)
+      outputSettings.pcmTap->setHeard(heard->asSeconds());
+    visualizer->update(heard);
     if (currentView)
       currentView->update();
   }
@@ -637,6 +11338,8 @@ public:
   {
     window.clear();
     window.draw(backgroundSprite); // Draw background first
+    artRows.clear();
+    artUploads = 0;
 
     // Draw navigation bar
     window.draw(navPanelSprite); // Draw the background image instead
@@ -665,6 +11368,16 @@ public:
     window.draw(prevButton);
     window.draw(prevButtonText);
     window.draw(currentSongText);
+    window.draw(timeText);
+    seekBar->draw();
+    visualizer->draw();
+    if (currentSongIndex >= 0)
+      if (const sf::Texture *cover = artFor(songs[currentSongIndex], ArtCache::Playing))
+      {
+        sf::Sprite sprite(*cover);
+        sprite.setPosition(210, 402);
+        window.draw(sprite);
+      }
 
     // Draw content based on current window
     if (currentWindow == "home")
@@ -679,12 +11392,22 @@ public:
     {
       window.draw(volumeText);
       window.draw(volumeSlider);
+      audioModeText.setString("Audio thread: " + (outputSettings.realtime ? outputSettings.realtime->getMode() : std::string("normal scheduling (use --realtime)")));
+      window.draw(audioModeText);
+      trimButtonText.setString(std::string("Trim silence: ") + (*outputSettings.trimSilence ? "ON" : "OFF"));
+      window.draw(trimButton);
+      window.draw(trimButtonText);
+      equalizerPanel->draw();
     }
     else if (currentWindow == "user")
     {
       currentView = std::make_unique<UserView>(window, extraBoldFont, username);
       currentView->draw();
     }
+    else if (currentWindow == "spectrogram" || currentWindow == "duplicates" || currentWindow == "verify")
+    {
+      currentView->draw();
+    }
 
     if (isPlaying)
     {
@@ -692,29 +11415,81 @@ public:
       window.draw(favButtonText);
       window.draw(repeatButton);
       window.draw(repeatButtonText);
+      window.draw(radioButton);
+      window.draw(radioButtonText);
     }
 
+    // The playing track first, then the rows on screen
+    if (currentSongIndex >= 0)
+      artRows.insert(artRows.begin(), songs[currentSongIndex]);
+    art.request(artRows);
     window.display();
   }
 
+  // The texture of `path`'s art at `size`, or null while there is none yet
+  const sf::Texture *artFor(const std::string &path, ArtCache::Size size)
+  {
+    std::shared_ptr<const ArtCache::Thumbnail> thumbnail = art.find(path, size);
+    if (!thumbnail)
+      return nullptr;
+    auto it = artTextures.find(thumbnail->key);
+    if (it != artTextures.end())
+      return &it->second;
+    if (artUploads >= 4)
+      return nullptr;
+    artUploads++;
+    if (artTextures.size() >= 256)
+      artTextures.clear();
+    sf::Texture &texture = artTextures[thumbnail->key];
+    if (!texture.loadFromImage(thumbnail->image))
+    {
+      artTextures.erase(thumbnail->key);
+      return nullptr;
+    }
+    texture.setSmooth(true);
+    return &texture;
+  }
+
+  void playSelectSound()
+  {
+    if (selectSound)
+      selectSound->play();
+  }
+
   void switchView(const std::string &viewName)
   {
     if (viewName == "home")
     {
-      currentView = std::make_unique<HomeView>(window, extraBoldFont, songs, [this](int i)
-                                               { playSong(i); });
+      currentView = std::make_unique<HomeView>(
+          window, extraBoldFont, songs, [this](int i)
+          { playSong(i); },
+          [this](const std::vector<std::string> &rows)
+          { prefetchHeads(rows); });
       currentWindow = "home";
     }
     else if (viewName == "favorites")
     {
-      currentView = std::make_unique<FavoritesView>(window, extraBoldFont, favorites, songs, [this](int i)
-                                                    { playSong(i); });
+      currentView = std::make_unique<FavoritesView>(
+          window, extraBoldFont, favorites, songs, [this](int i)
+          { playSong(i); },
+          [this](const std::vector<std::string> &rows)
+          { prefetchHeads(rows); });
       currentWindow = "favorites";
     }
     else if (viewName == "settings")
     {
-      currentView = std::make_unique<SettingsView>(window, extraBoldFont, volumeText, volumeSlider, [this](float v)
-                                                   { setVolume(v); });
+      currentView = std::make_unique<SettingsView>(
+          window, extraBoldFont, volumeText, volumeSlider, [this](float v)
+          { setVolume(v); },
+          [this](const sf::Event &e)
+          {
+            equalizerPanel->handleEvent(e);
+            if (e.type == sf::Event::MouseButtonPressed && trimButton.getGlobalBounds().contains(e.mouseButton.x, e.mouseButton.y))
+            {
+              *outputSettings.trimSilence = !*outputSettings.trimSilence;
+              std::cout << "[DEBUG] Silence trimming " << (*outputSettings.trimSilence ? "on" : "off") << "." << std::endl;
+            }
+          });
       currentWindow = "settings";
     }
     else if (viewName == "user")
@@ -722,6 +11497,36 @@ public:
       currentView = std::make_unique<UserView>(window, extraBoldFont, username);
       currentWindow = "user";
     }
+    else if (viewName == "spectrogram")
+    {
+      currentView = std::make_unique<SpectrogramView>(
+          window, extraBoldFont, spectrogramTiles, currentSongIndex >= 0 ? songs[currentSongIndex] : std::string(), [this]
+          { return music && !loader.isLoading() ? static_cast<double>(music->getPlayingOffset().asSeconds()) : -1.0; });
+      currentWindow = "spectrogram";
+    }
+    else if (viewName == "duplicates")
+    {
+      currentView = std::make_unique<DuplicatesView>(window, extraBoldFont, songs, analysisStore, [this](int i)
+                                                     { playSong(i); });
+      currentWindow = "duplicates";
+    }
+    else if (viewName == "verify")
+    {
+      currentView = std::make_unique<VerifyView>(
+          window, extraBoldFont, songs, analysisStore, [this](int i)
+          { playSong(i); },
+          [this]() -> std::optional<LibraryAnalyzer::Progress>
+          {
+            if (!verifier)
+              return std::nullopt;
+            return verifier->progress();
+          },
+          [this]()
+          { verifyLibrary(); },
+          [this]()
+          { return analyzer->progress().done + (verifier ? verifier->progress().done : 0); });
+      currentWindow = "verify";
+    }
   }
 
 private:
@@ -733,7 +11538,7 @@ private:
     navBar.setPosition(0, 0);
 
     // Navigation buttons
-    std::vector<std::string> buttonTexts = {"Home", "Favorites", "Settings", "User"};
+    std::vector<std::string> buttonTexts = {"Home", "Favorites", "Settings", "User", "Spectrogram", "Duplicates", "Verify"};
     float navButtonHeight = 50;
     float navSpacing = 10;
 
@@ -813,6 +11618,11 @@ private:
     currentSongText.setFillColor(sf::Color::White);
     currentSongText.setPosition(contentStartX + 50, controlsY - 50);
 
+    timeText.setFont(extraBoldFont);
+    timeText.setCharacterSize(16);
+    timeText.setFillColor(sf::Color(200, 200, 200));
+    timeText.setPosition(contentStartX + 680, controlsY - 47);
+
     // Volume control
     volumeText.setFont(extraBoldFont);
     volumeText.setString("Volume: 100%");
@@ -824,6 +11634,31 @@ private:
     volumeSlider.setPosition(220, 50);
     volumeSlider.setFillColor(sf::Color(100, 100, 100));
 
+    // Scheduling actually in effect for the audio thread
+    audioModeText.setFont(extraBoldFont);
+    audioModeText.setCharacterSize(16);
+    audioModeText.setFillColor(sf::Color(180, 180, 180));
+    audioModeText.setPosition(220, 90);
+
+    // Song order toggle next to the search bar
+    sortButton.setSize(sf::Vector2f(160, 30));
+    sortButton.setPosition(820, 10);
+    sortButton.setFillColor(sf::Color(50, 50, 50));
+    sortButtonText.setFont(extraBoldFont);
+    sortButtonText.setString("Sort: library");
+    sortButtonText.setCharacterSize(18);
+    sortButtonText.setFillColor(sf::Color::White);
+    sortButtonText.setPosition(830, 13);
+
+    // Skips leading and trailing silence from the next track on
+    trimButton.setSize(sf::Vector2f(180, 32));
+    trimButton.setPosition(460, 40);
+    trimButton.setFillColor(sf::Color(70, 130, 180));
+    trimButtonText.setFont(extraBoldFont);
+    trimButtonText.setCharacterSize(18);
+    trimButtonText.setFillColor(sf::Color::White);
+    trimButtonText.setPosition(472, 45);
+
     // Repeat toggle button
     repeatButton.setSize(sf::Vector2f(140, 40));
     repeatButton.setFillColor(sf::Color(70, 130, 180));
@@ -834,6 +11669,16 @@ private:
     repeatButtonText.setFillColor(sf::Color::White);
     repeatButtonText.setPosition(repeatButton.getPosition().x + 10, repeatButton.getPosition().y + 8);
 
+    // Radio toggle (to the right of repeat)
+    radioButton.setSize(sf::Vector2f(140, 40));
+    radioButton.setFillColor(sf::Color(70, 130, 180));
+    radioButton.setPosition(playButton.getPosition().x + 290, playButton.getPosition().y + 60);
+    radioButtonText.setFont(extraBoldFont);
+    radioButtonText.setString("Radio: OFF");
+    radioButtonText.setCharacterSize(18);
+    radioButtonText.setFillColor(sf::Color::White);
+    radioButtonText.setPosition(radioButton.getPosition().x + 10, radioButton.getPosition().y + 8);
+
     // Favourite button (to the left of repeat)
     favButton.setSize(sf::Vector2f(140, 40));
     favButton.setPosition(playButton.getPosition().x - 170, playButton.getPosition().y + 60);
@@ -847,7 +11692,48 @@ private:
 
   void loadSongs()
   {
-    songs = {"Music1.ogg", "Music2.ogg", "Music3.ogg", "cold.mp3"};
+    songs = loadLibrary();
+    libraryOrder = songs;
+  }
+
+  // Next order in the cycle library -> BPM ascending -> BPM descending; the
+  // playing track keeps playing and the queue follows the new order
+  void cycleSongOrder()
+  {
+    songOrder = static_cast<SongOrder>((songOrder + 1) % 3);
+    std::string playing = currentSongIndex >= 0 ? songs[currentSongIndex] : std::string();
+    songs = libraryOrder;
+    if (songOrder != LibraryOrder)
+    {
+      tempoIndex->collect(tempos);
+      bool ascending = songOrder == TempoAscending;
+      std::stable_sort(songs.begin(), songs.end(), [&](const std::string &a, const std::string &b)
+                       {
+                         auto x = tempos.find(a), y = tempos.find(b);
+                         if (x == tempos.end() || y == tempos.end())
+                           return x != tempos.end() && y == tempos.end();
+                         return ascending ? x->second < y->second : x->second > y->second;
+                       });
+    }
+    if (!playing.empty())
+      currentSongIndex = static_cast<int>(std::find(songs.begin(), songs.end(), playing) - songs.begin());
+    sortButtonText.setString(songOrder == LibraryOrder ? "Sort: library" : songOrder == TempoAscending ? "Sort: BPM up" : "Sort: BPM down");
+  }
+
+  // Plain text matches the file name; "bpm:120-130" or "bpm:128" (give or
+  // take 2) matches analyzed tracks by tempo
+  bool matchesSearch(const std::string &song) const
+  {
+    if (searchQuery.rfind("bpm:", 0) != 0)
+      return searchQuery.empty() || song.find(searchQuery) != std::string::npos;
+    double low = std::atof(searchQuery.c_str() + 4), high = low + 2;
+    std::size_t dash = searchQuery.find('-', 4);
+    if (dash != std::string::npos)
+      high = std::atof(searchQuery.c_str() + dash + 1);
+    else
+      low -= 2;
+    auto it = tempos.find(song);
+    return it != tempos.end() && it->second >= low && it->second <= high;
   }
 
   void loadFavorites()
@@ -879,55 +11765,137 @@ private:
     searchText.setFillColor(sf::Color::White);
     searchText.setPosition(searchBarX + 10, 13);
     window.draw(searchText);
-    // Filter and draw songs
+    if (currentWindow == "home")
+    {
+      window.draw(sortButton);
+      window.draw(sortButtonText);
+    }
+    // Filter and draw songs, with their tempo once analyzed
     int shown = 0;
     for (size_t i = 0; i < songList.size(); i++)
     {
-      if (searchQuery.empty() || songList[i].find(searchQuery) != std::string::npos)
+      if (matchesSearch(songList[i]))
       {
+        float y = 50 + shown * 40;
+        if (y < window.getSize().y)
+        {
+          artRows.push_back(songList[i]);
+          if (const sf::Texture *cover = artFor(songList[i], ArtCache::Row))
+          {
+            sf::Sprite sprite(*cover);
+            sprite.setPosition(contentStartX + 20, y);
+            window.draw(sprite);
+          }
+        }
         sf::Text text;
         text.setFont(extraBoldFont);
         text.setString(songList[i]);
         text.setCharacterSize(20);
         text.setFillColor(sf::Color::White);
-        text.setPosition(contentStartX + 20, 50 + shown * 40);
+        text.setPosition(contentStartX + 60, y);
         window.draw(text);
+        auto tempo = tempos.find(songList[i]);
+        if (tempo != tempos.end())
+        {
+          text.setString(std::to_string(static_cast<int>(std::lround(tempo->second))) + " BPM");
+          text.setFillColor(sf::Color(180, 180, 180));
+          text.setPosition(contentStartX + 680, y);
+          window.draw(text);
+        }
         shown++;
       }
     }
   }
 
+  // Reading the store touches the disk, so the peaks are fetched off the UI
+  // thread; update() hands them to the seek bar when they arrive
+  void fetchPeaks(const std::string &path)
+  {
+    auto promise = std::make_shared<std::promise<std::optional<PeakPyramid>>>();
+    peakFetch = promise->get_future();
+    peakFetchPath = path;
+    DetachedThreads::start([promise, path, store = analysisStore]
+                           {
+                             PeakPyramid peaks;
+                             std::optional<std::string> stored = store->get(path, "peaks");
+                             if (stored && peaks.parse(*stored))
+                               promise->set_value(std::move(peaks));
+                             else
+                               promise->set_value(std::nullopt);
+                           });
+  }
+
+  void prefetchHeads(const std::vector<std::string> &rows)
+  {
+    if (outputSettings.heads)
+      outputSettings.heads->prefetch(rows);
+    analyzer->enqueue(rows, LibraryAnalyzer::Visible);
+  }
+
   void playSong(int index)
   {
-    if (index >= 0 && index < songs.size())
+    if (index >= 0 && index < (int)songs.size())
     {
       currentSongIndex = index;
-      music.stop();
-      if (music.openFromFile(songs[index]))
+      // Half the library at most, so the radio always has somewhere to go
+      recentlyPlayed.push_back(songs[index]);
+      while (recentlyPlayed.size() > std::min<std::size_t>(50, songs.size() / 2))
+        recentlyPlayed.pop_front();
+      if (music)
+        music->stop();
+      loader.request(index, songs[index]);
+      // The next track too, so its silence is known by the transition
+      analyzer->enqueue({songs[index], songs[nextSongIndex(index, static_cast<int>(songs.size()))]}, LibraryAnalyzer::Playing);
+      currentSongText.setString("Loading: " + songs[index] + "...");
+    }
+  }
+
+  void startLoadedSong(TrackLoader::Result &loaded)
+  {
+    // The loader only hands back the latest request, which is the current
+    // song; its index may have moved since if the list was re-sorted
+    if (!loaded.output)
+    {
+      currentSongText.setString("Could not open: " + songs[currentSongIndex]);
+      // Playback moves on to the next track, but not round and round a
+      // library where nothing opens
+      if (++failedLoads >= songs.size())
       {
-        music.setVolume(volume);
-        music.play();
-        isPlaying = true;
-        currentSongText.setString("Now playing: " + songs[index]);
-        playButtonText.setString("Pause");
-        updateFavButton();
+        std::cout << "[ERROR] No track could be opened; playback stopped." << std::endl;
+        music.reset();
+        isPlaying = false;
+        failedLoads = 0;
+        playButtonText.setString("Play");
       }
+      return;
     }
+    failedLoads = 0;
+    music = std::move(loaded.output);
+    music->setVolume(volume);
+    music->play();
+    isPlaying = true;
+    currentSongText.setString("Now playing: " + songs[currentSongIndex]);
+    seekBar->setTrack(music->getDuration().asSeconds(), std::nullopt);
+    fetchPeaks(songs[currentSongIndex]);
+    if (currentWindow == "spectrogram")
+      switchView("spectrogram");
+    playButtonText.setString("Pause");
+    updateFavButton();
   }
 
   void togglePlay()
   {
-    if (currentSongIndex >= 0)
+    if (currentSongIndex >= 0 && music && !loader.isLoading())
     {
       if (isPlaying)
       {
-        music.pause();
+        music->pause();
         isPlaying = false;
         playButtonText.setString("Play");
       }
       else
       {
-        music.play();
+        music->play();
         isPlaying = true;
         playButtonText.setString("Pause");
       }
@@ -938,24 +11906,49 @@ private:
   {
     if (!songs.empty())
     {
-      int nextIndex = (currentSongIndex + 1) % songs.size();
-      playSong(nextIndex);
+      playSong(radioSongAfter(currentSongIndex).value_or(nextSongIndex(currentSongIndex, songs.size())));
+    }
+  }
+
+  // In radio mode, the track that sounds most like `index` among those not
+  // played lately; nothing if radio is off or the track is not indexed yet
+  std::optional<int> radioSongAfter(int index)
+  {
+    if (!radioOn || index < 0 || index >= (int)songs.size())
+      return std::nullopt;
+    std::optional<std::string> next = radio->next(songs[index], std::vector<std::string>(recentlyPlayed.begin(), recentlyPlayed.end()));
+    if (!next)
+      return std::nullopt;
+    auto it = std::find(songs.begin(), songs.end(), *next);
+    if (it == songs.end())
+      return std::nullopt;
+    return static_cast<int>(it - songs.begin());
+  }
+
+  // Decodes the whole library on every core, skipping tracks verified before
+  void verifyLibrary()
+  {
+    if (!verifier)
+    {
+      verifier = std::make_unique<LibraryAnalyzer>(analysisStore, std::max(1u, std::thread::hardware_concurrency()), false);
+      verifier->add(std::make_shared<VerifyAnalyzer>());
     }
+    verifier->enqueue(libraryOrder, LibraryAnalyzer::Background);
   }
 
   void playPrevious()
   {
     if (!songs.empty())
     {
-      int prevIndex = (currentSongIndex - 1 + songs.size()) % songs.size();
-      playSong(prevIndex);
+      playSong(previousSongIndex(currentSongIndex, songs.size()));
     }
   }
 
   void setVolume(float newVolume)
   {
     volume = newVolume;
-    music.setVolume(volume);
+    if (music)
+      music->setVolume(volume);
     volumeText.setString("Volume: " + std::to_string((int)volume) + "%");
   }
 
@@ -970,6 +11963,8 @@ private:
         std::ofstream file("favorites.txt");
         for (const auto &fav : favorites)
           file << fav << "\n";
+        if (outputSettings.cache)
+          outputSettings.cache->fill({song});
       }
     }
   }
@@ -1016,9 +12011,299 @@ private:
   }
 };
 
-int main()
+// Measures what the float pipeline costs over decoding straight to 16-bit:
+// the same file is read once through sf::InputSoundFile and once through
+// PlaybackSource (decode, convert, effects, dithered output).
+void benchmarkPipeline(const std::string &path, const OutputSettings &settings)
 {
+  typedef std::chrono::steady_clock Clock;
+  const std::size_t blockSize = 8192;
+  std::vector<sf::Int16> samples(blockSize);
+
+  sf::InputSoundFile file;
+  std::unique_ptr<AudioDecoder> decoder = openDecoder(path);
+  if (!file.openFromFile(path) || !decoder)
+  {
+    std::cout << "[ERROR] Could not open " << path << " for benchmarking.\n";
+    return;
+  }
+  double audioSeconds = static_cast<double>(file.getSampleCount()) / file.getChannelCount() / file.getSampleRate();
+  auto started = Clock::now();
+  while (file.read(samples.data(), blockSize) == blockSize)
+  {
+  }
+  double int16Seconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+  PlaybackSource source(std::move(decoder), settings.effects);
+  started = Clock::now();
+  while (source.read(samples.data(), blockSize) == blockSize)
+  {
+  }
+  double floatSeconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+  // The output kernel on its own, dithered, over ten seconds of stereo audio
+  std::vector<float> block(blockSize, 0.25f);
+  DitherQuantizer quantizer;
+  std::size_t kernelSamples = 0;
+  started = Clock::now();
+  for (; kernelSamples < 882000; kernelSamples += blockSize)
+    quantizer.process(block.data(), samples.data(), blockSize, true);
+  double kernelSeconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+  std::cout << "[BENCH] " << path << ": " << audioSeconds << " s of audio\n"
+            << "[BENCH] int16 path: " << int16Seconds * 1000 << " ms (" << audioSeconds / int16Seconds << "x real time)\n"
+            << "[BENCH] float path: " << floatSeconds * 1000 << " ms (" << audioSeconds / floatSeconds << "x real time, "
+            << (floatSeconds / int16Seconds - 1) * 100 << "% over int16)\n"
+            << "[BENCH] dither kernel: " << kernelSeconds * 1e9 / kernelSamples << " ns/sample" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  DetachedThreads::ExitGuard waitForDetachedThreads;
   std::cout << "[DEBUG] Top of main reached." << std::endl;
+#ifdef MUSIC_PLAYER_HAS_OPUS
+  sf::SoundFileFactory::registerReader<OpusFileReader>();
+#endif
+  // --audio=null runs without a sound card; MUSIC_PLAYER_AUDIO does the same for CI
+  OutputSettings outputSettings;
+  if (const char *env = std::getenv("MUSIC_PLAYER_AUDIO"))
+    outputSettings = OutputSettings::fromName(env);
+  std::string renderPath, tapName, benchPath, eqName, transcodeList;
+  BatchTranscoder::Options transcodeSettings;
+  bool transcode = false;
+  bool analyze = false;
+  bool duplicates = false;
+  bool verify = false;
+  bool trimSilence = false;
+  std::vector<std::string> impulsePaths;
+  std::size_t impulsePartition = 512;
+  OfflineRenderer::Options renderOptions;
+  bool realtime = false;
+  double pcmCacheMegabytes = 0;
+  RealtimeAudio::Settings realtimeSettings;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg.rfind("--audio=", 0) == 0)
+      outputSettings = OutputSettings::fromName(arg.substr(8));
+    else if (arg == "--realtime")
+      realtime = true;
+    else if (arg.rfind("--realtime-priority=", 0) == 0)
+      realtimeSettings.priority = std::atoi(arg.c_str() + 20);
+    else if (arg.rfind("--audio-core=", 0) == 0)
+      realtimeSettings.core = std::atoi(arg.c_str() + 13);
+    else if (arg.rfind("--pcm-tap=", 0) == 0)
+      tapName = arg.substr(10);
+    else if (arg.rfind("--ir=", 0) == 0)
+      impulsePaths.push_back(arg.substr(5));
+    else if (arg.rfind("--ir-partition=", 0) == 0)
+      impulsePartition = std::max(16, std::atoi(arg.c_str() + 15));
+    else if (arg.rfind("--pcm-cache=", 0) == 0)
+      pcmCacheMegabytes = std::max(0.0, std::atof(arg.c_str() + 12));
+    else if (arg.rfind("--soundfont=", 0) == 0)
+      MidiDecoder::soundFontPath = arg.substr(12);
+    else if (arg.rfind("--eq=", 0) == 0)
+      eqName = arg.substr(5);
+    else if (arg.rfind("--bench-pipeline=", 0) == 0)
+      benchPath = arg.substr(17);
+    else if (arg == "--analyze")
+      analyze = true;
+    else if (arg == "--duplicates")
+      duplicates = true;
+    else if (arg == "--verify")
+      verify = true;
+    else if (arg == "--trim-silence")
+      trimSilence = true;
+    else if (arg.rfind("--transcode=", 0) == 0)
+    {
+      transcode = true;
+      transcodeSettings.outputDir = arg.substr(12);
+    }
+    else if (arg.rfind("--transcode-list=", 0) == 0)
+      transcodeList = arg.substr(17);
+    else if (arg.rfind("--transcode-format=", 0) == 0)
+      transcodeSettings.format = arg.substr(19);
+    else if (arg.rfind("--transcode-rate=", 0) == 0)
+      transcodeSettings.sampleRate = static_cast<unsigned int>(std::max(0, std::atoi(arg.c_str() + 17)));
+    else if (arg.rfind("--transcode-loudness=", 0) == 0)
+      transcodeSettings.loudness = std::atof(arg.c_str() + 21);
+    else if (arg.rfind("--transcode-jobs=", 0) == 0)
+      transcodeSettings.jobs = static_cast<unsigned int>(std::max(0, std::atoi(arg.c_str() + 17)));
+    else if (arg.rfind("--render=", 0) == 0)
+      renderPath = arg.substr(9);
+    else if (arg.rfind("--render-start=", 0) == 0)
+      renderOptions.startIndex = std::atoi(arg.c_str() + 15);
+    else if (arg.rfind("--render-length=", 0) == 0)
+      renderOptions.lengthSeconds = std::atof(arg.c_str() + 16);
+    else if (arg == "--render-repeat")
+      renderOptions.repeat = true;
+    else if (arg.rfind("--render-volume=", 0) == 0)
+    {
+      // e.g. 100@0,40@12.5: volume 40 from 12.5 seconds on
+      std::istringstream list(arg.substr(16));
+      std::string item;
+      while (std::getline(list, item, ','))
+      {
+        std::size_t at = item.find('@');
+        if (at != std::string::npos)
+          renderOptions.volume.push_back({std::atof(item.c_str() + at + 1), (float)std::atof(item.substr(0, at).c_str())});
+      }
+    }
+  }
+  if (realtime)
+    outputSettings.realtime = std::make_shared<RealtimeAudio>(realtimeSettings);
+  *outputSettings.trimSilence = trimSilence;
+  if (pcmCacheMegabytes > 0)
+    outputSettings.cache = std::make_shared<PcmCache>("pcmcache", static_cast<std::uintmax_t>(pcmCacheMegabytes * 1024 * 1024));
+  std::shared_ptr<SharedMemoryTap> tap;
+  if (!tapName.empty())
+  {
+    tap = std::make_shared<SharedMemoryTap>();
+    if (tap->open(tapName))
+    {
+      outputSettings.effects->addTap(tap);
+      outputSettings.pcmTap = tap;
+      std::cout << "[DEBUG] PCM tap published as shared memory '" << tapName << "'." << std::endl;
+    }
+    else
+    {
+      std::cout << "[ERROR] Could not create shared memory '" << tapName << "' for the PCM tap.\n";
+    }
+  }
+  // Impulse responses go after the EQ, so they are added once the EQ is in the chain
+  std::vector<std::shared_ptr<ConvolutionEffect>> convolutions;
+  for (const std::string &path : impulsePaths)
+  {
+    std::size_t partition = 16;
+    while (partition < impulsePartition)
+      partition *= 2; // the FFT is radix-2
+    auto convolution = std::make_shared<ConvolutionEffect>(partition);
+    if (convolution->loadImpulse(path))
+    {
+      std::cout << "[DEBUG] Impulse response " << path << " loaded, latency " << partition << " frames." << std::endl;
+      convolutions.push_back(convolution);
+    }
+    else
+    {
+      std::cout << "[ERROR] Could not load impulse response " << path << "\n";
+    }
+  }
+  if (!benchPath.empty())
+  {
+    benchmarkPipeline(benchPath, outputSettings);
+    return 0;
+  }
+  if (analyze)
+  {
+    // Every analyzer over the whole library on all cores, reporting once a second
+    LibraryAnalyzer analyzer(std::make_shared<AnalysisStore>("analysis"), std::thread::hardware_concurrency(), false);
+    addStandardAnalyzers(analyzer);
+    analyzer.enqueue(loadLibrary(), LibraryAnalyzer::Background);
+    auto started = std::chrono::steady_clock::now();
+    for (LibraryAnalyzer::Progress progress = analyzer.progress(); progress.done < progress.total; progress = analyzer.progress())
+    {
+      std::cout << "[DEBUG] Analyzed " << progress.done << " of " << progress.total << " tracks." << std::endl;
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    analyzer.wait();
+    std::cout << "[DEBUG] Library analysis finished in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() << " s." << std::endl;
+    if (!duplicates && !verify)
+      return 0;
+  }
+  if (verify)
+  {
+    // Decodes every track not verified before on all cores; a run cut short
+    // carries on from there next time. Exits with 1 if any track has problems.
+    std::vector<std::string> library = loadLibrary();
+    auto store = std::make_shared<AnalysisStore>("analysis");
+    LibraryAnalyzer verifier(store, std::thread::hardware_concurrency(), false);
+    verifier.add(std::make_shared<VerifyAnalyzer>());
+    verifier.enqueue(library, LibraryAnalyzer::Background);
+    auto started = std::chrono::steady_clock::now();
+    for (LibraryAnalyzer::Progress progress = verifier.progress(); progress.done < progress.total; progress = verifier.progress())
+    {
+      std::cout << "[DEBUG] Verified " << progress.done << " of " << progress.total << " tracks." << std::endl;
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    verifier.wait();
+    VerifySummary summary = summarizeVerification(library, *store);
+    for (const auto &[path, report] : summary.problems)
+      std::cout << path << ": " << VerifyAnalyzer::describe(report) << "\n";
+    std::cout << "[DEBUG] " << summary.problems.size() << " of " << summary.verified << " verified tracks have problems ("
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() << " s)." << std::endl;
+    return summary.problems.empty() ? 0 : 1;
+  }
+  if (duplicates)
+  {
+    // Only tracks that already have a fingerprint; combine with --analyze for the rest
+    std::vector<std::string> library = loadLibrary();
+    AnalysisStore store("analysis");
+    DuplicateReport report = findDuplicates(library, store);
+    for (const DuplicateGroup &group : report.groups)
+    {
+      std::cout << "Duplicates:\n";
+      for (std::size_t i = 0; i < group.paths.size(); i++)
+        std::cout << "  " << std::lround(group.confidence[i] * 100) << "%  " << group.paths[i] << "\n";
+    }
+    std::cout << "[DEBUG] " << report.groups.size() << " duplicate groups among " << report.fingerprinted << " of "
+              << library.size() << " tracks fingerprinted." << std::endl;
+    return 0;
+  }
+  if (transcode)
+  {
+    // The whole library, or one path per line from a list such as favorites.txt
+    std::vector<std::string> paths;
+    if (transcodeList.empty())
+      paths = loadLibrary();
+    std::ifstream list(transcodeList);
+    for (std::string line; std::getline(list, line);)
+      if (!line.empty())
+        paths.push_back(line);
+    BatchTranscoder transcoder(transcodeSettings);
+    return transcoder.run(paths) ? 0 : 1;
+  }
+  if (!renderPath.empty())
+  {
+    // Renders take the EQ from the command line: a preset name or a preset file
+    if (!eqName.empty())
+    {
+      auto equalizer = std::make_shared<ParametricEq>();
+      ParametricEq::Bands bands;
+      bool found = loadEqBands(eqName, bands);
+      for (const EqPreset &preset : eqPresets)
+      {
+        if (eqName == preset.name)
+        {
+          bands = eqPresetBands(preset);
+          found = true;
+        }
+      }
+      if (!found)
+      {
+        std::cout << "[ERROR] Unknown EQ preset " << eqName << "\n";
+        return 1;
+      }
+      equalizer->setBands(bands);
+      outputSettings.effects->add(equalizer);
+    }
+    for (auto &convolution : convolutions)
+      outputSettings.effects->add(convolution);
+    std::vector<std::string> library = loadLibrary();
+    if (trimSilence)
+    {
+      // Every track's silence is known before the first frame, so the render
+      // does not depend on how far a background analysis had got
+      auto store = std::make_shared<AnalysisStore>("analysis");
+      LibraryAnalyzer analyzer(store, std::thread::hardware_concurrency(), false);
+      analyzer.add(std::make_shared<SilenceAnalyzer>());
+      analyzer.enqueue(library, LibraryAnalyzer::Background);
+      analyzer.wait();
+      outputSettings = withAudibleRanges(outputSettings, store);
+    }
+    OfflineRenderer renderer(library, outputSettings);
+    return renderer.render(renderPath, renderOptions) ? 0 : 1;
+  }
   try
   {
     sf::RenderWindow window(sf::VideoMode(1000, 600), "SFML Music Player");
@@ -1040,7 +12325,10 @@ int main()
     if (!window.isOpen())
       return 0;
     std::cout << "[DEBUG] Creating MusicPlayer..." << std::endl;
-    MusicPlayer player(window, login.getUsername());
+    outputSettings.heads = std::make_shared<HeadCache>();
+    MusicPlayer player(window, login.getUsername(), outputSettings);
+    for (auto &convolution : convolutions)
+      outputSettings.effects->add(convolution);
     std::cout << "[DEBUG] MusicPlayer created successfully." << std::endl;
     while (window.isOpen())
     {